@@ -4,6 +4,7 @@
 #include <StringAlgorithm.hpp>
 #include <WeaselUtility.h>
 #include <WeaselVersion.h>
+#include <WeaselProfiler.h>
 #include <VersionHelpers.hpp>
 #include <math.h>
 
@@ -17,7 +18,9 @@ int expand_ibus_modifier(int m)
 RimeWithWeaselHandler::RimeWithWeaselHandler(weasel::UI *ui)
 	: m_ui(ui)
 	, m_active_session(0)
+	, m_prepare_session(0)
 	, m_disabled(true)
+	, m_server_ui(false)
 	, _UpdateUICallback(NULL)
 	, m_vista_greater(IsWindowsVistaOrGreater())
 {
@@ -30,6 +33,7 @@ RimeWithWeaselHandler::~RimeWithWeaselHandler()
 
 void _UpdateUIStyle(RimeConfig* config, weasel::UI* ui, bool initialize);
 void _LoadAppOptions(RimeConfig* config, AppOptionsByAppName& app_options);
+void _LoadKeyInterest(RimeConfig* config, weasel::KeyInterest& interest);
 
 void RimeWithWeaselHandler::_Setup()
 {
@@ -72,6 +76,9 @@ void RimeWithWeaselHandler::Initialize()
 			m_base_style = m_ui->style();
 		}
 		_LoadAppOptions(&config, m_app_options);
+		Bool server_ui = False;
+		RimeConfigGetBool(&config, "style/server_ui", &server_ui);
+		m_server_ui = !!server_ui;
 		RimeConfigClose(&config);
 	}
 	m_last_schema_id.clear();
@@ -137,11 +144,28 @@ BOOL RimeWithWeaselHandler::ProcessKeyEvent(weasel::KeyEvent keyEvent, UINT sess
 	DLOG(INFO) << "Process key event: keycode = " << keyEvent.keycode << ", mask = " << keyEvent.mask
 		 << ", session_id = " << session_id;
 	if (m_disabled) return FALSE;
-	Bool handled = RimeProcessKey(session_id, keyEvent.keycode, expand_ibus_modifier(keyEvent.mask));
+	Bool handled;
+	{
+		weasel::ProfileScope profile(weasel::PROFILE_PROCESS_KEY);
+		handled = RimeProcessKey(session_id, keyEvent.keycode, expand_ibus_modifier(keyEvent.mask));
+	}
+	weasel::Profiler::Count(handled ? weasel::PROFILE_KEYS_EATEN : weasel::PROFILE_KEYS_PASSED);
 	_Respond(session_id, eat);
 	_UpdateUI(session_id);
 	m_active_session = session_id;
-	return (BOOL)handled;
+	m_prepare_session = session_id;
+	BOOL state = handled ? WEASEL_KEY_EATEN : 0;
+	RIME_STRUCT(RimeStatus, status);
+	if (RimeGetStatus(session_id, &status))
+	{
+		if (status.is_composing)
+			state |= WEASEL_KEY_COMPOSING;
+		RimeFreeStatus(&status);
+	}
+	// the key switched schemas; their interest comes with the next reply
+	if (!RimeGetOption(session_id, "__synced"))
+		state |= WEASEL_KEY_RESYNC;
+	return state;
 }
 
 void RimeWithWeaselHandler::CommitComposition(UINT session_id)
@@ -165,8 +189,12 @@ void RimeWithWeaselHandler::ClearComposition(UINT session_id)
 void RimeWithWeaselHandler::FocusIn(DWORD client_caps, UINT session_id)
 {
 	DLOG(INFO) << "Focus in: session_id = " << session_id << ", client_caps = " << client_caps;
+	RimeSetProperty(session_id, "client_caps", std::to_string(client_caps).c_str());
 	if (m_disabled) return;
 	_UpdateUI(session_id);
+	// the client may learn it draws only after the panel here has shown a composition
+	if (m_ui && (client_caps & weasel::CLIENT_DRAWS_CANDIDATES))
+		m_ui->Hide();
 	m_active_session = session_id;
 }
 
@@ -257,6 +285,16 @@ void RimeWithWeaselHandler::_ReadClientInfo(UINT session_id, LPWSTR buffer)
 	RimeSetOption(session_id, "soft_cursor", Bool(!inline_preedit));
 }
 
+static std::wstring _GetSelectLabel(RimeContext & ctx, int i)
+{
+	if (RIME_STRUCT_HAS_MEMBER(ctx, ctx.select_labels) && ctx.select_labels)
+		return utf8towcs(ctx.select_labels[i]);
+	else if (ctx.menu.select_keys)
+		return std::wstring(1, ctx.menu.select_keys[i]);
+	else
+		return std::to_wstring((i + 1) % 10);
+}
+
 void RimeWithWeaselHandler::_GetCandidateInfo(weasel::CandidateInfo & cinfo, RimeContext & ctx)
 {
 	cinfo.candies.resize(ctx.menu.num_candidates);
@@ -269,23 +307,60 @@ void RimeWithWeaselHandler::_GetCandidateInfo(weasel::CandidateInfo & cinfo, Rim
 		{
 			cinfo.comments[i].str = utf8towcs(ctx.menu.candidates[i].comment);
 		}
-		if (RIME_STRUCT_HAS_MEMBER(ctx, ctx.select_labels) && ctx.select_labels)
-		{
-			cinfo.labels[i].str = utf8towcs(ctx.select_labels[i]);
-		}
-		else if (ctx.menu.select_keys)
-		{
-			cinfo.labels[i].str = std::wstring(1, ctx.menu.select_keys[i]);
-		}
-		else
-		{
-			cinfo.labels[i].str = std::to_wstring((i + 1) % 10);
-		}
+		cinfo.labels[i].str = _GetSelectLabel(ctx, i);
 	}
 	cinfo.highlighted = ctx.menu.highlighted_candidate_index;
 	cinfo.currentPage = ctx.menu.page_no;
 }
 
+bool RimeWithWeaselHandler::_GetCandidatePage(weasel::CandidateInfo & cinfo, RimeContext & ctx, UINT session_id, int index)
+{
+	// the page of the menu in ctx starting at candidate index, as _GetCandidateInfo would have read it
+	RimeCandidateListIterator iterator = { 0 };
+	if (!RimeCandidateListFromIndex(session_id, &iterator, index))
+		return false;
+	cinfo.candies.clear();
+	cinfo.comments.clear();
+	cinfo.labels.clear();
+	for (int i = 0; i < ctx.menu.page_size && RimeCandidateListNext(&iterator); ++i)
+	{
+		cinfo.candies.push_back(weasel::Text(utf8towcs(iterator.candidate.text)));
+		cinfo.comments.push_back(weasel::Text(iterator.candidate.comment ? utf8towcs(iterator.candidate.comment) : std::wstring()));
+		cinfo.labels.push_back(weasel::Text(_GetSelectLabel(ctx, i)));
+	}
+	RimeCandidateListEnd(&iterator);
+	if (cinfo.candies.empty())
+		return false;
+	// paging keeps the highlight at its place on the page
+	cinfo.highlighted = (std::min)(ctx.menu.highlighted_candidate_index, (int)cinfo.candies.size() - 1);
+	cinfo.currentPage = index / ctx.menu.page_size;
+	return true;
+}
+
+void RimeWithWeaselHandler::Idle()
+{
+	// lays out the pages before and after the one shown, so that paging to them only paints;
+	// the server calls it after the key's reply with its other calls held off, and not while the next key waits
+	UINT session_id = m_prepare_session;
+	m_prepare_session = 0;
+	if (!session_id || m_disabled || !m_ui || !m_ui->style().prefetch_pages || !m_ui->IsShown())
+		return;
+	RIME_STRUCT(RimeContext, ctx);
+	if (!RimeGetContext(session_id, &ctx))
+		return;
+	if (ctx.menu.num_candidates && ctx.menu.page_size > 0)
+	{
+		const int first = ctx.menu.page_no * ctx.menu.page_size;
+		// same preedit and aux as shown, only the candidates differ
+		weasel::Context page(m_ui->ctx());
+		if (!ctx.menu.is_last_page && _GetCandidatePage(page.cinfo, ctx, session_id, first + ctx.menu.page_size))
+			m_ui->Prepare(page);
+		if (ctx.menu.page_no > 0 && _GetCandidatePage(page.cinfo, ctx, session_id, first - ctx.menu.page_size))
+			m_ui->Prepare(page);
+	}
+	RimeFreeContext(&ctx);
+}
+
 void RimeWithWeaselHandler::StartMaintenance()
 {
 	Finalize();
@@ -326,10 +401,12 @@ bool RimeWithWeaselHandler::_IsDeployerRunning()
 
 void RimeWithWeaselHandler::_UpdateUI(UINT session_id)
 {
+	weasel::ProfileScope profile(weasel::PROFILE_UPDATE_UI);
 	weasel::Status weasel_status;
 	weasel::Context weasel_context;
 
-	bool is_tsf = _IsSessionTSF(session_id);
+	// a TSF client draws its own candidates, unless the panel here draws them for it
+	bool is_tsf = _IsSessionTSF(session_id) && (!m_server_ui || _IsSessionClientDrawn(session_id));
 
 	if (session_id == 0)
 		weasel_status.disabled = m_disabled;
@@ -379,10 +456,12 @@ void RimeWithWeaselHandler::_LoadSchemaSpecificSettings(const std::string& schem
 {
 	if (!m_ui) return;
 	RimeConfig config;
+	m_key_interest.Clear();
 	if (!RimeSchemaOpen(schema_id.c_str(), &config))
 		return;
 	m_ui->style() = m_base_style;
 	_UpdateUIStyle(&config, m_ui, false);
+	_LoadKeyInterest(&config, m_key_interest);
 	RimeConfigClose(&config);
 }
 
@@ -429,6 +508,7 @@ bool RimeWithWeaselHandler::_ShowMessage(weasel::Context& ctx, weasel::Status& s
 
 bool RimeWithWeaselHandler::_Respond(UINT session_id, EatLine eat)
 {
+	weasel::ProfileScope profile(weasel::PROFILE_RESPOND);
 	std::set<std::string> actions;
 	std::list<std::string> messages;
 
@@ -501,6 +581,7 @@ bool RimeWithWeaselHandler::_Respond(UINT session_id, EatLine eat)
 	// configuration information
 	actions.insert("config");
 	messages.push_back(std::string("config.inline_preedit=") + std::to_string((int)m_ui->style().inline_preedit) + '\n');
+	messages.push_back(std::string("config.server_ui=") + std::to_string((int)m_server_ui) + '\n');
 
 	// style
 	bool has_synced = RimeGetOption(session_id, "__synced");
@@ -511,6 +592,9 @@ bool RimeWithWeaselHandler::_Respond(UINT session_id, EatLine eat)
 
 		actions.insert("style");
 		messages.push_back(std::string("style=") + wcstoutf8(ss.str().c_str()) + '\n');
+		// empty until the schema's is known, which leaves every key to the server
+		actions.insert("interest");
+		messages.push_back(std::string("interest=") + m_key_interest.Format<char>() + '\n');
 		RimeSetOption(session_id, "__synced", true);
 	}
 
@@ -621,6 +705,11 @@ static void _UpdateUIStyle(RimeConfig* config, weasel::UI* ui, bool initialize)
 	{
 		style.color_font = !!color_font;
 	}
+	Bool prefetch_pages = False;
+	if (RimeConfigGetBool(config, "style/prefetch_pages", &prefetch_pages) || initialize)
+	{
+		style.prefetch_pages = !!prefetch_pages;
+	}
 	char preedit_type[20] = { 0 };
 	if (RimeConfigGetString(config, "style/preedit_type", preedit_type, sizeof(preedit_type) - 1))
 	{
@@ -689,6 +778,7 @@ static void _UpdateUIStyle(RimeConfig* config, weasel::UI* ui, bool initialize)
 	RimeConfigGetInt(config, "style/layout/shadow_radius", &style.shadow_radius);
 	RimeConfigGetInt(config, "style/layout/shadow_offset_x", &style.shadow_offset_x);
 	RimeConfigGetInt(config, "style/layout/shadow_offset_y", &style.shadow_offset_y);
+	RimeConfigGetInt(config, "style/layout/grid_rows", &style.grid_rows);
 	// round_corner as alias of hilited_corner_radius
 	if(!RimeConfigGetInt(config, "style/layout/hilited_corner_radius", &style.round_corner))
 	{
@@ -788,6 +878,76 @@ static void _LoadAppOptions(RimeConfig* config, AppOptionsByAppName& app_options
 	RimeConfigEnd(&app_iter);
 }
 
+// the keysym a key binding such as "Control+Shift+F4" ends in
+static bool _BindKey(const char* key, weasel::KeyInterest& interest)
+{
+	if (!key)
+		return false;
+	std::string name(key);
+	size_t plus = name.rfind('+', name.size() > 1 ? name.size() - 2 : 0);
+	if (plus != std::string::npos)
+		name = name.substr(plus + 1);
+	int keycode = RimeGetKeycodeByName(name.c_str());
+	if (keycode == 0xffffff)  // XK_VoidSymbol
+		return false;
+	interest.Bind(keycode);
+	return true;
+}
+
+static void _LoadKeyInterest(RimeConfig* config, weasel::KeyInterest& interest)
+{
+	// any other processor, a lua_processor say, may take any key
+	static const char* const known_processors[] = {
+		"ascii_composer", "chord_composer", "recognizer", "key_binder", "speller",
+		"punctuator", "selector", "navigator", "express_editor", "fluid_editor",
+	};
+	interest.Clear();
+	int flags = 0;
+	bool known = true;
+	RimeConfigIterator iter;
+	RimeConfigBeginList(&iter, config, "engine/processors");
+	while (RimeConfigNext(&iter)) {
+		const char* value = RimeConfigGetCString(config, iter.path);
+		std::string processor(value ? value : "");
+		processor = processor.substr(0, processor.find('@'));
+		if (processor == "ascii_composer")
+			flags |= weasel::KeyInterest::ASCII_COMPOSER;
+		else if (processor == "chord_composer")
+			flags |= weasel::KeyInterest::CHORD_COMPOSER;
+		known = known && std::find(std::begin(known_processors), std::end(known_processors), processor) != std::end(known_processors);
+	}
+	RimeConfigEnd(&iter);
+	// a key name librime does not know leaves the schema unpublished too
+	RimeConfigBeginList(&iter, config, "key_binder/bindings");
+	while (RimeConfigNext(&iter)) {
+		std::string accept = std::string(iter.path) + "/accept";
+		known = known && _BindKey(RimeConfigGetCString(config, accept.c_str()), interest);
+	}
+	RimeConfigEnd(&iter);
+	// the switcher takes its hotkeys from default.yaml
+	RimeConfig default_config;
+	if (RimeConfigOpen("default", &default_config)) {
+		RimeConfigBeginList(&iter, &default_config, "switcher/hotkeys");
+		while (RimeConfigNext(&iter)) {
+			known = known && _BindKey(RimeConfigGetCString(&default_config, iter.path), interest);
+		}
+		RimeConfigEnd(&iter);
+		RimeConfigClose(&default_config);
+	}
+	else {
+		known = false;
+	}
+	RimeConfigBeginMap(&iter, config, "editor/bindings");
+	while (RimeConfigNext(&iter)) {
+		known = known && _BindKey(iter.key, interest);
+	}
+	RimeConfigEnd(&iter);
+	if (known)
+		interest.Publish(flags);
+	else
+		interest.Clear();
+}
+
 void RimeWithWeaselHandler::_GetStatus(weasel::Status & stat, UINT session_id)
 {
 	RIME_STRUCT(RimeStatus, status);
@@ -842,3 +1002,10 @@ bool RimeWithWeaselHandler::_IsSessionTSF(UINT session_id)
 	RimeGetProperty(session_id, "client_type", client_type, sizeof(client_type) - 1);
 	return std::string(client_type) == "tsf";
 }
+
+bool RimeWithWeaselHandler::_IsSessionClientDrawn(UINT session_id)
+{
+	char client_caps[12] = { 0 };	// stays empty for a client that never told
+	RimeGetProperty(session_id, "client_caps", client_caps, sizeof(client_caps) - 1);
+	return (atoi(client_caps) & weasel::CLIENT_DRAWS_CANDIDATES) != 0;
+}
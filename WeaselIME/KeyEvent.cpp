@@ -2,7 +2,7 @@
 #include "KeyEvent.h"
 
 
-bool ConvertKeyEvent(UINT vkey, KeyInfo kinfo, const LPBYTE keyState, weasel::KeyEvent& result)
+bool ConvertKeyEvent(UINT vkey, KeyInfo kinfo, const LPBYTE keyState, weasel::KeyEvent& result, weasel::KeyTranslationCache& cache)
 {
 	const BYTE KEY_DOWN = 0x80;
 	const BYTE TOGGLED = 0x01;
@@ -42,17 +42,43 @@ bool ConvertKeyEvent(UINT vkey, KeyInfo kinfo, const LPBYTE keyState, weasel::Ke
 		return true;
 	}
 
-	const int buf_len = 8;
-	static WCHAR buf[buf_len];
-	static BYTE table[256];
-	// 清除Ctrl、Alt鍵狀態，以令ToUnicodeEx()返回字符
-	memcpy(table, keyState, sizeof(table));
-	table[VK_CONTROL] = 0;
-	table[VK_MENU] = 0;
-	int ret = ToUnicodeEx(vkey, UINT(kinfo), table, buf, buf_len, 0, NULL);
-	if (ret == 1)
+	// the part of the key state ToUnicodeEx() reads once Ctrl and Alt are cleared
+	unsigned state = 0;
+	if ((keyState[VK_SHIFT] & KEY_DOWN) != 0)
+		state |= weasel::KeyTranslationCache::SHIFT;
+	if ((keyState[VK_CAPITAL] & TOGGLED) != 0)
+		state |= weasel::KeyTranslationCache::CAPS_LOCK;
+	if ((keyState[VK_LCONTROL] & KEY_DOWN) != 0)
+		state |= weasel::KeyTranslationCache::LCONTROL;
+	if ((keyState[VK_RCONTROL] & KEY_DOWN) != 0)
+		state |= weasel::KeyTranslationCache::RCONTROL;
+	if ((keyState[VK_LMENU] & KEY_DOWN) != 0)
+		state |= weasel::KeyTranslationCache::LMENU;
+	if ((keyState[VK_RMENU] & KEY_DOWN) != 0)
+		state |= weasel::KeyTranslationCache::RMENU;
+	if ((keyState[VK_KANA] & TOGGLED) != 0)
+		state |= weasel::KeyTranslationCache::KANA;
+	if (kinfo.isKeyUp)
+		state |= weasel::KeyTranslationCache::KEY_UP;
+
+	HKL layout = GetKeyboardLayout(0);
+	auto translate = [&](wchar_t* ch) -> int
+	{
+		const int buf_len = 8;
+		WCHAR buf[buf_len];
+		BYTE table[256];
+		// 清除Ctrl、Alt鍵狀態，以令ToUnicodeEx()返回字符
+		memcpy(table, keyState, sizeof(table));
+		table[VK_CONTROL] = 0;
+		table[VK_MENU] = 0;
+		int ret = ToUnicodeEx(vkey, UINT(kinfo), table, buf, buf_len, 0, layout);
+		*ch = buf[0];
+		return ret;
+	};
+	wchar_t ch = 0;
+	if (cache.Translate(reinterpret_cast<uintptr_t>(layout), vkey, state, translate, &ch) == 1)
 	{
-		result.keycode = UINT(buf[0]);
+		result.keycode = UINT(ch);
 		return true;
 	}
 
@@ -60,13 +86,86 @@ bool ConvertKeyEvent(UINT vkey, KeyInfo kinfo, const LPBYTE keyState, weasel::Ke
 	return false;
 }
 
+// keysyms by virtual key, filled in at compile time
+struct KeycodeTable
+{
+	ibus::Keycode codes[256];
+};
+
+static constexpr KeycodeTable MakeKeycodeTable()
+{
+	KeycodeTable t = {};
+	t.codes[VK_BACK] = ibus::BackSpace;
+	t.codes[VK_TAB] = ibus::Tab;
+	t.codes[VK_CLEAR] = ibus::Clear;
+	t.codes[VK_MENU] = ibus::Alt_L;
+	t.codes[VK_PAUSE] = ibus::Pause;
+	t.codes[VK_CAPITAL] = ibus::Caps_Lock;
+
+	t.codes[VK_KANA] = ibus::Hiragana_Katakana;
+	//t.codes[VK_JUNJA] = 0;
+	//t.codes[VK_FINAL] = 0;
+	t.codes[VK_KANJI] = ibus::Kanji;
+
+	t.codes[VK_ESCAPE] = ibus::Escape;
+
+	//t.codes[VK_CONVERT] = 0;
+	//t.codes[VK_NONCONVERT] = 0;
+	//t.codes[VK_ACCEPT] = 0;
+	//t.codes[VK_MODECHANGE] = 0;
+
+	t.codes[VK_SPACE] = ibus::space;
+	t.codes[VK_PRIOR] = ibus::Prior;
+	t.codes[VK_NEXT] = ibus::Next;
+	t.codes[VK_END] = ibus::End;
+	t.codes[VK_HOME] = ibus::Home;
+	t.codes[VK_LEFT] = ibus::Left;
+	t.codes[VK_UP] = ibus::Up;
+	t.codes[VK_RIGHT] = ibus::Right;
+	t.codes[VK_DOWN] = ibus::Down;
+	t.codes[VK_SELECT] = ibus::Select;
+	t.codes[VK_PRINT] = ibus::Print;
+	t.codes[VK_EXECUTE] = ibus::Execute;
+	//t.codes[VK_SNAPSHOT] = 0;
+	t.codes[VK_INSERT] = ibus::Insert;
+	t.codes[VK_DELETE] = ibus::Delete;
+	t.codes[VK_HELP] = ibus::Help;
+
+	t.codes[VK_LWIN] = ibus::Meta_L;
+	t.codes[VK_RWIN] = ibus::Meta_R;
+	//t.codes[VK_APPS] = 0;
+	//t.codes[VK_SLEEP] = 0;
+	for (int i = 0; i <= 9; ++i)
+		t.codes[VK_NUMPAD0 + i] = ibus::Keycode(ibus::KP_0 + i);
+	t.codes[VK_MULTIPLY] = ibus::KP_Multiply;
+	t.codes[VK_ADD] = ibus::KP_Add;
+	t.codes[VK_SEPARATOR] = ibus::KP_Separator;
+	t.codes[VK_SUBTRACT] = ibus::KP_Subtract;
+	t.codes[VK_DECIMAL] = ibus::KP_Decimal;
+	t.codes[VK_DIVIDE] = ibus::KP_Divide;
+	for (int i = 0; i < 24; ++i)
+		t.codes[VK_F1 + i] = ibus::Keycode(ibus::F1 + i);
+
+	t.codes[VK_NUMLOCK] = ibus::Num_Lock;
+	t.codes[VK_SCROLL] = ibus::Scroll_Lock;
+
+	t.codes[VK_LSHIFT] = ibus::Shift_L;
+	t.codes[VK_RSHIFT] = ibus::Shift_R;
+	t.codes[VK_LCONTROL] = ibus::Control_L;
+	t.codes[VK_RCONTROL] = ibus::Control_R;
+	t.codes[VK_LMENU] = ibus::Alt_L;
+	t.codes[VK_RMENU] = ibus::Alt_R;
+	return t;
+}
+
+static constexpr KeycodeTable KEYCODES = MakeKeycodeTable();
+static_assert(KEYCODES.codes[VK_NUMPAD9] == ibus::KP_9 && KEYCODES.codes[VK_F24] == ibus::F24, "keycode table");
+
 ibus::Keycode TranslateKeycode(UINT vkey, KeyInfo kinfo)
 {
+	// these tell left from right, or the keypad, by the scan code
 	switch (vkey)
 	{
-	case VK_BACK:	return ibus::BackSpace;
-	case VK_TAB:	return ibus::Tab;
-	case VK_CLEAR:	return ibus::Clear;
 	case VK_RETURN:
 	{
 		if (kinfo.isExtended == 1)
@@ -88,95 +187,8 @@ ibus::Keycode TranslateKeycode(UINT vkey, KeyInfo kinfo)
 		else
 			return ibus::Control_L;
 	}
-	case VK_MENU:	return ibus::Alt_L;
-	case VK_PAUSE:	return ibus::Pause;
-	case VK_CAPITAL:	return ibus::Caps_Lock;
-
-	case VK_KANA:	return ibus::Hiragana_Katakana;
-	//case VK_JUNJA:	return 0;
-	//case VK_FINAL:	return 0;
-	case VK_KANJI:	return ibus::Kanji;
-
-	case VK_ESCAPE:	return ibus::Escape;
-
-	//case VK_CONVERT:	return 0;
-	//case VK_NONCONVERT:	return 0;
-	//case VK_ACCEPT:	return 0;
-	//case VK_MODECHANGE:	return 0;
-
-	case VK_SPACE:	return ibus::space;
-	case VK_PRIOR:	return ibus::Prior;
-	case VK_NEXT:	return ibus::Next;
-	case VK_END:	return ibus::End;
-	case VK_HOME:	return ibus::Home;
-	case VK_LEFT:	return ibus::Left;
-	case VK_UP:	return ibus::Up;
-	case VK_RIGHT:	return ibus::Right;
-	case VK_DOWN:	return ibus::Down;
-	case VK_SELECT:	return ibus::Select;
-	case VK_PRINT:	return ibus::Print;
-	case VK_EXECUTE:	return ibus::Execute;
-	//case VK_SNAPSHOT:	return 0;
-	case VK_INSERT:	return ibus::Insert;
-	case VK_DELETE:	return ibus::Delete;
-	case VK_HELP:	return ibus::Help;
-
-	case VK_LWIN:	return ibus::Meta_L;
-	case VK_RWIN:	return ibus::Meta_R;
-	//case VK_APPS:	return 0;
-	//case VK_SLEEP:	return 0;
-	case VK_NUMPAD0:	return ibus::KP_0;
-	case VK_NUMPAD1:	return ibus::KP_1;
-	case VK_NUMPAD2:	return ibus::KP_2;
-	case VK_NUMPAD3:	return ibus::KP_3;
-	case VK_NUMPAD4:	return ibus::KP_4;
-	case VK_NUMPAD5:	return ibus::KP_5;
-	case VK_NUMPAD6:	return ibus::KP_6;
-	case VK_NUMPAD7:	return ibus::KP_7;
-	case VK_NUMPAD8:	return ibus::KP_8;
-	case VK_NUMPAD9:	return ibus::KP_9;
-	case VK_MULTIPLY:	return ibus::KP_Multiply;
-	case VK_ADD:	return ibus::KP_Add;
-	case VK_SEPARATOR:	return ibus::KP_Separator;
-	case VK_SUBTRACT:	return ibus::KP_Subtract;
-	case VK_DECIMAL:	return ibus::KP_Decimal;
-	case VK_DIVIDE:	return ibus::KP_Divide;
-	case VK_F1:	return ibus::F1;
-	case VK_F2:	return ibus::F2;
-	case VK_F3:	return ibus::F3;
-	case VK_F4:	return ibus::F4;
-	case VK_F5:	return ibus::F5;
-	case VK_F6:	return ibus::F6;
-	case VK_F7:	return ibus::F7;
-	case VK_F8:	return ibus::F8;
-	case VK_F9:	return ibus::F9;
-	case VK_F10:	return ibus::F10;
-	case VK_F11:	return ibus::F11;
-	case VK_F12:	return ibus::F12;
-	case VK_F13:	return ibus::F13;
-	case VK_F14:	return ibus::F14;
-	case VK_F15:	return ibus::F15;
-	case VK_F16:	return ibus::F16;
-	case VK_F17:	return ibus::F17;
-	case VK_F18:	return ibus::F18;
-	case VK_F19:	return ibus::F19;
-	case VK_F20:	return ibus::F20;
-	case VK_F21:	return ibus::F21;
-	case VK_F22:	return ibus::F22;
-	case VK_F23:	return ibus::F23;
-	case VK_F24:	return ibus::F24;
-
-	case VK_NUMLOCK:	return ibus::Num_Lock;
-	case VK_SCROLL:	return ibus::Scroll_Lock;
-
-	case VK_LSHIFT:	return ibus::Shift_L;
-	case VK_RSHIFT:	return ibus::Shift_R;
-	case VK_LCONTROL:	return ibus::Control_L;
-	case VK_RCONTROL:	return ibus::Control_R;
-	case VK_LMENU:	return ibus::Alt_L;
-	case VK_RMENU:	return ibus::Alt_R;
 	}
-	return ibus::Null;
+	return vkey < 256 ? KEYCODES.codes[vkey] : ibus::Null;
 }
 
 /*
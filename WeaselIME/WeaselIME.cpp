@@ -406,14 +406,8 @@ BOOL WeaselIME::ProcessKeyEvent(UINT vKey, KeyInfo kinfo, const LPBYTE lpbKeySta
 		return FALSE;
 	}
 
-	if (!m_client.Echo())
-	{
-		m_client.Connect(NULL);
-		m_client.StartSession();
-	}
-
 	weasel::KeyEvent ke;
-	if (!ConvertKeyEvent(vKey, kinfo, lpbKeyState, ke))
+	if (!ConvertKeyEvent(vKey, kinfo, lpbKeyState, ke, m_keyTranslation))
 	{
 		// unknown key event
 		return FALSE;
@@ -441,6 +435,7 @@ BOOL WeaselIME::ProcessKeyEvent(UINT vKey, KeyInfo kinfo, const LPBYTE lpbKeySta
 				_StartComposition();
 		}
 	}
+	_FlushIMEMessages();
 
 	return (BOOL)accepted;
 }
@@ -544,41 +539,47 @@ HRESULT WeaselIME::_AddIMEMessage(UINT msg, WPARAM wp, LPARAM lp)
 	if(!m_hIMC)
 		return S_FALSE;
 
-	LPINPUTCONTEXT lpIMC = (LPINPUTCONTEXT)ImmLockIMC(m_hIMC);
-	if(!lpIMC)
-		return E_FAIL;
+	TRANSMSG message = { msg, wp, lp };
+	m_messages.Add(message);
+	return S_OK;
+}
 
-	HIMCC hBuf = ImmReSizeIMCC(lpIMC->hMsgBuf,
-		sizeof(TRANSMSG) * (lpIMC->dwNumMsgBuf + 1));
-	if(!hBuf)
+HRESULT WeaselIME::_FlushIMEMessages()
+{
+	bool ok = m_messages.Flush([this](const TRANSMSG* messages, size_t count) -> bool
 	{
-		ImmUnlockIMC(m_hIMC);
-		return E_FAIL;
-	}
-	lpIMC->hMsgBuf = hBuf;
+		LPINPUTCONTEXT lpIMC = (LPINPUTCONTEXT)ImmLockIMC(m_hIMC);
+		if(!lpIMC)
+			return false;
 
-	LPTRANSMSG pBuf = (LPTRANSMSG)ImmLockIMCC(hBuf);
-	if(!pBuf)
-	{
-		ImmUnlockIMC(m_hIMC);
-		return E_FAIL;
-	}
+		HIMCC hBuf = ImmReSizeIMCC(lpIMC->hMsgBuf,
+			sizeof(TRANSMSG) * (lpIMC->dwNumMsgBuf + count));
+		if(!hBuf)
+		{
+			ImmUnlockIMC(m_hIMC);
+			return false;
+		}
+		lpIMC->hMsgBuf = hBuf;
+
+		LPTRANSMSG pBuf = (LPTRANSMSG)ImmLockIMCC(hBuf);
+		if(!pBuf)
+		{
+			ImmUnlockIMC(m_hIMC);
+			return false;
+		}
 
-	DWORD last = lpIMC->dwNumMsgBuf;
-	pBuf[last].message = msg;
-	pBuf[last].wParam = wp;
-	pBuf[last].lParam = lp;
-	lpIMC->dwNumMsgBuf++;
-	ImmUnlockIMCC(hBuf);
+		memcpy(pBuf + lpIMC->dwNumMsgBuf, messages, sizeof(TRANSMSG) * count);
+		lpIMC->dwNumMsgBuf += (DWORD)count;
+		ImmUnlockIMCC(hBuf);
 
-	ImmUnlockIMC(m_hIMC);
+		ImmUnlockIMC(m_hIMC);
 
-	if (!ImmGenerateMessage(m_hIMC))
-	{
-		return E_FAIL;
-	}
+		return ImmGenerateMessage(m_hIMC) != FALSE;
+	});
+	EZDBGONLYLOGGERPRINT("IME messages: %llu in %llu generate calls, HIMC = 0x%x",
+		m_messages.Flushed(), m_messages.Flushes(), m_hIMC);
 
-	return S_OK;
+	return ok ? S_OK : E_FAIL;
 }
 
 void WeaselIME::_UpdateInputPosition(LPINPUTCONTEXT lpIMC, POINT pt)
@@ -1,6 +1,7 @@
 #pragma once
 #include <WeaselIPC.h>
 #include "KeyEvent.h"
+#include <MessageBatch.h>
 
 #define MAX_COMPOSITION_SIZE 256
 
@@ -58,6 +59,7 @@ private:
 	HRESULT _StartComposition();
 	HRESULT _EndComposition(LPCWSTR composition);
 	HRESULT _AddIMEMessage(UINT msg, WPARAM wp, LPARAM lp);
+	HRESULT _FlushIMEMessages();
 	void _SetCandidatePos(LPINPUTCONTEXT lpIMC);
 	void _SetCompositionWindow(LPINPUTCONTEXT lpIMC);
 	void _UpdateInputPosition(LPINPUTCONTEXT lpIMC, POINT pt);
@@ -69,4 +71,7 @@ private:
 	bool m_composing;
 	bool m_preferCandidatePos;
 	weasel::Client m_client;
+	weasel::KeyTranslationCache m_keyTranslation;
+	// messages of the key being handled, generated together when it is done
+	weasel::MessageBatch<TRANSMSG> m_messages;
 };
@@ -27,4 +27,8 @@ void Configurator::Store(Deserializer::KeyType const& key, std::wstring const& v
 	{
 		m_pTarget->p_config->inline_preedit = bool_value;
 	}
+	else if (key[1] == L"server_ui")
+	{
+		m_pTarget->p_config->server_ui = bool_value;
+	}
 }
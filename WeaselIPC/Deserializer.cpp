@@ -5,6 +5,7 @@
 #include "ContextUpdater.h"
 #include "Configurator.h"
 #include "Styler.h"
+#include "KeyInterestUpdater.h"
 
 using namespace weasel;
 
@@ -24,6 +25,7 @@ void Deserializer::Initialize(ResponseParser* pTarget)
 		Define(L"status", StatusUpdater::Create);
 		Define(L"config", Configurator::Create);
 		Define(L"style", Styler::Create);
+		Define(L"interest", KeyInterestUpdater::Create);
 	}
 
 	// loaded by default
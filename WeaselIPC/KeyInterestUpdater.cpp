@@ -0,0 +1,27 @@
+#include "stdafx.h"
+#include "Deserializer.h"
+#include "KeyInterestUpdater.h"
+#include <KeyInterest.h>
+
+using namespace weasel;
+
+KeyInterestUpdater::KeyInterestUpdater(weasel::ResponseParser * pTarget)
+	: Deserializer(pTarget)
+{
+}
+
+KeyInterestUpdater::~KeyInterestUpdater()
+{
+}
+
+void KeyInterestUpdater::Store(weasel::Deserializer::KeyType const & key, std::wstring const & value)
+{
+	if (!m_pTarget->p_interest) return;
+	// a malformed line leaves every key to the server
+	m_pTarget->p_interest->Parse(value);
+}
+
+weasel::Deserializer::Ptr KeyInterestUpdater::Create(weasel::ResponseParser * pTarget)
+{
+	return Deserializer::Ptr(new KeyInterestUpdater(pTarget));
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include "Deserializer.h"
+
+class KeyInterestUpdater : public weasel::Deserializer
+{
+public:
+	KeyInterestUpdater(weasel::ResponseParser* pTarget);
+	virtual ~KeyInterestUpdater();
+	// store data
+	virtual void Store(weasel::Deserializer::KeyType const& key, std::wstring const& value);
+	// factory method
+	static weasel::Deserializer::Ptr Create(weasel::ResponseParser* pTarget);
+};
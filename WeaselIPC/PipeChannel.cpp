@@ -17,6 +17,7 @@ PipeChannelBase::PipeChannelBase(std::wstring &&pn_cmd, size_t bs = 4 * 1024, SE
 	buffer(std::make_unique<char[]>(bs)),
 	hpipe(INVALID_HANDLE_VALUE),
 	has_body(false),
+	body_size(0),
 	sa(s) {};
 
 PipeChannelBase::PipeChannelBase(PipeChannelBase &&r)
@@ -26,6 +27,7 @@ PipeChannelBase::PipeChannelBase(PipeChannelBase &&r)
 	buffer(std::move(r.buffer)),
 	hpipe(r.hpipe),
 	has_body(r.has_body),
+	body_size(r.body_size),
 	sa(r.sa) {};
 
 
@@ -99,22 +101,6 @@ void PipeChannelBase::_FinalizePipe(HANDLE &p)
 	p = INVALID_HANDLE_VALUE;
 }
 
-void PipeChannelBase::_Receive(HANDLE pipe, LPVOID msg, size_t rec_len)
-{
-	DWORD lread;
-	BOOL success = ::ReadFile(pipe, msg, rec_len, &lread, NULL);
-	if (!success) {
-		_ThrowIfNot(ERROR_MORE_DATA);
-
-		memset(buffer.get(), 0, buff_size);
-		success = ::ReadFile(pipe, buffer.get(), buff_size, &lread, NULL);
-		if (!success) {
-			_ThrowLastError;
-		}
-	}
-	has_body = false;
-}
-
 HANDLE PipeChannelBase::_ConnectServerPipe(std::wstring &pn)
 {
 	HANDLE pipe = CreateNamedPipe(
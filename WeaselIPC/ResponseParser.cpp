@@ -5,8 +5,8 @@
 
 using namespace weasel;
 
-ResponseParser::ResponseParser(std::wstring* commit, Context* context, Status* status, Config* config, UIStyle* style)
- : p_commit(commit), p_context(context), p_status(status), p_config(config), p_style(style)
+ResponseParser::ResponseParser(std::wstring* commit, Context* context, Status* status, Config* config, UIStyle* style, KeyInterest* interest)
+ : p_commit(commit), p_context(context), p_status(status), p_config(config), p_style(style), p_interest(interest)
 {
 	Deserializer::Initialize(this);
 }
@@ -6,8 +6,10 @@ using namespace weasel;
 
 ClientImpl::ClientImpl()
 	: session_id(0),
-	  channel(GetPipeName()),
-	  is_ime(false)
+	  channel(GetPipeName(), NULL, WEASEL_IPC_BUFFER_SIZE),
+	  is_ime(false),
+	  transact_failed(false),
+	  client_caps(0)
 {
 	_InitializeClientInfo();
 }
@@ -66,13 +68,23 @@ void ClientImpl::ShutdownServer()
 	_SendMessage(WEASEL_IPC_SHUTDOWN_SERVER, 0, 0);
 }
 
-bool ClientImpl::ProcessKeyEvent(KeyEvent const& keyEvent)
+bool ClientImpl::ProcessKeyEvent(KeyEvent const& keyEvent, UINT* state)
 {
-	if (!_Active())
-		return false;
-
-	LRESULT ret = _SendMessage(WEASEL_IPC_PROCESS_KEY_EVENT, keyEvent, session_id);
-	return ret != 0;
+	LRESULT ret = 0;
+	if (_Active())
+		ret = _SendMessage(WEASEL_IPC_PROCESS_KEY_EVENT, keyEvent, session_id);
+	// the reply tells whether the session is alive; start another only when it or the pipe is gone
+	if (!_Active() || transact_failed || ret == WEASEL_IPC_UNKNOWN_SESSION)
+	{
+		ret = 0;
+		if (_RestartSession())
+			ret = _SendMessage(WEASEL_IPC_PROCESS_KEY_EVENT, keyEvent, session_id);
+		if (ret == WEASEL_IPC_UNKNOWN_SESSION)
+			ret = 0;
+	}
+	if (state)
+		*state = (UINT)ret;
+	return (ret & WEASEL_KEY_EATEN) != 0;
 }
 
 bool ClientImpl::CommitComposition()
@@ -119,9 +131,9 @@ void ClientImpl::UpdateInputPosition(RECT const& rc)
 	_SendMessage(WEASEL_IPC_UPDATE_INPUT_POS, compressed_rect, session_id);
 }
 
-void ClientImpl::FocusIn()
+void ClientImpl::FocusIn(DWORD client_caps)
 {
-	DWORD client_caps = 0;  /* TODO */
+	this->client_caps = client_caps;
 	_SendMessage(WEASEL_IPC_FOCUS_IN, client_caps, session_id);
 }
 
@@ -163,6 +175,22 @@ void ClientImpl::EndMaintenance()
 	session_id = 0;
 }
 
+bool ClientImpl::_RestartSession()
+{
+	if (transact_failed || !_Connected())
+	{
+		channel.Disconnect();
+		channel.Connect();
+	}
+	session_id = 0;
+	_WriteClientInfo();
+	session_id = _SendMessage(WEASEL_IPC_START_SESSION, 0, 0);
+	// the new session knows nothing of the client, say again who draws the candidates
+	if (_Active() && client_caps)
+		_SendMessage(WEASEL_IPC_FOCUS_IN, client_caps, session_id);
+	return _Active();
+}
+
 bool ClientImpl::Echo()
 {
 	if (!_Active())
@@ -194,11 +222,13 @@ bool ClientImpl::_WriteClientInfo()
 
 LRESULT ClientImpl::_SendMessage(WEASEL_IPC_COMMAND Msg, DWORD wParam, DWORD lParam)
 {
+	transact_failed = false;
 	try {
 		PipeMessage req{ Msg, wParam, lParam };
 		return channel.Transact(req);
 	}
 	catch (DWORD /* ex */) {
+		transact_failed = true;
 		return 0;
 	}
 }
@@ -229,9 +259,9 @@ void Client::ShutdownServer()
 	m_pImpl->ShutdownServer();
 }
 
-bool Client::ProcessKeyEvent(KeyEvent const& keyEvent)
+bool Client::ProcessKeyEvent(KeyEvent const& keyEvent, UINT* state)
 {
-	return m_pImpl->ProcessKeyEvent(keyEvent);
+	return m_pImpl->ProcessKeyEvent(keyEvent, state);
 }
 
 bool Client::CommitComposition()
@@ -249,9 +279,9 @@ void Client::UpdateInputPosition(RECT const& rc)
 	m_pImpl->UpdateInputPosition(rc);
 }
 
-void Client::FocusIn()
+void Client::FocusIn(DWORD client_caps)
 {
-	m_pImpl->FocusIn();
+	m_pImpl->FocusIn(client_caps);
 }
 
 void Client::FocusOut()
@@ -19,11 +19,11 @@ namespace weasel
 		void StartMaintenance();
 		void EndMaintenance();
 		bool Echo();
-		bool ProcessKeyEvent(KeyEvent const& keyEvent);
+		bool ProcessKeyEvent(KeyEvent const& keyEvent, UINT* state);
 		bool CommitComposition();
 		bool ClearComposition();
 		void UpdateInputPosition(RECT const& rc);
-		void FocusIn();
+		void FocusIn(DWORD client_caps);
 		void FocusOut();
 		void TrayCommand(UINT menuId);
 		bool GetResponseData(ResponseHandler const& handler);
@@ -31,6 +31,7 @@ namespace weasel
 	protected:
 		void _InitializeClientInfo();
 		bool _WriteClientInfo();
+		bool _RestartSession();
 
 		LRESULT _SendMessage(WEASEL_IPC_COMMAND Msg, DWORD wParam, DWORD lParam);
 
@@ -41,6 +42,10 @@ namespace weasel
 		UINT session_id;
 		std::wstring app_name;
 		bool is_ime;
+		// whether the last _SendMessage lost the pipe
+		bool transact_failed;
+		// as last sent with FocusIn, for a session started again
+		DWORD client_caps;
 
 		PipeChannel<PipeMessage> channel;
 	};
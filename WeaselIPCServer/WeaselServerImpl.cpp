@@ -3,6 +3,8 @@
 #include <Windows.h>
 #include <VersionHelpers.hpp>
 #include <resource.h>
+#include <WeaselProfiler.h>
+#include <KeyJournal.h>
 
 namespace weasel {
 	class PipeServer : public PipeChannel<DWORD, PipeMessage>
@@ -10,7 +12,10 @@ namespace weasel {
 	public:
 		using ServerRunner = std::function<void()>;
 		using Respond = std::function<void(Msg)>;
-		using ServerHandler = std::function<void(PipeMessage, Respond)>;
+		/* Whether the client has sent its next message already */
+		using Pending = std::function<bool()>;
+		/* Handles a message that arrived on the channel of its client's pipe */
+		using ServerHandler = std::function<void(PipeMessage, PipeServer&, Respond, Pending)>;
 
 		PipeServer(std::wstring &&pn_cmd, SECURITY_ATTRIBUTES *s);
 
@@ -18,7 +23,11 @@ namespace weasel {
 		void Listen(ServerHandler const &handler);
 		/* Get a server runner */
 		ServerRunner GetServerRunner(ServerHandler const &handler);
+		/* Bytes of body written for the reply about to be sent */
+		size_t BodySize() const { return has_body ? _WrittenSize() : 0; }
 	private:
+		/* The channel of one client's pipe, the frame it sent and the reply to it */
+		explicit PipeServer(size_t bs);
 		void _ProcessPipeThread(HANDLE pipe, ServerHandler const &handler);
 	};
 }
@@ -30,7 +39,8 @@ extern CAppModule _Module;
 
 ServerImpl::ServerImpl()
 	: m_pRequestHandler(NULL),
-	channel(std::make_unique<PipeServer>(GetPipeName(), sa.get_attr()))
+	channel(std::make_unique<PipeServer>(GetPipeName(), sa.get_attr())),
+	m_pipeChannel(NULL)
 {
 	m_hUser32Module = GetModuleHandle(_T("user32.dll"));
 }
@@ -153,8 +163,8 @@ int ServerImpl::Run()
 	// auto listener = boost::bind(&PipeServer::Listen, channel.get(), handler);
 	//
 
-	auto listener = [this](PipeMessage msg, PipeServer::Respond resp) -> void {
-		HandlePipeMessage(msg, resp);
+	auto listener = [this](PipeMessage msg, PipeServer &pipe, PipeServer::Respond resp, PipeServer::Pending pending) -> void {
+		HandlePipeMessage(msg, pipe, resp, pending);
 	};
 	pipeThread = std::make_unique<boost::thread>([this, &listener]() {
 		channel->Listen(listener);
@@ -181,9 +191,9 @@ DWORD ServerImpl::OnStartSession(WEASEL_IPC_COMMAND uMsg, DWORD wParam, DWORD lP
 	if (!m_pRequestHandler)
 		return 0;
 	return m_pRequestHandler->AddSession(
-		reinterpret_cast<LPWSTR>(channel->ReceiveBuffer()),
+		reinterpret_cast<LPWSTR>(m_pipeChannel->ReceiveBuffer()),
 		[this](std::wstring &msg) -> bool {
-			*channel << msg;
+			*m_pipeChannel << msg;
 			return true;
 		}
 	);
@@ -200,9 +210,12 @@ DWORD ServerImpl::OnKeyEvent(WEASEL_IPC_COMMAND uMsg, DWORD wParam, DWORD lParam
 {
 	if (!m_pRequestHandler/* || !m_pSharedMemory*/)
 		return 0;
+	// rather than an echo before each key, the reply tells the client its session is gone
+	if (!m_pRequestHandler->FindSession(lParam))
+		return WEASEL_IPC_UNKNOWN_SESSION;
 
 	auto eat = [this](std::wstring &msg) -> bool {
-		*channel << msg;
+		*m_pipeChannel << msg;
 		return true;
 	};
 	return m_pRequestHandler->ProcessKeyEvent(KeyEvent(wParam), lParam, eat);
@@ -311,32 +324,73 @@ case __msg:\
 
 #define END_MAP_PIPE_MSG_HANDLE(__result) }__result = _result; }
 
-template<typename _Resp>
-void ServerImpl::HandlePipeMessage(PipeMessage pipe_msg, _Resp resp)
+template<typename _Resp, typename _Pending>
+void ServerImpl::HandlePipeMessage(PipeMessage pipe_msg, PipeServer &pipe, _Resp resp, _Pending pending)
 {
+	// every client has a pipe thread and a channel of its own, but they share the handler
+	boost::lock_guard<boost::mutex> lock(m_handlerMutex);
+	m_pipeChannel = &pipe;
 	DWORD result;
+	{
+		ProfileScope profile(PROFILE_IPC_MESSAGE);
+		const int64_t start = Profiler::Now();
+
+		MAP_PIPE_MSG_HANDLE(pipe_msg.Msg, pipe_msg.wParam, pipe_msg.lParam)
+			PIPE_MSG_HANDLE(WEASEL_IPC_ECHO, OnEcho)
+			PIPE_MSG_HANDLE(WEASEL_IPC_START_SESSION, OnStartSession)
+			PIPE_MSG_HANDLE(WEASEL_IPC_END_SESSION, OnEndSession)
+			PIPE_MSG_HANDLE(WEASEL_IPC_PROCESS_KEY_EVENT, OnKeyEvent)
+			PIPE_MSG_HANDLE(WEASEL_IPC_SHUTDOWN_SERVER, OnShutdownServer)
+			PIPE_MSG_HANDLE(WEASEL_IPC_FOCUS_IN, OnFocusIn)
+			PIPE_MSG_HANDLE(WEASEL_IPC_FOCUS_OUT, OnFocusOut)
+			PIPE_MSG_HANDLE(WEASEL_IPC_UPDATE_INPUT_POS, OnUpdateInputPosition)
+			PIPE_MSG_HANDLE(WEASEL_IPC_START_MAINTENANCE, OnStartMaintenance)
+			PIPE_MSG_HANDLE(WEASEL_IPC_END_MAINTENANCE, OnEndMaintenance)
+			PIPE_MSG_HANDLE(WEASEL_IPC_COMMIT_COMPOSITION, OnCommitComposition)
+			PIPE_MSG_HANDLE(WEASEL_IPC_CLEAR_COMPOSITION, OnClearComposition);
+			PIPE_MSG_HANDLE(WEASEL_IPC_TRAY_COMMAND, OnCommand);
+		END_MAP_PIPE_MSG_HANDLE(result);
+
+		KeyJournal &journal = KeyJournal::Server();
+		if (journal.IsEnabled())
+		{
+			// before the reply is sent and its body with it
+			const int64_t ns = Profiler::Now() - start;
+			JournalEntry entry = { start, (uint32_t)pipe_msg.Msg, pipe_msg.wParam, pipe_msg.lParam,
+				pipe_msg.Msg == WEASEL_IPC_START_SESSION ? result : pipe_msg.lParam, result,
+				(uint32_t)pipe.BodySize(), (uint32_t)(ns < 0xFFFFFFFF ? ns : 0xFFFFFFFF), 0 };
+			journal.Record(entry);
+		}
 
-	MAP_PIPE_MSG_HANDLE(pipe_msg.Msg, pipe_msg.wParam, pipe_msg.lParam)
-		PIPE_MSG_HANDLE(WEASEL_IPC_ECHO, OnEcho)
-		PIPE_MSG_HANDLE(WEASEL_IPC_START_SESSION, OnStartSession)
-		PIPE_MSG_HANDLE(WEASEL_IPC_END_SESSION, OnEndSession)
-		PIPE_MSG_HANDLE(WEASEL_IPC_PROCESS_KEY_EVENT, OnKeyEvent)
-		PIPE_MSG_HANDLE(WEASEL_IPC_SHUTDOWN_SERVER, OnShutdownServer)
-		PIPE_MSG_HANDLE(WEASEL_IPC_FOCUS_IN, OnFocusIn)
-		PIPE_MSG_HANDLE(WEASEL_IPC_FOCUS_OUT, OnFocusOut)
-		PIPE_MSG_HANDLE(WEASEL_IPC_UPDATE_INPUT_POS, OnUpdateInputPosition)
-		PIPE_MSG_HANDLE(WEASEL_IPC_START_MAINTENANCE, OnStartMaintenance)
-		PIPE_MSG_HANDLE(WEASEL_IPC_END_MAINTENANCE, OnEndMaintenance)
-		PIPE_MSG_HANDLE(WEASEL_IPC_COMMIT_COMPOSITION, OnCommitComposition)
-		PIPE_MSG_HANDLE(WEASEL_IPC_CLEAR_COMPOSITION, OnClearComposition);
-		PIPE_MSG_HANDLE(WEASEL_IPC_TRAY_COMMAND, OnCommand);
-	END_MAP_PIPE_MSG_HANDLE(result);
-
-	resp(result);
+		resp(result);
+		m_pipeChannel = NULL;
+	}
+
+	// the client has its reply; work left over from the key no longer keeps it waiting,
+	// unless its next key is already in the pipe, which goes first: the last key of a burst does the work
+	if (m_pRequestHandler && pipe_msg.Msg == WEASEL_IPC_PROCESS_KEY_EVENT)
+	{
+		if (pending())
+		{
+			Profiler::Count(PROFILE_IDLE_DEFERRED);
+			return;
+		}
+		const int64_t start = Profiler::Now();
+		m_pRequestHandler->Idle();
+		const int64_t end = Profiler::Now();
+		Profiler::Record(PROFILE_IDLE, start, end);
+		// a key typed meanwhile waited in the pipe for up to this long
+		if (pending())
+			Profiler::Record(PROFILE_KEY_BEHIND_IDLE, start, end);
+	}
 }
 
 PipeServer::PipeServer(std::wstring &&pn_cmd, SECURITY_ATTRIBUTES *s)
-	: PipeChannel(std::move(pn_cmd), s)
+	: PipeChannel(std::move(pn_cmd), s, WEASEL_IPC_BUFFER_SIZE)
+{}
+
+PipeServer::PipeServer(size_t bs)
+	: PipeChannel(std::wstring(), NULL, bs)
 {}
 
 void PipeServer::Listen(ServerHandler const &handler)
@@ -366,18 +420,24 @@ PipeServer::ServerRunner PipeServer::GetServerRunner(ServerHandler const &handle
 
 void PipeServer::_ProcessPipeThread(HANDLE pipe, ServerHandler const &handler)
 {
+	// read and written apart from the other clients', so that one's frame cannot overwrite another's
+	PipeServer conn(buff_size);
 	try {
 		for (;;) {
-			Res msg;
-			_Receive(pipe, &msg, sizeof(msg));
-			handler(msg, [this, pipe](Msg resp) {
-				_Send(pipe, resp);
+			Res msg = conn._ReceiveFrame(pipe);
+			handler(msg, conn, [&conn, pipe](Msg resp) {
+				conn._Send(pipe, resp);
+			}, [pipe]() -> bool {
+				DWORD available = 0;
+				return ::PeekNamedPipe(pipe, NULL, 0, NULL, &available, NULL) && available > 0;
 			});
 		}
 	}
 	catch (...) {
 		_FinalizePipe(pipe);
 	}
+	// the client is gone, and so is this thread
+	Profiler::ReleaseThread();
 }
 
 
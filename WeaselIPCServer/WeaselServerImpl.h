@@ -69,8 +69,8 @@ namespace weasel
 
 	private:
 		void _Finailize();
-		template<typename _Resp>
-		void HandlePipeMessage(PipeMessage pipe_msg, _Resp resp);
+		template<typename _Resp, typename _Pending>
+		void HandlePipeMessage(PipeMessage pipe_msg, PipeServer &pipe, _Resp resp, _Pending pending);
 
 		std::unique_ptr<PipeServer> channel;
 		std::unique_ptr<boost::thread> pipeThread;
@@ -78,6 +78,10 @@ namespace weasel
 		std::map<UINT, CommandHandler> m_MenuHandlers;
 		HMODULE m_hUser32Module;
 		SecurityAttribute sa;
+		// held by a pipe thread from dispatch through Idle
+		boost::mutex m_handlerMutex;
+		// the channel of the message being dispatched, while m_handlerMutex is held
+		PipeServer *m_pipeChannel;
 	};
 
 
@@ -56,4 +56,7 @@ void WeaselServerApp::SetupMenuHandlers()
 	m_server.AddMenuHandler(ID_WEASELTRAY_CHECKUPDATE, check_update);
 	m_server.AddMenuHandler(ID_WEASELTRAY_INSTALLDIR, std::bind(explore, dir));
 	m_server.AddMenuHandler(ID_WEASELTRAY_USERCONFIG, std::bind(explore, WeaselUserDataPath()));
+	m_server.AddMenuHandler(ID_WEASELTRAY_PROFILE_DUMP, dump_profile);
+	m_server.AddMenuHandler(ID_WEASELTRAY_PROFILE_TRACE, toggle_profile_trace);
+	m_server.AddMenuHandler(ID_WEASELTRAY_PROFILE_JOURNAL, toggle_key_journal);
 }
@@ -5,7 +5,10 @@
 #include <WeaselUI.h>
 #include <RimeWithWeasel.h>
 #include <WeaselUtility.h>
+#include <WeaselProfiler.h>
+#include <KeyJournal.h>
 #include <winsparkle.h>
+#include <fstream>
 #include <functional>
 #include <memory>
 
@@ -40,6 +43,45 @@ public:
 		return true;
 	}
 
+	// writes the profiler statistics and chrome trace to the temp folder, next to the rime logs,
+	// and the key journal if one is kept, for TestWeaselIPC /replay
+	static bool dump_profile()
+	{
+		WCHAR temp_path[MAX_PATH] = { 0 };
+		GetTempPathW(_countof(temp_path), temp_path);
+		std::wstring report_path = std::wstring(temp_path) + L"weasel_profile.txt";
+		std::wstring trace_path = std::wstring(temp_path) + L"weasel_trace.json";
+		std::wstring journal_path = std::wstring(temp_path) + L"weasel_journal.bin";
+		std::vector<weasel::JournalEntry> journal = weasel::KeyJournal::Server().Snapshot();
+		std::ofstream report(report_path.c_str());
+		report << weasel::Profiler::Report() << "\nchrome trace: " << wcstoutf8(trace_path.c_str()) << "\n";
+		if (!journal.empty())
+			report << "key journal: " << wcstoutf8(journal_path.c_str()) << ", " << journal.size() << " messages\n";
+		report.close();
+		std::ofstream trace(trace_path.c_str(), std::ios::binary);
+		trace << weasel::Profiler::TraceJson(GetCurrentProcessId());
+		trace.close();
+		if (!journal.empty())
+		{
+			std::ofstream file(journal_path.c_str(), std::ios::binary);
+			weasel::KeyJournal::Save(file, journal);
+		}
+		return open(report_path);
+	}
+
+	static bool toggle_profile_trace()
+	{
+		weasel::Profiler::SetTracing(!weasel::Profiler::IsTracing());
+		return true;
+	}
+
+	static bool toggle_key_journal()
+	{
+		weasel::KeyJournal &journal = weasel::KeyJournal::Server();
+		journal.SetEnabled(!journal.IsEnabled());
+		return true;
+	}
+
 	static std::wstring install_dir()
 	{
 		WCHAR exe_path[MAX_PATH] = { 0 };
@@ -3,6 +3,8 @@
 
 // nasty
 #include <resource.h>
+#include <WeaselProfiler.h>
+#include <KeyJournal.h>
 
 static UINT mode_icon[] = { IDI_ZH, IDI_ZH, IDI_EN, IDI_RELOAD };
 static const WCHAR *mode_label[] = { NULL, /*L"中文"*/ NULL, /*L"西文"*/ NULL, L"維護中" };
@@ -14,6 +16,8 @@ WeaselTrayIcon::WeaselTrayIcon(weasel::UI &ui)
 
 void WeaselTrayIcon::CustomizeMenu(HMENU hMenu)
 {
+	CheckMenuItem(hMenu, ID_WEASELTRAY_PROFILE_TRACE, MF_BYCOMMAND | (weasel::Profiler::IsTracing() ? MF_CHECKED : MF_UNCHECKED));
+	CheckMenuItem(hMenu, ID_WEASELTRAY_PROFILE_JOURNAL, MF_BYCOMMAND | (weasel::KeyJournal::Server().IsEnabled() ? MF_CHECKED : MF_UNCHECKED));
 }
 
 BOOL WeaselTrayIcon::Create(HWND hTargetWnd)
@@ -7,9 +7,9 @@ using namespace std;
 using namespace weasel;
 
 CCandidateList::CCandidateList(com_ptr<WeaselTSF> pTextService)
-	: _ui(make_unique<UI>())
-	, _tsf(pTextService)
+	: _tsf(pTextService)
 	, _pbShow(TRUE)
+	, _serverUI(false)
 {
 	_cRef = 1;
 }
@@ -85,6 +85,8 @@ STDMETHODIMP CCandidateList::GetGUID(GUID * pguid)
 
 STDMETHODIMP CCandidateList::Show(BOOL showCandidateWindow)
 {
+	if (_ui == nullptr)
+		return S_OK;
 	if (showCandidateWindow)
 		_ui->Show();
 	else
@@ -94,7 +96,7 @@ STDMETHODIMP CCandidateList::Show(BOOL showCandidateWindow)
 
 STDMETHODIMP CCandidateList::IsShown(BOOL * pIsShow)
 {
-	*pIsShow = _ui->IsShown();
+	*pIsShow = _ui != nullptr && _ui->IsShown();
 	return S_OK;
 }
 
@@ -124,24 +126,23 @@ STDMETHODIMP CCandidateList::GetDocumentMgr(ITfDocumentMgr ** ppdim)
 
 STDMETHODIMP CCandidateList::GetCount(UINT * pCandidateCount)
 {
-	*pCandidateCount = _ui->ctx().cinfo.candies.size();
+	*pCandidateCount = _cinfo.candies.size();
 	return S_OK;
 }
 
 STDMETHODIMP CCandidateList::GetSelection(UINT * pSelectedCandidateIndex)
 {
-	*pSelectedCandidateIndex = _ui->ctx().cinfo.highlighted;
+	*pSelectedCandidateIndex = _cinfo.highlighted;
 	return S_OK;
 }
 
 STDMETHODIMP CCandidateList::GetString(UINT uIndex, BSTR * pbstr)
 {
 	*pbstr = nullptr;
-	auto &cinfo = _ui->ctx().cinfo;
-	if (uIndex >= cinfo.candies.size())
+	if (uIndex >= _cinfo.candies.size())
 		return E_INVALIDARG;
 
-	auto &str = cinfo.candies[uIndex].str;
+	auto &str = _cinfo.candies[uIndex].str;
 	*pbstr = SysAllocStringLen(str.c_str(), str.size() + 1);
 
 	return S_OK;
@@ -223,6 +224,14 @@ STDMETHODIMP CCandidateList::FinalizeExactCompositionString()
 
 void CCandidateList::UpdateUI(const Context & ctx, const Status & status)
 {
+	// for hosts that draw the candidates themselves
+	_cinfo = ctx.cinfo;
+	if (_ui == nullptr) {
+		if (_pbShow == FALSE)
+			_UpdateUIElement();
+		return;
+	}
+
 	if (_ui->style().inline_preedit) {
 		_ui->style().client_caps |= weasel::INLINE_PREEDIT_CAPABLE;
 	}
@@ -245,12 +254,28 @@ void CCandidateList::UpdateUI(const Context & ctx, const Status & status)
 
 void CCandidateList::UpdateStyle(const UIStyle & sty)
 {
-	_ui->style() = sty;
+	_style = sty;
+	if (_ui != nullptr)
+		_ui->style() = sty;
 }
 
 void CCandidateList::UpdateInputPosition(RECT const & rc)
 {
-	_ui->UpdateInputPosition(rc);
+	if (_ui != nullptr)
+		_ui->UpdateInputPosition(rc);
+}
+
+void CCandidateList::SetServerUI(bool serverUI)
+{
+	if (serverUI == _serverUI)
+		return;
+	_serverUI = serverUI;
+	// the server draws from now on; let go of this process's render stack
+	if (_serverUI && _ui != nullptr)
+	{
+		_ui->Destroy();
+		_ui.reset();
+	}
 }
 
 void CCandidateList::Destroy()
@@ -325,13 +350,16 @@ void CCandidateList::StartUI()
 		return;
 	}
 
+	BOOL shown = _pbShow;
 	pUIElementMgr->BeginUIElement(this, &_pbShow, &uiid);
 	//pUIElementMgr->UpdateUIElement(uiid);
 	if (_pbShow)
 	{
-		_ui->style() = _style;
 		_MakeUIWindow();
 	}
+	// the server's panel must not draw a second list over the host's
+	if (_serverUI && _pbShow != shown)
+		_tsf->_UpdateClientCaps();
 }
 
 void CCandidateList::EndUI()
@@ -364,6 +392,12 @@ void CCandidateList::_DisposeUIWindow()
 void CCandidateList::_MakeUIWindow()
 {
 	HWND p = _GetActiveWnd();
+	if (_serverUI)
+		return;
+	// made on the first composition, so that hosts that never compose do not load the render stack
+	if (_ui == nullptr)
+		_ui = make_unique<UI>();
+	_ui->style() = _style;
 	_ui->Create(p);
 }
 
@@ -377,6 +411,19 @@ void WeaselTSF::_StartUI()
 	_cand->StartUI();
 }
 
+DWORD WeaselTSF::_GetClientCaps()
+{
+	// a UWP host shows only windows owned by its active view, which the server's cannot be
+	if (isImmersive() || _cand->HostDrawsUI())
+		return weasel::CLIENT_DRAWS_CANDIDATES;
+	return 0;
+}
+
+void WeaselTSF::_UpdateClientCaps()
+{
+	m_client.FocusIn(_GetClientCaps());
+}
+
 void WeaselTSF::_EndUI()
 {
 	_cand->EndUI();
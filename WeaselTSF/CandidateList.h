@@ -49,6 +49,10 @@ public:
 	void UpdateUI(const weasel::Context &ctx, const weasel::Status &status);
 	void UpdateStyle(const weasel::UIStyle &sty);
 	void UpdateInputPosition(RECT const& rc);
+	/* Whether the server's panel draws the candidates instead of one made in this process */
+	void SetServerUI(bool serverUI);
+	/* Whether the host draws the candidates, from the UI element it was handed */
+	bool HostDrawsUI() const { return _pbShow == FALSE; }
 	void Destroy();
 	void StartUI();
 	void EndUI();
@@ -66,14 +70,16 @@ private:
 	void _DisposeUIWindow();
 	void _MakeUIWindow();
 
-	std::unique_ptr<weasel::UI> _ui;
+	std::unique_ptr<weasel::UI> _ui;  // none while the server draws
 	DWORD _cRef;
 	com_ptr<WeaselTSF> _tsf;
 	DWORD uiid;
 	TfIntegratableCandidateListSelectionStyle _selectionStyle = STYLE_ACTIVE_SELECTION;
 
 	BOOL _pbShow;
+	bool _serverUI;
 	weasel::UIStyle _style;
+	weasel::CandidateInfo _cinfo;
 
 	com_ptr<ITfContext> _pContextDocument;
 };
@@ -67,15 +67,14 @@ STDAPI CStartCompositionEditSession::DoEditSession(TfEditCookie ec)
 	return hr;
 }
 
-void WeaselTSF::_StartComposition(com_ptr<ITfContext> pContext, BOOL fCUASWorkaroundEnabled)
+void WeaselTSF::_StartComposition(TfEditCookie ec, com_ptr<ITfContext> pContext, BOOL fCUASWorkaroundEnabled)
 {
 	com_ptr<CStartCompositionEditSession> pStartCompositionEditSession;
 	pStartCompositionEditSession.Attach(new CStartCompositionEditSession(this, pContext, fCUASWorkaroundEnabled));
 	_cand->StartUI();
 	if (pStartCompositionEditSession != nullptr)
 	{
-		HRESULT hr;
-		pContext->RequestEditSession(_tfClientId, pStartCompositionEditSession, TF_ES_SYNC | TF_ES_READWRITE, &hr);
+		pStartCompositionEditSession->DoEditSession(ec);
 	}
 }
 
@@ -123,6 +122,17 @@ void WeaselTSF::_EndComposition(com_ptr<ITfContext> pContext, BOOL clear)
 	}
 }
 
+void WeaselTSF::_EndComposition(TfEditCookie ec, com_ptr<ITfContext> pContext, BOOL clear)
+{
+	com_ptr<CEndCompositionEditSession> pEditSession;
+	_cand->EndUI();
+	pEditSession.Attach(new CEndCompositionEditSession(this, pContext, _pComposition, clear));
+	if (pEditSession != nullptr)
+	{
+		pEditSession->DoEditSession(ec);
+	}
+}
+
 /* Get Text Extent */
 class CGetTextExtentEditSession: public CEditSession
 {
@@ -176,6 +186,20 @@ BOOL WeaselTSF::_UpdateCompositionWindow(com_ptr<ITfContext> pContext)
 	return SUCCEEDED(hr);
 }
 
+BOOL WeaselTSF::_UpdateCompositionWindow(TfEditCookie ec, com_ptr<ITfContext> pContext)
+{
+	com_ptr<ITfContextView> pContextView;
+	if (pContext->GetActiveView(&pContextView) != S_OK)
+		return FALSE;
+	com_ptr<CGetTextExtentEditSession> pEditSession;
+	pEditSession.Attach(new CGetTextExtentEditSession(this, pContext, pContextView, _pComposition));
+	if (pEditSession == NULL)
+	{
+		return FALSE;
+	}
+	return SUCCEEDED(pEditSession->DoEditSession(ec));
+}
+
 void WeaselTSF::_SetCompositionPosition(const RECT &rc)
 {
 	/* Test if rect is valid.
@@ -200,7 +224,7 @@ void WeaselTSF::_SetCompositionPosition(const RECT &rc)
 class CInlinePreeditEditSession: public CEditSession
 {
 public:
-	CInlinePreeditEditSession(com_ptr<WeaselTSF> pTextService, com_ptr<ITfContext> pContext, com_ptr<ITfComposition> pComposition, const std::shared_ptr<weasel::Context> context)
+	CInlinePreeditEditSession(com_ptr<WeaselTSF> pTextService, com_ptr<ITfContext> pContext, com_ptr<ITfComposition> pComposition, const weasel::Context& context)
 		: CEditSession(pTextService, pContext), _pComposition(pComposition), _context(context)
 	{
 	}
@@ -210,36 +234,67 @@ public:
 
 private:
 	com_ptr<ITfComposition> _pComposition;
-	const std::shared_ptr<weasel::Context> _context;
+	const weasel::Context& _context;  // run within the session that parsed it
 };
 
 STDAPI CInlinePreeditEditSession::DoEditSession(TfEditCookie ec)
 {
-	std::wstring preedit = _context->preedit.str;
+	const std::wstring& preedit = _context.preedit.str;
 
 	com_ptr<ITfRange> pRangeComposition;
 	if ((_pComposition->GetRange(&pRangeComposition)) != S_OK)
 		return E_FAIL;
 
-	if ((pRangeComposition->SetText(ec, 0, preedit.c_str(), preedit.length())) != S_OK)
-		return E_FAIL;
+	/* Set only what follows the part of the composition that stays, sparing the host a reflow of the rest.
+	 * The composition is read as it is, for the host or the user may have edited it since;
+	 * one character more than the preedit tells whether it is any longer. */
+	std::wstring shown(preedit.length() + 1, L'\0');
+	ULONG cchShown = 0;
+	if (pRangeComposition->GetText(ec, 0, &shown[0], (ULONG) shown.size(), &cchShown) != S_OK)
+		cchShown = 0;
+	size_t same = 0;
+	size_t n = min((size_t) cchShown, preedit.length());
+	while (same < n && shown[same] == preedit[same])
+		same++;
+	if (same > 0 && same < preedit.length() && IS_HIGH_SURROGATE(preedit[same - 1]))
+		same--;
+	if (same == 0)
+	{
+		if ((pRangeComposition->SetText(ec, 0, preedit.c_str(), preedit.length())) != S_OK)
+			return E_FAIL;
+	}
+	else if (same < cchShown || same < preedit.length())
+	{
+		com_ptr<ITfRange> pRangeChanged;
+		LONG cch;
+		if (pRangeComposition->Clone(&pRangeChanged) != S_OK)
+			return E_FAIL;
+		pRangeChanged->ShiftStart(ec, same, &cch, NULL);
+		if ((pRangeChanged->SetText(ec, 0, preedit.c_str() + same, preedit.length() - same)) != S_OK)
+			return E_FAIL;
+		// text appended at the end may fall outside the composition
+		_pComposition->ShiftEnd(ec, pRangeChanged);
+	}
 
 	int sel_start = 0, sel_end = 0; /* TODO: Check the availability and correctness of these values */
-	for (size_t i = 0; i < _context->preedit.attributes.size(); i++)
-		if (_context->preedit.attributes.at(i).type == weasel::HIGHLIGHTED)
+	for (size_t i = 0; i < _context.preedit.attributes.size(); i++)
+		if (_context.preedit.attributes.at(i).type == weasel::HIGHLIGHTED)
 		{
-			sel_start = _context->preedit.attributes.at(i).range.start;
-			sel_end = _context->preedit.attributes.at(i).range.end;
+			sel_start = _context.preedit.attributes.at(i).range.start;
+			sel_end = _context.preedit.attributes.at(i).range.end;
 			break;
 		}
 
 	/* Set caret */
+	com_ptr<ITfRange> pRangeCaret;
+	if ((_pComposition->GetRange(&pRangeCaret)) != S_OK)
+		return E_FAIL;
 	LONG cch;
 	TF_SELECTION tfSelection;
-	pRangeComposition->Collapse(ec, TF_ANCHOR_START);
-	pRangeComposition->ShiftEnd(ec, sel_end, &cch, NULL);
-	pRangeComposition->ShiftStart(ec, sel_start, &cch, NULL);
-	tfSelection.range = pRangeComposition;
+	pRangeCaret->Collapse(ec, TF_ANCHOR_START);
+	pRangeCaret->ShiftEnd(ec, sel_end, &cch, NULL);
+	pRangeCaret->ShiftStart(ec, sel_start, &cch, NULL);
+	tfSelection.range = pRangeCaret;
 	tfSelection.style.ase = TF_AE_NONE;
 	tfSelection.style.fInterimChar = FALSE;
 	_pContext->SetSelection(ec, 1, &tfSelection);
@@ -247,14 +302,13 @@ STDAPI CInlinePreeditEditSession::DoEditSession(TfEditCookie ec)
 	return S_OK;
 }
 
-BOOL WeaselTSF::_ShowInlinePreedit(com_ptr<ITfContext> pContext, const std::shared_ptr<weasel::Context> context)
+BOOL WeaselTSF::_ShowInlinePreedit(TfEditCookie ec, com_ptr<ITfContext> pContext, const weasel::Context& context)
 {
 	com_ptr<CInlinePreeditEditSession> pEditSession;
 	pEditSession.Attach(new CInlinePreeditEditSession(this, pContext, _pComposition, context));
 	if (pEditSession != NULL)
 	{
-		HRESULT hr;
-		pContext->RequestEditSession(_tfClientId, pEditSession, TF_ES_ASYNCDONTCARE | TF_ES_READWRITE, &hr);
+		pEditSession->DoEditSession(ec);
 	}
 	return TRUE;
 }
@@ -300,14 +354,13 @@ STDMETHODIMP CInsertTextEditSession::DoEditSession(TfEditCookie ec)
 	return hRet;
 }
 
-BOOL WeaselTSF::_InsertText(com_ptr<ITfContext> pContext, const std::wstring& text)
+BOOL WeaselTSF::_InsertText(TfEditCookie ec, com_ptr<ITfContext> pContext, const std::wstring& text)
 {
 	CInsertTextEditSession *pEditSession;
-	HRESULT hr;
 
 	if ((pEditSession = new CInsertTextEditSession(this, pContext, _pComposition, text)) != NULL)
 	{
-		pContext->RequestEditSession(_tfClientId, pEditSession, TF_ES_ASYNCDONTCARE | TF_ES_READWRITE, &hr);
+		pEditSession->DoEditSession(ec);
 		pEditSession->Release();
 	}
 
@@ -8,41 +8,46 @@ STDAPI WeaselTSF::DoEditSession(TfEditCookie ec)
 	// get commit string from server
 	std::wstring commit;
 	weasel::Config config;
-	auto context = std::make_shared<weasel::Context>();
-	weasel::ResponseParser parser(&commit, context.get(), &_status, &config, &_cand->style());
+	weasel::Context context;
+	weasel::ResponseParser parser(&commit, &context, &_status, &config, &_cand->style(), &_keyInterest);
 
 	bool ok = m_client.GetResponseData(std::ref(parser));
 
 	_UpdateLanguageBar(_status);
 
+	// the whole response is applied within this one session: some hosts are slow to grant each
 	if (ok)
 	{
+		// before a composition starts, so that it makes no window of its own when the server draws;
+		// UWP hosts keep theirs, see _GetClientCaps
+		_cand->SetServerUI(config.server_ui && !isImmersive());
 		if (!commit.empty())
 		{
 			// For auto-selecting, commit and preedit can both exist.
 			// Commit and close the original composition first.
 			if (!_IsComposing()) {
-				_StartComposition(_pEditSessionContext, _fCUASWorkaroundEnabled && !config.inline_preedit);
+				_StartComposition(ec, _pEditSessionContext, _fCUASWorkaroundEnabled && !config.inline_preedit);
 			}
-			_InsertText(_pEditSessionContext, commit);
-			_EndComposition(_pEditSessionContext, false);
+			_InsertText(ec, _pEditSessionContext, commit);
+			_EndComposition(ec, _pEditSessionContext, false);
 		}
 		if (_status.composing && !_IsComposing())
 		{
-			_StartComposition(_pEditSessionContext, _fCUASWorkaroundEnabled && !config.inline_preedit);
+			_StartComposition(ec, _pEditSessionContext, _fCUASWorkaroundEnabled && !config.inline_preedit);
 		}
 		else if (!_status.composing && _IsComposing())
 		{
-			_EndComposition(_pEditSessionContext, true);
+			_EndComposition(ec, _pEditSessionContext, true);
 		}
-		_UpdateCompositionWindow(_pEditSessionContext);
 		if (_IsComposing() && config.inline_preedit)
 		{
-			_ShowInlinePreedit(_pEditSessionContext, context);
+			_ShowInlinePreedit(ec, _pEditSessionContext, context);
 		}
+		// after the preedit, so that the caret it sets is where the candidates go
+		_UpdateCompositionWindow(ec, _pEditSessionContext);
 	}
 
-	_UpdateUI(*context, _status);
+	_UpdateUI(context, _status);
 
 	return TRUE;
 }
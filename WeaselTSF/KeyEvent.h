@@ -1,5 +1,6 @@
 #pragma once
 #include <WeaselIPC.h>
+#include <KeyTranslation.h>
 
 struct KeyInfo
 {
@@ -22,7 +23,7 @@ struct KeyInfo
 	}
 };
 
-bool ConvertKeyEvent(UINT vkey, KeyInfo kinfo, const LPBYTE keyState, weasel::KeyEvent& result);
+bool ConvertKeyEvent(UINT vkey, KeyInfo kinfo, const LPBYTE keyState, weasel::KeyEvent& result, weasel::KeyTranslationCache& cache);
 
 
 namespace ibus
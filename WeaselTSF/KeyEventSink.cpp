@@ -3,29 +3,40 @@
 #include "WeaselTSF.h"
 #include "KeyEvent.h"
 
-void WeaselTSF::_ProcessKeyEvent(WPARAM wParam, LPARAM lParam, BOOL *pfEaten)
+/* Returns whether the server was asked, and so whether the composition needs updating */
+BOOL WeaselTSF::_ProcessKeyEvent(WPARAM wParam, LPARAM lParam, BOOL *pfEaten)
 {
 	if (!_IsKeyboardOpen())
-		return;
+		return TRUE;
 
-	_EnsureServerConnected();
 	weasel::KeyEvent ke;
 	GetKeyboardState(_lpbKeyState);
-	if (!ConvertKeyEvent(wParam, lParam, _lpbKeyState, ke))
+	if (!ConvertKeyEvent(wParam, lParam, _lpbKeyState, ke, _keyTranslation))
 	{
 		/* Unknown key event */
 		*pfEaten = FALSE;
 	}
+	else if (!_keyInterest.MayEat(ke.keycode, ke.mask, _fKeyComposing != FALSE))
+	{
+		/* The schema takes no such key, as the server published */
+		*pfEaten = FALSE;
+		return FALSE;
+	}
 	else
-    {
-		*pfEaten = (BOOL) m_client.ProcessKeyEvent(ke);
-    }
+	{
+		UINT state = 0;
+		*pfEaten = (BOOL) m_client.ProcessKeyEvent(ke, &state);
+		_fKeyComposing = (state & WEASEL_KEY_COMPOSING) != 0;
+		if (state & WEASEL_KEY_RESYNC)
+			_keyInterest.Clear();
+	}
+	return TRUE;
 }
 
 STDAPI WeaselTSF::OnSetFocus(BOOL fForeground)
 {
 	if (fForeground)
-		m_client.FocusIn();
+		m_client.FocusIn(_GetClientCaps());
 	else {
 		m_client.FocusOut();
 		_AbortComposition();
@@ -51,8 +62,8 @@ STDAPI WeaselTSF::OnTestKeyDown(ITfContext *pContext, WPARAM wParam, LPARAM lPar
 		*pfEaten = TRUE;
 		return S_OK;
 	}
-	_ProcessKeyEvent(wParam, lParam, pfEaten);
-	_UpdateComposition(pContext);
+	if (_ProcessKeyEvent(wParam, lParam, pfEaten))
+		_UpdateComposition(pContext);
 	if (*pfEaten)
 		_fTestKeyDownPending = TRUE;
 	return S_OK;
@@ -68,8 +79,8 @@ STDAPI WeaselTSF::OnKeyDown(ITfContext *pContext, WPARAM wParam, LPARAM lParam,
     }
 	else
     {
-		_ProcessKeyEvent(wParam, lParam, pfEaten);
-	    _UpdateComposition(pContext);
+		if (_ProcessKeyEvent(wParam, lParam, pfEaten))
+			_UpdateComposition(pContext);
     }
 	return S_OK;
 } 
@@ -82,8 +93,8 @@ STDAPI WeaselTSF::OnTestKeyUp(ITfContext *pContext, WPARAM wParam, LPARAM lParam
 		*pfEaten = TRUE;
 		return S_OK;
 	}
-	_ProcessKeyEvent(wParam, lParam, pfEaten);
-	_UpdateComposition(pContext);
+	if (_ProcessKeyEvent(wParam, lParam, pfEaten))
+		_UpdateComposition(pContext);
 	if (*pfEaten)
 		_fTestKeyUpPending = TRUE;
 	return S_OK;
@@ -99,8 +110,8 @@ STDAPI WeaselTSF::OnKeyUp(ITfContext *pContext, WPARAM wParam, LPARAM lParam, BO
     }
 	else
     {
-		_ProcessKeyEvent(wParam, lParam, pfEaten);
-        _UpdateComposition(pContext);
+		if (_ProcessKeyEvent(wParam, lParam, pfEaten))
+			_UpdateComposition(pContext);
     }
 	return S_OK;
 }
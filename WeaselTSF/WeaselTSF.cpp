@@ -28,6 +28,7 @@ WeaselTSF::WeaselTSF()
 	_dwTextLayoutSinkCookie = TF_INVALID_COOKIE;
 	_fTestKeyDownPending = FALSE;
 	_fTestKeyUpPending = FALSE;
+	_fKeyComposing = FALSE;
 
 	_fCUASWorkaroundTested = _fCUASWorkaroundEnabled = FALSE;
 
@@ -195,10 +196,12 @@ void WeaselTSF::_EnsureServerConnected()
 		m_client.Disconnect();
 		m_client.Connect(NULL);
 		m_client.StartSession();
-		weasel::ResponseParser parser(NULL, NULL, &_status, NULL, &_cand->style());
+		weasel::ResponseParser parser(NULL, NULL, &_status, NULL, &_cand->style(), &_keyInterest);
 		bool ok = m_client.GetResponseData(std::ref(parser));
 		if (ok) {
 			_UpdateLanguageBar(_status);
 		}
+		// the new session has yet to hear who draws the candidates
+		_UpdateClientCaps();
 	}
 }
\ No newline at end of file
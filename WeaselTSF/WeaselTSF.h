@@ -3,6 +3,8 @@
 #include <WeaselCommon.h>
 #include "Globals.h"
 #include "WeaselIPC.h"
+#include <KeyInterest.h>
+#include <KeyTranslation.h>
 
 class CCandidateList;
 class CLangBarItemButton;
@@ -77,15 +79,17 @@ public:
     BOOL _IsKeyboardOpen();
     HRESULT _SetKeyboardOpen(BOOL fOpen);
 
-	/* Composition */
-	void _StartComposition(com_ptr<ITfContext> pContext, BOOL fCUASWorkaroundEnabled);
+	/* Composition; those taking an edit cookie work within that session rather than requesting their own */
+	void _StartComposition(TfEditCookie ec, com_ptr<ITfContext> pContext, BOOL fCUASWorkaroundEnabled);
 	void _EndComposition(com_ptr<ITfContext> pContext, BOOL clear);
-	BOOL _ShowInlinePreedit(com_ptr<ITfContext> pContext, const std::shared_ptr<weasel::Context> context);
+	void _EndComposition(TfEditCookie ec, com_ptr<ITfContext> pContext, BOOL clear);
+	BOOL _ShowInlinePreedit(TfEditCookie ec, com_ptr<ITfContext> pContext, const weasel::Context& context);
 	void _UpdateComposition(com_ptr<ITfContext> pContext);
 	BOOL _IsComposing();
 	void _SetComposition(com_ptr<ITfComposition> pComposition);
 	void _SetCompositionPosition(const RECT &rc);
 	BOOL _UpdateCompositionWindow(com_ptr<ITfContext> pContext);
+	BOOL _UpdateCompositionWindow(TfEditCookie ec, com_ptr<ITfContext> pContext);
 	void _FinalizeComposition();
 	void _AbortComposition(bool clear = true);
 
@@ -95,6 +99,8 @@ public:
 
 	/* IPC */
 	void _EnsureServerConnected();
+	/* Tells the server again who draws the candidates, once a composition has found out */
+	void _UpdateClientCaps();
 
 	/* UI */
 	void _UpdateUI(const weasel::Context & ctx, const weasel::Status & status);
@@ -116,7 +122,7 @@ private:
 
 	BOOL _InitKeyEventSink();
 	void _UninitKeyEventSink();
-	void _ProcessKeyEvent(WPARAM wParam, LPARAM lParam, BOOL *pfEaten);
+	BOOL _ProcessKeyEvent(WPARAM wParam, LPARAM lParam, BOOL *pfEaten);
 
 	BOOL _InitPreservedKey();
 	void _UninitPreservedKey();
@@ -127,7 +133,7 @@ private:
 	void _ShowLanguageBar(BOOL show);
 	void _EnableLanguageBar(BOOL enable);
 
-	BOOL _InsertText(com_ptr<ITfContext> pContext, const std::wstring& ext);
+	BOOL _InsertText(TfEditCookie ec, com_ptr<ITfContext> pContext, const std::wstring& ext);
 
 	void _DeleteCandidateList();
 
@@ -138,6 +144,7 @@ private:
 	bool isImmersive() const {
 		return (_activateFlags & TF_TMF_IMMERSIVEMODE) != 0;
 	}
+	DWORD _GetClientCaps();
 
 	com_ptr<ITfThreadMgr> _pThreadMgr;
 	TfClientId _tfClientId;
@@ -146,6 +153,7 @@ private:
 	com_ptr<ITfContext> _pTextEditSinkContext;
 	DWORD _dwTextEditSinkCookie, _dwTextLayoutSinkCookie;
 	BYTE _lpbKeyState[256];
+	weasel::KeyTranslationCache _keyTranslation;
 	BOOL _fTestKeyDownPending, _fTestKeyUpPending;
 
 	com_ptr<ITfContext> _pEditSessionContext;
@@ -170,4 +178,8 @@ private:
 
 	/* IME status */
 	weasel::Status _status;
+
+	/* Keys the schema may eat, and whether the last key sent left a composition */
+	weasel::KeyInterest _keyInterest;
+	BOOL _fKeyComposing;
 };
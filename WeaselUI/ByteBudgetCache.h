@@ -0,0 +1,107 @@
+#pragma once
+
+#include <stddef.h>
+#include <list>
+#include <map>
+
+namespace weasel
+{
+	struct CacheStats
+	{
+		unsigned long hits, misses, evictions;
+		size_t entries, bytes;
+	};
+
+	/*
+	 * Least recently used cache bounded by the total size of its values.
+	 *
+	 * Values own resources (bitmaps); release(value) is called when a value
+	 * is evicted, replaced or cleared. Key needs operator<.
+	 */
+	template <class Key, class Value, class Release>
+	class ByteBudgetCache
+	{
+	public:
+		explicit ByteBudgetCache(size_t budget, Release release = Release())
+			: _budget(budget), _release(release)
+		{
+			_stats.hits = _stats.misses = _stats.evictions = 0;
+			_stats.entries = _stats.bytes = 0;
+		}
+		~ByteBudgetCache() { Clear(); }
+
+		/* Returns the cached value and marks it most recently used, or NULL */
+		const Value* Find(const Key& key)
+		{
+			typename Index::iterator it = _index.find(key);
+			if (it == _index.end())
+			{
+				++_stats.misses;
+				return NULL;
+			}
+			++_stats.hits;
+			_entries.splice(_entries.begin(), _entries, it->second);
+			return &it->second->value;
+		}
+
+		/* Takes ownership of value; returns false, leaving it to the caller, if it exceeds the whole budget */
+		bool Insert(const Key& key, const Value& value, size_t bytes)
+		{
+			if (bytes > _budget)
+				return false;
+			Erase(key);
+			while (_stats.bytes + bytes > _budget && !_entries.empty())
+			{
+				_Remove(--_entries.end());
+				++_stats.evictions;
+			}
+			Entry entry = { key, value, bytes };
+			_entries.push_front(entry);
+			_index[key] = _entries.begin();
+			_stats.bytes += bytes;
+			++_stats.entries;
+			return true;
+		}
+
+		void Erase(const Key& key)
+		{
+			typename Index::iterator it = _index.find(key);
+			if (it != _index.end())
+				_Remove(it->second);
+		}
+
+		void Clear()
+		{
+			while (!_entries.empty())
+				_Remove(_entries.begin());
+		}
+
+		const CacheStats& GetStats() const { return _stats; }
+		size_t GetBudget() const { return _budget; }
+
+	private:
+		struct Entry
+		{
+			Key key;
+			Value value;
+			size_t bytes;
+		};
+		typedef std::list<Entry> Entries;
+		typedef std::map<Key, typename Entries::iterator> Index;
+
+		void _Remove(typename Entries::iterator it)
+		{
+			_release(it->value);
+			_stats.bytes -= it->bytes;
+			--_stats.entries;
+			_index.erase(it->key);
+			_entries.erase(it);
+		}
+
+		size_t _budget;
+		Release _release;
+		Entries _entries;
+		Index _index;
+		CacheStats _stats;
+	};
+};
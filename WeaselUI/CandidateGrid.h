@@ -0,0 +1,156 @@
+#pragma once
+
+#include <stddef.h>
+#include <algorithm>
+#include <vector>
+#include <WeaselCommon.h>
+#include "Framebuffer.h"
+
+namespace weasel
+{
+	/*
+	 * Label, text and comment rects of a page of candidates, one contiguous
+	 * array per part, and their arrangement by the vertical layouts: one
+	 * column, or for pages of more than rows candidates, columns of rows
+	 * candidates each, filled top to bottom. Rows line up across columns and
+	 * each column aligns its comments on its own. Arranging is two passes
+	 * over the candidates plus one over the rows and columns; the arrays only
+	 * grow, so pages of the same size lay out without allocating.
+	 */
+	class CandidateGrid
+	{
+	public:
+		enum Part { LABEL, TEXT, COMMENT, PART_COUNT };
+
+		CandidateGrid() : _count(0), _perColumn(0), _columns(0) {}
+
+		/* Starts a page of count candidates, all parts empty */
+		void Reset(size_t count)
+		{
+			_count = count;
+			for (int part = 0; part < PART_COUNT; ++part)
+			{
+				if (_rects[part].size() < count)
+					_rects[part].resize(count);
+				std::fill(_rects[part].begin(), _rects[part].begin() + count, MakeFbRect(0, 0, 0, 0));
+			}
+			_perColumn = _columns = 0;
+		}
+
+		size_t Count() const { return _count; }
+		size_t Columns() const { return _columns; }
+
+		/* Measured size of a part; a candidate without comment leaves it 0 x 0 */
+		void SetSize(size_t i, Part part, int cx, int cy) { _rects[part][i] = MakeFbRect(0, 0, cx, cy); }
+
+		const FbRect& Rect(size_t i, Part part) const { return _rects[part][i]; }
+
+		/*
+		 * Places the measured parts, the first candidate's label at (left, top).
+		 * space separates label, text and comment, candidateSpacing the rows
+		 * and columnSpacing the columns; rows 0 keeps a single column. Returns
+		 * the extent of the candidates.
+		 */
+		void Arrange(int left, int top, size_t rows, int space, int candidateSpacing, int columnSpacing,
+			UIStyle::LayoutAlignType align, int* width, int* height)
+		{
+			*width = *height = 0;
+			if (!_count)
+				return;
+			_perColumn = (rows && rows < _count) ? rows : _count;
+			_columns = (_count + _perColumn - 1) / _perColumn;
+			_Ensure(_rowTop, _perColumn);
+			_Ensure(_rowHeight, _perColumn);
+			_Ensure(_columnLeft, _columns);
+			_Ensure(_columnRight, _columns);
+			_Ensure(_candidateWidth, _columns);
+			_Ensure(_commentShift, _columns);
+			_Ensure(_commentWidth, _columns);
+			std::fill(_rowHeight.begin(), _rowHeight.begin() + _perColumn, 0);
+			std::fill(_candidateWidth.begin(), _candidateWidth.begin() + _columns, 0);
+			std::fill(_commentShift.begin(), _commentShift.begin() + _columns, 0);
+			std::fill(_commentWidth.begin(), _commentWidth.begin() + _columns, 0);
+
+			// row heights, and per column the widest label + text and where comments start
+			for (size_t i = 0; i < _count; ++i)
+			{
+				const size_t column = i / _perColumn, row = i % _perColumn;
+				const FbRect& label = _rects[LABEL][i];
+				const FbRect& text = _rects[TEXT][i];
+				const FbRect& comment = _rects[COMMENT][i];
+				int h = (std::max)((std::max)(label.bottom, text.bottom), comment.bottom);
+				_rowHeight[row] = (std::max)(_rowHeight[row], h);
+				int w = label.right + space + text.right;
+				_candidateWidth[column] = (std::max)(_candidateWidth[column], w);
+				if (comment.right || comment.bottom)
+				{
+					_commentShift[column] = (std::max)(_commentShift[column], w + space);
+					_commentWidth[column] = (std::max)(_commentWidth[column], comment.right);
+				}
+			}
+			int x = left;
+			for (size_t column = 0; column < _columns; ++column)
+			{
+				int w = (std::max)(_candidateWidth[column], _commentShift[column] + _commentWidth[column]);
+				_columnLeft[column] = x;
+				_columnRight[column] = x + w;
+				x += w + columnSpacing;
+			}
+			int y = top;
+			for (size_t row = 0; row < _perColumn; ++row)
+			{
+				_rowTop[row] = y;
+				y += _rowHeight[row] + candidateSpacing;
+			}
+			*width = _columnRight[_columns - 1] - left;
+			*height = y - candidateSpacing - top;
+
+			for (size_t i = 0; i < _count; ++i)
+			{
+				const size_t column = i / _perColumn, row = i % _perColumn;
+				const int x0 = _columnLeft[column], y0 = _rowTop[row], h = _rowHeight[row];
+				FbRect& label = _rects[LABEL][i];
+				FbRect& text = _rects[TEXT][i];
+				FbRect& comment = _rects[COMMENT][i];
+				text = _Align(text, x0 + label.right + space, y0, h, align);
+				label = _Align(label, x0, y0, h, align);
+				comment = _Align(comment, x0 + _commentShift[column], y0, h, align);
+			}
+		}
+
+		/*
+		 * Where the highlight of candidate i goes: its text's rows across its
+		 * column, the last column reaching to right, the content edge.
+		 */
+		FbRect HighlightRect(size_t i, int right) const
+		{
+			const size_t column = i / _perColumn;
+			const FbRect& text = _rects[TEXT][i];
+			return MakeFbRect(_columnLeft[column], text.top, column + 1 < _columns ? _columnRight[column] : right, text.bottom);
+		}
+
+	private:
+		static void _Ensure(std::vector<int>& v, size_t n)
+		{
+			if (v.size() < n)
+				v.resize(n);
+		}
+
+		// a measured rect at (x, y), moved down within a row of height h
+		static FbRect _Align(FbRect const& size, int x, int y, int h, UIStyle::LayoutAlignType align)
+		{
+			int offset = 0;
+			if (align == UIStyle::ALIGN_CENTER)
+				offset = (h - size.bottom) / 2;
+			else if (align == UIStyle::ALIGN_BOTTOM)
+				offset = h - size.bottom;
+			return MakeFbRect(x, y + offset, x + size.right, y + offset + size.bottom);
+		}
+
+		std::vector<FbRect> _rects[PART_COUNT];
+		size_t _count, _perColumn, _columns;
+		std::vector<int> _rowTop, _rowHeight;
+		std::vector<int> _columnLeft, _columnRight;
+		std::vector<int> _candidateWidth, _commentShift, _commentWidth;
+	};
+};
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "EmojiTable.h"
+
+namespace weasel
+{
+	/* Emoji properties of a code point, the bits in EmojiTable.h (see gen_emoji_table.py) */
+	enum EmojiProperty
+	{
+		EMOJI_PICTOGRAPHIC = 1,			// Extended_Pictographic
+		EMOJI_ZWJ = 2,					// U+200D
+		EMOJI_VARIATION_SELECTOR = 4,	// U+FE00..U+FE0F
+		EMOJI_MODIFIER = 8,				// skin tones U+1F3FB..U+1F3FF
+		EMOJI_REGIONAL_INDICATOR = 16,	// flag letters U+1F1E6..U+1F1FF
+		EMOJI_TAG = 32,					// U+E0020..U+E007F, subdivision flags
+		EMOJI_KEYCAP = 64				// U+20E3
+	};
+
+	inline unsigned int GetEmojiProperty(unsigned int cp)
+	{
+		if (cp < EMOJI_TABLE_LIMIT)
+		{
+			unsigned int block = kEmojiStage1[cp >> EMOJI_TABLE_BLOCK_SHIFT];
+			return kEmojiStage2[(block << EMOJI_TABLE_BLOCK_SHIFT) | (cp & ((1 << EMOJI_TABLE_BLOCK_SHIFT) - 1))];
+		}
+		return (cp >= 0xE0020 && cp <= 0xE007F) ? EMOJI_TAG : 0;
+	}
+
+	/* A run of UTF-16 code units, all emoji or all other text */
+	struct EmojiRun
+	{
+		unsigned int start;
+		unsigned int length;
+		bool emoji;
+	};
+
+	/* Decodes the code point at text[i], setting its length in code units; lone surrogates decode as themselves */
+	inline unsigned int DecodeUtf16(const wchar_t* text, size_t length, size_t i, size_t* units)
+	{
+		unsigned int w1 = (unsigned int)text[i] & 0xFFFF;
+		if (w1 >= 0xD800 && w1 < 0xDC00 && i + 1 < length)
+		{
+			unsigned int w2 = (unsigned int)text[i + 1] & 0xFFFF;
+			if (w2 >= 0xDC00 && w2 <= 0xDFFF)
+			{
+				*units = 2;
+				return 0x10000 + ((w1 - 0xD800) << 10) + (w2 - 0xDC00);
+			}
+		}
+		*units = 1;
+		return w1;
+	}
+
+	/*
+	 * Splits UTF-16 text into alternating emoji and non-emoji runs in one pass.
+	 *
+	 * An emoji run starts at an Extended_Pictographic or regional indicator
+	 * character, or at a keycap base (0-9 # *) followed by U+20E3, and goes on
+	 * through joiners, variation selectors, skin tones, tags and keycaps.
+	 * Those combining characters outside an emoji run are plain text.
+	 * emit(const EmojiRun&) is called for each run in order.
+	 */
+	template <class Emit>
+	void SegmentEmoji(const wchar_t* text, size_t length, Emit emit)
+	{
+		const unsigned int EXTENDERS = EMOJI_ZWJ | EMOJI_VARIATION_SELECTOR | EMOJI_MODIFIER | EMOJI_TAG | EMOJI_KEYCAP;
+		size_t start = 0, i = 0;
+		bool inEmoji = false;
+		while (i < length)
+		{
+			size_t units;
+			unsigned int cp = DecodeUtf16(text, length, i, &units);
+			unsigned int prop = GetEmojiProperty(cp);
+			bool emoji;
+			if (prop & (EMOJI_PICTOGRAPHIC | EMOJI_REGIONAL_INDICATOR))
+				emoji = true;
+			else if (prop & EXTENDERS)
+				emoji = inEmoji;
+			else if ((cp >= '0' && cp <= '9') || cp == '#' || cp == '*')
+			{
+				// keycap sequence: base, optional U+FE0F, U+20E3
+				size_t next = i + 1;
+				if (next < length && (unsigned int)text[next] == 0xFE0F)
+					++next;
+				emoji = next < length && (unsigned int)text[next] == 0x20E3;
+			}
+			else
+				emoji = false;
+
+			if (emoji != inEmoji && i > start)
+			{
+				EmojiRun run = { (unsigned int)start, (unsigned int)(i - start), inEmoji };
+				emit(run);
+				start = i;
+			}
+			inEmoji = emoji;
+			i += units;
+		}
+		if (length > start)
+		{
+			EmojiRun run = { (unsigned int)start, (unsigned int)(length - start), inEmoji };
+			emit(run);
+		}
+	}
+
+	inline void SegmentEmoji(const std::wstring& text, std::vector<EmojiRun>* runs)
+	{
+		runs->clear();
+		SegmentEmoji(text.c_str(), text.length(), [runs](const EmojiRun& run) { runs->push_back(run); });
+	}
+};
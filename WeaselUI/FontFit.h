@@ -0,0 +1,196 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+namespace weasel
+{
+	/* Pixel extent of laid out content */
+	struct FitExtent
+	{
+		int cx, cy;
+	};
+
+	/* Coarse shape of the content being fitted into a work area. */
+	/* Typing within the same shape reuses the memoized font point. */
+	struct FontFitKey
+	{
+		int work_width, work_height;
+		int candidate_count;
+		int text_bucket;	// bit length of the total text length
+
+		static int Bucket(size_t length)
+		{
+			int bucket = 0;
+			while (length) { ++bucket; length >>= 1; }
+			return bucket;
+		}
+
+		bool operator==(const FontFitKey& other) const
+		{
+			return work_width == other.work_width && work_height == other.work_height &&
+				candidate_count == other.candidate_count && text_bucket == other.text_bucket;
+		}
+	};
+
+	/*
+	 * Finds the largest font point at which the content fits the work area.
+	 *
+	 * Content size is modeled per axis as `margin + slope * point`. The first
+	 * measurement predicts a proportional scale, the second one resolves the
+	 * margins, so a miss usually costs three layout passes. A memoized point
+	 * that still fits costs a single pass.
+	 */
+	class FontFitter
+	{
+	public:
+		enum { MEMO_SIZE = 8, MAX_CORRECTIONS = 4 };
+
+		FontFitter(int minPoint = 4, int maxPoint = 2048)
+			: _minPoint(minPoint), _maxPoint(maxPoint), _memoNext(0), _memoCount(0), _measureCount(0), _hitCount(0) {}
+
+		/* measure(point) lays the content out at `point` and returns its extent. */
+		/* On return the content has been laid out at the returned point. */
+		template <class Measure>
+		int Fit(const FontFitKey& key, int startPoint, Measure measure)
+		{
+			const int width = key.work_width, height = key.work_height;
+			int point = _Clamp(startPoint);
+			for (int i = 0; i < _memoCount; ++i)
+			{
+				if (_memo[i].key == key)
+				{
+					point = _memo[i].point;
+					FitExtent sz = _Measure(measure, point);
+					if (_Fits(sz, width, height))
+					{
+						++_hitCount;
+						return point;
+					}
+					return _Refit(key, point, sz, measure);
+				}
+			}
+			return _Refit(key, point, _Measure(measure, point), measure);
+		}
+
+		void Clear() { _memoCount = 0; _memoNext = 0; }
+		/* number of layout passes requested so far */
+		unsigned long MeasureCount() const { return _measureCount; }
+		/* number of fits answered by a memoized point in a single pass */
+		unsigned long HitCount() const { return _hitCount; }
+
+	private:
+		struct MemoEntry
+		{
+			FontFitKey key;
+			int point;
+		};
+
+		template <class Measure>
+		int _Refit(const FontFitKey& key, int p0, FitExtent s0, Measure measure)
+		{
+			const int width = key.work_width, height = key.work_height;
+
+			// proportional guess
+			int p1 = _Clamp(_Predict(p0, s0, width, height));
+			FitExtent s1 = s0;
+			if (p1 != p0)
+				s1 = _Measure(measure, p1);
+
+			// solve margin and slope from the two samples
+			int point = p1;
+			FitExtent sz = s1;
+			if (p1 != p0)
+			{
+				int p2 = _Clamp((std::min)(_Solve(p0, s0.cx, p1, s1.cx, width, p1),
+					_Solve(p0, s0.cy, p1, s1.cy, height, p1)));
+				if (p2 != p1)
+				{
+					point = p2;
+					sz = _Measure(measure, p2);
+				}
+			}
+
+			// rounding and hinting may still overshoot by a pixel or two
+			for (int i = 0; i < MAX_CORRECTIONS && !_Fits(sz, width, height) && point > _minPoint; ++i)
+			{
+				int next = _Clamp((std::min)(point - 1, _Predict(point, sz, width, height)));
+				point = next;
+				sz = _Measure(measure, point);
+			}
+			while (!_Fits(sz, width, height) && point > _minPoint)
+			{
+				point = _Clamp(point / 2);
+				sz = _Measure(measure, point);
+			}
+
+			_Remember(key, point);
+			return point;
+		}
+
+		template <class Measure>
+		FitExtent _Measure(Measure& measure, int point)
+		{
+			++_measureCount;
+			return measure(point);
+		}
+
+		static bool _Fits(const FitExtent& sz, int width, int height)
+		{
+			return sz.cx <= width && sz.cy <= height;
+		}
+
+		static int _Predict(int point, const FitExtent& sz, int width, int height)
+		{
+			double scale = (std::min)(sz.cx > 0 ? (double)width / sz.cx : 1.0, sz.cy > 0 ? (double)height / sz.cy : 1.0);
+			return _ToPoint(point * scale);
+		}
+
+		static int _Solve(int p0, int s0, int p1, int s1, int bound, int fallback)
+		{
+			if (s1 == s0)
+				return s1 <= bound ? INT_MAX_POINT : fallback;
+			double slope = (double)(s1 - s0) / (p1 - p0);
+			if (slope <= 0)
+				return fallback;
+			double margin = s0 - slope * p0;
+			return _ToPoint((bound - margin) / slope);
+		}
+
+		static int _ToPoint(double point)
+		{
+			if (point >= INT_MAX_POINT)
+				return INT_MAX_POINT;
+			return (int)std::floor(point);
+		}
+
+		int _Clamp(int point) const
+		{
+			return (std::max)(_minPoint, (std::min)(_maxPoint, point));
+		}
+
+		void _Remember(const FontFitKey& key, int point)
+		{
+			for (int i = 0; i < _memoCount; ++i)
+			{
+				if (_memo[i].key == key)
+				{
+					_memo[i].point = point;
+					return;
+				}
+			}
+			_memo[_memoNext].key = key;
+			_memo[_memoNext].point = point;
+			_memoNext = (_memoNext + 1) % MEMO_SIZE;
+			if (_memoCount < MEMO_SIZE) ++_memoCount;
+		}
+
+		static const int INT_MAX_POINT = 0x7fffffff;
+
+		int _minPoint, _maxPoint;
+		MemoEntry _memo[MEMO_SIZE];
+		int _memoNext, _memoCount;
+		unsigned long _measureCount;
+		unsigned long _hitCount;
+	};
+};
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+#include "Rasterizer.h"
+#include "GaussBlur.h"
+
+namespace weasel
+{
+	/* Pixel rect, right and bottom exclusive, as CRect */
+	struct FbRect
+	{
+		int left, top, right, bottom;
+
+		int Width() const { return right - left; }
+		int Height() const { return bottom - top; }
+		bool IsEmpty() const { return right <= left || bottom <= top; }
+		FbRect Offset(int dx, int dy) const { FbRect rc = { left + dx, top + dy, right + dx, bottom + dy }; return rc; }
+		FbRect Inflate(int dx, int dy) const { FbRect rc = { left - dx, top - dy, right + dx, bottom + dy }; return rc; }
+	};
+
+	inline FbRect MakeFbRect(int left, int top, int right, int bottom)
+	{
+		FbRect rc = { left, top, right, bottom };
+		return rc;
+	}
+
+	/* UIStyle color (0xAABBGGRR) to premultiplied 0xAARRGGBB, the BGRA byte order of a 32bpp DIB */
+	inline uint32_t PremultiplyStyleColor(int color)
+	{
+		unsigned int a = ((unsigned int)color >> 24) & 0xFF;
+		unsigned int r = color & 0xFF, g = (color >> 8) & 0xFF, b = (color >> 16) & 0xFF;
+		return (a << 24) | (Div255(r * a) << 16) | (Div255(g * a) << 8) | Div255(b * a);
+	}
+
+	/*
+	 * Premultiplied 32bpp framebuffer with the drawing WeaselPanel does:
+	 * anti-aliased round rects, borders, source-over blending and the gauss
+	 * blur used for shadows. Runs without a desktop, for tests and benchmarks.
+	 */
+	class Framebuffer
+	{
+	public:
+		Framebuffer() : _width(0), _height(0) {}
+		Framebuffer(int width, int height)
+			: _width((std::max)(width, 0)), _height((std::max)(height, 0)), _pixels((size_t)_width * _height) {}
+
+		int Width() const { return _width; }
+		int Height() const { return _height; }
+		uint32_t* Pixels() { return _pixels.empty() ? NULL : &_pixels[0]; }
+		const uint32_t* Pixels() const { return _pixels.empty() ? NULL : &_pixels[0]; }
+		uint32_t GetPixel(int x, int y) const { return _pixels[(size_t)y * _width + x]; }
+
+		void Clear(uint32_t color = 0) { std::fill(_pixels.begin(), _pixels.end(), color); }
+
+		/* The pixels as a drawing target, clipped to the buffer */
+		PixelTarget Target()
+		{
+			return MakePixelTarget(Pixels(), _width, 0, 0, _width, _height);
+		}
+
+		/* Source over, with the premultiplied color scaled by coverage (0..255) */
+		void Blend(int x, int y, uint32_t color, unsigned int coverage)
+		{
+			BlendPixel(&_pixels[(size_t)y * _width + x], color, coverage);
+		}
+
+		void FillRect(FbRect rc, uint32_t color)
+		{
+			rc = _Clip(rc);
+			for (int y = rc.top; y < rc.bottom && rc.left < rc.right; ++y)
+				BlendSpan(&_pixels[(size_t)y * _width + rc.left], rc.right - rc.left, color);
+		}
+
+		void FillRoundRect(FbRect const& rc, int radius, uint32_t color)
+		{
+			weasel::FillRoundRect(Target(), rc.left, rc.top, rc.right, rc.bottom, radius, color);
+		}
+
+		void StrokeRoundRect(FbRect const& rc, int radius, int width, uint32_t color)
+		{
+			weasel::StrokeRoundRect(Target(), rc.left, rc.top, rc.right, rc.bottom, radius, width, color);
+		}
+
+		/* Composites src over this buffer with its top left corner at (x, y) */
+		void Draw(const Framebuffer& src, int x, int y)
+		{
+			if (!src._pixels.empty())
+				BlendImage(Target(), x, y, src.Pixels(), src._width, src._height, src._width);
+		}
+
+		/* The box approximated gauss blur of DoGaussianBlur, radius clamped to half the size */
+		void Blur(float radiusX, float radiusY)
+		{
+			if (_pixels.empty() || (radiusX == 0.0f && radiusY == 0.0f))
+				return;
+			radiusX = (std::min)(radiusX, (float)(_width / 2));
+			radiusY = (std::min)(radiusY, (float)(_height / 2));
+			std::vector<uint32_t> temp(_pixels.size());
+			// like DoGaussianBlur, keep what gaussBlur_4 leaves in its source
+			gaussBlur_4((unsigned char*)&_pixels[0], (unsigned char*)&temp[0], _width, _height, radiusX, radiusY, 4, _width * 4);
+		}
+
+	private:
+		FbRect _Clip(FbRect rc) const
+		{
+			rc.left = (std::max)(rc.left, 0);
+			rc.top = (std::max)(rc.top, 0);
+			rc.right = (std::min)(rc.right, _width);
+			rc.bottom = (std::min)(rc.bottom, _height);
+			return rc;
+		}
+
+		int _width, _height;
+		std::vector<uint32_t> _pixels;
+	};
+};
@@ -3,220 +3,144 @@
 
 using namespace weasel;
 
-FullScreenLayout::FullScreenLayout(const UIStyle &style, const Context &context, const Status &status, const CRect& inputPos, Layout* layout)
-	: StandardLayout(style, context, status), mr_inputPos(inputPos), m_layout(layout)
+FullScreenLayout::FullScreenLayout(const UIStyle &style, const Context &context, const Status &status, int statusIconSize, const CRect& workArea, Layout* layout)
+	: StandardLayout(style, context, status, statusIconSize, LayoutEngine::DirectionOf(style)), m_workArea(workArea), m_layout(layout)
 {
 }
 
 FullScreenLayout::~FullScreenLayout()
 {
-	delete m_layout;
+}
+
+void FullScreenLayout::Reset(int statusIconSize)
+{
+	StandardLayout::Reset(statusIconSize);
+	m_layout->Reset(statusIconSize);
+	m_offset.SetSize(0, 0);
+}
+
+void FullScreenLayout::Assign(const Layout& other)
+{
+	const FullScreenLayout& layout = static_cast<const FullScreenLayout&>(other);
+	StandardLayout::Assign(other);
+	m_layout->Assign(*layout.m_layout);
+	m_workArea = layout.m_workArea;
+	m_offset = layout.m_offset;
 }
 
 void FullScreenLayout::DoLayout(CDCHandle dc, GDIFonts* pFonts)
 {
 	if (_context.empty())
 	{
-		int width = 0, height = 0;
-		UpdateStatusIconLayout(&width, &height);
-		_contentSize.SetSize(width, height);
+		_rects.width = _rects.height = 0;
+		_engine.PlaceStatusIcon(_statusIconSize, &_rects);
 		return;
 	}
 
-	CRect workArea;
-	HMONITOR hMonitor = MonitorFromRect(mr_inputPos, MONITOR_DEFAULTTONEAREST);
-	if (hMonitor)
-	{
-		MONITORINFO info;
-		info.cbSize = sizeof(MONITORINFO);
-		if (GetMonitorInfo(hMonitor, &info))
-		{
-			workArea = info.rcWork;
-		}
-	}
-
-	int fontPoint = _style.font_point;
-	int step = 32;
-	do {
+	m_fontFitter.Fit(GetFitKey(m_workArea), pFonts->_TextFontPoint, [&](int point) {
+		pFonts->_LabelFontPoint = ScaleFontPoint(_style.label_font_point, point);
+		pFonts->_TextFontPoint = point;
+		pFonts->_CommentFontPoint = ScaleFontPoint(_style.comment_font_point, point);
 		m_layout->DoLayout(dc, pFonts);
-	}
-	while (AdjustFontPoint(dc, workArea, pFonts, step));
-
-	if (fontPoint < 4) fontPoint = 4;
-	else if (fontPoint > 2048) fontPoint = 2048;
-	const_cast<UIStyle*>(&_style)->font_point = fontPoint;
+		CSize sz = m_layout->GetContentSize();
+		FitExtent extent = { sz.cx, sz.cy };
+		return extent;
+	});
 
-	int offsetX = (workArea.Width() - m_layout->GetContentSize().cx) / 2;
-	int offsetY = (workArea.Height() - m_layout->GetContentSize().cy) / 2;
-	_preeditRect = m_layout->GetPreeditRect();
-	_preeditRect.OffsetRect(offsetX, offsetY);
-	_auxiliaryRect = m_layout->GetAuxiliaryRect();
-	_auxiliaryRect.OffsetRect(offsetX, offsetY);
-	_highlightRect = m_layout->GetHighlightRect();
-	_highlightRect.OffsetRect(offsetX, offsetY);
-	for (int i = 0, n = (int)_context.cinfo.candies.size(); i < n && i < MAX_CANDIDATES_COUNT; ++i)
-	{
-		_candidateLabelRects[i] = m_layout->GetCandidateLabelRect(i);
-		_candidateLabelRects[i].OffsetRect(offsetX, offsetY);
-		_candidateTextRects[i] = m_layout->GetCandidateTextRect(i);
-		_candidateTextRects[i].OffsetRect(offsetX, offsetY);
-		_candidateCommentRects[i] = m_layout->GetCandidateCommentRect(i);
-		_candidateCommentRects[i].OffsetRect(offsetX, offsetY);
-	}
-	_statusIconRect = m_layout->GetStatusIconRect();
-	_statusIconRect.OffsetRect(offsetX, offsetY);
-
-	_contentSize.SetSize(workArea.Width(), workArea.Height());
+	CenterInWorkArea(m_workArea);
 }
 
 void weasel::FullScreenLayout::DoLayout(CDCHandle dc, DirectWriteResources* pDWR)
 {
 	if (_context.empty())
 	{
-		int width = 0, height = 0;
-		UpdateStatusIconLayout(&width, &height);
-		_contentSize.SetSize(width, height);
+		_rects.width = _rects.height = 0;
+		_engine.PlaceStatusIcon(_statusIconSize, &_rects);
 		return;
 	}
 
-	CRect workArea;
-	HMONITOR hMonitor = MonitorFromRect(mr_inputPos, MONITOR_DEFAULTTONEAREST);
-	if (hMonitor)
-	{
-		MONITORINFO info;
-		info.cbSize = sizeof(MONITORINFO);
-		if (GetMonitorInfo(hMonitor, &info))
-		{
-			workArea = info.rcWork;
-		}
-	}
-
-	int fontPoint = _style.font_point;
-	int step = 32;
-	do {
+	int startPoint = _style.font_point;
+	if (pDWR->pTextFormat && pDWR->dpiScaleX_ > 0)
+		startPoint = (int)(pDWR->pTextFormat->GetFontSize() / pDWR->dpiScaleX_ + 0.5f);
+	m_fontFitter.Fit(GetFitKey(m_workArea), startPoint, [&](int point) {
+		SetFontPoint(pDWR, point);
 		m_layout->DoLayout(dc, pDWR);
-	}
-	while (AdjustFontPoint(dc, workArea, pDWR, step));
+		CSize sz = m_layout->GetContentSize();
+		FitExtent extent = { sz.cx, sz.cy };
+		return extent;
+	});
 
-	if (fontPoint < 4) fontPoint = 4;
-	else if (fontPoint > 2048) fontPoint = 2048;
-	const_cast<UIStyle*>(&_style)->font_point = fontPoint;
+	CenterInWorkArea(m_workArea);
+}
 
-	int offsetX = (workArea.Width() - m_layout->GetContentSize().cx) / 2;
-	int offsetY = (workArea.Height() - m_layout->GetContentSize().cy) / 2;
-	_preeditRect = m_layout->GetPreeditRect();
-	_preeditRect.OffsetRect(offsetX, offsetY);
-	_auxiliaryRect = m_layout->GetAuxiliaryRect();
-	_auxiliaryRect.OffsetRect(offsetX, offsetY);
-	_highlightRect = m_layout->GetHighlightRect();
-	_highlightRect.OffsetRect(offsetX, offsetY);
-	for (int i = 0, n = (int)_context.cinfo.candies.size(); i < n && i < MAX_CANDIDATES_COUNT; ++i)
-	{
-		_candidateLabelRects[i] = m_layout->GetCandidateLabelRect(i);
-		_candidateLabelRects[i].OffsetRect(offsetX, offsetY);
-		_candidateTextRects[i] = m_layout->GetCandidateTextRect(i);
-		_candidateTextRects[i].OffsetRect(offsetX, offsetY);
-		_candidateCommentRects[i] = m_layout->GetCandidateCommentRect(i);
-		_candidateCommentRects[i].OffsetRect(offsetX, offsetY);
-	}
-	_statusIconRect = m_layout->GetStatusIconRect();
-	_statusIconRect.OffsetRect(offsetX, offsetY);
+FontFitKey FullScreenLayout::GetFitKey(const CRect& workArea) const
+{
+	const CandidateInfo& cinfo = _context.cinfo;
+	size_t length = _context.preedit.str.length() + _context.aux.str.length();
+	for (size_t i = 0; i < cinfo.candies.size(); ++i)
+		length += cinfo.candies[i].str.length();
+	for (size_t i = 0; i < cinfo.comments.size(); ++i)
+		length += cinfo.comments[i].str.length();
+
+	FontFitKey key;
+	key.work_width = workArea.Width();
+	key.work_height = workArea.Height();
+	key.candidate_count = (int)cinfo.candies.size();
+	key.text_bucket = FontFitKey::Bucket(length);
+	return key;
+}
 
-	_contentSize.SetSize(workArea.Width(), workArea.Height());
+int FullScreenLayout::ScaleFontPoint(int basePoint, int textPoint) const
+{
+	// label and comment fonts keep their configured ratio to the text font
+	if (_style.font_point <= 0)
+		return textPoint;
+	return max(1, MulDiv(basePoint, textPoint, _style.font_point));
 }
 
-bool FullScreenLayout::AdjustFontPoint(CDCHandle dc, const CRect& workArea, DirectWriteResources* pDWR, int& step)
+void FullScreenLayout::SetFontPoint(DirectWriteResources* pDWR, int textPoint) const
 {
-	if (_context.empty() || step == 0)
-		return false;
-	int fontPointLabel		= pDWR->pLabelTextFormat->GetFontSize();
-	int fontPoint			= pDWR->pTextFormat->GetFontSize();
-	int fontPointComment	= pDWR->pCommentTextFormat->GetFontSize();
-	CSize sz = m_layout->GetContentSize();
-	if (sz.cx > workArea.Width() || sz.cy > workArea.Height())
-	{
-		if (step > 0)
-		{
-			step = - (step >> 1);
-		}
-		fontPoint += step* pDWR->dpiScaleX_;
-		fontPointLabel += step* pDWR->dpiScaleX_;
-		fontPointComment += step* pDWR->dpiScaleX_;
-		pDWR->pDWFactory->CreateTextFormat(_style.font_face.c_str(), NULL, DWRITE_FONT_WEIGHT_NORMAL, DWRITE_FONT_STYLE_NORMAL, DWRITE_FONT_STRETCH_NORMAL, 
-				fontPoint, L"", &pDWR->pTextFormat);
-		pDWR->pDWFactory->CreateTextFormat(_style.label_font_face.c_str(), NULL, DWRITE_FONT_WEIGHT_NORMAL, DWRITE_FONT_STYLE_NORMAL, DWRITE_FONT_STRETCH_NORMAL, 
-				fontPointLabel, L"", &pDWR->pLabelTextFormat);
-		pDWR->pDWFactory->CreateTextFormat(_style.comment_font_face.c_str(), NULL, DWRITE_FONT_WEIGHT_NORMAL, DWRITE_FONT_STYLE_NORMAL, DWRITE_FONT_STRETCH_NORMAL, 
-				fontPointComment, L"", &pDWR->pCommentTextFormat);
-		pDWR->pTextFormat->SetTextAlignment(DWRITE_TEXT_ALIGNMENT_LEADING);
-		pDWR->pTextFormat->SetParagraphAlignment(DWRITE_PARAGRAPH_ALIGNMENT_CENTER);
-		pDWR->pTextFormat->SetWordWrapping(DWRITE_WORD_WRAPPING_NO_WRAP);
-		pDWR->pLabelTextFormat->SetTextAlignment(DWRITE_TEXT_ALIGNMENT_LEADING);
-		pDWR->pLabelTextFormat->SetParagraphAlignment(DWRITE_PARAGRAPH_ALIGNMENT_CENTER);
-		pDWR->pLabelTextFormat->SetWordWrapping(DWRITE_WORD_WRAPPING_NO_WRAP);
-		pDWR->pCommentTextFormat->SetTextAlignment(DWRITE_TEXT_ALIGNMENT_LEADING);
-		pDWR->pCommentTextFormat->SetParagraphAlignment(DWRITE_PARAGRAPH_ALIGNMENT_CENTER);
-		pDWR->pCommentTextFormat->SetWordWrapping(DWRITE_WORD_WRAPPING_NO_WRAP);
-		return true;
-	}
-	else if (sz.cx <= workArea.Width() * 31 / 32 && sz.cy <= workArea.Height() * 31 / 32)
+	if (pDWR->pTextFormat && pDWR->dpiScaleX_ > 0 &&
+		(int)(pDWR->pTextFormat->GetFontSize() / pDWR->dpiScaleX_ + 0.5f) == textPoint)
+		return;
+	SafeRelease(&pDWR->pTextFormat);
+	SafeRelease(&pDWR->pLabelTextFormat);
+	SafeRelease(&pDWR->pCommentTextFormat);
+	pDWR->InitResources(_style.label_font_face, ScaleFontPoint(_style.label_font_point, textPoint),
+		_style.font_face, textPoint,
+		_style.comment_font_face, ScaleFontPoint(_style.comment_font_point, textPoint));
+}
+
+void FullScreenLayout::CenterInWorkArea(const CRect& workArea)
+{
+	int offsetX = (workArea.Width() - m_layout->GetContentSize().cx) / 2;
+	int offsetY = (workArea.Height() - m_layout->GetContentSize().cy) / 2;
+	m_offset.SetSize(offsetX, offsetY);
+	_rects.preedit = ToFbRect(m_layout->GetPreeditRect()).Offset(offsetX, offsetY);
+	_rects.aux = ToFbRect(m_layout->GetAuxiliaryRect()).Offset(offsetX, offsetY);
+	_rects.highlight = ToFbRect(m_layout->GetHighlightRect()).Offset(offsetX, offsetY);
+	for (int i = 0, n = (int)m_layout->GetCandidateCount(); i < n && i < (int)GetCandidateCount(); ++i)
 	{
-		if (step < 0)
-		{
-			step = -step >> 1;
-		}
-		fontPoint += step* pDWR->dpiScaleX_;
-		fontPointLabel += step* pDWR->dpiScaleX_;
-		fontPointComment += step* pDWR->dpiScaleX_;
-		pDWR->pDWFactory->CreateTextFormat(_style.font_face.c_str(), NULL, DWRITE_FONT_WEIGHT_NORMAL, DWRITE_FONT_STYLE_NORMAL, DWRITE_FONT_STRETCH_NORMAL, 
-				fontPoint, L"", &pDWR->pTextFormat);
-		pDWR->pDWFactory->CreateTextFormat(_style.label_font_face.c_str(), NULL, DWRITE_FONT_WEIGHT_NORMAL, DWRITE_FONT_STYLE_NORMAL, DWRITE_FONT_STRETCH_NORMAL, 
-				fontPointLabel, L"", &pDWR->pLabelTextFormat);
-		pDWR->pDWFactory->CreateTextFormat(_style.comment_font_face.c_str(), NULL, DWRITE_FONT_WEIGHT_NORMAL, DWRITE_FONT_STYLE_NORMAL, DWRITE_FONT_STRETCH_NORMAL, 
-				fontPointComment, L"", &pDWR->pCommentTextFormat);
-		pDWR->pTextFormat->SetTextAlignment(DWRITE_TEXT_ALIGNMENT_LEADING);
-		pDWR->pTextFormat->SetParagraphAlignment(DWRITE_PARAGRAPH_ALIGNMENT_CENTER);
-		pDWR->pTextFormat->SetWordWrapping(DWRITE_WORD_WRAPPING_NO_WRAP);
-		pDWR->pLabelTextFormat->SetTextAlignment(DWRITE_TEXT_ALIGNMENT_LEADING);
-		pDWR->pLabelTextFormat->SetParagraphAlignment(DWRITE_PARAGRAPH_ALIGNMENT_CENTER);
-		pDWR->pLabelTextFormat->SetWordWrapping(DWRITE_WORD_WRAPPING_NO_WRAP);
-		pDWR->pCommentTextFormat->SetTextAlignment(DWRITE_TEXT_ALIGNMENT_LEADING);
-		pDWR->pCommentTextFormat->SetParagraphAlignment(DWRITE_PARAGRAPH_ALIGNMENT_CENTER);
-		pDWR->pCommentTextFormat->SetWordWrapping(DWRITE_WORD_WRAPPING_NO_WRAP);
-		return true;
+		_rects.labels[i] = ToFbRect(m_layout->GetCandidateLabelRect(i)).Offset(offsetX, offsetY);
+		_rects.texts[i] = ToFbRect(m_layout->GetCandidateTextRect(i)).Offset(offsetX, offsetY);
+		_rects.comments[i] = ToFbRect(m_layout->GetCandidateCommentRect(i)).Offset(offsetX, offsetY);
 	}
+	_rects.statusIcon = ToFbRect(m_layout->GetStatusIconRect()).Offset(offsetX, offsetY);
 
-	return false;
+	_rects.width = workArea.Width();
+	_rects.height = workArea.Height();
 }
 
-bool weasel::FullScreenLayout::AdjustFontPoint(CDCHandle dc, const CRect& workArea, GDIFonts* pFonts, int& step)
+CRect FullScreenLayout::GetCandidateBackRect(int id) const
 {
-	if (_context.empty() || step == 0)
-		return false;
-
-	CSize sz = m_layout->GetContentSize();
-	if (sz.cx > workArea.Width() || sz.cy > workArea.Height())
-	{
-		if (step > 0)
-		{
-			step = - (step >> 1);
-		}
-		pFonts->_LabelFontPoint += step;
-		pFonts->_TextFontPoint += step;
-		pFonts->_CommentFontPoint += step;
-		return true;
-	}
-	else if (sz.cx <= workArea.Width() * 31 / 32 && sz.cy <= workArea.Height() * 31 / 32)
-	{
-		if (step < 0)
-		{
-			step = -step >> 1;
-		}
-		pFonts->_LabelFontPoint += step;
-		pFonts->_TextFontPoint += step;
-		pFonts->_CommentFontPoint += step;
-		return true;
-	}
+	CRect rc = m_layout->GetCandidateBackRect(id);
+	if (!rc.IsRectNull())
+		rc.OffsetRect(m_offset);
+	return rc;
+}
 
-	return false;
+void FullScreenLayout::UpdateHighlightRect()
+{
+	m_layout->UpdateHighlightRect();
+	_rects.highlight = ToFbRect(m_layout->GetHighlightRect()).Offset(m_offset.cx, m_offset.cy);
 }
@@ -1,23 +1,38 @@
 #pragma once
 
 #include "StandardLayout.h"
+#include "FontFit.h"
 
 namespace weasel
 {
 	class FullScreenLayout: public StandardLayout
 	{
 	public:
-		FullScreenLayout(const UIStyle &style, const Context &context, const Status &status, const CRect& inputPos, Layout* layout);
+		/* layout is fitted into the work area; the panel owns it, and it outlives this one */
+		FullScreenLayout(const UIStyle &style, const Context &context, const Status &status, int statusIconSize, const CRect& workArea, Layout* layout);
 		virtual ~FullScreenLayout();
 
 		virtual void DoLayout(CDCHandle dc, GDIFonts* pFonts = 0);
 		virtual void DoLayout(CDCHandle dc, DirectWriteResources* pDWR);
+		virtual void UpdateHighlightRect();
+		virtual void Reset(int statusIconSize);
+		virtual void Assign(const Layout& other);
+		virtual CRect GetCandidateBackRect(int id) const;
+
+		void SetWorkArea(const CRect& workArea) { m_workArea = workArea; }
 
 	private:
-		bool AdjustFontPoint(CDCHandle dc, const CRect& workArea, DirectWriteResources* pDWR, int& step);
-		bool AdjustFontPoint(CDCHandle dc, const CRect& workArea, GDIFonts* pFonts, int& step);
+		FontFitKey GetFitKey(const CRect& workArea) const;
+		int ScaleFontPoint(int basePoint, int textPoint) const;
+		void SetFontPoint(DirectWriteResources* pDWR, int textPoint) const;
+		void CenterInWorkArea(const CRect& workArea);
 
-		const CRect& mr_inputPos;
+		// of the monitor at the input position, as the panel last found it
+		CRect m_workArea;
 		Layout* m_layout;
+		CSize m_offset;
+
+		/* the panel keeps its layout across refreshes, and with it what was fitted */
+		FontFitter m_fontFitter;
 	};
 };
@@ -0,0 +1,311 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <WeaselCommon.h>
+#include "EmojiSegment.h"
+#include "Framebuffer.h"
+#include "StatusIconAtlas.h"
+#include "LayoutEngine.h"
+
+namespace weasel
+{
+	/*
+	 * Bitmap stand-in for a GDI or DirectWrite font, so that text can be
+	 * measured and drawn without a desktop. CJK and other wide characters
+	 * advance one em and the rest half an em, close to the metrics of the
+	 * default fonts; each glyph is a block pattern derived from its code point.
+	 */
+	class StandInFont
+	{
+	public:
+		explicit StandInFont(int point = 0, int dpi = 96) : _em((point * dpi + 36) / 72) {}
+
+		int Em() const { return _em; }
+		int LineHeight() const { return _em * 5 / 4; }
+		int Advance(unsigned int cp) const { return cp >= 0x2E80 ? _em : _em / 2; }
+
+		/* Size of the first count units of text, lines broken at \r, \n, \r\n or \n\r as DrawText(DT_CALCRECT) after ConvertCRLF */
+		void Measure(const std::wstring& text, size_t count, int* width, int* height) const
+		{
+			*width = *height = 0;
+			if (count == 0)
+				return;
+			_ForEachGlyph(text, count, 0, 0, [width](int x, int, int advance, unsigned int) {
+				if (x + advance > *width)
+					*width = x + advance;
+			}, height);
+		}
+
+		void Draw(Framebuffer* fb, int x, int y, const std::wstring& text, uint32_t color) const
+		{
+			const int lineHeight = LineHeight();
+			const int pad = (std::max)(_em / 8, 1);
+			_ForEachGlyph(text, text.length(), x, y, [&](int gx, int gy, int advance, unsigned int cp) {
+				if (cp == ' ' || cp == 0x3000)
+					return;
+				// 3x3 cells lit by bits of the code point; the center one always, so no glyph is blank
+				unsigned int bits = (cp * 2654435761u) >> 23 | 0x10;
+				int w = advance - 2 * pad, h = lineHeight - 2 * pad;
+				for (int cell = 0; cell < 9; ++cell)
+				{
+					if (!(bits & (1 << cell)))
+						continue;
+					int col = cell % 3, row = cell / 3;
+					FbRect rc = MakeFbRect(gx + pad + w * col / 3, gy + pad + h * row / 3,
+						gx + pad + w * (col + 1) / 3, gy + pad + h * (row + 1) / 3);
+					fb->FillRect(rc, color);
+				}
+			});
+		}
+
+	private:
+		template <class Glyph>
+		void _ForEachGlyph(const std::wstring& text, size_t count, int x, int y, Glyph glyph, int* height = NULL) const
+		{
+			const wchar_t* s = text.c_str();
+			int cx = x, cy = y;
+			for (size_t i = 0; i < count;)
+			{
+				if (s[i] == '\r' || s[i] == '\n')
+				{
+					if (i + 1 < count && (s[i + 1] == '\r' || s[i + 1] == '\n') && s[i + 1] != s[i])
+						++i;
+					++i;
+					cx = x, cy += LineHeight();
+					continue;
+				}
+				size_t units;
+				unsigned int cp = DecodeUtf16(s, count, i, &units);
+				int advance = Advance(cp);
+				glyph(cx, cy, advance, cp);
+				cx += advance;
+				i += units;
+			}
+			if (height)
+				*height = cy - y + LineHeight();
+		}
+
+		int _em;
+	};
+
+	/* The label, text and comment fonts of a style, measuring for LayoutEngine */
+	struct HeadlessFonts : public TextMeasurer
+	{
+		HeadlessFonts(const UIStyle& style, int dpi = 96)
+			: dpi(dpi), label(style.label_font_point, dpi), text(style.font_point, dpi), comment(style.comment_font_point, dpi) {}
+
+		virtual void Measure(Font font, const std::wstring& s, size_t count, int* cx, int* cy)
+		{
+			const StandInFont& f = font == LABEL_FONT ? label : font == COMMENT_FONT ? comment : text;
+			f.Measure(s, count, cx, cy);
+		}
+
+		int dpi;
+		StandInFont label, text, comment;
+	};
+
+	/* Lays out ctx as HeadlessPanel::Render does, with the status icon sized for the dpi of fonts */
+	inline void HeadlessLayOut(const UIStyle& style, const Context& ctx, const Status& status, HeadlessFonts& fonts, LayoutRects* rects)
+	{
+		LayoutEngine(style, ctx, status).DoLayout(fonts, StatusIconSize(fonts.dpi), rects);
+	}
+
+	/*
+	 * Paints a candidate panel the way WeaselPanel::DoPaint does, into a
+	 * framebuffer sized as the window: background and border, shadows,
+	 * preedit and candidate highlights, text and the status icon. The
+	 * framebuffer is reused across frames.
+	 */
+	class HeadlessPanel
+	{
+	public:
+		HeadlessPanel(const UIStyle& style, int dpi = 96) : _style(style), _fonts(style, dpi)
+		{
+			// the IDI_ZH, IDI_EN and IDI_RELOAD icons as flat squares, as WeaselPanel rasterizes them
+			static const uint32_t colors[STATUS_ICON_COUNT] = { 0xFFC02020, 0xFF2060C0, 0xFF808080 };
+			Framebuffer* strip = _statusIcons.Add(dpi);
+			const int size = strip->Height();
+			for (int i = 0; i < STATUS_ICON_COUNT; ++i)
+				strip->FillRoundRect(MakeFbRect(i * size, 0, (i + 1) * size, size).Inflate(-2, -2), 4, colors[i]);
+		}
+
+		/* Lays out and paints a full frame; returns false where DoPaint would hide the window */
+		bool Render(const Context& ctx, const Status& status)
+		{
+			HeadlessLayOut(_style, ctx, status, _fonts, &_layout);
+
+			// WeaselPanel::_ResizeWindow
+			int cx = _layout.width + abs(_style.shadow_offset_x * 4) + _style.shadow_radius * 4;
+			int cy = _layout.height + abs(_style.shadow_offset_y * 4) + _style.shadow_radius * 4;
+			if (_fb.Width() != cx || _fb.Height() != cy)
+				_fb = Framebuffer(cx, cy);
+			else
+				_fb.Clear();
+
+			const int ox = abs(_style.shadow_offset_x) * 2 + _style.shadow_radius * 2;
+			const int oy = abs(_style.shadow_offset_y) * 2 + _style.shadow_radius * 2;
+			const bool hide_candidates = _ShouldHideCandidates(ctx);
+			_DrawBackground(ctx, hide_candidates, ox, oy);
+
+			bool drawn = false;
+			if (!LayoutEngine::IsInlinePreedit(_style) && !hide_candidates)
+				drawn |= _DrawPreedit(ctx.preedit, _layout.preedit.Offset(ox, oy));
+			// DoPaint draws the auxiliary text at its unshifted rect
+			drawn |= _DrawPreedit(ctx.aux, _layout.aux);
+			if (LayoutEngine::ShouldDisplayStatusIcon(ctx, status))
+			{
+				FbRect icon = _layout.statusIcon.Offset(ox, oy);
+				_statusIcons.Draw(_fb.Target(), icon.left, icon.top, _fonts.dpi, GetStatusIconKind(status));
+				drawn = true;
+			}
+			if (!hide_candidates)
+				drawn |= _DrawCandidates(ctx, ox, oy);
+			return drawn;
+		}
+
+		const Framebuffer& GetFramebuffer() const { return _fb; }
+		const LayoutRects& GetLayout() const { return _layout; }
+
+	private:
+		bool _IsFullScreen() const
+		{
+			return _style.layout_type == UIStyle::LAYOUT_HORIZONTAL_FULLSCREEN || _style.layout_type == UIStyle::LAYOUT_VERTICAL_FULLSCREEN;
+		}
+
+		bool _ShouldHideCandidates(const Context& ctx) const
+		{
+			return _style.hide_candidates_when_single && _style.inline_preedit
+				&& ctx.cinfo.candies.size() == 1 && _style.preedit_type == UIStyle::PREVIEW;
+		}
+
+		/* WeaselPanel::_HighlightTextEx */
+		void _HighlightTextEx(FbRect const& rc, int color, int shadowColor, int blurOffsetX, int blurOffsetY, int radius)
+		{
+			if (_style.shadow_radius && (shadowColor & 0xff000000) && !_IsFullScreen())
+			{
+				Framebuffer shadow(rc.Width() + blurOffsetX * 2, rc.Height() + blurOffsetY * 2);
+				FbRect rect = MakeFbRect(blurOffsetX + _style.shadow_offset_x, blurOffsetY + _style.shadow_offset_y,
+					rc.Width() + blurOffsetX + _style.shadow_offset_x, rc.Height() + blurOffsetY + _style.shadow_offset_y);
+				if (_style.shadow_offset_x != 0 || _style.shadow_offset_y != 0)
+					shadow.FillRoundRect(rect, radius, PremultiplyStyleColor(shadowColor));
+				else
+				{
+					// rings fading out from the rect
+					int alpha = (shadowColor >> 24) & 255;
+					int step = alpha / _style.shadow_radius;
+					for (int i = 0; i < _style.shadow_radius; i++)
+					{
+						int ring = ((alpha - i * step) << 24) | (shadowColor & 0xFFFFFF);
+						shadow.StrokeRoundRect(rect, radius + i, 1, PremultiplyStyleColor(ring));
+						rect = rect.Inflate(2, 2);
+					}
+				}
+				shadow.Blur((float)_style.shadow_radius, (float)_style.shadow_radius);
+				_fb.Draw(shadow, rc.left - blurOffsetX, rc.top - blurOffsetY);
+			}
+			if (color & 0xff000000)
+				_fb.FillRoundRect(rc, radius, PremultiplyStyleColor(color));
+		}
+
+		/* WeaselPanel::_DrawBackground */
+		void _DrawBackground(const Context& ctx, bool hide_candidates, int ox, int oy)
+		{
+			if ((ctx.cinfo.candies.empty() && ((ctx.aux.str.empty() && ctx.preedit.str.empty()) || _style.inline_preedit)) || hide_candidates)
+				return;
+			FbRect trc = MakeFbRect(0, 0, _fb.Width(), _fb.Height()).Inflate(-(ox + _style.border), -(oy + _style.border));
+			if (_style.shadow_radius && (_style.shadow_color & 0xff000000))
+				_HighlightTextEx(trc, _style.back_color, _style.shadow_color, ox * 2, oy * 2, _style.round_corner_ex);
+			else
+				_fb.FillRoundRect(trc, _style.round_corner_ex, PremultiplyStyleColor(_style.back_color));
+			// a zero width GDI+ pen still draws one pixel
+			_fb.StrokeRoundRect(trc, _style.round_corner_ex, (std::max)(_style.border, 1), PremultiplyStyleColor(_style.border_color));
+		}
+
+		/* WeaselPanel::_DrawPreedit */
+		bool _DrawPreedit(Text const& text, FbRect const& rc)
+		{
+			std::wstring const& t = text.str;
+			if (t.empty())
+				return false;
+			TextRange range;
+			for (size_t j = 0; j < text.attributes.size(); ++j)
+				if (text.attributes[j].type == HIGHLIGHTED)
+					range = text.attributes[j].range;
+			if (range.start >= range.end)
+			{
+				_fonts.text.Draw(&_fb, rc.left, rc.top, t, PremultiplyStyleColor(_style.text_color));
+				return true;
+			}
+			int selStart, selEnd, cy;
+			_fonts.text.Measure(t, range.start, &selStart, &cy);
+			_fonts.text.Measure(t, range.end, &selEnd, &cy);
+			int x = rc.left;
+			if (range.start > 0)
+			{
+				_fonts.text.Draw(&_fb, x, rc.top, t.substr(0, range.start), PremultiplyStyleColor(_style.text_color));
+				x += selStart + _style.hilite_spacing;
+			}
+			FbRect rc_hi = MakeFbRect(x, rc.top, x + (selEnd - selStart), rc.bottom).Inflate(_style.hilite_padding, _style.hilite_padding);
+			_HighlightTextEx(rc_hi, _style.hilited_back_color, _style.hilited_shadow_color,
+				_style.margin_x - _style.hilite_padding, _style.margin_y - _style.hilite_padding, _style.round_corner);
+			_fonts.text.Draw(&_fb, x, rc.top, t.substr(range.start, range.end - range.start), PremultiplyStyleColor(_style.hilited_text_color));
+			x += selEnd - selStart;
+			if (range.end < (int)t.length())
+			{
+				x += _style.hilite_spacing;
+				_fonts.text.Draw(&_fb, x, rc.top, t.substr(range.end), PremultiplyStyleColor(_style.text_color));
+			}
+			return true;
+		}
+
+		/* WeaselPanel::_DrawCandidates */
+		bool _DrawCandidates(const Context& ctx, int ox, int oy)
+		{
+			const std::vector<Text>& candidates(ctx.cinfo.candies);
+			const std::vector<Text>& comments(ctx.cinfo.comments);
+			const std::vector<Text>& labels(ctx.cinfo.labels);
+			const int shadow = (std::max)(abs(_style.shadow_offset_x), abs(_style.shadow_offset_y)) * 2;
+			const int bkx = abs(_style.margin_x - _style.hilite_padding) + shadow;
+			const int bky = abs(_style.margin_y - _style.hilite_padding) + shadow;
+
+			bool drawn = false;
+			for (size_t i = 0; i < _layout.texts.size(); ++i)
+			{
+				const bool hilited = (int)i == ctx.cinfo.highlighted;
+				if (hilited)
+				{
+					FbRect rect = _layout.highlight.Offset(ox, oy).Inflate(_style.hilite_padding, _style.hilite_padding);
+					_HighlightTextEx(rect, _style.hilited_candidate_back_color, _style.hilited_candidate_shadow_color, bkx, bky, _style.round_corner);
+				}
+				else
+				{
+					FbRect back = _layout.backs[i].Offset(ox, oy).Inflate(_style.hilite_padding, _style.hilite_padding);
+					_HighlightTextEx(back, _style.candidate_back_color, _style.candidate_shadow_color, bkx, bky, _style.round_corner);
+				}
+
+				FbRect rect = _layout.labels[i].Offset(ox, oy);
+				_fonts.label.Draw(&_fb, rect.left, rect.top, LayoutEngine::FormatLabel(_style.label_text_format, labels.at(i).str),
+					PremultiplyStyleColor(hilited ? _style.hilited_label_text_color : _style.label_text_color));
+				rect = _layout.texts[i].Offset(ox, oy);
+				_fonts.text.Draw(&_fb, rect.left, rect.top, candidates.at(i).str,
+					PremultiplyStyleColor(hilited ? _style.hilited_candidate_text_color : _style.candidate_text_color));
+				if (!comments.at(i).str.empty())
+				{
+					rect = _layout.comments[i].Offset(ox, oy);
+					_fonts.comment.Draw(&_fb, rect.left, rect.top, comments.at(i).str,
+						PremultiplyStyleColor(hilited ? _style.hilited_comment_text_color : _style.comment_text_color));
+				}
+				drawn = true;
+			}
+			return drawn;
+		}
+
+		const UIStyle& _style;
+		HeadlessFonts _fonts;
+		LayoutRects _layout;
+		StatusIconAtlas _statusIcons;
+		Framebuffer _fb;
+	};
+};
@@ -4,12 +4,10 @@
 
 namespace weasel
 {
+	/* Candidates side by side in one row */
 	class HorizontalLayout: public StandardLayout
 	{
 	public:
-		HorizontalLayout(const UIStyle &style, const Context &context, const Status &status);
-
-		virtual void DoLayout(CDCHandle dc, GDIFonts* pFonts = 0);
-		virtual void DoLayout(CDCHandle dc, DirectWriteResources* pDWR);
+		HorizontalLayout(const UIStyle &style, const Context &context, const Status &status, int statusIconSize);
 	};
 };
@@ -21,6 +21,7 @@ DirectWriteResources::DirectWriteResources() :
 
 DirectWriteResources::~DirectWriteResources()
 {
+	ReleaseCaches();
 	SafeRelease(&pTextFormat);
 	SafeRelease(&pLabelTextFormat);
 	SafeRelease(&pCommentTextFormat);
@@ -29,18 +30,32 @@ DirectWriteResources::~DirectWriteResources()
 	SafeRelease(&pD2d1Factory);
 }
 
+typedef HRESULT (WINAPI *PD2D1CreateFactory)(D2D1_FACTORY_TYPE factoryType, REFIID riid, const D2D1_FACTORY_OPTIONS* pFactoryOptions, void** ppIFactory);
+typedef HRESULT (WINAPI *PDWriteCreateFactory)(DWRITE_FACTORY_TYPE factoryType, REFIID iid, IUnknown** factory);
+
 HRESULT DirectWriteResources::InitResources(std::wstring label_font_face, int label_font_point,
 	std::wstring font_face, int font_point,
 	std::wstring comment_font_face, int comment_font_point) 
 {
 	// prepare d2d1 resources
 	HRESULT hResult = S_OK;
-	// create factory
+	// d2d1.dll and dwrite.dll are not imported: processes whose panels draw with GDI never map them
 	if(pD2d1Factory == NULL)
-		hResult = ::D2D1CreateFactory(D2D1_FACTORY_TYPE_MULTI_THREADED, &pD2d1Factory);
-	// create IDWriteFactory
-	if(pDWFactory == NULL)
-		hResult = DWriteCreateFactory(DWRITE_FACTORY_TYPE_SHARED, __uuidof(IDWriteFactory), reinterpret_cast<IUnknown**>(&pDWFactory));
+	{
+		HMODULE d2d1 = ::LoadLibrary(L"d2d1.dll");
+		PD2D1CreateFactory createFactory = d2d1 ? (PD2D1CreateFactory)::GetProcAddress(d2d1, "D2D1CreateFactory") : NULL;
+		hResult = createFactory ?
+			createFactory(D2D1_FACTORY_TYPE_MULTI_THREADED, __uuidof(ID2D1Factory), NULL, reinterpret_cast<void**>(&pD2d1Factory)) : E_NOTIMPL;
+	}
+	if(pDWFactory == NULL && SUCCEEDED(hResult))
+	{
+		HMODULE dwrite = ::LoadLibrary(L"dwrite.dll");
+		PDWriteCreateFactory createFactory = dwrite ? (PDWriteCreateFactory)::GetProcAddress(dwrite, "DWriteCreateFactory") : NULL;
+		hResult = createFactory ?
+			createFactory(DWRITE_FACTORY_TYPE_SHARED, __uuidof(IDWriteFactory), reinterpret_cast<IUnknown**>(&pDWFactory)) : E_NOTIMPL;
+	}
+	if (pD2d1Factory == NULL || pDWFactory == NULL)
+		return FAILED(hResult) ? hResult : E_FAIL;
 	/* ID2D1HwndRenderTarget */
 	if (pRenderTarget == NULL)
 	{
@@ -86,3 +101,85 @@ HRESULT DirectWriteResources::InitResources(std::wstring label_font_face, int la
 	return hResult;
 }
 
+
+ID2D1SolidColorBrush* DirectWriteResources::GetBrush(COLORREF color)
+{
+	std::map<COLORREF, ID2D1SolidColorBrush*>::iterator it = _brushes.find(color);
+	if (it != _brushes.end())
+		return it->second;
+	if (pRenderTarget == NULL)
+		return NULL;
+	float r = (float)(GetRValue(color)) / 255.0f;
+	float g = (float)(GetGValue(color)) / 255.0f;
+	float b = (float)(GetBValue(color)) / 255.0f;
+	float alpha = (float)((color >> 24) & 255) / 255.0f;
+	ID2D1SolidColorBrush* pBrush = NULL;
+	if (FAILED(pRenderTarget->CreateSolidColorBrush(D2D1::ColorF(r, g, b, alpha), &pBrush)))
+		return NULL;
+	_brushes[color] = pBrush;
+	return pBrush;
+}
+
+IDWriteTextLayout* DirectWriteResources::GetTextLayout(const std::wstring& text, IDWriteTextFormat* pFormat)
+{
+	if (pFormat == NULL || pDWFactory == NULL)
+		return NULL;
+	TextLayoutKey key(pFormat, text);
+	std::map<TextLayoutKey, TextLayoutList::iterator>::iterator it = _textLayoutIndex.find(key);
+	if (it != _textLayoutIndex.end())
+	{
+		_textLayouts.splice(_textLayouts.begin(), _textLayouts, it->second);
+		return it->second->pLayout;
+	}
+
+	IDWriteTextLayout* pLayout = NULL;
+	if (FAILED(pDWFactory->CreateTextLayout(text.c_str(), text.length(), pFormat, 0.0f, 0.0f, &pLayout)))
+		return NULL;
+	if (_textLayouts.size() >= TEXT_LAYOUT_CACHE_SIZE)
+	{
+		TextLayoutEntry& oldest = _textLayouts.back();
+		_textLayoutIndex.erase(oldest.key);
+		oldest.pLayout->Release();
+		oldest.key.first->Release();
+		_textLayouts.pop_back();
+	}
+	pFormat->AddRef();
+	TextLayoutEntry entry = { key, pLayout };
+	_textLayouts.push_front(entry);
+	_textLayoutIndex[key] = _textLayouts.begin();
+	return pLayout;
+}
+
+HRESULT DirectWriteResources::BindDC(HDC hdc, const RECT& rc)
+{
+	if (pRenderTarget == NULL)
+		return E_POINTER;
+	return pRenderTarget->BindDC(hdc, &rc);
+}
+
+HRESULT DirectWriteResources::RecreateRenderTarget()
+{
+	for (std::map<COLORREF, ID2D1SolidColorBrush*>::iterator it = _brushes.begin(); it != _brushes.end(); ++it)
+		it->second->Release();
+	_brushes.clear();
+	SafeRelease(&pRenderTarget);
+	if (pD2d1Factory == NULL)
+		return E_POINTER;
+	const D2D1_PIXEL_FORMAT format = D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED);
+	const D2D1_RENDER_TARGET_PROPERTIES properties = D2D1::RenderTargetProperties( D2D1_RENDER_TARGET_TYPE_DEFAULT, format);
+	return pD2d1Factory->CreateDCRenderTarget(&properties, &pRenderTarget);
+}
+
+void DirectWriteResources::ReleaseCaches()
+{
+	for (TextLayoutList::iterator it = _textLayouts.begin(); it != _textLayouts.end(); ++it)
+	{
+		it->pLayout->Release();
+		it->key.first->Release();
+	}
+	_textLayouts.clear();
+	_textLayoutIndex.clear();
+	for (std::map<COLORREF, ID2D1SolidColorBrush*>::iterator it = _brushes.begin(); it != _brushes.end(); ++it)
+		it->second->Release();
+	_brushes.clear();
+}
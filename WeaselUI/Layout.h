@@ -3,6 +3,8 @@
 #include <WeaselCommon.h>
 #include <WeaselUI.h>
 #include <regex>
+#include <list>
+#include <map>
 #include <dwrite.h>
 #include <d2d1.h>
 
@@ -26,6 +28,18 @@ public:
 		std::wstring font_face, int font_point,
 		std::wstring comment_font_face, int comment_font_point);
 
+	/* Solid color brush bound to pRenderTarget, created once per color (alpha in the high byte) */
+	ID2D1SolidColorBrush* GetBrush(COLORREF color);
+	/* Text layout shared by measuring and drawing, kept across refreshes; owned by the cache */
+	IDWriteTextLayout* GetTextLayout(const std::wstring& text, IDWriteTextFormat* pFormat);
+	/* Binds pRenderTarget to rc of hdc; the back buffer's dc is recreated on resize, so every draw binds */
+	HRESULT BindDC(HDC hdc, const RECT& rc);
+	/* Recreates pRenderTarget after D2DERR_RECREATE_TARGET, dropping the brushes bound to it */
+	HRESULT RecreateRenderTarget();
+	void ReleaseCaches();
+
+	enum { TEXT_LAYOUT_CACHE_SIZE = 256 };
+
 	float dpiScaleX_, dpiScaleY_;
 	ID2D1Factory* pD2d1Factory;
 	IDWriteFactory* pDWFactory;
@@ -33,6 +47,21 @@ public:
 	IDWriteTextFormat* pTextFormat;
 	IDWriteTextFormat* pLabelTextFormat;
 	IDWriteTextFormat* pCommentTextFormat;
+
+private:
+	typedef std::pair<IDWriteTextFormat*, std::wstring> TextLayoutKey;
+	struct TextLayoutEntry
+	{
+		TextLayoutKey key;
+		IDWriteTextLayout* pLayout;
+	};
+	typedef std::list<TextLayoutEntry> TextLayoutList;
+
+	// most recently used first; every entry holds a reference on its format,
+	// so a released format pointer cannot be reused while a layout is cached
+	TextLayoutList _textLayouts;
+	std::map<TextLayoutKey, TextLayoutList::iterator> _textLayoutIndex;
+	std::map<COLORREF, ID2D1SolidColorBrush*> _brushes;
 };
 
 class GDIFonts
@@ -66,22 +95,32 @@ namespace weasel
 
 		virtual void DoLayout(CDCHandle dc, GDIFonts* pFonts = 0) = 0;
 		virtual void DoLayout(CDCHandle dc, DirectWriteResources* pDWR) = 0;
+		/* Moves the highlight to the currently highlighted candidate, reusing the other rects */
+		virtual void UpdateHighlightRect() = 0;
+		/* Forgets the last layout before this instance lays out the current context again */
+		virtual void Reset(int statusIconSize) = 0;
+		/* Takes the rects of other, an instance of the same class laid out ahead for a page with the current text */
+		virtual void Assign(const Layout& other) = 0;
 		/* All points in this class is based on the content area */
 		/* The top-left corner of the content area is always (0, 0) */
 		virtual CSize GetContentSize() const = 0;
 		virtual CRect GetPreeditRect() const = 0;
 		virtual CRect GetAuxiliaryRect() const = 0;
 		virtual CRect GetHighlightRect() const = 0;
+		/* Candidates with rects: those of the context as of the last Reset */
+		virtual size_t GetCandidateCount() const = 0;
 		virtual CRect GetCandidateLabelRect(int id) const = 0;
 		virtual CRect GetCandidateTextRect(int id) const = 0;
 		virtual CRect GetCandidateCommentRect(int id) const = 0;
+		/* Where the background of a candidate that is not highlighted goes */
+		virtual CRect GetCandidateBackRect(int id) const = 0;
 		virtual CRect GetStatusIconRect() const = 0;
 
 		virtual std::wstring GetLabelText(const std::vector<Text> &labels, int id, const wchar_t *format) const = 0;
 		virtual bool IsInlinePreedit() const = 0;
 		virtual bool ShouldDisplayStatusIcon() const = 0;
 		virtual void GetTextExtentDCMultiline(CDCHandle dc, std::wstring wszString, int nCount, LPSIZE lpSize) const = 0;
-		virtual void GetTextSizeDW(const std::wstring text, int nCount, IDWriteTextFormat* pTextFormat, IDWriteFactory* pDWFactaory,  LPSIZE lpSize) const = 0;
+		virtual void GetTextSizeDW(const std::wstring text, int nCount, IDWriteTextFormat* pTextFormat, DirectWriteResources* pDWR, LPSIZE lpSize) const = 0;
 		
 		virtual std::wstring Layout::ConvertCRLF(std::wstring strString, std::wstring strCRLF) const = 0;
 	protected:
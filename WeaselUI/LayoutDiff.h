@@ -0,0 +1,103 @@
+#pragma once
+
+#include <WeaselCommon.h>
+
+namespace weasel
+{
+	/* What a refresh has to redo, compared to the state the layout was built from */
+	enum LayoutChange
+	{
+		LAYOUT_UNCHANGED = 0,
+		LAYOUT_REPAINT,				// same rects, status icon or colors changed
+		LAYOUT_HIGHLIGHT_CHANGED,	// same rects, the highlight moved to another candidate
+		LAYOUT_CHANGED				// text or metrics changed, lay out again
+	};
+
+	inline bool IsSameText(const Text& a, const Text& b)
+	{
+		if (a.str != b.str || a.attributes.size() != b.attributes.size())
+			return false;
+		for (size_t i = 0; i < a.attributes.size(); ++i)
+		{
+			const TextAttribute &x = a.attributes[i], &y = b.attributes[i];
+			if (x.type != y.type || x.range.start != y.range.start || x.range.end != y.range.end)
+				return false;
+		}
+		return true;
+	}
+
+	inline bool IsSameTextList(const std::vector<Text>& a, const std::vector<Text>& b)
+	{
+		if (a.size() != b.size())
+			return false;
+		for (size_t i = 0; i < a.size(); ++i)
+		{
+			if (!IsSameText(a[i], b[i]))
+				return false;
+		}
+		return true;
+	}
+
+	/* Compares every style field that affects rects; colors only need a repaint */
+	inline bool IsSameLayoutStyle(const UIStyle& a, const UIStyle& b)
+	{
+		return a.align_type == b.align_type && a.preedit_type == b.preedit_type && a.layout_type == b.layout_type &&
+			a.font_face == b.font_face && a.label_font_face == b.label_font_face && a.comment_font_face == b.comment_font_face &&
+			a.font_point == b.font_point && a.label_font_point == b.label_font_point && a.comment_font_point == b.comment_font_point &&
+			a.inline_preedit == b.inline_preedit && a.hide_candidates_when_single == b.hide_candidates_when_single &&
+			a.color_font == b.color_font && a.label_text_format == b.label_text_format &&
+			a.min_width == b.min_width && a.min_height == b.min_height && a.border == b.border &&
+			a.margin_x == b.margin_x && a.margin_y == b.margin_y && a.spacing == b.spacing &&
+			a.candidate_spacing == b.candidate_spacing && a.hilite_spacing == b.hilite_spacing &&
+			a.hilite_padding == b.hilite_padding && a.round_corner == b.round_corner && a.round_corner_ex == b.round_corner_ex &&
+			a.shadow_radius == b.shadow_radius && a.shadow_offset_x == b.shadow_offset_x && a.shadow_offset_y == b.shadow_offset_y &&
+			a.grid_rows == b.grid_rows && a.client_caps == b.client_caps;
+	}
+
+	inline bool IsSameColors(const UIStyle& a, const UIStyle& b)
+	{
+		return a.text_color == b.text_color && a.candidate_text_color == b.candidate_text_color &&
+			a.candidate_back_color == b.candidate_back_color && a.candidate_shadow_color == b.candidate_shadow_color &&
+			a.label_text_color == b.label_text_color && a.comment_text_color == b.comment_text_color &&
+			a.back_color == b.back_color && a.shadow_color == b.shadow_color && a.border_color == b.border_color &&
+			a.hilited_text_color == b.hilited_text_color && a.hilited_back_color == b.hilited_back_color &&
+			a.hilited_shadow_color == b.hilited_shadow_color &&
+			a.hilited_candidate_text_color == b.hilited_candidate_text_color &&
+			a.hilited_candidate_back_color == b.hilited_candidate_back_color &&
+			a.hilited_candidate_shadow_color == b.hilited_candidate_shadow_color &&
+			a.hilited_label_text_color == b.hilited_label_text_color &&
+			a.hilited_comment_text_color == b.hilited_comment_text_color;
+	}
+
+	/* Another page of the same input, as paging keys show; the panel may have laid it out ahead */
+	inline bool IsPageTurn(const Context& prevCtx, const Context& ctx)
+	{
+		return prevCtx.cinfo.currentPage != ctx.cinfo.currentPage && !ctx.cinfo.candies.empty() &&
+			IsSameText(prevCtx.preedit, ctx.preedit) && IsSameText(prevCtx.aux, ctx.aux);
+	}
+
+	inline LayoutChange DiffLayout(const Context& prevCtx, const Status& prevStatus, const UIStyle& prevStyle,
+		const Context& ctx, const Status& status, const UIStyle& style)
+	{
+		if (!IsSameLayoutStyle(prevStyle, style))
+			return LAYOUT_CHANGED;
+		if (!IsSameText(prevCtx.preedit, ctx.preedit) || !IsSameText(prevCtx.aux, ctx.aux))
+			return LAYOUT_CHANGED;
+		const CandidateInfo &prev = prevCtx.cinfo, &cinfo = ctx.cinfo;
+		if (!IsSameTextList(prev.candies, cinfo.candies) || !IsSameTextList(prev.comments, cinfo.comments) ||
+			!IsSameTextList(prev.labels, cinfo.labels))
+			return LAYOUT_CHANGED;
+		// the status icon takes up room only when it is displayed
+		bool prevIcon = prevStatus.ascii_mode || !prevStatus.composing;
+		bool icon = status.ascii_mode || !status.composing;
+		if (prevIcon != icon)
+			return LAYOUT_CHANGED;
+		// a full repaint also covers a moved highlight
+		if (prevStatus.ascii_mode != status.ascii_mode || prevStatus.disabled != status.disabled ||
+			!IsSameColors(prevStyle, style))
+			return LAYOUT_REPAINT;
+		if (prev.highlighted != cinfo.highlighted)
+			return LAYOUT_HIGHLIGHT_CHANGED;
+		return LAYOUT_UNCHANGED;
+	}
+};
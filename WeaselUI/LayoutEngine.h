@@ -0,0 +1,355 @@
+#pragma once
+
+#include <stddef.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <WeaselCommon.h>
+#include "Framebuffer.h"
+#include "CandidateGrid.h"
+
+namespace weasel
+{
+	/* Text measurement for LayoutEngine, in one of the fonts of a style */
+	class TextMeasurer
+	{
+	public:
+		enum Font { LABEL_FONT, TEXT_FONT, COMMENT_FONT, AUX_FONT };
+
+		virtual ~TextMeasurer() {}
+
+		/* Size of the first count units of text, lines broken at \r, \n, \r\n or \n\r */
+		virtual void Measure(Font font, const std::wstring& text, size_t count, int* cx, int* cy) = 0;
+	};
+
+	/* Rects of a candidate panel, based on the content area as in weasel::Layout */
+	struct LayoutRects
+	{
+		LayoutRects() { Reset(0); }
+
+		/* Empty rects for a page of count candidates; the vectors keep their capacity */
+		void Reset(size_t count)
+		{
+			const FbRect empty = { 0, 0, 0, 0 };
+			width = height = 0;
+			preedit = aux = highlight = statusIcon = empty;
+			labels.assign(count, empty);
+			texts.assign(count, empty);
+			comments.assign(count, empty);
+			backs.assign(count, empty);
+		}
+
+		int width, height;
+		FbRect preedit, aux, highlight, statusIcon;
+		std::vector<FbRect> labels, texts, comments;
+		// Layout::GetCandidateBackRect
+		std::vector<FbRect> backs;
+	};
+
+	/*
+	 * The geometry of the standard layouts: preedit and auxiliary rows, the
+	 * candidates in a column (or a grid of them) or a row, and the status
+	 * icon. Text is measured through a TextMeasurer, so the panel lays out
+	 * with GDI or DirectWrite and the headless panel with its stand-in fonts.
+	 * The candidate grid is kept across layouts.
+	 */
+	class LayoutEngine
+	{
+	public:
+		enum Direction { VERTICAL, HORIZONTAL };
+
+		/* Laid out as direction, whatever the layout type of style */
+		LayoutEngine(const UIStyle& style, const Context& ctx, const Status& status, Direction direction)
+			: _style(style), _ctx(ctx), _status(status), _direction(direction) {}
+		/* Laid out as the layout type of style; full screen styles as their base layout */
+		LayoutEngine(const UIStyle& style, const Context& ctx, const Status& status)
+			: _style(style), _ctx(ctx), _status(status), _direction(DirectionOf(style)) {}
+
+		static Direction DirectionOf(const UIStyle& style)
+		{
+			return style.layout_type == UIStyle::LAYOUT_HORIZONTAL || style.layout_type == UIStyle::LAYOUT_HORIZONTAL_FULLSCREEN ? HORIZONTAL : VERTICAL;
+		}
+
+		static bool IsInlinePreedit(const UIStyle& style)
+		{
+			return style.inline_preedit && (style.client_caps & 1 /* INLINE_PREEDIT_CAPABLE */) != 0 &&
+				style.layout_type != UIStyle::LAYOUT_VERTICAL_FULLSCREEN && style.layout_type != UIStyle::LAYOUT_HORIZONTAL_FULLSCREEN;
+		}
+
+		static bool ShouldDisplayStatusIcon(const Context& ctx, const Status& status)
+		{
+			// rule 1. emphasis ascii mode
+			// rule 2. show status icon when switching mode
+			// rule 3. always show status icon with tips
+			return status.ascii_mode || !status.composing || !ctx.aux.empty();
+		}
+
+		/* format with its %s replaced by label, and %% by % */
+		static std::wstring FormatLabel(const std::wstring& format, const std::wstring& label)
+		{
+			std::wstring result;
+			for (size_t i = 0; i < format.length(); ++i)
+			{
+				if (format[i] == '%' && i + 1 < format.length())
+				{
+					++i;
+					if (format[i] == 's')
+						result += label;
+					else
+						result += format[i];
+				}
+				else
+					result += format[i];
+			}
+			return result;
+		}
+
+		/* Lays out every candidate of the context; statusIconSize is SM_CXICON at the dpi of the panel */
+		void DoLayout(TextMeasurer& measurer, int statusIconSize, LayoutRects* rects)
+		{
+			rects->Reset(_ctx.cinfo.candies.size());
+			if (_direction == HORIZONTAL)
+				_Horizontal(measurer, statusIconSize, rects);
+			else
+				_Vertical(measurer, statusIconSize, rects);
+		}
+
+		/* Moves the highlight of rects, as laid out for the current text, to the highlighted candidate */
+		void UpdateHighlight(LayoutRects* rects) const
+		{
+			const int id = _ctx.cinfo.highlighted;
+			if (id < 0 || (size_t)id >= rects->texts.size())
+				return;
+			if (_direction == HORIZONTAL)
+			{
+				// all candidates share one row, only the horizontal extent moves
+				rects->highlight.left = rects->labels[id].left;
+				rects->highlight.right = rects->comments[id].right;
+			}
+			else
+				rects->highlight = rects->backs[id];
+		}
+
+		/*
+		 * Places the status icon in rects, which are rects->width by
+		 * rects->height, widening them to make room for it.
+		 * rule 1. status icon is middle-aligned with preedit text or auxiliary text, whichever comes first
+		 * rule 2. there is a spacing between preedit/aux text and the status icon
+		 * rule 3. status icon is right aligned in WeaselPanel, when [margin_x + width(preedit/aux) + spacing + width(icon) + margin_x] < style.min_width
+		 */
+		void PlaceStatusIcon(int size, LayoutRects* rects) const
+		{
+			if (!ShouldDisplayStatusIcon(_ctx, _status))
+				return;
+			int left = 0, middle = 0;
+			if (!_IsNull(rects->preedit))
+			{
+				left = rects->preedit.right + _style.spacing;
+				middle = (rects->preedit.top + rects->preedit.bottom) / 2;
+			}
+			else if (!_IsNull(rects->aux))
+			{
+				left = rects->aux.right + _style.spacing;
+				middle = (rects->aux.top + rects->aux.bottom) / 2;
+			}
+			if (left && middle)
+			{
+				int right_alignment = rects->width - _style.margin_x - size;
+				if (left > right_alignment)
+					rects->width = left + size + _style.margin_x;
+				else
+					left = right_alignment;
+				rects->statusIcon = MakeFbRect(left, middle - size / 2, left + size, middle + size / 2);
+			}
+			else
+			{
+				rects->statusIcon = MakeFbRect(0, 0, size, size);
+				rects->width = rects->height = size;
+			}
+		}
+
+	private:
+		static bool _IsNull(const FbRect& rc)
+		{
+			return !rc.left && !rc.top && !rc.right && !rc.bottom;
+		}
+
+		/* Preedit and auxiliary rows shared by both directions; returns the height so far */
+		int _Header(TextMeasurer& measurer, LayoutRects* rects, int* width)
+		{
+			int height = _style.margin_y, cx, cy;
+			if (!IsInlinePreedit(_style) && !_ctx.preedit.str.empty())
+			{
+				_PreeditSize(measurer, &cx, &cy);
+				rects->preedit = MakeFbRect(_style.margin_x, height, _style.margin_x + cx, height + cy);
+				*width = (std::max)(*width, _style.margin_x + cx + _style.margin_x);
+				height += cy + _style.spacing;
+			}
+			if (!_ctx.aux.str.empty())
+			{
+				measurer.Measure(TextMeasurer::AUX_FONT, _ctx.aux.str, _ctx.aux.str.length(), &cx, &cy);
+				rects->aux = MakeFbRect(_style.margin_x, height, _style.margin_x + cx, height + cy);
+				*width = (std::max)(*width, _style.margin_x + cx + _style.margin_x);
+				height += cy + _style.spacing;
+			}
+			return height;
+		}
+
+		/* The preedit text, with room around its highlighted range */
+		void _PreeditSize(TextMeasurer& measurer, int* cx, int* cy) const
+		{
+			const std::wstring& preedit = _ctx.preedit.str;
+			const std::vector<TextAttribute>& attrs = _ctx.preedit.attributes;
+			measurer.Measure(TextMeasurer::TEXT_FONT, preedit, preedit.length(), cx, cy);
+			for (size_t i = 0; i < attrs.size(); i++)
+			{
+				if (attrs[i].type != HIGHLIGHTED)
+					continue;
+				const TextRange& range = attrs[i].range;
+				if (range.start < range.end)
+				{
+					*cx += range.start > 0 ? _style.hilite_spacing : _style.hilite_padding;
+					*cx += range.end < (int)preedit.length() ? _style.hilite_spacing : _style.hilite_padding;
+				}
+			}
+		}
+
+		/* Trims the last spacing, applies the minimum size and places the status icon */
+		void _Footer(LayoutRects* rects, size_t count, int width, int height, int statusIconSize)
+		{
+			if (count)
+				height += _style.spacing;
+			if (height > 0)
+				height -= _style.spacing;
+			height += _style.margin_y;
+			if (!_ctx.preedit.str.empty() && count)
+			{
+				width = (std::max)(width, _style.min_width);
+				height = (std::max)(height, _style.min_height);
+			}
+			rects->width = width;
+			rects->height = height;
+			PlaceStatusIcon(statusIconSize, rects);
+		}
+
+		void _Vertical(TextMeasurer& measurer, int statusIconSize, LayoutRects* rects)
+		{
+			const std::vector<Text>& candidates(_ctx.cinfo.candies);
+			const std::vector<Text>& comments(_ctx.cinfo.comments);
+			const std::vector<Text>& labels(_ctx.cinfo.labels);
+			const size_t count = candidates.size();
+			int width = 0, cx, cy;
+			int height = _Header(measurer, rects, &width);
+
+			_grid.Reset(count);
+			for (size_t i = 0; i < count; ++i)
+			{
+				std::wstring label = FormatLabel(_style.label_text_format, labels.at(i).str);
+				measurer.Measure(TextMeasurer::LABEL_FONT, label, label.length(), &cx, &cy);
+				_grid.SetSize(i, CandidateGrid::LABEL, cx, cy);
+
+				const std::wstring& text = candidates.at(i).str;
+				measurer.Measure(TextMeasurer::TEXT_FONT, text, text.length(), &cx, &cy);
+				_grid.SetSize(i, CandidateGrid::TEXT, cx, cy);
+
+				if (!comments.at(i).str.empty())
+				{
+					const std::wstring& comment = comments.at(i).str;
+					measurer.Measure(TextMeasurer::COMMENT_FONT, comment, comment.length(), &cx, &cy);
+					_grid.SetSize(i, CandidateGrid::COMMENT, cx, cy);
+				}
+			}
+			// comments are left-aligned to the right of the longest candidate who has a comment, column by column
+			_grid.Arrange(_style.margin_x, height, (size_t)(std::max)(_style.grid_rows, 0), _style.hilite_spacing,
+				_style.candidate_spacing, _style.margin_x, _style.align_type, &cx, &cy);
+			for (size_t i = 0; i < count; ++i)
+			{
+				rects->labels[i] = _grid.Rect(i, CandidateGrid::LABEL);
+				rects->texts[i] = _grid.Rect(i, CandidateGrid::TEXT);
+				rects->comments[i] = _grid.Rect(i, CandidateGrid::COMMENT);
+			}
+			width = (std::max)(width, cx + 2 * _style.margin_x);
+			height += cy;
+
+			_Footer(rects, count, width, height, statusIconSize);
+
+			// the last column reaches to the content edge, so backs wait for the width
+			for (size_t i = 0; i < count; ++i)
+				rects->backs[i] = _grid.HighlightRect(i, rects->width - _style.margin_x);
+			UpdateHighlight(rects);
+		}
+
+		void _Horizontal(TextMeasurer& measurer, int statusIconSize, LayoutRects* rects)
+		{
+			const std::vector<Text>& candidates(_ctx.cinfo.candies);
+			const std::vector<Text>& comments(_ctx.cinfo.comments);
+			const std::vector<Text>& labels(_ctx.cinfo.labels);
+			const size_t count = candidates.size();
+			const int space = _style.hilite_spacing;
+			int width = 0, cx = 0, cy = 0;
+			int height = _Header(measurer, rects, &width);
+
+			int w = _style.margin_x, h = 0;
+			for (size_t i = 0; i < count; ++i)
+			{
+				if (i > 0)
+					w += _style.candidate_spacing;
+
+				std::wstring label = FormatLabel(_style.label_text_format, labels.at(i).str);
+				measurer.Measure(TextMeasurer::LABEL_FONT, label, label.length(), &cx, &cy);
+				rects->labels[i] = MakeFbRect(w, height, w + cx, height + cy);
+				w += cx + space, h = (std::max)(h, cy);
+
+				const std::wstring& text = candidates.at(i).str;
+				measurer.Measure(TextMeasurer::TEXT_FONT, text, text.length(), &cx, &cy);
+				rects->texts[i] = MakeFbRect(w, height, w + cx, height + cy);
+				w += cx + space, h = (std::max)(h, cy);
+
+				if (!comments.at(i).str.empty())
+				{
+					const std::wstring& comment = comments.at(i).str;
+					measurer.Measure(TextMeasurer::COMMENT_FONT, comment, comment.length(), &cx, &cy);
+					rects->comments[i] = MakeFbRect(w, height, w + cx + space, height + cy);
+					w += cx + space, h = (std::max)(h, cy);
+				}
+				else	// used for the highlight extent
+					rects->comments[i] = MakeFbRect(w, height, w, height + cy);
+			}
+			for (size_t i = 0; i < count; ++i)
+			{
+				_Align(rects, i, h);
+				// from the label to the end of the comment, as high as the text
+				rects->backs[i] = MakeFbRect(rects->labels[i].left, rects->texts[i].top, rects->comments[i].right, rects->texts[i].bottom);
+			}
+			w += _style.margin_x;
+
+			rects->highlight = MakeFbRect(0, height, 0, height + h);
+			UpdateHighlight(rects);
+
+			width = (std::max)(width, w);
+			height += h;
+			_Footer(rects, count, width, height, statusIconSize);
+		}
+
+		/* Moves the parts of candidate i down within the row of height h */
+		void _Align(LayoutRects* rects, size_t i, int h) const
+		{
+			FbRect* parts[3] = { &rects->labels[i], &rects->texts[i], &rects->comments[i] };
+			for (int k = 0; k < 3; ++k)
+			{
+				int offset = 0;
+				if (_style.align_type == UIStyle::ALIGN_CENTER)
+					offset = (h - parts[k]->Height()) / 2;
+				else if (_style.align_type == UIStyle::ALIGN_BOTTOM)
+					offset = h - parts[k]->Height();
+				*parts[k] = parts[k]->Offset(0, offset);
+			}
+		}
+
+		const UIStyle& _style;
+		const Context& _ctx;
+		const Status& _status;
+		Direction _direction;
+		CandidateGrid _grid;
+	};
+};
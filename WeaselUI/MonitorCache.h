@@ -0,0 +1,112 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace weasel
+{
+	/* Rect in screen coordinates, right and bottom exclusive, as RECT */
+	struct ScreenRect
+	{
+		int left, top, right, bottom;
+
+		int Width() const { return right - left; }
+		int Height() const { return bottom - top; }
+		bool Contains(int x, int y) const { return x >= left && x < right && y >= top && y < bottom; }
+	};
+
+	inline ScreenRect MakeScreenRect(int left, int top, int right, int bottom)
+	{
+		ScreenRect rc = { left, top, right, bottom };
+		return rc;
+	}
+
+	/* What MONITORINFO and GetDpiForMonitor tell of a monitor */
+	struct MonitorEntry
+	{
+		ScreenRect monitor;
+		ScreenRect work;
+		int dpi;
+	};
+
+	/*
+	 * The monitors as of the last change of the display settings, so that
+	 * following the caret does not ask the system for the work area each
+	 * time. Lookups try the monitor found last before the others, of which
+	 * there are rarely more than a few.
+	 */
+	class MonitorCache
+	{
+	public:
+		MonitorCache() : _valid(false), _last(0) {}
+
+		bool IsValid() const { return _valid; }
+		/* On WM_DISPLAYCHANGE, WM_SETTINGCHANGE or WM_DPICHANGED; the next lookup needs Assign first */
+		void Invalidate() { _valid = false; }
+		void Assign(std::vector<MonitorEntry> const& monitors)
+		{
+			_monitors = monitors;
+			_valid = true;
+			_last = 0;
+		}
+		size_t Size() const { return _monitors.size(); }
+
+		/* The monitor containing the point, or else the nearest one as MONITOR_DEFAULTTONEAREST; NULL if none */
+		const MonitorEntry* Find(int x, int y) const
+		{
+			if (_monitors.empty())
+				return NULL;
+			if (_monitors[_last].monitor.Contains(x, y))
+				return &_monitors[_last];
+			size_t nearest = 0;
+			int64_t nearestDistance = -1;
+			for (size_t i = 0; i < _monitors.size(); ++i)
+			{
+				int64_t distance = _Distance(_monitors[i].monitor, x, y);
+				if (nearestDistance < 0 || distance < nearestDistance)
+				{
+					nearest = i;
+					nearestDistance = distance;
+				}
+			}
+			_last = nearest;
+			return &_monitors[nearest];
+		}
+
+	private:
+		// squared, zero inside
+		static int64_t _Distance(ScreenRect const& rc, int x, int y)
+		{
+			int64_t dx = x < rc.left ? rc.left - x : x >= rc.right ? x - rc.right + 1 : 0;
+			int64_t dy = y < rc.top ? rc.top - y : y >= rc.bottom ? y - rc.bottom + 1 : 0;
+			return dx * dx + dy * dy;
+		}
+
+		std::vector<MonitorEntry> _monitors;
+		bool _valid;
+		mutable size_t _last;
+	};
+
+	/*
+	 * Top left corner of a panel of the given size shown for the input rect:
+	 * below it, kept within the work area, and above it when there is no
+	 * room below.
+	 */
+	inline void PlacePanel(ScreenRect const& input, int width, int height, ScreenRect const& work, int* x, int* y)
+	{
+		const int right = work.right - width, bottom = work.bottom - height;
+		*x = input.left;
+		*y = input.bottom;
+		if (*x > right)
+			*x = right;
+		if (*x < work.left)
+			*x = work.left;
+		if (*y > bottom)
+			*y = input.top - height;
+		if (*y > bottom)
+			*y = bottom;
+		if (*y < work.top)
+			*y = work.top;
+	}
+};
@@ -0,0 +1,451 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include "Framebuffer.h"
+
+namespace weasel
+{
+	/*
+	 * Minimal PNG codec for golden images: 8 bit RGBA, not interlaced.
+	 *
+	 * The encoder writes one fixed Huffman deflate block and only looks for
+	 * repeats of the previous pixel and of the pixel above, which catches the
+	 * flat fills a candidate panel is made of. The decoder reads stored and
+	 * fixed Huffman blocks, so it takes back what EncodePng writes but not
+	 * every PNG. Pixels are premultiplied BGRA in memory and straight RGBA
+	 * in the file; a round trip is exact.
+	 */
+	namespace png
+	{
+		inline uint32_t Crc32(const unsigned char* data, size_t size, uint32_t crc = 0)
+		{
+			static uint32_t table[256];
+			static bool ready = false;
+			if (!ready)
+			{
+				for (uint32_t n = 0; n < 256; ++n)
+				{
+					uint32_t c = n;
+					for (int k = 0; k < 8; ++k)
+						c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+					table[n] = c;
+				}
+				ready = true;
+			}
+			crc = ~crc;
+			for (size_t i = 0; i < size; ++i)
+				crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+			return ~crc;
+		}
+
+		inline uint32_t Adler32(const unsigned char* data, size_t size)
+		{
+			uint32_t a = 1, b = 0;
+			for (size_t i = 0; i < size; ++i)
+			{
+				a = (a + data[i]) % 65521;
+				b = (b + a) % 65521;
+			}
+			return (b << 16) | a;
+		}
+
+		static const unsigned short kLengthBase[29] = {
+			3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+			35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+		static const unsigned char kLengthExtra[29] = {
+			0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+			3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+		static const unsigned short kDistanceBase[30] = {
+			1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+			257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+		static const unsigned char kDistanceExtra[30] = {
+			0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+			7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+		class BitWriter
+		{
+		public:
+			BitWriter(std::vector<unsigned char>* out) : _out(out), _bits(0), _count(0) {}
+
+			void Write(uint32_t value, int count)
+			{
+				_bits |= value << _count;
+				_count += count;
+				while (_count >= 8)
+				{
+					_out->push_back((unsigned char)_bits);
+					_bits >>= 8;
+					_count -= 8;
+				}
+			}
+			/* Huffman codes go most significant bit first */
+			void WriteCode(uint32_t code, int count)
+			{
+				uint32_t reversed = 0;
+				for (int i = 0; i < count; ++i)
+					reversed |= ((code >> i) & 1) << (count - 1 - i);
+				Write(reversed, count);
+			}
+			void Flush()
+			{
+				if (_count > 0)
+					_out->push_back((unsigned char)_bits);
+				_bits = 0, _count = 0;
+			}
+
+		private:
+			std::vector<unsigned char>* _out;
+			uint32_t _bits;
+			int _count;
+		};
+
+		inline void WriteFixedSymbol(BitWriter& bw, int symbol)
+		{
+			if (symbol < 144)
+				bw.WriteCode(0x30 + symbol, 8);
+			else if (symbol < 256)
+				bw.WriteCode(0x190 + symbol - 144, 9);
+			else if (symbol < 280)
+				bw.WriteCode(symbol - 256, 7);
+			else
+				bw.WriteCode(0xC0 + symbol - 280, 8);
+		}
+
+		inline void WriteMatch(BitWriter& bw, int length, int distance)
+		{
+			int code = 28;
+			while (kLengthBase[code] > length)
+				--code;
+			WriteFixedSymbol(bw, 257 + code);
+			bw.Write(length - kLengthBase[code], kLengthExtra[code]);
+			code = 29;
+			while (kDistanceBase[code] > distance)
+				--code;
+			bw.WriteCode(code, 5);
+			bw.Write(distance - kDistanceBase[code], kDistanceExtra[code]);
+		}
+
+		/* zlib stream of one fixed Huffman block, matching at distances 4 (a pixel) and stride (a row) */
+		inline void Deflate(const std::vector<unsigned char>& data, size_t stride, std::vector<unsigned char>* out)
+		{
+			out->push_back(0x78);
+			out->push_back(0x01);
+			BitWriter bw(out);
+			bw.Write(1, 1);		// final block
+			bw.Write(1, 2);		// fixed Huffman
+			const size_t distances[2] = { 4, stride };
+			size_t i = 0, n = data.size();
+			while (i < n)
+			{
+				size_t best = 0, bestDistance = 0;
+				for (int d = 0; d < 2; ++d)
+				{
+					size_t distance = distances[d];
+					if (distance > i || distance > 32768)
+						continue;
+					size_t length = 0;
+					while (length < 258 && i + length < n && data[i + length] == data[i + length - distance])
+						++length;
+					if (length > best)
+						best = length, bestDistance = distance;
+				}
+				if (best >= 3)
+				{
+					WriteMatch(bw, (int)best, (int)bestDistance);
+					i += best;
+				}
+				else
+					WriteFixedSymbol(bw, data[i++]);
+			}
+			WriteFixedSymbol(bw, 256);
+			bw.Flush();
+			uint32_t adler = Adler32(data.empty() ? NULL : &data[0], data.size());
+			for (int shift = 24; shift >= 0; shift -= 8)
+				out->push_back((unsigned char)(adler >> shift));
+		}
+
+		class BitReader
+		{
+		public:
+			BitReader(const unsigned char* data, size_t size) : _data(data), _size(size), _pos(0), _bit(0) {}
+
+			bool Read(int count, uint32_t* value)
+			{
+				*value = 0;
+				for (int i = 0; i < count; ++i)
+				{
+					if (_pos >= _size)
+						return false;
+					*value |= (uint32_t)((_data[_pos] >> _bit) & 1) << i;
+					if (++_bit == 8)
+						_bit = 0, ++_pos;
+				}
+				return true;
+			}
+			/* Appends count bits of a Huffman code, most significant first */
+			bool ReadCode(int count, uint32_t* code)
+			{
+				for (int i = 0; i < count; ++i)
+				{
+					uint32_t bit;
+					if (!Read(1, &bit))
+						return false;
+					*code = (*code << 1) | bit;
+				}
+				return true;
+			}
+			void AlignToByte()
+			{
+				if (_bit)
+					_bit = 0, ++_pos;
+			}
+			size_t Position() const { return _pos; }
+			void Skip(size_t bytes) { _pos += bytes; }
+
+		private:
+			const unsigned char* _data;
+			size_t _size, _pos;
+			int _bit;
+		};
+
+		inline bool ReadFixedSymbol(BitReader& br, int* symbol)
+		{
+			uint32_t code = 0;
+			if (!br.ReadCode(7, &code))
+				return false;
+			if (code <= 0x17)
+				return *symbol = 256 + code, true;
+			if (!br.ReadCode(1, &code))
+				return false;
+			if (code >= 0x30 && code <= 0xBF)
+				return *symbol = code - 0x30, true;
+			if (code >= 0xC0 && code <= 0xC7)
+				return *symbol = 280 + code - 0xC0, true;
+			if (!br.ReadCode(1, &code))
+				return false;
+			return *symbol = 144 + code - 0x190, true;
+		}
+
+		/* Stored and fixed Huffman blocks only */
+		inline bool Inflate(const unsigned char* data, size_t size, std::vector<unsigned char>* out)
+		{
+			if (size < 6 || (data[0] & 0x0F) != 8 || ((data[0] << 8) | data[1]) % 31 || (data[1] & 0x20))
+				return false;
+			BitReader br(data + 2, size - 6);
+			uint32_t last = 0;
+			while (!last)
+			{
+				uint32_t type;
+				if (!br.Read(1, &last) || !br.Read(2, &type))
+					return false;
+				if (type == 0)
+				{
+					br.AlignToByte();
+					size_t pos = br.Position();
+					if (pos + 4 > size - 6)
+						return false;
+					const unsigned char* p = data + 2 + pos;
+					size_t len = p[0] | (p[1] << 8), nlen = p[2] | (p[3] << 8);
+					if ((len ^ 0xFFFF) != nlen || pos + 4 + len > size - 6)
+						return false;
+					out->insert(out->end(), p + 4, p + 4 + len);
+					br.Skip(4 + len);
+				}
+				else if (type == 1)
+				{
+					for (;;)
+					{
+						int symbol;
+						if (!ReadFixedSymbol(br, &symbol) || symbol > 285)
+							return false;
+						if (symbol < 256)
+						{
+							out->push_back((unsigned char)symbol);
+							continue;
+						}
+						if (symbol == 256)
+							break;
+						uint32_t extra, code = 0;
+						if (!br.Read(kLengthExtra[symbol - 257], &extra))
+							return false;
+						size_t length = kLengthBase[symbol - 257] + extra;
+						if (!br.ReadCode(5, &code) || code > 29 || !br.Read(kDistanceExtra[code], &extra))
+							return false;
+						size_t distance = kDistanceBase[code] + extra;
+						if (distance > out->size())
+							return false;
+						for (size_t k = 0; k < length; ++k)
+							out->push_back((*out)[out->size() - distance]);
+					}
+				}
+				else
+					return false;
+			}
+			const unsigned char* p = data + size - 4;
+			uint32_t adler = ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+			return adler == Adler32(out->empty() ? NULL : &(*out)[0], out->size());
+		}
+
+		inline void WriteChunk(std::vector<unsigned char>* png, const char* type, const std::vector<unsigned char>& data)
+		{
+			uint32_t size = (uint32_t)data.size();
+			for (int shift = 24; shift >= 0; shift -= 8)
+				png->push_back((unsigned char)(size >> shift));
+			size_t start = png->size();
+			png->insert(png->end(), type, type + 4);
+			png->insert(png->end(), data.begin(), data.end());
+			uint32_t crc = Crc32(&(*png)[start], png->size() - start);
+			for (int shift = 24; shift >= 0; shift -= 8)
+				png->push_back((unsigned char)(crc >> shift));
+		}
+
+		inline uint32_t ReadBigEndian(const unsigned char* p)
+		{
+			return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+		}
+
+		inline int Paeth(int a, int b, int c)
+		{
+			int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+			return (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+		}
+
+		static const unsigned char kSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	};
+
+	inline bool EncodePng(const uint32_t* pixels, int width, int height, std::vector<unsigned char>* out)
+	{
+		if (width <= 0 || height <= 0)
+			return false;
+		out->assign(png::kSignature, png::kSignature + 8);
+		std::vector<unsigned char> header(13, 0);
+		for (int i = 0; i < 4; ++i)
+		{
+			header[i] = (unsigned char)(width >> (24 - i * 8));
+			header[4 + i] = (unsigned char)(height >> (24 - i * 8));
+		}
+		header[8] = 8;		// bit depth
+		header[9] = 6;		// RGBA
+		png::WriteChunk(out, "IHDR", header);
+
+		const size_t stride = (size_t)width * 4 + 1;
+		std::vector<unsigned char> raw;
+		raw.reserve(stride * height);
+		for (int y = 0; y < height; ++y)
+		{
+			raw.push_back(0);	// filter: none
+			for (int x = 0; x < width; ++x)
+			{
+				uint32_t c = pixels[(size_t)y * width + x];
+				unsigned int a = c >> 24;
+				unsigned int rgb[3] = { (c >> 16) & 0xFF, (c >> 8) & 0xFF, c & 0xFF };
+				for (int k = 0; k < 3; ++k)
+					raw.push_back(a ? (unsigned char)((rgb[k] * 255 + a / 2) / a) : 0);
+				raw.push_back((unsigned char)a);
+			}
+		}
+		std::vector<unsigned char> compressed;
+		png::Deflate(raw, stride, &compressed);
+		png::WriteChunk(out, "IDAT", compressed);
+		png::WriteChunk(out, "IEND", std::vector<unsigned char>());
+		return true;
+	}
+
+	inline bool DecodePng(const unsigned char* data, size_t size, std::vector<uint32_t>* pixels, int* width, int* height)
+	{
+		if (size < 8 || !std::equal(png::kSignature, png::kSignature + 8, data))
+			return false;
+		std::vector<unsigned char> compressed;
+		int w = 0, h = 0;
+		for (size_t pos = 8; pos + 12 <= size;)
+		{
+			uint32_t length = png::ReadBigEndian(data + pos);
+			const unsigned char* type = data + pos + 4;
+			const unsigned char* body = type + 4;
+			if (length > size - pos - 12 || png::Crc32(type, length + 4) != png::ReadBigEndian(body + length))
+				return false;
+			if (!memcmp(type, "IHDR", 4))
+			{
+				if (length != 13 || body[8] != 8 || body[9] != 6 || body[12] != 0)
+					return false;
+				w = (int)png::ReadBigEndian(body);
+				h = (int)png::ReadBigEndian(body + 4);
+			}
+			else if (!memcmp(type, "IDAT", 4))
+				compressed.insert(compressed.end(), body, body + length);
+			else if (!memcmp(type, "IEND", 4))
+				break;
+			pos += 12 + length;
+		}
+		std::vector<unsigned char> raw;
+		const size_t stride = (size_t)w * 4 + 1;
+		if (w <= 0 || h <= 0 || compressed.empty() ||
+			!png::Inflate(&compressed[0], compressed.size(), &raw) || raw.size() != stride * h)
+			return false;
+
+		for (int y = 0; y < h; ++y)
+		{
+			unsigned char* line = &raw[y * stride + 1];
+			const unsigned char* prev = y > 0 ? line - stride : NULL;
+			int filter = line[-1];
+			for (size_t i = 0; i < stride - 1; ++i)
+			{
+				int a = i >= 4 ? line[i - 4] : 0;
+				int b = prev ? prev[i] : 0;
+				int c = (prev && i >= 4) ? prev[i - 4] : 0;
+				int predicted;
+				switch (filter)
+				{
+				case 0: predicted = 0; break;
+				case 1: predicted = a; break;
+				case 2: predicted = b; break;
+				case 3: predicted = (a + b) / 2; break;
+				case 4: predicted = png::Paeth(a, b, c); break;
+				default: return false;
+				}
+				line[i] = (unsigned char)(line[i] + predicted);
+			}
+		}
+
+		pixels->resize((size_t)w * h);
+		for (int y = 0; y < h; ++y)
+			for (int x = 0; x < w; ++x)
+			{
+				const unsigned char* p = &raw[y * stride + 1 + x * 4];
+				unsigned int a = p[3];
+				(*pixels)[(size_t)y * w + x] = (a << 24) | (Div255(p[0] * a) << 16) | (Div255(p[1] * a) << 8) | Div255(p[2] * a);
+			}
+		*width = w;
+		*height = h;
+		return true;
+	}
+
+	inline bool WritePngFile(const char* path, const Framebuffer& fb)
+	{
+		std::vector<unsigned char> data;
+		if (!EncodePng(fb.Pixels(), fb.Width(), fb.Height(), &data))
+			return false;
+		std::ofstream file(path, std::ios::binary);
+		file.write((const char*)&data[0], data.size());
+		return file.good();
+	}
+
+	inline bool ReadPngFile(const char* path, Framebuffer* fb)
+	{
+		std::ifstream file(path, std::ios::binary);
+		std::vector<unsigned char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		std::vector<uint32_t> pixels;
+		int width, height;
+		if (data.empty() || !DecodePng(&data[0], data.size(), &pixels, &width, &height))
+			return false;
+		*fb = Framebuffer(width, height);
+		std::copy(pixels.begin(), pixels.end(), fb->Pixels());
+		return true;
+	}
+};
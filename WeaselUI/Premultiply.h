@@ -0,0 +1,141 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define WEASEL_PREMULTIPLY_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define WEASEL_TARGET_AVX2
+#else
+#define WEASEL_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace weasel
+{
+	/* x / 255 rounded to nearest, exact for x in [0, 255 * 255] */
+	inline unsigned int Div255(unsigned int x)
+	{
+		x += 128;
+		return (x + (x >> 8)) >> 8;
+	}
+
+	/*
+	 * Turns GDI text drawn white on black into premultiplied BGRA of one color.
+	 *
+	 * The blue channel of each 32bpp pixel holds the coverage; it becomes the
+	 * alpha, and each color channel becomes color * coverage / 255. The SIMD
+	 * versions are bit-exact with the scalar one.
+	 */
+	inline void PremultiplyCoverageScalar(uint32_t* pixels, size_t count, unsigned char r, unsigned char g, unsigned char b)
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			unsigned int a = pixels[i] & 0xFF;
+			pixels[i] = (a << 24) | (Div255(r * a) << 16) | (Div255(g * a) << 8) | Div255(b * a);
+		}
+	}
+
+#ifdef WEASEL_PREMULTIPLY_X86
+	/* BGRA of 2 pixels times the coverage in 16 bit lanes, divided by 255 and rounded */
+	static inline __m128i PremultiplyLanes(__m128i coverage, __m128i color)
+	{
+		__m128i x = _mm_add_epi16(_mm_mullo_epi16(coverage, color), _mm_set1_epi16(128));
+		return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+	}
+
+	inline void PremultiplyCoverageSSE2(uint32_t* pixels, size_t count, unsigned char r, unsigned char g, unsigned char b)
+	{
+		// alpha is coverage * 255 / 255, which is exact
+		const __m128i color = _mm_setr_epi16(b, g, r, 255, b, g, r, 255);
+		const __m128i mask = _mm_set1_epi32(0xFF);
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i*)(pixels + i)), mask);
+			a = _mm_or_si128(a, _mm_slli_epi32(a, 16));
+			__m128i lo = PremultiplyLanes(_mm_unpacklo_epi32(a, a), color);
+			__m128i hi = PremultiplyLanes(_mm_unpackhi_epi32(a, a), color);
+			_mm_storeu_si128((__m128i*)(pixels + i), _mm_packus_epi16(lo, hi));
+		}
+		PremultiplyCoverageScalar(pixels + i, count - i, r, g, b);
+	}
+
+	WEASEL_TARGET_AVX2 inline void PremultiplyCoverageAVX2(uint32_t* pixels, size_t count, unsigned char r, unsigned char g, unsigned char b)
+	{
+		const __m256i color = _mm256_setr_epi16(b, g, r, 255, b, g, r, 255, b, g, r, 255, b, g, r, 255);
+		const __m256i mask = _mm256_set1_epi32(0xFF);
+		const __m256i round = _mm256_set1_epi16(128);
+		size_t i = 0;
+		for (; i + 8 <= count; i += 8)
+		{
+			__m256i a = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(pixels + i)), mask);
+			a = _mm256_or_si256(a, _mm256_slli_epi32(a, 16));
+			// unpack and pack work within 128 bit lanes, so the pixel order survives
+			__m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi32(a, a), color), round);
+			__m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi32(a, a), color), round);
+			lo = _mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)), 8);
+			hi = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)), 8);
+			_mm256_storeu_si256((__m256i*)(pixels + i), _mm256_packus_epi16(lo, hi));
+		}
+		PremultiplyCoverageSSE2(pixels + i, count - i, r, g, b);
+	}
+
+	enum { CPU_SSE2 = 1, CPU_AVX2 = 2 };
+
+	inline int DetectCpuFeatures()
+	{
+		int features = 0;
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 0);
+		int maxLeaf = info[0];
+		__cpuid(info, 1);
+		if (info[3] & (1 << 26))
+			features |= CPU_SSE2;
+		// AVX2 also needs the OS to save the ymm registers
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		if (maxLeaf >= 7 && osxsave && (_xgetbv(0) & 6) == 6)
+		{
+			__cpuidex(info, 7, 0);
+			if (info[1] & (1 << 5))
+				features |= CPU_AVX2;
+		}
+#else
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("sse2"))
+			features |= CPU_SSE2;
+		if (__builtin_cpu_supports("avx2"))
+			features |= CPU_AVX2;
+#endif
+		return features;
+	}
+
+	/* DetectCpuFeatures, run once */
+	inline int GetCpuFeatures()
+	{
+		// constant initialized, so no guard is needed when loaded as a dll on XP; racing callers store the same value
+		static int features = -1;
+		if (features < 0)
+			features = DetectCpuFeatures();
+		return features;
+	}
+#endif
+
+	inline void PremultiplyCoverage(uint32_t* pixels, size_t count, unsigned char r, unsigned char g, unsigned char b)
+	{
+#ifdef WEASEL_PREMULTIPLY_X86
+		const int features = GetCpuFeatures();
+		if (features & CPU_AVX2)
+			PremultiplyCoverageAVX2(pixels, count, r, g, b);
+		else if (features & CPU_SSE2)
+			PremultiplyCoverageSSE2(pixels, count, r, g, b);
+		else
+#endif
+			PremultiplyCoverageScalar(pixels, count, r, g, b);
+	}
+};
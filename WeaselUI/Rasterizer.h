@@ -0,0 +1,258 @@
+#pragma once
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include "Premultiply.h"
+
+namespace weasel
+{
+	/* Premultiplied 32bpp pixels, as a top-down DIB section, and the rect drawing is clipped to */
+	struct PixelTarget
+	{
+		uint32_t* pixels;
+		int stride;		// in pixels
+		int left, top, right, bottom;
+
+		uint32_t* Row(int y) const { return pixels + (ptrdiff_t)y * stride; }
+	};
+
+	inline PixelTarget MakePixelTarget(uint32_t* pixels, int stride, int left, int top, int right, int bottom)
+	{
+		PixelTarget target = { pixels, stride, left, top, right, bottom };
+		return target;
+	}
+
+	/* Each channel of a premultiplied color times factor / 255 */
+	inline uint32_t ScalePixel(uint32_t color, unsigned int factor)
+	{
+		return (Div255((color >> 24) * factor) << 24) | (Div255(((color >> 16) & 0xFF) * factor) << 16) |
+			(Div255(((color >> 8) & 0xFF) * factor) << 8) | Div255((color & 0xFF) * factor);
+	}
+
+	/* Source over, with the premultiplied color scaled by coverage (0..255) */
+	inline void BlendPixel(uint32_t* dst, uint32_t color, unsigned int coverage = 255)
+	{
+		if (coverage != 255)
+			color = ScalePixel(color, coverage);
+		unsigned int inv = 255 - (color >> 24);
+		*dst = color + (inv == 255 ? *dst : ScalePixel(*dst, inv));
+	}
+
+	inline void BlendSpanScalar(uint32_t* dst, size_t count, uint32_t color)
+	{
+		for (size_t i = 0; i < count; ++i)
+			BlendPixel(dst + i, color);
+	}
+
+	/* dst = src + dst * (255 - src alpha) / 255, per pixel */
+	inline void BlendRowScalar(uint32_t* dst, const uint32_t* src, size_t count)
+	{
+		for (size_t i = 0; i < count; ++i)
+			if (src[i])
+				BlendPixel(dst + i, src[i]);
+	}
+
+#ifdef WEASEL_PREMULTIPLY_X86
+	/* Bit-exact with BlendSpanScalar: one color over 4 pixels at a time */
+	inline void BlendSpanSSE2(uint32_t* dst, size_t count, uint32_t color)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i src = _mm_set1_epi32((int)color);
+		const __m128i inv = _mm_set1_epi16((short)(255 - (color >> 24)));
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+			__m128i lo = PremultiplyLanes(inv, _mm_unpacklo_epi8(d, zero));
+			__m128i hi = PremultiplyLanes(inv, _mm_unpackhi_epi8(d, zero));
+			_mm_storeu_si128((__m128i*)(dst + i), _mm_add_epi8(_mm_packus_epi16(lo, hi), src));
+		}
+		BlendSpanScalar(dst + i, count - i, color);
+	}
+
+	inline void BlendRowSSE2(uint32_t* dst, const uint32_t* src, size_t count)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i full = _mm_set1_epi32(255);
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+			__m128i inv = _mm_sub_epi32(full, _mm_srli_epi32(s, 24));
+			inv = _mm_or_si128(inv, _mm_slli_epi32(inv, 16));
+			__m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+			__m128i lo = PremultiplyLanes(_mm_unpacklo_epi32(inv, inv), _mm_unpacklo_epi8(d, zero));
+			__m128i hi = PremultiplyLanes(_mm_unpackhi_epi32(inv, inv), _mm_unpackhi_epi8(d, zero));
+			_mm_storeu_si128((__m128i*)(dst + i), _mm_add_epi8(_mm_packus_epi16(lo, hi), s));
+		}
+		BlendRowScalar(dst + i, src + i, count - i);
+	}
+#endif
+
+	/* A premultiplied color over count pixels; opaque colors are a plain fill */
+	inline void BlendSpan(uint32_t* dst, size_t count, uint32_t color)
+	{
+		if (!(color >> 24))
+			return;
+		if ((color >> 24) == 255)
+		{
+			std::fill(dst, dst + count, color);
+			return;
+		}
+#ifdef WEASEL_PREMULTIPLY_X86
+		if (GetCpuFeatures() & CPU_SSE2)
+			return BlendSpanSSE2(dst, count, color);
+#endif
+		BlendSpanScalar(dst, count, color);
+	}
+
+	inline void BlendRow(uint32_t* dst, const uint32_t* src, size_t count)
+	{
+#ifdef WEASEL_PREMULTIPLY_X86
+		if (GetCpuFeatures() & CPU_SSE2)
+			return BlendRowSSE2(dst, src, count);
+#endif
+		BlendRowScalar(dst, src, count);
+	}
+
+	/* Composites a premultiplied image over the target with its top left corner at (x, y) */
+	inline void BlendImage(PixelTarget const& target, int x, int y, const uint32_t* src, int width, int height, int srcStride)
+	{
+		int left = (std::max)(x, target.left), right = (std::min)(x + width, target.right);
+		int top = (std::max)(y, target.top), bottom = (std::min)(y + height, target.bottom);
+		for (int row = top; row < bottom && left < right; ++row)
+			BlendRow(target.Row(row) + left, src + (ptrdiff_t)(row - y) * srcStride + (left - x), right - left);
+	}
+
+	/*
+	 * Signed distance to a rounded rect, negative inside. Pixels are sampled
+	 * at their centers and covered by clamp(0.5 - distance), which is the
+	 * exact area along straight edges and close to it around the corners.
+	 */
+	class RoundRectDistance
+	{
+	public:
+		RoundRectDistance(float left, float top, float right, float bottom, float radius)
+			: _cx((left + right) / 2), _cy((top + bottom) / 2), _hw((right - left) / 2), _hh((bottom - top) / 2), _r(radius) {}
+
+		float operator()(float px, float py) const
+		{
+			float qx = fabsf(px - _cx) - (_hw - _r), qy = fabsf(py - _cy) - (_hh - _r);
+			float ox = (std::max)(qx, 0.0f), oy = (std::max)(qy, 0.0f);
+			return sqrtf(ox * ox + oy * oy) + (std::min)((std::max)(qx, qy), 0.0f) - _r;
+		}
+		/* Distance to the nearer horizontal edge, and the one from the corner arcs' centers */
+		float EdgeY(float py) const { return fabsf(py - _cy) - _hh; }
+		float ArcY(float py) const { return fabsf(py - _cy) - (_hh - _r); }
+
+	private:
+		float _cx, _cy, _hw, _hh, _r;
+	};
+
+	inline unsigned int CoverageByte(float coverage)
+	{
+		if (coverage <= 0.0f)
+			return 0;
+		if (coverage >= 1.0f)
+			return 255;
+		return (unsigned int)(coverage * 255 + 0.5f);
+	}
+
+	inline void BlendCoverage(uint32_t* row, int x, uint32_t color, unsigned int coverage)
+	{
+		if (coverage)
+			BlendPixel(row + x, color, coverage);
+	}
+
+	/*
+	 * Fills a rounded rect whose corners are quarter circles of radius,
+	 * clamped to half the size, as the GDI+ round rect path was. Within each row
+	 * the pixels between the corners share one coverage and are blended as a
+	 * span; only the corner pixels are computed one by one.
+	 */
+	inline void FillRoundRect(PixelTarget const& target, int left, int top, int right, int bottom, int radius, uint32_t color)
+	{
+		if (!(color >> 24) || right <= left || bottom <= top)
+			return;
+		int r = (std::max)((std::min)(radius, (std::min)((right - left) / 2, (bottom - top) / 2)), 0);
+		RoundRectDistance distance((float)left, (float)top, (float)right, (float)bottom, (float)r);
+		// pixels clear of the corners, and whole pixels in from the sides, only depend on the row
+		int x0 = (std::max)(left + r, target.left), x1 = (std::min)(right - r, target.right);
+		int bl = (std::max)(left, target.left), br = (std::min)(right, target.right);
+		int bt = (std::max)(top, target.top), bb = (std::min)(bottom, target.bottom);
+		for (int y = bt; y < bb; ++y)
+		{
+			uint32_t* row = target.Row(y);
+			const float py = y + 0.5f;
+			if (x0 < x1)
+			{
+				unsigned int coverage = CoverageByte(0.5f - distance.EdgeY(py));
+				BlendSpan(row + x0, x1 - x0, coverage == 255 ? color : ScalePixel(color, coverage));
+			}
+			for (int x = bl; x < br; ++x)
+			{
+				if (x == x0 && x0 < x1)
+					x = x1;
+				if (x >= br)
+					break;
+				BlendCoverage(row, x, color, CoverageByte(0.5f - distance(x + 0.5f, py)));
+			}
+		}
+	}
+
+	/*
+	 * Strokes a rounded rect with a pen of width centered on the outline, as
+	 * Gdiplus::Graphics::DrawPath. Rows crossing the top or bottom edge blend
+	 * their straight part as a span; other rows only visit the pixels near
+	 * the left and right edges.
+	 */
+	inline void StrokeRoundRect(PixelTarget const& target, int left, int top, int right, int bottom, int radius, int width, uint32_t color)
+	{
+		if (!(color >> 24) || width <= 0 || right <= left || bottom <= top)
+			return;
+		const float half = width / 2.0f;
+		const int reach = (int)ceilf(half) + 1;
+		int r = (std::max)((std::min)(radius, (std::min)((right - left) / 2, (bottom - top) / 2)), 0);
+		RoundRectDistance distance((float)left, (float)top, (float)right, (float)bottom, (float)r);
+		int bl = (std::max)(left - reach, target.left), br = (std::min)(right + reach, target.right);
+		int bt = (std::max)(top - reach, target.top), bb = (std::min)(bottom + reach, target.bottom);
+		for (int y = bt; y < bb; ++y)
+		{
+			uint32_t* row = target.Row(y);
+			const float py = y + 0.5f;
+			const float ey = distance.EdgeY(py), qy = distance.ArcY(py);
+			int x0 = br, x1 = br;		// the span sharing one coverage, if any
+			if (qy > 0 || ey >= -(half + 0.5f))
+			{
+				// where the distance is ey: between the arcs, and no closer to a side than to the top or bottom
+				float e = qy > 0 ? -(float)r : (std::min)(-(float)r, ey);
+				x0 = (std::max)((int)ceilf(left - e - 0.5f), bl);
+				x1 = (std::min)((int)floorf(right + e - 0.5f) + 1, br);
+				if (x0 < x1)
+				{
+					unsigned int coverage = CoverageByte(half + 0.5f - fabsf(ey));
+					if (coverage)
+						BlendSpan(row + x0, x1 - x0, coverage == 255 ? color : ScalePixel(color, coverage));
+				}
+				else
+					x0 = x1 = br;
+			}
+			else
+			{
+				// inside the straight sides, only pixels within the pen of them are touched
+				x0 = (std::max)(left + reach, bl);
+				x1 = (std::max)((std::min)(right - reach, br), x0);
+			}
+			for (int x = bl; x < br; ++x)
+			{
+				if (x == x0)
+					x = x1;
+				if (x >= br)
+					break;
+				BlendCoverage(row, x, color, CoverageByte(half + 0.5f - fabsf(distance(x + 0.5f, py))));
+			}
+		}
+	}
+};
@@ -1,17 +1,129 @@
 #include "stdafx.h"
 #include "StandardLayout.h"
+#include <WeaselProfiler.h>
 
 using namespace weasel;
 
-StandardLayout::StandardLayout(const UIStyle &style, const Context &context, const Status &status)
-	: Layout(style, context, status)
+namespace
 {
+	/* Measures with the label, text and comment fonts of pFonts, at the dpi of dc */
+	class GDIMeasurer : public TextMeasurer
+	{
+	public:
+		GDIMeasurer(const StandardLayout& layout, CDCHandle dc, GDIFonts* pFonts)
+			: _layout(layout), _dc(dc), _oldFont(NULL), _selected(-1)
+		{
+			const int dpi = dc.GetDeviceCaps(LOGPIXELSY);
+			_fonts[LABEL_FONT].CreateFontW(-MulDiv(pFonts->_LabelFontPoint, dpi, 72), 0, 0, 0, 0, 0, 0, 0, DEFAULT_CHARSET, 0, 0, 0, 0, pFonts->_LabelFontFace.c_str());
+			_fonts[TEXT_FONT].CreateFontW(-MulDiv(pFonts->_TextFontPoint, dpi, 72), 0, 0, 0, 0, 0, 0, 0, DEFAULT_CHARSET, 0, 0, 0, 0, pFonts->_TextFontFace.c_str());
+			_fonts[COMMENT_FONT].CreateFontW(-MulDiv(pFonts->_CommentFontPoint, dpi, 72), 0, 0, 0, 0, 0, 0, 0, DEFAULT_CHARSET, 0, 0, 0, 0, pFonts->_CommentFontFace.c_str());
+		}
+
+		~GDIMeasurer()
+		{
+			// deselected before the fonts are deleted
+			if (_selected >= 0)
+				_dc.SelectFont(_oldFont);
+		}
+
+		virtual void Measure(Font font, const std::wstring& text, size_t count, int* cx, int* cy)
+		{
+			// the auxiliary text is drawn with the text font
+			if (font == AUX_FONT)
+				font = TEXT_FONT;
+			if (font != _selected)
+			{
+				HFONT oldFont = _dc.SelectFont(_fonts[font]);
+				if (_selected < 0)
+					_oldFont = oldFont;
+				_selected = font;
+			}
+			SIZE size = { 0, 0 };
+			_layout.GetTextExtentDCMultiline(_dc, text, (int)count, &size);
+			*cx = size.cx;
+			*cy = size.cy;
+		}
+
+	private:
+		const StandardLayout& _layout;
+		CDCHandle _dc;
+		CFont _fonts[AUX_FONT];
+		HFONT _oldFont;
+		int _selected;
+	};
+
+	/* Measures with the text formats of pDWR, and the auxiliary text with the font selected in dc */
+	class DirectWriteMeasurer : public TextMeasurer
+	{
+	public:
+		DirectWriteMeasurer(const StandardLayout& layout, CDCHandle dc, DirectWriteResources* pDWR)
+			: _layout(layout), _dc(dc), _pDWR(pDWR)
+		{
+			_formats[LABEL_FONT] = pDWR->pLabelTextFormat;
+			_formats[TEXT_FONT] = pDWR->pTextFormat;
+			_formats[COMMENT_FONT] = pDWR->pCommentTextFormat;
+		}
+
+		virtual void Measure(Font font, const std::wstring& text, size_t count, int* cx, int* cy)
+		{
+			SIZE size = { 0, 0 };
+			if (font == AUX_FONT)
+				_layout.GetTextExtentDCMultiline(_dc, text, (int)count, &size);
+			else
+				_layout.GetTextSizeDW(text, (int)count, _formats[font], _pDWR, &size);
+			*cx = size.cx;
+			*cy = size.cy;
+		}
+
+	private:
+		const StandardLayout& _layout;
+		CDCHandle _dc;
+		DirectWriteResources* _pDWR;
+		IDWriteTextFormat* _formats[AUX_FONT];
+	};
+}
+
+StandardLayout::StandardLayout(const UIStyle &style, const Context &context, const Status &status, int statusIconSize, LayoutEngine::Direction direction)
+	: Layout(style, context, status), _engine(style, context, status, direction), _statusIconSize(statusIconSize)
+{
+	StandardLayout::Reset(statusIconSize);
+}
+
+void StandardLayout::Reset(int statusIconSize)
+{
+	_statusIconSize = statusIconSize;
+	// the rect vectors keep their capacity, so pages of the same size lay out without allocating
+	_rects.Reset(_context.cinfo.candies.size());
+}
+
+void StandardLayout::Assign(const Layout& other)
+{
+	const StandardLayout& layout = static_cast<const StandardLayout&>(other);
+	_statusIconSize = layout._statusIconSize;
+	_rects = layout._rects;
+}
+
+void StandardLayout::DoLayout(CDCHandle dc, GDIFonts* pFonts)
+{
+	GDIMeasurer measurer(*this, dc, pFonts);
+	_engine.DoLayout(measurer, _statusIconSize, &_rects);
+}
+
+void StandardLayout::DoLayout(CDCHandle dc, DirectWriteResources* pDWR)
+{
+	DirectWriteMeasurer measurer(*this, dc, pDWR);
+	_engine.DoLayout(measurer, _statusIconSize, &_rects);
+}
+
+void StandardLayout::UpdateHighlightRect()
+{
+	_engine.UpdateHighlight(&_rects);
 }
+
 std::wstring StandardLayout::GetLabelText(const std::vector<Text> &labels, int id, const wchar_t *format) const
 {
-	wchar_t buffer[128];
-	swprintf_s<128>(buffer, format, labels.at(id).str.c_str());
-	return std::wstring(buffer);
+	// as measured by the layout engine
+	return LayoutEngine::FormatLabel(format, labels.at(id).str);
 }
 
 // std::wstring汾
@@ -61,6 +173,7 @@ std::wstring StandardLayout::ConvertCRLF(std::wstring strString, std::wstring st
 
 void weasel::StandardLayout::GetTextExtentDCMultiline(CDCHandle dc, std::wstring wszString, int nCount, LPSIZE lpSize) const
 {
+	ProfileScope profile(PROFILE_MEASURE_TEXT);
 	RECT TextArea = { 0, 0, 0, 0 };
 	wszString = ConvertCRLF(wszString,  L"\r");
 	DrawText(dc, wszString.c_str(), nCount, &TextArea, DT_CALCRECT);
@@ -68,135 +181,27 @@ void weasel::StandardLayout::GetTextExtentDCMultiline(CDCHandle dc, std::wstring
 	lpSize->cy = TextArea.bottom - TextArea.top;
 }
 
-void weasel::StandardLayout::GetTextSizeDW(const std::wstring text, int nCount, IDWriteTextFormat* pTextFormat, IDWriteFactory* pDWFactory, LPSIZE lpSize) const
-{
-	D2D1_SIZE_F sz;
-	HRESULT hr = S_OK;
-	IDWriteTextLayout* pTextLayout = NULL;
-
-	// ı 
-	if(pTextFormat != NULL)
-		hr = pDWFactory->CreateTextLayout(text.c_str(), nCount, pTextFormat, 0.0f, 0.0f, &pTextLayout);
-	if (SUCCEEDED(hr))
-	{
-		// ȡıߴ  
-		DWRITE_TEXT_METRICS textMetrics;
-		hr = pTextLayout->GetMetrics(&textMetrics);
-		sz = D2D1::SizeF(ceil(textMetrics.width), ceil(textMetrics.height));
-		lpSize->cx = (int)sz.width;
-		lpSize->cy = (int)sz.height;
-	}
-	SafeRelease(&pTextLayout);
-}
-
-CSize StandardLayout::GetPreeditSize(CDCHandle dc) const
-{
-	const std::wstring &preedit = _context.preedit.str;
-	const std::vector<weasel::TextAttribute> &attrs = _context.preedit.attributes;
-	CSize size(0, 0);
-	if (!preedit.empty())
-	{
-		GetTextExtentDCMultiline(dc, preedit, preedit.length(), &size);
-		for (size_t i = 0; i < attrs.size(); i++)
-		{
-			if (attrs[i].type == weasel::HIGHLIGHTED)
-			{
-				const weasel::TextRange &range = attrs[i].range;
-				if (range.start < range.end)
-				{
-					if (range.start > 0)
-						size.cx += _style.hilite_spacing;
-					else
-						size.cx += _style.hilite_padding;
-					if (range.end < static_cast<int>(preedit.length()))
-						size.cx += _style.hilite_spacing;
-					else
-						size.cx += _style.hilite_padding;
-				}
-			}
-		}
-	}
-	return size;
-}
-
-CSize StandardLayout::GetPreeditSize(CDCHandle dc, IDWriteTextFormat* pTextFormat, IDWriteFactory* pDWFactory) const
-{
-	const std::wstring &preedit = _context.preedit.str;
-	const std::vector<weasel::TextAttribute> &attrs = _context.preedit.attributes;
-	CSize size(0, 0);
-	if (!preedit.empty())
-	{
-		GetTextSizeDW(preedit, preedit.length(), pTextFormat, pDWFactory, &size);
-		for (size_t i = 0; i < attrs.size(); i++)
-		{
-			if (attrs[i].type == weasel::HIGHLIGHTED)
-			{
-				const weasel::TextRange &range = attrs[i].range;
-				if (range.start < range.end)
-				{
-					if (range.start > 0)
-						size.cx += _style.hilite_spacing;
-					else
-						size.cx += _style.hilite_padding;
-					if (range.end < static_cast<int>(preedit.length()))
-						size.cx += _style.hilite_spacing;
-					else
-						size.cx += _style.hilite_padding;
-				}
-			}
-		}
-	}
-	return size;
-}
-void StandardLayout::UpdateStatusIconLayout(int* width, int* height)
+void weasel::StandardLayout::GetTextSizeDW(const std::wstring text, int nCount, IDWriteTextFormat* pTextFormat, DirectWriteResources* pDWR, LPSIZE lpSize) const
 {
-	// rule 1. status icon is middle-aligned with preedit text or auxiliary text, whichever comes first
-	// rule 2. there is a spacing between preedit/aux text and the status icon
-	// rule 3. status icon is right aligned in WeaselPanel, when [margin_x + width(preedit/aux) + spacing + width(icon) + margin_x] < style.min_width
-	if (ShouldDisplayStatusIcon())
+	ProfileScope profile(PROFILE_MEASURE_TEXT);
+	// the layout is cached, drawing the same text later reuses it
+	IDWriteTextLayout* pTextLayout = pDWR->GetTextLayout(nCount < (int)text.length() ? text.substr(0, nCount) : text, pTextFormat);
+	if (pTextLayout == NULL)
+		return;
+	DWRITE_TEXT_METRICS textMetrics;
+	if (SUCCEEDED(pTextLayout->GetMetrics(&textMetrics)))
 	{
-		int left = 0, middle = 0;
-		if (!_preeditRect.IsRectNull())
-		{
-			left = _preeditRect.right + _style.spacing;
-			middle = (_preeditRect.top + _preeditRect.bottom) / 2;
-		}
-		else if (!_auxiliaryRect.IsRectNull())
-		{
-			left = _auxiliaryRect.right + _style.spacing;
-			middle = (_auxiliaryRect.top + _auxiliaryRect.bottom) / 2;
-		}
-		if (left && middle)
-		{
-			int right_alignment = *width - _style.margin_x - STATUS_ICON_SIZE;
-			if (left > right_alignment)
-			{
-				*width = left + STATUS_ICON_SIZE + _style.margin_x;
-			}
-			else
-			{
-				left = right_alignment;
-			}
-			_statusIconRect.SetRect(left, middle - STATUS_ICON_SIZE / 2, left + STATUS_ICON_SIZE, middle + STATUS_ICON_SIZE / 2);
-		}
-		else
-		{
-			_statusIconRect.SetRect(0, 0, STATUS_ICON_SIZE, STATUS_ICON_SIZE);
-			*width = *height = STATUS_ICON_SIZE;
-		}
+		lpSize->cx = (int)ceil(textMetrics.width);
+		lpSize->cy = (int)ceil(textMetrics.height);
 	}
 }
 
 bool StandardLayout::IsInlinePreedit() const
 {
-	return _style.inline_preedit && (_style.client_caps & weasel::INLINE_PREEDIT_CAPABLE) != 0 &&
-		_style.layout_type != UIStyle::LAYOUT_VERTICAL_FULLSCREEN && _style.layout_type != UIStyle::LAYOUT_HORIZONTAL_FULLSCREEN;
+	return LayoutEngine::IsInlinePreedit(_style);
 }
 
 bool StandardLayout::ShouldDisplayStatusIcon() const
 {
-	// rule 1. emphasis ascii mode
-	// rule 2. show status icon when switching mode
-	// rule 3. always show status icon with tips 
-	return _status.ascii_mode || !_status.composing || !_context.aux.empty();
+	return LayoutEngine::ShouldDisplayStatusIcon(_context, _status);
 }
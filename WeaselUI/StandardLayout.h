@@ -1,51 +1,52 @@
 #pragma once
 
 #include "Layout.h"
+#include "LayoutEngine.h"
 #include <d2d1.h>
 #include <dwrite.h>
-#pragma comment(lib, "d2d1.lib")
-#pragma comment(lib, "dwrite.lib")
 
 namespace weasel
 {
-	const int MAX_CANDIDATES_COUNT = 10;
-	const int STATUS_ICON_SIZE = GetSystemMetrics(SM_CXICON);
 	class StandardLayout: public Layout
 	{
 	public:
-		StandardLayout(const UIStyle &style, const Context &context, const Status &status);
+		/* statusIconSize is SM_CXICON at the dpi of the panel; candidates are laid out as direction */
+		StandardLayout(const UIStyle &style, const Context &context, const Status &status, int statusIconSize, LayoutEngine::Direction direction);
 
 		/* Layout */
 
-		virtual void DoLayout(CDCHandle dc, GDIFonts* pFonts = 0) = 0;
-		virtual void DoLayout(CDCHandle dc, DirectWriteResources* pDWR) = 0;
-		virtual CSize GetContentSize() const { return _contentSize; }
-		virtual CRect GetPreeditRect() const { return _preeditRect; }
-		virtual CRect GetAuxiliaryRect() const { return _auxiliaryRect; }
-		virtual CRect GetHighlightRect() const { return _highlightRect; }
-		virtual CRect GetCandidateLabelRect(int id) const { return _candidateLabelRects[id]; }
-		virtual CRect GetCandidateTextRect(int id) const { return _candidateTextRects[id]; }
-		virtual CRect GetCandidateCommentRect(int id) const { return _candidateCommentRects[id]; }
-		virtual CRect GetStatusIconRect() const { return _statusIconRect; }
+		virtual void DoLayout(CDCHandle dc, GDIFonts* pFonts = 0);
+		virtual void DoLayout(CDCHandle dc, DirectWriteResources* pDWR);
+		virtual void UpdateHighlightRect();
+		virtual CSize GetContentSize() const { return CSize(_rects.width, _rects.height); }
+		virtual CRect GetPreeditRect() const { return ToCRect(_rects.preedit); }
+		virtual CRect GetAuxiliaryRect() const { return ToCRect(_rects.aux); }
+		virtual CRect GetHighlightRect() const { return ToCRect(_rects.highlight); }
+		virtual size_t GetCandidateCount() const { return _rects.texts.size(); }
+		virtual CRect GetCandidateLabelRect(int id) const { return _IsCandidate(id) ? ToCRect(_rects.labels[id]) : CRect(); }
+		virtual CRect GetCandidateTextRect(int id) const { return _IsCandidate(id) ? ToCRect(_rects.texts[id]) : CRect(); }
+		virtual CRect GetCandidateCommentRect(int id) const { return _IsCandidate(id) ? ToCRect(_rects.comments[id]) : CRect(); }
+		virtual CRect GetCandidateBackRect(int id) const { return _IsCandidate(id) ? ToCRect(_rects.backs[id]) : CRect(); }
+		virtual CRect GetStatusIconRect() const { return ToCRect(_rects.statusIcon); }
 		virtual std::wstring GetLabelText(const std::vector<Text> &labels, int id, const wchar_t *format) const;
 		virtual bool IsInlinePreedit() const;
 		virtual bool ShouldDisplayStatusIcon() const;
+		virtual void Reset(int statusIconSize);
+		virtual void Assign(const Layout& other);
 
 		void GetTextExtentDCMultiline(CDCHandle dc, std::wstring wszString, int nCount, LPSIZE lpSize) const;
 		std::wstring StandardLayout::ConvertCRLF(std::wstring strString, std::wstring strCRLF) const;
-		void GetTextSizeDW(const std::wstring text, int nCount, IDWriteTextFormat* pTextFormat, IDWriteFactory* pDWFactory, LPSIZE lpSize) const;
+		void GetTextSizeDW(const std::wstring text, int nCount, IDWriteTextFormat* pTextFormat, DirectWriteResources* pDWR, LPSIZE lpSize) const;
 
 	protected:
 		/* Utility functions */
-		CSize GetPreeditSize(CDCHandle dc) const;
-		CSize GetPreeditSize(CDCHandle dc, IDWriteTextFormat* pTextFormat, IDWriteFactory* pDWFactory) const;
-		void UpdateStatusIconLayout(int* width, int* height);
+		static CRect ToCRect(const FbRect& rc) { return CRect(rc.left, rc.top, rc.right, rc.bottom); }
+		static FbRect ToFbRect(const CRect& rc) { return MakeFbRect(rc.left, rc.top, rc.right, rc.bottom); }
+		bool _IsCandidate(int id) const { return id >= 0 && (size_t)id < _rects.texts.size(); }
 
-		CSize _contentSize;
-		CRect _preeditRect, _auxiliaryRect, _highlightRect;
-		CRect _candidateLabelRects[MAX_CANDIDATES_COUNT];
-		CRect _candidateTextRects[MAX_CANDIDATES_COUNT];
-		CRect _candidateCommentRects[MAX_CANDIDATES_COUNT];
-		CRect _statusIconRect;
+		/* one rect per candidate of the context as of the last Reset; the vectors keep their capacity */
+		LayoutRects _rects;
+		LayoutEngine _engine;
+		int _statusIconSize;
 	};
 };
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <utility>
+#include <vector>
+#include <WeaselCommon.h>
+#include "Framebuffer.h"
+
+namespace weasel
+{
+	/* SM_CXICON at dpi: 32 pixels at 96 dpi, scaled as GetSystemMetricsForDpi does */
+	inline int StatusIconSize(int dpi)
+	{
+		return (32 * dpi + 48) / 96;
+	}
+
+	/* Cells of the atlas, for IDI_ZH, IDI_EN and IDI_RELOAD */
+	enum StatusIconKind
+	{
+		STATUS_ICON_ENABLED,
+		STATUS_ICON_ALPHA,
+		STATUS_ICON_DISABLED,
+		STATUS_ICON_COUNT
+	};
+
+	inline StatusIconKind GetStatusIconKind(Status const& status)
+	{
+		return status.disabled ? STATUS_ICON_DISABLED : status.ascii_mode ? STATUS_ICON_ALPHA : STATUS_ICON_ENABLED;
+	}
+
+	/*
+	 * The status icons rasterized once per dpi into a premultiplied strip of
+	 * STATUS_ICON_COUNT square cells, StatusIconSize(dpi) wide each, so that a
+	 * paint only blends pixels. A strip is kept for each dpi the panel has
+	 * been shown at, up to MAX_DPIS; all are dropped when the dpi settings change.
+	 */
+	class StatusIconAtlas
+	{
+	public:
+		enum { MAX_DPIS = 4 };
+
+		/* The strip for dpi, or NULL until it is added */
+		const Framebuffer* Find(int dpi) const
+		{
+			for (size_t i = 0; i < _strips.size(); ++i)
+				if (_strips[i].first == dpi)
+					return &_strips[i].second;
+			return NULL;
+		}
+
+		/* A transparent strip for dpi to rasterize the icons into, replacing the oldest one when full */
+		Framebuffer* Add(int dpi)
+		{
+			for (size_t i = 0; i < _strips.size(); ++i)
+			{
+				if (_strips[i].first == dpi)
+				{
+					_strips.erase(_strips.begin() + i);
+					break;
+				}
+			}
+			if (_strips.size() >= MAX_DPIS)
+				_strips.erase(_strips.begin());
+			const int size = StatusIconSize(dpi);
+			_strips.push_back(std::make_pair(dpi, Framebuffer(size * STATUS_ICON_COUNT, size)));
+			return &_strips.back().second;
+		}
+
+		/* Blends the icon with its top left corner at (x, y); false if there is no strip for dpi */
+		bool Draw(PixelTarget const& target, int x, int y, int dpi, StatusIconKind kind) const
+		{
+			const Framebuffer* strip = Find(dpi);
+			if (!strip || !strip->Pixels())
+				return false;
+			const int size = strip->Height();
+			BlendImage(target, x, y, strip->Pixels() + kind * size, size, size, strip->Width());
+			return true;
+		}
+
+		void Clear() { _strips.clear(); }
+		size_t Size() const { return _strips.size(); }
+
+	private:
+		// oldest first
+		std::vector<std::pair<int, Framebuffer> > _strips;
+	};
+};
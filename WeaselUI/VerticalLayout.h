@@ -4,12 +4,10 @@
 
 namespace weasel
 {
+	/* Candidates one below the other, in columns of style.grid_rows if set */
 	class VerticalLayout: public StandardLayout
 	{
 	public:
-		VerticalLayout(const UIStyle &style, const Context &context, const Status &status);
-
-		virtual void DoLayout(CDCHandle dc, GDIFonts* pFonts = 0);
-		virtual void DoLayout(CDCHandle dc, DirectWriteResources* pDWR);
+		VerticalLayout(const UIStyle &style, const Context &context, const Status &status, int statusIconSize);
 	};
 };
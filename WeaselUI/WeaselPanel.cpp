@@ -8,345 +8,32 @@
 #include "VerticalLayout.h"
 #include "HorizontalLayout.h"
 #include "FullScreenLayout.h"
+#include "Premultiply.h"
+#include "Framebuffer.h"
+#include "StatusIconAtlas.h"
+#include "MonitorCache.h"
+#include <WeaselProfiler.h>
 
 // for IDI_ZH, IDI_EN
 #include <resource.h>
 
-using namespace Gdiplus;
 using namespace weasel;
 using namespace std;
 
-/* start image gauss blur functions from https://github.com/kenjinote/DropShadow/  */
-#define myround(x) (int)((x)+0.5)
+// colorized GDI text lines kept for reuse, 4 MB holds a few hundred candidate runs
+static const size_t GLYPH_RUN_CACHE_BUDGET = 4 * 1024 * 1024;
 
-inline void boxesForGauss(double sigma, int* sizes, int n)
+bool GlyphRunKey::operator<(GlyphRunKey const& other) const
 {
-	double wIdeal = sqrt((12 * sigma * sigma / n) + 1);
-	int wl = (int)floor(wIdeal);
-	if (wl % 2 == 0) --wl;
-
-	const double wu = (double)wl + 2;
-
-	const double mIdeal = (12 * sigma * sigma - n * (LONGLONG)wl * wl - 4 *(LONGLONG)n * wl - 3 * (LONGLONG)n) / (-4 * (LONGLONG)wl - 4);
-	const int m = myround(mIdeal);
-
-	for (int i = 0; i < n; ++i)
-		sizes[i] = int(i < m ? wl : wu);
-}
-
-inline void boxBlurH_4(BYTE* scl, BYTE* tcl, int w, int h, int r, int bpp, int stride)
-{
-	float iarr = (float)(1. / ((LONGLONG)r + r + 1));
-	for (int i = 0; i < h; ++i) {
-		int ti1 = i * stride;
-		int ti2 = i * stride + 1;
-		int ti3 = i * stride + 2;
-		int ti4 = i * stride + 3;
-
-		int li1 = ti1;
-		int li2 = ti2;
-		int li3 = ti3;
-		int li4 = ti4;
-
-		int ri1 = ti1 + r * bpp;
-		int ri2 = ti2 + r * bpp;
-		int ri3 = ti3 + r * bpp;
-		int ri4 = ti4 + r * bpp;
-
-		int fv1 = scl[ti1];
-		int fv2 = scl[ti2];
-		int fv3 = scl[ti3];
-		int fv4 = scl[ti4];
-
-		int lv1 = scl[ti1 + (w - 1) * bpp];
-		int lv2 = scl[ti2 + (w - 1) * bpp];
-		int lv3 = scl[ti3 + (w - 1) * bpp];
-		int lv4 = scl[ti4 + (w - 1) * bpp];
-
-		int val1 = (r + 1) * fv1;
-		int val2 = (r + 1) * fv2;
-		int val3 = (r + 1) * fv3;
-		int val4 = (r + 1) * fv4;
-
-		for (int j = 0; j < r; ++j) {
-			val1 += scl[ti1 + j * bpp];
-			val2 += scl[ti2 + j * bpp];
-			val3 += scl[ti3 + j * bpp];
-			val4 += scl[ti4 + j * bpp];
-		}
-
-		for (int j = 0; j <= r; ++j) {
-			val1 += scl[ri1] - fv1;
-			val2 += scl[ri2] - fv2;
-			val3 += scl[ri3] - fv3;
-			val4 += scl[ri4] - fv4;
-
-			tcl[ti1] = myround(val1 * iarr);
-			tcl[ti2] = myround(val2 * iarr);
-			tcl[ti3] = myround(val3 * iarr);
-			tcl[ti4] = myround(val4 * iarr);
-
-			ri1 += bpp;
-			ri2 += bpp;
-			ri3 += bpp;
-			ri4 += bpp;
-
-			ti1 += bpp;
-			ti2 += bpp;
-			ti3 += bpp;
-			ti4 += bpp;
-		}
-
-		for (int j = r + 1; j < w - r; ++j) {
-			val1 += scl[ri1] - scl[li1];
-			val2 += scl[ri2] - scl[li2];
-			val3 += scl[ri3] - scl[li3];
-			val4 += scl[ri4] - scl[li4];
-
-			tcl[ti1] = myround(val1 * iarr);
-			tcl[ti2] = myround(val2 * iarr);
-			tcl[ti3] = myround(val3 * iarr);
-			tcl[ti4] = myround(val4 * iarr);
-
-			ri1 += bpp;
-			ri2 += bpp;
-			ri3 += bpp;
-			ri4 += bpp;
-
-			li1 += bpp;
-			li2 += bpp;
-			li3 += bpp;
-			li4 += bpp;
-
-			ti1 += bpp;
-			ti2 += bpp;
-			ti3 += bpp;
-			ti4 += bpp;
-		}
-
-		for (int j = w - r; j < w; ++j) {
-			val1 += lv1 - scl[li1];
-			val2 += lv2 - scl[li2];
-			val3 += lv3 - scl[li3];
-			val4 += lv4 - scl[li4];
-
-			tcl[ti1] = myround(val1 * iarr);
-			tcl[ti2] = myround(val2 * iarr);
-			tcl[ti3] = myround(val3 * iarr);
-			tcl[ti4] = myround(val4 * iarr);
-
-			li1 += bpp;
-			li2 += bpp;
-			li3 += bpp;
-			li4 += bpp;
-
-			ti1 += bpp;
-			ti2 += bpp;
-			ti3 += bpp;
-			ti4 += bpp;
-		}
-	}
-}
-
-inline void boxBlurT_4(BYTE* scl, BYTE* tcl, int w, int h, int r, int bpp, int stride)
-{
-	float iarr = (float)(1.0f / (r + r + 1.0f));
-	for (int i = 0; i < w; ++i) {
-		int ti1 = i * bpp;
-		int ti2 = i * bpp + 1;
-		int ti3 = i * bpp + 2;
-		int ti4 = i * bpp + 3;
-
-		int li1 = ti1;
-		int li2 = ti2;
-		int li3 = ti3;
-		int li4 = ti4;
-
-		int ri1 = ti1 + r * stride;
-		int ri2 = ti2 + r * stride;
-		int ri3 = ti3 + r * stride;
-		int ri4 = ti4 + r * stride;
-
-		int fv1 = scl[ti1];
-		int fv2 = scl[ti2];
-		int fv3 = scl[ti3];
-		int fv4 = scl[ti4];
-
-		int lv1 = scl[ti1 + stride * (h - 1)];
-		int lv2 = scl[ti2 + stride * (h - 1)];
-		int lv3 = scl[ti3 + stride * (h - 1)];
-		int lv4 = scl[ti4 + stride * (h - 1)];
-
-		int val1 = (r + 1) * fv1;
-		int val2 = (r + 1) * fv2;
-		int val3 = (r + 1) * fv3;
-		int val4 = (r + 1) * fv4;
-
-		for (int j = 0; j < r; ++j) {
-			val1 += scl[ti1 + j * stride];
-			val2 += scl[ti2 + j * stride];
-			val3 += scl[ti3 + j * stride];
-			val4 += scl[ti4 + j * stride];
-		}
-
-		for (int j = 0; j <= r; ++j) {
-			val1 += scl[ri1] - fv1;
-			val2 += scl[ri2] - fv2;
-			val3 += scl[ri3] - fv3;
-			val4 += scl[ri4] - fv4;
-
-			tcl[ti1] = myround(val1 * iarr);
-			tcl[ti2] = myround(val2 * iarr);
-			tcl[ti3] = myround(val3 * iarr);
-			tcl[ti4] = myround(val4 * iarr);
-
-			ri1 += stride;
-			ri2 += stride;
-			ri3 += stride;
-			ri4 += stride;
-
-			ti1 += stride;
-			ti2 += stride;
-			ti3 += stride;
-			ti4 += stride;
-		}
-
-		for (int j = r + 1; j < h - r; ++j) {
-			val1 += scl[ri1] - scl[li1];
-			val2 += scl[ri2] - scl[li2];
-			val3 += scl[ri3] - scl[li3];
-			val4 += scl[ri4] - scl[li4];
-
-			tcl[ti1] = myround(val1 * iarr);
-			tcl[ti2] = myround(val2 * iarr);
-			tcl[ti3] = myround(val3 * iarr);
-			tcl[ti4] = myround(val4 * iarr);
-
-			li1 += stride;
-			li2 += stride;
-			li3 += stride;
-			li4 += stride;
-
-			ri1 += stride;
-			ri2 += stride;
-			ri3 += stride;
-			ri4 += stride;
-
-			ti1 += stride;
-			ti2 += stride;
-			ti3 += stride;
-			ti4 += stride;
-		}
-
-		for (int j = h - r; j < h; ++j) {
-			val1 += lv1 - scl[li1];
-			val2 += lv2 - scl[li2];
-			val3 += lv3 - scl[li3];
-			val4 += lv4 - scl[li4];
-
-			tcl[ti1] = myround(val1 * iarr);
-			tcl[ti2] = myround(val2 * iarr);
-			tcl[ti3] = myround(val3 * iarr);
-			tcl[ti4] = myround(val4 * iarr);
-
-			li1 += stride;
-			li2 += stride;
-			li3 += stride;
-			li4 += stride;
-
-			ti1 += stride;
-			ti2 += stride;
-			ti3 += stride;
-			ti4 += stride;
-		}
-	}
-}
-
-inline void boxBlur_4(BYTE* scl, BYTE* tcl, int w, int h, int rx, int ry, int bpp, int stride)
-{
-	memcpy(tcl, scl, stride * h);
-	boxBlurH_4(tcl, scl, w, h, rx, bpp, stride);
-	boxBlurT_4(scl, tcl, w, h, ry, bpp, stride);
-}
-
-inline void gaussBlur_4(BYTE* scl, BYTE* tcl, int w, int h, float rx, float ry, int bpp, int stride)
-{
-	int bxsX[4];
-	boxesForGauss(rx, bxsX, 4);
-
-	int bxsY[4];
-	boxesForGauss(ry, bxsY, 4);
-
-	boxBlur_4(scl, tcl, w, h, (bxsX[0] - 1) / 2, (bxsY[0] - 1) / 2, bpp, stride);
-	boxBlur_4(tcl, scl, w, h, (bxsX[1] - 1) / 2, (bxsY[1] - 1) / 2, bpp, stride);
-	boxBlur_4(scl, tcl, w, h, (bxsX[2] - 1) / 2, (bxsY[2] - 1) / 2, bpp, stride);
-	boxBlur_4(scl, tcl, w, h, (bxsX[3] - 1) / 2, (bxsY[3] - 1) / 2, bpp, stride);
-}
-
-void DoGaussianBlur(Gdiplus::Bitmap* img, float radiusX, float radiusY)
-{
-	if (img == 0 || (radiusX == 0.0f && radiusY == 0.0f)) return;
-
-	const int w = img->GetWidth();
-	const int h = img->GetHeight();
-
-	if (radiusX > w / 2) {
-		radiusX = (float)(w / 2);
-	}
-
-	if (radiusY > h / 2) {
-		radiusY = (float)(h / 2);
-	}
-
-	Gdiplus::Bitmap* temp = new Gdiplus::Bitmap(img->GetWidth(), img->GetHeight(), img->GetPixelFormat());
-
-	Gdiplus::BitmapData bitmapData1;
-	Gdiplus::BitmapData bitmapData2;
-	Gdiplus::Rect rect(0, 0, img->GetWidth(), img->GetHeight());
-
-	if (Gdiplus::Ok == img->LockBits(
-		&rect,
-		Gdiplus::ImageLockModeRead | Gdiplus::ImageLockModeWrite,
-		img->GetPixelFormat(),
-		&bitmapData1
-	)
-		&&
-		Gdiplus::Ok == temp->LockBits(
-			&rect,
-			Gdiplus::ImageLockModeRead | Gdiplus::ImageLockModeWrite,
-			temp->GetPixelFormat(),
-			&bitmapData2
-		)) {
-		BYTE* src = (BYTE*)bitmapData1.Scan0;
-		BYTE* dst = (BYTE*)bitmapData2.Scan0;
-
-		const int bpp = 4;
-		const int stride = bitmapData1.Stride;
-
-		gaussBlur_4(src, dst, w, h, radiusX, radiusY, bpp, stride);
-
-		img->UnlockBits(&bitmapData1);
-		temp->UnlockBits(&bitmapData2);
-	}
-
-	delete temp;
+	if (font_height != other.font_height) return font_height < other.font_height;
+	if (dpi != other.dpi) return dpi < other.dpi;
+	if (color != other.color) return color < other.color;
+	if (size.cx != other.size.cx) return size.cx < other.size.cx;
+	if (size.cy != other.size.cy) return size.cy < other.size.cy;
+	if (text != other.text) return text < other.text;
+	return font_face < other.font_face;
 }
 
-void DoGaussianBlurPower(Gdiplus::Bitmap* img, float radiusX, float radiusY, int nPower)
-{
-	Gdiplus::Bitmap* pBitmap = img->Clone(0, 0, img->GetWidth(), img->GetHeight(), PixelFormat32bppARGB);
-	DoGaussianBlur(pBitmap, radiusX, radiusY);
-	Gdiplus::Graphics g(pBitmap);
-	for (int i = 0; i < 8; ++i) {
-		g.DrawImage(pBitmap, 0, 0);
-		if ((1 << i) & nPower) {
-			Gdiplus::Graphics g(img);
-			g.DrawImage(pBitmap, 0, 0);
-		}
-	}
-	delete pBitmap;
-}
-/* end  image gauss blur functions from https://github.com/kenjinote/DropShadow/  */
 static CRect OffsetRect(const CRect rc, int offsetx, int offsety)
 {
 	CRect res(rc.left + offsetx, rc.top + offsety, rc.right + offsetx, rc.bottom + offsety);
@@ -355,30 +42,33 @@ static CRect OffsetRect(const CRect rc, int offsetx, int offsety)
 
  WeaselPanel::WeaselPanel(weasel::UI &ui)
 	: m_layout(NULL), 
+	  m_layouts(),
+	  m_nextPrepared(0),
 	  m_ctx(ui.ctx()), 
 	  m_status(ui.status()), 
 	  m_style(ui.style()),
-	  _isVistaSp2OrGrater(false),
-	  _m_gdiplusToken(0)
+	  m_paintTarget(),
+	  m_glyphRuns(GLYPH_RUN_CACHE_BUDGET),
+	  m_dpi(0),
+	  _isVistaSp2OrGrater(false)
 	  //dpiScaleX_(0.0f),
 	  //dpiScaleY_(0.0f)
 {
-	m_iconDisabled.LoadIconW(IDI_RELOAD, STATUS_ICON_SIZE, STATUS_ICON_SIZE, LR_DEFAULTCOLOR);
-	m_iconEnabled.LoadIconW(IDI_ZH, STATUS_ICON_SIZE, STATUS_ICON_SIZE, LR_DEFAULTCOLOR);
-	m_iconAlpha.LoadIconW(IDI_EN, STATUS_ICON_SIZE, STATUS_ICON_SIZE, LR_DEFAULTCOLOR);
 }
 
 WeaselPanel::~WeaselPanel()
 {
-	if (m_layout != NULL)
-		delete m_layout;
+	for (int i = 0; i < UIStyle::LAYOUT_TYPE_LAST; ++i)
+		delete m_layouts[i];
+	for (int i = 0; i < PREPARED_PAGES; ++i)
+		delete m_prepared[i].layout;
 	if (pDWR != NULL)
 		delete pDWR;
 }
 
 void WeaselPanel::_ResizeWindow()
 {
-	CDCHandle dc = GetDC();
+	// applied along with the position by _RepositionWindow
 	CSize size = m_layout->GetContentSize();
 	if (m_style.shadow_offset_x)
 		size.cx += abs(m_style.shadow_offset_x * 4) ;
@@ -386,108 +76,257 @@ void WeaselPanel::_ResizeWindow()
 		size.cy += abs(m_style.shadow_offset_y * 4) ;
 	size.cx += m_style.shadow_radius * 4;
 	size.cy += m_style.shadow_radius * 4;
-	SetWindowPos(NULL, 0, 0, size.cx, size.cy, SWP_NOACTIVATE | SWP_NOMOVE | SWP_NOZORDER);
-	ReleaseDC(dc);
+	m_windowRect.right = m_windowRect.left + size.cx;
+	m_windowRect.bottom = m_windowRect.top + size.cy;
 }
 
-void WeaselPanel::_CreateLayout()
+UIStyle::LayoutType WeaselPanel::_GetLayoutType() const
 {
-	if (m_layout != NULL)
-		delete m_layout;
+	return (m_style.layout_type >= 0 && m_style.layout_type < UIStyle::LAYOUT_TYPE_LAST) ?
+		m_style.layout_type : UIStyle::LAYOUT_VERTICAL;
+}
 
-	Layout* layout = NULL;
-	if (m_style.layout_type == UIStyle::LAYOUT_VERTICAL ||
-		m_style.layout_type == UIStyle::LAYOUT_VERTICAL_FULLSCREEN)
+void WeaselPanel::_ResetLayout()
+{
+	// one instance per layout type, created on first use and reset before each layout
+	const int iconSize = StatusIconSize(m_dpi);
+	const UIStyle::LayoutType type = _GetLayoutType();
+	const UIStyle::LayoutType baseType = (type == UIStyle::LAYOUT_HORIZONTAL || type == UIStyle::LAYOUT_HORIZONTAL_FULLSCREEN) ?
+		UIStyle::LAYOUT_HORIZONTAL : UIStyle::LAYOUT_VERTICAL;
+	if (m_layouts[baseType] == NULL)
 	{
-		layout = new VerticalLayout(m_style, m_ctx, m_status);
+		if (baseType == UIStyle::LAYOUT_HORIZONTAL)
+			m_layouts[baseType] = new HorizontalLayout(m_style, m_ctx, m_status, iconSize);
+		else
+			m_layouts[baseType] = new VerticalLayout(m_style, m_ctx, m_status, iconSize);
 	}
-	else if (m_style.layout_type == UIStyle::LAYOUT_HORIZONTAL ||
-		m_style.layout_type == UIStyle::LAYOUT_HORIZONTAL_FULLSCREEN)
+	if (type != baseType)
 	{
-		layout = new HorizontalLayout(m_style, m_ctx, m_status);
+		// full screen styles fit the base layout of the same direction into the work area
+		const MonitorEntry* monitor = _GetMonitor();
+		CRect workArea;
+		if (monitor)
+			workArea.SetRect(monitor->work.left, monitor->work.top, monitor->work.right, monitor->work.bottom);
+		if (m_layouts[type] == NULL)
+			m_layouts[type] = new FullScreenLayout(m_style, m_ctx, m_status, iconSize, workArea, m_layouts[baseType]);
+		else
+			static_cast<FullScreenLayout*>(m_layouts[type])->SetWorkArea(workArea);
 	}
-	if (m_style.layout_type == UIStyle::LAYOUT_VERTICAL_FULLSCREEN ||
-		m_style.layout_type == UIStyle::LAYOUT_HORIZONTAL_FULLSCREEN)
+	m_layout = m_layouts[type];
+	m_layout->Reset(iconSize);
+}
+
+void WeaselPanel::_InitDirectWrite()
+{
+	// the style's fonts at the time; full screen styles refit the text format themselves
+	if (pDWR->pDWFactory == NULL)
+		pDWR->InitResources(m_style.label_font_face, m_style.label_font_point,
+			m_style.font_face, m_style.font_point,
+			m_style.comment_font_face, m_style.comment_font_point);
+}
+
+const WeaselPanel::PreparedPage* WeaselPanel::_FindPreparedPage(Context const& ctx) const
+{
+	// same text and metrics as laid out ahead; the highlight is moved on taking it
+	for (int i = 0; i < PREPARED_PAGES; ++i)
 	{
-		layout = new FullScreenLayout(m_style, m_ctx, m_status, m_inputPos, layout);
+		const PreparedPage& page = m_prepared[i];
+		if (page.layout && page.type == _GetLayoutType() && page.dpi == m_dpi &&
+			DiffLayout(page.ctx, page.status, page.style, ctx, m_status, m_style) != LAYOUT_CHANGED)
+			return &page;
 	}
-	m_layout = layout;
+	return NULL;
 }
 
-//更新界面
-void WeaselPanel::Refresh()
+void WeaselPanel::Prepare(Context const& ctx)
 {
-	_CreateLayout();
+	// full screen styles fit the fonts to each page, which would change those of the page shown
+	const UIStyle::LayoutType type = _GetLayoutType();
+	if (!m_layout || ctx.cinfo.candies.empty() || (type != UIStyle::LAYOUT_VERTICAL && type != UIStyle::LAYOUT_HORIZONTAL))
+		return;
+	if (_FindPreparedPage(ctx))
+		return;
+
+	ProfileScope profile(PROFILE_PREPARE_PAGE);
+	PreparedPage& page = m_prepared[m_nextPrepared];
+	m_nextPrepared = (m_nextPrepared + 1) % PREPARED_PAGES;
+	page.ctx = ctx;
+	page.status = m_status;
+	page.style = m_style;
+	if (page.layout && page.type != type)
+	{
+		delete page.layout;
+		page.layout = NULL;
+	}
+	const int iconSize = StatusIconSize(m_dpi);
+	if (page.layout == NULL)
+	{
+		if (type == UIStyle::LAYOUT_HORIZONTAL)
+			page.layout = new HorizontalLayout(page.style, page.ctx, page.status, iconSize);
+		else
+			page.layout = new VerticalLayout(page.style, page.ctx, page.status, iconSize);
+	}
+	page.type = type;
+	page.dpi = m_dpi;
+	page.layout->Reset(iconSize);
 
 	CDCHandle dc = GetDC();
 	if (m_style.color_font)
-		m_layout->DoLayout(dc, pDWR);
+	{
+		_InitDirectWrite();
+		page.layout->DoLayout(dc, pDWR);
+	}
 	else
-		m_layout->DoLayout(dc, pFonts);
+		page.layout->DoLayout(dc, pFonts);
 	ReleaseDC(dc);
+}
+
+//更新界面
+void WeaselPanel::Refresh()
+{
+	// the status icon size follows the dpi of the monitor the panel is on
+	const int dpi = _GetDpi();
+	const bool dpiChanged = (dpi != m_dpi);
+	m_dpi = dpi;
+	LayoutChange change = (m_layout && !dpiChanged) ? DiffLayout(m_layoutCtx, m_layoutStatus, m_layoutStyle, m_ctx, m_status, m_style) : LAYOUT_CHANGED;
+	if (change == LAYOUT_UNCHANGED)
+		return;
+	if (change != LAYOUT_CHANGED)
+	{
+		// same text and metrics, keep the rects and move the highlight only
+		CRect oldHighlight = m_layout->GetHighlightRect();
+		m_layout->UpdateHighlightRect();
+		m_layoutCtx.cinfo.highlighted = m_ctx.cinfo.highlighted;
+		m_layoutStatus = m_status;
+		if (change == LAYOUT_HIGHLIGHT_CHANGED)
+		{
+			_Invalidate(_GetHighlightDirtyRect(oldHighlight));
+			_Invalidate(_GetHighlightDirtyRect(m_layout->GetHighlightRect()));
+			UpdateWindow();
+		}
+		else
+		{
+			m_layoutStyle = m_style;
+			CRect rc;
+			GetClientRect(&rc);
+			_Invalidate(rc);
+			RedrawWindow();
+		}
+		return;
+	}
+
+	// page turns are timed apart, by whether the page was laid out ahead
+	const bool pageTurn = m_layout && !dpiChanged && IsPageTurn(m_layoutCtx, m_ctx);
+	const int64_t start = Profiler::Now();
+	const PreparedPage* prepared = _FindPreparedPage(m_ctx);
+	_ResetLayout();
+	m_layoutCtx = m_ctx;
+	m_layoutStatus = m_status;
+	m_layoutStyle = m_style;
+
+	if (prepared)
+	{
+		m_layout->Assign(*prepared->layout);
+		m_layout->UpdateHighlightRect();
+	}
+	else
+	{
+		CDCHandle dc = GetDC();
+		{
+			ProfileScope profile(PROFILE_LAYOUT);
+			if (m_style.color_font)
+			{
+				_InitDirectWrite();
+				m_layout->DoLayout(dc, pDWR);
+			}
+			else
+				m_layout->DoLayout(dc, pFonts);
+		}
+		ReleaseDC(dc);
+	}
 
 	_ResizeWindow();
 	_RepositionWindow();
+	CRect rc;
+	GetClientRect(&rc);
+	_Invalidate(rc);
 	RedrawWindow();
+
+	if (pageTurn)
+	{
+		Profiler::Record(prepared ? PROFILE_PAGE_TURN_PREPARED : PROFILE_PAGE_TURN_COLD, start, Profiler::Now());
+		Profiler::Count(prepared ? PROFILE_PAGE_TURN_HITS : PROFILE_PAGE_TURN_MISSES);
+	}
+}
+
+CRect WeaselPanel::_GetHighlightDirtyRect(CRect const& highlight) const
+{
+	// same offsets as _DrawCandidates, plus the room taken by the drop shadow
+	int ox = abs(m_style.shadow_offset_x)*2 + m_style.shadow_radius*2;
+	int oy = abs(m_style.shadow_offset_y)*2 + m_style.shadow_radius*2;
+	int bkx = abs((m_style.margin_x - m_style.hilite_padding)) + max(abs(m_style.shadow_offset_x), abs(m_style.shadow_offset_y)) * 2;
+	int bky = abs((m_style.margin_y - m_style.hilite_padding)) + max(abs(m_style.shadow_offset_x), abs(m_style.shadow_offset_y)) * 2;
+	CRect rc = OffsetRect(highlight, ox, oy);
+	rc.InflateRect(m_style.hilite_padding + bkx, m_style.hilite_padding + bky);
+	return rc;
+}
+
+CRect WeaselPanel::_GetCandidateExtent(int id) const
+{
+	CRect rc;
+	rc.UnionRect(m_layout->GetCandidateLabelRect(id), m_layout->GetCandidateTextRect(id));
+	if (!m_layout->GetCandidateCommentRect(id).IsRectEmpty())
+		rc.UnionRect(rc, m_layout->GetCandidateCommentRect(id));
+	if (id == m_ctx.cinfo.highlighted)
+		rc.UnionRect(rc, m_layout->GetHighlightRect());
+	else
+		rc.UnionRect(rc, m_layout->GetCandidateBackRect(id));
+	return _GetHighlightDirtyRect(rc);
 }
 
-void WeaselPanel::_HighlightTextEx(CDCHandle dc, CRect rc, COLORREF color, COLORREF shadowColor, int blurOffsetX, int blurOffsetY, int radius)
+bool WeaselPanel::_NeedsPaint(CRect const& rc) const
 {
-	Graphics gBack(dc);
-	gBack.SetSmoothingMode(SmoothingMode::SmoothingModeHighQuality);
+	CRect clip;
+	return !!clip.IntersectRect(rc, m_paintRect);
+}
+
+void WeaselPanel::_HighlightTextEx(PixelTarget const& target, CRect rc, COLORREF color, COLORREF shadowColor, int blurOffsetX, int blurOffsetY, int radius)
+{
+	// drawn straight into the DIB bits, after any pending GDI text
+	GdiFlush();
 	// 必须shadow_color都是非完全透明色才做绘制, 全屏状态不绘制阴影保证响应速度
 	if (m_style.shadow_radius && (shadowColor & 0xff000000) 
 		&& m_style.layout_type != UIStyle::LAYOUT_HORIZONTAL_FULLSCREEN 
 		&& m_style.layout_type != UIStyle::LAYOUT_VERTICAL_FULLSCREEN)	
 	{
-		BYTE r = GetRValue(shadowColor);
-		BYTE g = GetGValue(shadowColor);
-		BYTE b = GetBValue(shadowColor);
-		Color brc = Color::MakeARGB((BYTE)(shadowColor >> 24), r, g, b);
-		static Bitmap* pBitmapDropShadow;
-		pBitmapDropShadow = new Gdiplus::Bitmap((INT)rc.Width() + blurOffsetX * 2, (INT)rc.Height() + blurOffsetY * 2, PixelFormat32bppARGB);
-		Gdiplus::Graphics gg(pBitmapDropShadow);
-		gg.SetSmoothingMode(SmoothingModeHighQuality);
-
-		CRect rect(
+		Framebuffer shadow(rc.Width() + blurOffsetX * 2, rc.Height() + blurOffsetY * 2);
+		FbRect rect = MakeFbRect(
 				blurOffsetX + m_style.shadow_offset_x,
 				blurOffsetY + m_style.shadow_offset_y, 
 				rc.Width() + blurOffsetX + m_style.shadow_offset_x,
 				rc.Height() + blurOffsetY + m_style.shadow_offset_y);
 		if (m_style.shadow_offset_x != 0 || m_style.shadow_offset_y != 0)
-		{
-			GraphicsRoundRectPath path(rect, radius);
-			SolidBrush br(brc);
-			gg.FillPath(&br, &path);
-		}
+			shadow.FillRoundRect(rect, radius, PremultiplyStyleColor(shadowColor));
 		else
 		{
-			int pensize = 1;
 			int alpha = ((shadowColor >> 24) & 255);
 			int step = alpha / m_style.shadow_radius;
-			Color scolor = Color::MakeARGB(alpha, GetRValue(shadowColor), GetGValue(shadowColor), GetBValue(shadowColor));
-			Pen penShadow(scolor, (Gdiplus::REAL)pensize);
-			CRect rcShadowEx = rect;
 			for (int i = 0; i < m_style.shadow_radius; i++)
 			{
-				GraphicsRoundRectPath path(rcShadowEx, radius + i);
-				gg.DrawPath(&penShadow, &path);
-				scolor = Color::MakeARGB(alpha - i * step, GetRValue(shadowColor), GetGValue(shadowColor), GetBValue(shadowColor));
-				penShadow.SetColor(scolor);
-				rcShadowEx.InflateRect(2, 2);
+				int ring = ((alpha - i * step) << 24) | (shadowColor & 0xffffff);
+				shadow.StrokeRoundRect(rect, radius + i, 1, PremultiplyStyleColor(ring));
+				rect = rect.Inflate(2, 2);
 			}
 		}
-		DoGaussianBlur(pBitmapDropShadow, (float)m_style.shadow_radius, (float)m_style.shadow_radius);
-		gBack.DrawImage(pBitmapDropShadow, rc.left - blurOffsetX, rc.top - blurOffsetY);
-		delete pBitmapDropShadow;
+		{
+			ProfileScope profile(PROFILE_BLUR);
+			shadow.Blur((float)m_style.shadow_radius, (float)m_style.shadow_radius);
+		}
+		if (shadow.Pixels())
+			BlendImage(target, rc.left - blurOffsetX, rc.top - blurOffsetY, shadow.Pixels(), shadow.Width(), shadow.Height(), shadow.Width());
 	}
 	if (color & 0xff000000)	// 必须back_color非完全透明才绘制
-	{
-		GraphicsRoundRectPath bgPath(rc, radius);
-		Color back_color = Color::MakeARGB((color >> 24), GetRValue(color), GetGValue(color), GetBValue(color));
-		SolidBrush gBrBack(back_color);
-		gBack.FillPath(&gBrBack, &bgPath);
-	}
+		FillRoundRect(target, rc.left, rc.top, rc.right, rc.bottom, radius, PremultiplyStyleColor(color));
 }
 
 bool WeaselPanel::_DrawPreedit(Text const& text, CDCHandle dc, CRect const& rc)
@@ -507,8 +346,8 @@ bool WeaselPanel::_DrawPreedit(Text const& text, CDCHandle dc, CRect const& rc)
 			CSize selStart, selEnd;
 			if (m_style.color_font)
 			{
-				m_layout->GetTextSizeDW(t, range.start, pDWR->pTextFormat, pDWR->pDWFactory, &selStart);
-				m_layout->GetTextSizeDW(t, range.end, pDWR->pTextFormat, pDWR->pDWFactory, &selEnd);
+				m_layout->GetTextSizeDW(t, range.start, pDWR->pTextFormat, pDWR, &selStart);
+				m_layout->GetTextSizeDW(t, range.end, pDWR->pTextFormat, pDWR, &selEnd);
 			}
 			else
 			{
@@ -538,7 +377,7 @@ bool WeaselPanel::_DrawPreedit(Text const& text, CDCHandle dc, CRect const& rc)
 				CRect rc_hi(x, rc.top, x + (selEnd.cx - selStart.cx), rc.bottom);
 				rc_hi.InflateRect(m_style.hilite_padding, m_style.hilite_padding);
 				OffsetRect(rc_hi, -m_style.hilite_padding, 0);
-				_HighlightTextEx(dc, rc_hi, m_style.hilited_back_color, m_style.hilited_shadow_color, 
+				_HighlightTextEx(m_paintTarget, rc_hi, m_style.hilited_back_color, m_style.hilited_shadow_color, 
 					(m_style.margin_x-m_style.hilite_padding), (m_style.margin_y - m_style.hilite_padding), m_style.round_corner);
 				dc.SetTextColor(m_style.hilited_text_color);
 				dc.SetBkColor(m_style.hilited_back_color);
@@ -578,34 +417,26 @@ bool WeaselPanel::_DrawCandidates(CDCHandle dc)
 	int bkx = abs((m_style.margin_x - m_style.hilite_padding)) + max(abs(m_style.shadow_offset_x), abs(m_style.shadow_offset_y)) * 2;
 	int bky = abs((m_style.margin_y - m_style.hilite_padding)) + max(abs(m_style.shadow_offset_x), abs(m_style.shadow_offset_y)) * 2;
 
-	for (size_t i = 0; i < candidates.size() && i < MAX_CANDIDATES_COUNT; ++i)
+	for (size_t i = 0; i < candidates.size() && i < m_layout->GetCandidateCount(); ++i)
 	{
 		CRect rect;
+		if (!_NeedsPaint(_GetCandidateExtent(i)))
+		{
+			drawn = true;
+			continue;
+		}
 		if (i == m_ctx.cinfo.highlighted)
 		{
 			rect = OffsetRect(m_layout->GetHighlightRect(), ox, oy);
 			rect.InflateRect(m_style.hilite_padding, m_style.hilite_padding);
-			_HighlightTextEx(dc, rect, m_style.hilited_candidate_back_color, m_style.hilited_candidate_shadow_color, bkx, bky, m_style.round_corner);
+			_HighlightTextEx(m_paintTarget, rect, m_style.hilited_candidate_back_color, m_style.hilited_candidate_shadow_color, bkx, bky, m_style.round_corner);
 			dc.SetTextColor(m_style.hilited_label_text_color);
 		}
 		else
 		{
-			CRect candidateBackRect;
-			if(m_style.layout_type == m_style.LAYOUT_HORIZONTAL_FULLSCREEN || m_style.layout_type == m_style.LAYOUT_HORIZONTAL)
-			{
-				candidateBackRect.left = m_layout->GetCandidateLabelRect(i).left;
-				candidateBackRect.right = m_layout->GetCandidateCommentRect(i).right;
-			}
-			else
-			{
-				candidateBackRect.left = m_layout->GetHighlightRect().left;
-				candidateBackRect.right = m_layout->GetHighlightRect().right;
-			}
-			candidateBackRect.top =m_layout->GetCandidateTextRect(i).top;
-			candidateBackRect.bottom = m_layout->GetCandidateTextRect(i).bottom;
-			candidateBackRect = OffsetRect(candidateBackRect, ox, oy);
+			CRect candidateBackRect = OffsetRect(m_layout->GetCandidateBackRect(i), ox, oy);
 			candidateBackRect.InflateRect(m_style.hilite_padding, m_style.hilite_padding);
-			_HighlightTextEx(dc, candidateBackRect, m_style.candidate_back_color, m_style.candidate_shadow_color, bkx, bky, m_style.round_corner);
+			_HighlightTextEx(m_paintTarget, candidateBackRect, m_style.candidate_back_color, m_style.candidate_shadow_color, bkx, bky, m_style.round_corner);
 			dc.SetTextColor(m_style.label_text_color);
 		}
 
@@ -644,57 +475,149 @@ bool WeaselPanel::_DrawCandidates(CDCHandle dc)
 	return drawn;
 }
 
-//draw client area
-void WeaselPanel::DoPaint(CDCHandle dc)
+bool RetainedSurface::Ensure(CSize size)
 {
-	// background start
-	CRect rc;
-	GetClientRect(&rc);
+	if (m_dc && size == m_size)
+		return false;
+	Release();
+	BITMAPINFO bmi = { 0 };
+	bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+	bmi.bmiHeader.biWidth = size.cx;
+	bmi.bmiHeader.biHeight = -size.cy;	// top-down
+	bmi.bmiHeader.biPlanes = 1;
+	bmi.bmiHeader.biBitCount = 32;
+	bmi.bmiHeader.biCompression = BI_RGB;
+	void* bits = NULL;
+	m_dc.CreateCompatibleDC(NULL);
+	m_bitmap.CreateDIBSection(m_dc, &bmi, DIB_RGB_COLORS, &bits, NULL, 0);
+	if (!m_bitmap)
+	{
+		m_dc.DeleteDC();
+		return true;
+	}
+	m_old = m_dc.SelectBitmap(m_bitmap);
+	m_bits = (BYTE*)bits;
+	m_size = size;
+	return true;
+}
 
-	SIZE sz = { rc.right - rc.left, rc.bottom - rc.top };
-	CDCHandle hdc = ::GetDC(m_hWnd);
-	CDCHandle memDC = ::CreateCompatibleDC(hdc);
-	HBITMAP memBitmap = ::CreateCompatibleBitmap(hdc, sz.cx, sz.cy);
-	::SelectObject(memDC, memBitmap);
-	
-	int ox = abs(m_style.shadow_offset_x)*2 + m_style.shadow_radius*2;
-	int oy = abs(m_style.shadow_offset_y)*2 + m_style.shadow_radius*2;
+void RetainedSurface::Release()
+{
+	if (m_old)
+		m_dc.SelectBitmap(m_old);
+	m_old = NULL;
+	if (m_bitmap)
+		m_bitmap.DeleteObject();
+	if (m_dc)
+		m_dc.DeleteDC();
+	m_bits = NULL;
+	m_size.SetSize(0, 0);
+}
+
+void RetainedSurface::Clear(CRect const& rc)
+{
+	CRect clip;
+	if (!m_bits || !clip.IntersectRect(rc, CRect(CPoint(0, 0), m_size)))
+		return;
+	GdiFlush();
+	for (int y = clip.top; y < clip.bottom; ++y)
+		memset(m_bits + (y * m_size.cx + clip.left) * 4, 0, clip.Width() * 4);
+}
 
+void RetainedSurface::CopyFrom(RetainedSurface const& src, CRect const& rc)
+{
+	CRect clip;
+	if (!m_bits || !src.m_bits || src.m_size != m_size || !clip.IntersectRect(rc, CRect(CPoint(0, 0), m_size)))
+		return;
+	GdiFlush();
+	for (int y = clip.top; y < clip.bottom; ++y)
+	{
+		size_t offset = (y * m_size.cx + clip.left) * 4;
+		memcpy(m_bits + offset, src.m_bits + offset, clip.Width() * 4);
+	}
+}
+
+void WeaselPanel::_Invalidate(CRect const& rc)
+{
+	m_dirtyRect.UnionRect(m_dirtyRect, rc);
+	InvalidateRect(rc, FALSE);
+}
+
+bool WeaselPanel::_ShouldHideCandidates() const
+{
 	/* inline_preedit and candidate size 1 and preedit_type preview, and hide_candidates_when_single is set */
-	const std::vector<Text> &candidates(m_ctx.cinfo.candies);
-	bool hide_candidates = false;
-	if (m_style.hide_candidates_when_single == True 
+	return m_style.hide_candidates_when_single == True 
 		&& m_style.inline_preedit == True 
-		&& candidates.size() == 1 
-		&& m_style.preedit_type == UIStyle::PreeditType::PREVIEW)
-		hide_candidates = True;
+		&& m_ctx.cinfo.candies.size() == 1 
+		&& m_style.preedit_type == UIStyle::PreeditType::PREVIEW;
+}
+
+void WeaselPanel::_DrawBackground(PixelTarget const& target, CRect const& rc)
+{
+	int ox = abs(m_style.shadow_offset_x)*2 + m_style.shadow_radius*2;
+	int oy = abs(m_style.shadow_offset_y)*2 + m_style.shadow_radius*2;
 
+	const std::vector<Text> &candidates(m_ctx.cinfo.candies);
 	CRect trc;
 	/* (candidate not empty or (input not empty and not inline_preedit)) and not hide_candidates */
 	if(
 		(!(candidates.size()==0) 
 			|| ((!m_ctx.aux.str.empty() || !m_ctx.preedit.str.empty()) && !m_style.inline_preedit)) 
-		&& !hide_candidates)
+		&& !_ShouldHideCandidates())
 	{
-		Graphics gBack(memDC);
-		gBack.SetSmoothingMode(SmoothingMode::SmoothingModeHighQuality);
 		trc = rc;
 		trc.DeflateRect(ox + m_style.border, oy + m_style.border);
-		GraphicsRoundRectPath bgPath(trc, m_style.round_corner_ex);
-		int alpha = ((m_style.border_color >> 24) & 255);
-		Color border_color = Color::MakeARGB(alpha, GetRValue(m_style.border_color), GetGValue(m_style.border_color), GetBValue(m_style.border_color));
-		Pen gPenBorder(border_color, (Gdiplus::REAL)m_style.border);
 		if (m_style.shadow_radius && (m_style.shadow_color & 0xff000000))
-			_HighlightTextEx(memDC, trc, m_style.back_color, m_style.shadow_color, ox*2, oy*2, m_style.round_corner_ex);
+			_HighlightTextEx(target, trc, m_style.back_color, m_style.shadow_color, ox*2, oy*2, m_style.round_corner_ex);
 		else
 		{
-			Color back_color = Color::MakeARGB((m_style.back_color>>24), GetRValue(m_style.back_color), GetGValue(m_style.back_color), GetBValue(m_style.back_color));
-			gBack.FillPath(new SolidBrush(back_color), &bgPath);
+			GdiFlush();
+			FillRoundRect(target, trc.left, trc.top, trc.right, trc.bottom, m_style.round_corner_ex, PremultiplyStyleColor(m_style.back_color));
 		}
-		gBack.DrawPath(&gPenBorder, &bgPath);
-		gBack.ReleaseHDC(memDC);
+		// a zero width GDI+ pen drew one pixel
+		StrokeRoundRect(target, trc.left, trc.top, trc.right, trc.bottom, m_style.round_corner_ex, max(m_style.border, 1), PremultiplyStyleColor(m_style.border_color));
 	}
-	// background end
+}
+
+//draw client area
+void WeaselPanel::DoPaint(CDCHandle dc)
+{
+	// nothing laid out since the panel was made
+	if (m_layout == NULL)
+		return;
+	const int64_t start = Profiler::Now();
+
+	CRect rc;
+	GetClientRect(&rc);
+	SIZE sz = { rc.right - rc.left, rc.bottom - rc.top };
+
+	// the background layer and the back buffer survive across paints; only
+	// a resize or a full refresh redraws the background
+	bool resized = m_backBuffer.Ensure(sz);
+	resized |= m_backgroundLayer.Ensure(sz);
+	CRect dirty = resized ? rc : m_dirtyRect;
+	dirty.IntersectRect(dirty, rc);
+	m_dirtyRect.SetRectEmpty();
+	if (dirty.IsRectEmpty() || !m_backBuffer.GetDC())
+		return;
+	const bool full = (dirty == rc);
+	Profiler::Count(full ? PROFILE_FULL_PAINTS : PROFILE_PARTIAL_PAINTS);
+
+	if (full)
+	{
+		m_backgroundLayer.Clear(rc);
+		_DrawBackground(m_backgroundLayer.GetTarget(rc), rc);
+	}
+	m_backBuffer.CopyFrom(m_backgroundLayer, dirty);
+
+	CDCHandle memDC = m_backBuffer.GetDC();
+	m_paintRect = dirty;
+	m_paintTarget = m_backBuffer.GetTarget(dirty);
+	memDC.IntersectClipRect(dirty);
+
+	int ox = abs(m_style.shadow_offset_x)*2 + m_style.shadow_radius*2;
+	int oy = abs(m_style.shadow_offset_y)*2 + m_style.shadow_radius*2;
+	bool hide_candidates = _ShouldHideCandidates();
 
 	if (!m_style.color_font)
 	{
@@ -706,22 +629,30 @@ void WeaselPanel::DoPaint(CDCHandle dc)
 	bool drawn = false;
 
 	// draw preedit string
+	CRect trc;
 	if (!m_layout->IsInlinePreedit() && !hide_candidates)
 	{
 		trc = OffsetRect(m_layout->GetPreeditRect(), ox, oy);
-		drawn |= _DrawPreedit(m_ctx.preedit, memDC, trc);
+		if (_NeedsPaint(trc))
+			drawn |= _DrawPreedit(m_ctx.preedit, memDC, trc);
 	}
 	
 	// draw auxiliary string
 	trc = OffsetRect(m_layout->GetAuxiliaryRect(), ox, oy);
-	drawn |= _DrawPreedit(m_ctx.aux, memDC, m_layout->GetAuxiliaryRect());
+	if (_NeedsPaint(trc))
+		drawn |= _DrawPreedit(m_ctx.aux, memDC, m_layout->GetAuxiliaryRect());
 
 	// status icon (I guess Metro IME stole my idea :)
 	if (m_layout->ShouldDisplayStatusIcon())
 	{
 		const CRect iconRect(OffsetRect(m_layout->GetStatusIconRect(), ox, oy));
-		CIcon& icon(m_status.disabled ? m_iconDisabled : m_status.ascii_mode ? m_iconAlpha : m_iconEnabled);
-		memDC.DrawIconEx(iconRect.left, iconRect.top, icon, 0, 0);
+		if (_NeedsPaint(iconRect))
+		{
+			if (!m_statusIcons.Find(m_dpi))
+				_RasterizeStatusIcons(m_dpi);
+			GdiFlush();
+			m_statusIcons.Draw(m_paintTarget, iconRect.left, iconRect.top, m_dpi, GetStatusIconKind(m_status));
+		}
 		drawn = true;
 	}
 
@@ -729,32 +660,54 @@ void WeaselPanel::DoPaint(CDCHandle dc)
 	if(!hide_candidates)
 		drawn |= _DrawCandidates(memDC);
 
+	memDC.SelectClipRgn(NULL);
+
 	/* Nothing drawn, hide candidate window */
-	if (!drawn)
+	if (full && !drawn)
 		ShowWindow(SW_HIDE);
 
-	HDC screenDC = ::GetDC(NULL);
-	CRect rect;
-	GetWindowRect(&rect);
-	POINT ptSrc = {
-		rect.left,
-		rect.top 
-	};
-	POINT ptDest = {
-		rc.left,
-		rc.top 
-	};
+	POINT ptDst = { m_windowRect.left, m_windowRect.top };
+	POINT ptSrc = { rc.left, rc.top };
 
 	BLENDFUNCTION bf;
 	bf.AlphaFormat = AC_SRC_ALPHA;
 	bf.BlendFlags = 0;
 	bf.BlendOp = AC_SRC_OVER;
 	bf.SourceConstantAlpha = 255;
-	::UpdateLayeredWindow(m_hWnd, screenDC, &ptSrc, &sz, memDC, &ptDest, RGB(0,0,0), &bf, ULW_ALPHA);
-	::DeleteDC(memDC);
-	::DeleteObject(memBitmap);
-	ReleaseDC(screenDC);
+	_UpdateLayeredWindow(ptDst, sz, memDC, ptSrc, bf, full ? NULL : &dirty);
 
+	Profiler::Record(PROFILE_PAINT, start, Profiler::Now());
+}
+
+typedef struct {
+	DWORD cbSize;
+	HDC hdcDst;
+	const POINT* pptDst;
+	const SIZE* psize;
+	HDC hdcSrc;
+	const POINT* pptSrc;
+	COLORREF crKey;
+	const BLENDFUNCTION* pblend;
+	DWORD dwFlags;
+	const RECT* prcDirty;
+} ULW_INFO;	// UPDATELAYEREDWINDOWINFO, declared for Vista and later only
+typedef BOOL (WINAPI *PUpdateLayeredWindowIndirect)(HWND hwnd, const ULW_INFO* pULWInfo);
+
+void WeaselPanel::_UpdateLayeredWindow(POINT const& ptDst, SIZE const& sz, HDC memDC, POINT const& ptSrc, BLENDFUNCTION const& bf, const RECT* dirty)
+{
+	static PUpdateLayeredWindowIndirect pUpdateLayeredWindowIndirect =
+		(PUpdateLayeredWindowIndirect)GetProcAddress(GetModuleHandle(L"user32.dll"), "UpdateLayeredWindowIndirect");
+	ProfileScope profile(PROFILE_UPDATE_LAYERED_WINDOW);
+	HDC screenDC = ::GetDC(NULL);
+	BOOL done = FALSE;
+	if (pUpdateLayeredWindowIndirect)
+	{
+		ULW_INFO info = { sizeof(ULW_INFO), screenDC, &ptDst, &sz, memDC, &ptSrc, RGB(0,0,0), &bf, ULW_ALPHA, dirty };
+		done = pUpdateLayeredWindowIndirect(m_hWnd, &info);
+	}
+	if (!done)
+		::UpdateLayeredWindow(m_hWnd, screenDC, const_cast<POINT*>(&ptDst), const_cast<SIZE*>(&sz), memDC, const_cast<POINT*>(&ptSrc), RGB(0,0,0), const_cast<BLENDFUNCTION*>(&bf), ULW_ALPHA);
+	::ReleaseDC(NULL, screenDC);
 }
 
 LRESULT WeaselPanel::OnCreate(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL& bHandled)
@@ -763,71 +716,41 @@ LRESULT WeaselPanel::OnCreate(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL& bHa
 	t |= WS_EX_LAYERED;
 	::SetWindowLong(m_hWnd, GWL_EXSTYLE, t);
 	//CenterWindow();
-	GdiplusStartup(&_m_gdiplusToken, &_m_gdiplusStartupInput, NULL);
 	GetWindowRect(&m_inputPos);
+	m_windowRect = m_inputPos;
 
 	_isVistaSp2OrGrater = IsWindowsVistaSP2OrGreater();
 
+	// render resources wait for the first layout: many hosts make a panel they never show
 	pDWR = new DirectWriteResources();
-	// prepare d2d1 resources
-	HRESULT hResult = S_OK;
-	// create factory
-	if(pDWR->pD2d1Factory == NULL)
-		hResult = ::D2D1CreateFactory(D2D1_FACTORY_TYPE_MULTI_THREADED, &pDWR->pD2d1Factory);
-	// create IDWriteFactory
-	if(pDWR->pDWFactory == NULL)
-		hResult = DWriteCreateFactory(DWRITE_FACTORY_TYPE_SHARED, __uuidof(IDWriteFactory), reinterpret_cast<IUnknown**>(&pDWR->pDWFactory));
-	/* ID2D1HwndRenderTarget */
-	if (pDWR->pRenderTarget == NULL)
-	{
-		const D2D1_PIXEL_FORMAT format = D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED);
-		const D2D1_RENDER_TARGET_PROPERTIES properties = D2D1::RenderTargetProperties( D2D1_RENDER_TARGET_TYPE_DEFAULT, format);
-		pDWR->pD2d1Factory->CreateDCRenderTarget(&properties, &pDWR->pRenderTarget);
-	}
-	pDWR->pD2d1Factory->GetDesktopDpi(&pDWR->dpiScaleX_, &pDWR->dpiScaleY_);
-	pDWR->dpiScaleX_ /= 72.0f;
-	pDWR->dpiScaleY_ /= 72.0f;
-	//CDCHandle dc = GetDC();
-	//pDWR->dpiScaleX_ = dc.GetDeviceCaps(LOGPIXELSX) / 72;
-	//pDWR->dpiScaleY_ = dc.GetDeviceCaps(LOGPIXELSY) / 72;
-	//ReleaseDC(dc);
-	if(pDWR->pTextFormat == NULL)
-		hResult = pDWR->pDWFactory->CreateTextFormat(m_style.font_face.c_str(), NULL, DWRITE_FONT_WEIGHT_NORMAL, DWRITE_FONT_STYLE_NORMAL, DWRITE_FONT_STRETCH_NORMAL, 
-				m_style.font_point * pDWR->dpiScaleX_, L"", &pDWR->pTextFormat);
-	if( pDWR->pTextFormat != NULL)
-	{
-		pDWR->pTextFormat->SetTextAlignment(DWRITE_TEXT_ALIGNMENT_LEADING);
-		pDWR->pTextFormat->SetParagraphAlignment(DWRITE_PARAGRAPH_ALIGNMENT_CENTER);
-		pDWR->pTextFormat->SetWordWrapping(DWRITE_WORD_WRAPPING_NO_WRAP);
-	}
-	if(pDWR->pLabelTextFormat == NULL)
-		hResult = pDWR->pDWFactory->CreateTextFormat(m_style.label_font_face.c_str(), NULL, DWRITE_FONT_WEIGHT_NORMAL, DWRITE_FONT_STYLE_NORMAL, DWRITE_FONT_STRETCH_NORMAL, 
-				m_style.label_font_point * pDWR->dpiScaleX_, L"", &pDWR->pLabelTextFormat);
-	if( pDWR->pLabelTextFormat != NULL)
-	{
-		pDWR->pLabelTextFormat->SetTextAlignment(DWRITE_TEXT_ALIGNMENT_LEADING);
-		pDWR->pLabelTextFormat->SetParagraphAlignment(DWRITE_PARAGRAPH_ALIGNMENT_CENTER);
-		pDWR->pLabelTextFormat->SetWordWrapping(DWRITE_WORD_WRAPPING_NO_WRAP);
-	}
-	if(pDWR->pCommentTextFormat == NULL)
-		hResult = pDWR->pDWFactory->CreateTextFormat(m_style.comment_font_face.c_str(), NULL, DWRITE_FONT_WEIGHT_NORMAL, DWRITE_FONT_STYLE_NORMAL, DWRITE_FONT_STRETCH_NORMAL, 
-				m_style.comment_font_point * pDWR->dpiScaleX_, L"", &pDWR->pCommentTextFormat);
-	if( pDWR->pCommentTextFormat != NULL)
-	{
-		pDWR->pCommentTextFormat->SetTextAlignment(DWRITE_TEXT_ALIGNMENT_LEADING);
-		pDWR->pCommentTextFormat->SetParagraphAlignment(DWRITE_PARAGRAPH_ALIGNMENT_CENTER);
-		pDWR->pCommentTextFormat->SetWordWrapping(DWRITE_WORD_WRAPPING_NO_WRAP);
-	}
 	pFonts = new GDIFonts(m_style.label_font_face, m_style.label_font_point,
 		m_style.font_face, m_style.font_point,
 		m_style.comment_font_face, m_style.comment_font_point);
-	Refresh();
 	return TRUE;
 }
 
+LRESULT WeaselPanel::OnDpiChanged(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL& bHandled)
+{
+	// scaling settings changed, or a per monitor aware panel moved to another monitor:
+	// icons of every dpi may be stale, and the layout is redone at the new dpi
+	m_statusIcons.Clear();
+	m_monitors.Invalidate();
+	m_dpi = 0;
+	if (m_layout)
+		Refresh();
+	return 0;
+}
+
+LRESULT WeaselPanel::OnDisplayChange(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL& bHandled)
+{
+	// monitors added, removed or rearranged, or a taskbar moved: look them up again on the next move
+	m_monitors.Invalidate();
+	bHandled = FALSE;
+	return 0;
+}
+
 LRESULT WeaselPanel::OnDestroy(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL& bHandled)
 {
-	GdiplusShutdown(_m_gdiplusToken);
 	return 0;
 }
 
@@ -841,44 +764,94 @@ void WeaselPanel::MoveTo(RECT const& rc)
 	const int distance = 6;
 	m_inputPos = rc;
 	m_inputPos.OffsetRect(0, distance);
-	_RepositionWindow();
+	// moved to a monitor of another dpi, lay out again
+	if (m_layout && _GetDpi() != m_dpi)
+		Refresh();
+	else
+		_RepositionWindow();
 }
 
-void WeaselPanel::_RepositionWindow()
+typedef HRESULT (WINAPI *PGetDpiForMonitor)(HMONITOR hmonitor, int dpiType, UINT* dpiX, UINT* dpiY);
+
+static int _GetScreenDpi()
+{
+	HDC screen = ::GetDC(NULL);
+	int dpi = GetDeviceCaps(screen, LOGPIXELSY);
+	::ReleaseDC(NULL, screen);
+	return dpi;
+}
+
+static BOOL CALLBACK _EnumMonitor(HMONITOR hMonitor, HDC hdc, LPRECT lprcMonitor, LPARAM lParam)
 {
-	RECT rcWorkArea;
-	//SystemParametersInfo(SPI_GETWORKAREA, 0, &rcWorkArea, 0);
-	memset(&rcWorkArea, 0, sizeof(rcWorkArea));
-	HMONITOR hMonitor = MonitorFromRect(m_inputPos, MONITOR_DEFAULTTONEAREST);
-	if (hMonitor)
+	// the dpi as seen by this process: the system dpi unless the server is per monitor dpi aware
+	static HMODULE shcore = ::LoadLibrary(L"shcore.dll");	// Windows 8.1 and later
+	static PGetDpiForMonitor pGetDpiForMonitor =
+		shcore ? (PGetDpiForMonitor)::GetProcAddress(shcore, "GetDpiForMonitor") : NULL;
+	MONITORINFO info;
+	info.cbSize = sizeof(MONITORINFO);
+	if (!GetMonitorInfo(hMonitor, &info))
+		return TRUE;
+	MonitorEntry entry;
+	entry.monitor = MakeScreenRect(info.rcMonitor.left, info.rcMonitor.top, info.rcMonitor.right, info.rcMonitor.bottom);
+	entry.work = MakeScreenRect(info.rcWork.left, info.rcWork.top, info.rcWork.right, info.rcWork.bottom);
+	UINT dpiX = 0, dpiY = 0;
+	if (pGetDpiForMonitor && SUCCEEDED(pGetDpiForMonitor(hMonitor, 0 /* MDT_EFFECTIVE_DPI */, &dpiX, &dpiY)) && dpiY)
+		entry.dpi = dpiY;
+	else
+		entry.dpi = _GetScreenDpi();
+	reinterpret_cast<std::vector<MonitorEntry>*>(lParam)->push_back(entry);
+	return TRUE;
+}
+
+const MonitorEntry* WeaselPanel::_GetMonitor()
+{
+	if (!m_monitors.IsValid())
 	{
-		MONITORINFO info;
-		info.cbSize = sizeof(MONITORINFO);
-		if (GetMonitorInfo(hMonitor, &info))
-		{
-			rcWorkArea = info.rcWork;
-		}
+		std::vector<MonitorEntry> monitors;
+		EnumDisplayMonitors(NULL, NULL, _EnumMonitor, reinterpret_cast<LPARAM>(&monitors));
+		m_monitors.Assign(monitors);
 	}
-	RECT rcWindow;
-	GetWindowRect(&rcWindow);
-	int width = (rcWindow.right - rcWindow.left);
-	int height = (rcWindow.bottom - rcWindow.top);
-	// keep panel visible
-	rcWorkArea.right -= width;
-	rcWorkArea.bottom -= height;
-	int x = m_inputPos.left;
-	int y = m_inputPos.bottom;
-	if (x > rcWorkArea.right)
-		x = rcWorkArea.right;
-	if (x < rcWorkArea.left)
-		x = rcWorkArea.left;
-	// show panel above the input focus if we're around the bottom
-	if (y > rcWorkArea.bottom)
-		y = m_inputPos.top - height;
-	if (y > rcWorkArea.bottom)
-		y = rcWorkArea.bottom;
-	if (y < rcWorkArea.top)
-		y = rcWorkArea.top;
+	return m_monitors.Find(m_inputPos.left, m_inputPos.top);
+}
+
+int WeaselPanel::_GetDpi()
+{
+	// the dpi of the monitor at the input position
+	const MonitorEntry* monitor = _GetMonitor();
+	return monitor ? monitor->dpi : _GetScreenDpi();
+}
+
+void WeaselPanel::_RasterizeStatusIcons(int dpi)
+{
+	static const UINT ids[STATUS_ICON_COUNT] = { IDI_ZH, IDI_EN, IDI_RELOAD };
+	Framebuffer* strip = m_statusIcons.Add(dpi);
+	const int size = strip->Height();
+	// DrawIconEx over transparent black leaves the icons premultiplied
+	RetainedSurface surface;
+	surface.Ensure(CSize(strip->Width(), size));
+	if (!surface.GetDC())
+		return;
+	surface.Clear(CRect(0, 0, strip->Width(), size));
+	for (int i = 0; i < STATUS_ICON_COUNT; ++i)
+	{
+		CIcon icon;
+		if (icon.LoadIconW(ids[i], size, size, LR_DEFAULTCOLOR))
+			::DrawIconEx(surface.GetDC(), i * size, 0, icon, size, size, 0, NULL, DI_NORMAL);
+	}
+	GdiFlush();
+	PixelTarget bits = surface.GetTarget(CRect(0, 0, strip->Width(), size));
+	for (int y = 0; y < size; ++y)
+		memcpy(strip->Pixels() + y * strip->Width(), bits.Row(y), strip->Width() * sizeof(uint32_t));
+}
+
+void WeaselPanel::_RepositionWindow()
+{
+	const MonitorEntry* monitor = _GetMonitor();
+	const ScreenRect work = monitor ? monitor->work : MakeScreenRect(0, 0, 0, 0);
+	// keep panel visible, above the input focus if we're around the bottom
+	int x, y;
+	PlacePanel(MakeScreenRect(m_inputPos.left, m_inputPos.top, m_inputPos.right, m_inputPos.bottom),
+		m_windowRect.Width(), m_windowRect.Height(), work, &x, &y);
 	// memorize adjusted position (to avoid window bouncing on height change)
 	if (m_style.layout_type == UIStyle::LAYOUT_HORIZONTAL_FULLSCREEN || m_style.layout_type == UIStyle::LAYOUT_VERTICAL_FULLSCREEN)
 	{
@@ -886,7 +859,8 @@ void WeaselPanel::_RepositionWindow()
 		y -= (abs(m_style.shadow_offset_y) + m_style.shadow_radius) * 2;
 	}
 	m_inputPos.bottom = y;
-	SetWindowPos(HWND_TOPMOST, x, y, 0, 0, SWP_NOSIZE|SWP_NOACTIVATE);
+	m_windowRect.MoveToXY(x, y);
+	SetWindowPos(HWND_TOPMOST, x, y, m_windowRect.Width(), m_windowRect.Height(), SWP_NOACTIVATE);
 }
 
 static HRESULT _TextOutWithFallback(CDCHandle dc, int x, int y, CRect const& rc, LPCWSTR psz, int cch)
@@ -951,23 +925,9 @@ HBITMAP WeaselPanel::_CreateAlphaTextBitmap(LPCWSTR inText, HFONT inFont, COLORR
 			SetBkMode(hTextDC, OPAQUE);
 			// draw text to buffer
 			DrawText(hTextDC, inText, cch, &TextArea, DT_NOCLIP);
-			BYTE* DataPtr = (BYTE*)pvBits;
-			BYTE FillR = GetRValue(inColor);
-			BYTE FillG = GetGValue(inColor);
-			BYTE FillB = GetBValue(inColor);
-			BYTE ThisA;
-
-			for (int LoopY = 0; LoopY < BMIH.biHeight; LoopY++)
-			{
-				for (int LoopX = 0; LoopX < BMIH.biWidth; LoopX++)
-				{
-					ThisA = *DataPtr; // move alpha and premutiply with rgb
-					*DataPtr++ = (FillB * ThisA) >> 8;
-					*DataPtr++ = (FillG * ThisA) >> 8;
-					*DataPtr++ = (FillR * ThisA) >> 8;
-					*DataPtr++ = ThisA;
-				}
-			}
+			GdiFlush();
+			// move coverage to alpha and premultiply with the text color
+			PremultiplyCoverage((uint32_t*)pvBits, BMIH.biWidth * BMIH.biHeight, GetRValue(inColor), GetGValue(inColor), GetBValue(inColor));
 			SelectObject(hTextDC, hOldBMP);
 		}
 	}
@@ -976,224 +936,72 @@ HBITMAP WeaselPanel::_CreateAlphaTextBitmap(LPCWSTR inText, HFONT inFont, COLORR
 	return hMyDIB;
 }
 
-static HRESULT _TextOutWithFallback_ULW(CDCHandle dc, int x, int y, CRect const rc, LPCWSTR psz, int cch, long height, std::wstring fontface)
+// draws a line white on black with Uniscribe font fallback, then colorizes it;
+// returns NULL if the line cannot be shaped. lineHeight is set either way.
+static HBITMAP _CreateGlyphRunBitmap(CSize const& size, LPCWSTR psz, int cch, HFONT font, COLORREF color, int* lineHeight)
 {
-    SCRIPT_STRING_ANALYSIS ssa;
-    HRESULT hr;
-	CFont font;
-	font.CreateFontW(height, 0, 0, 0, 0, 0, 0, 0, DEFAULT_CHARSET, 0, 0, 0, 0, fontface.c_str());
-	int TextLength = cch;
+	SCRIPT_STRING_ANALYSIS ssa = NULL;
+	HRESULT hr;
 	HDC hTextDC = CreateCompatibleDC(NULL);
 	HFONT hOldFont = (HFONT)SelectObject(hTextDC, font);
 	HBITMAP MyBMP = NULL;
-
-    hr = ScriptStringAnalyse(
-        hTextDC,
-        psz, cch,
-        2 * cch + 16,
-        -1,
-        SSA_GLYPHS|SSA_FALLBACK|SSA_LINK,
-        0,
-        NULL, // control
-        NULL, // state
-        NULL, // piDx
-        NULL,
-        NULL, // pbInClass
-        &ssa);
-
-    if (SUCCEEDED(hr))
-    {
-
+	SIZE extent = { 0, 0 };
+	GetTextExtentPoint32(hTextDC, psz, cch, &extent);
+	*lineHeight = extent.cy;
+
+	hr = ScriptStringAnalyse(
+		hTextDC,
+		psz, cch,
+		2 * cch + 16,
+		-1,
+		SSA_GLYPHS|SSA_FALLBACK|SSA_LINK,
+		0,
+		NULL, // control
+		NULL, // state
+		NULL, // piDx
+		NULL,
+		NULL, // pbInClass
+		&ssa);
+
+	if (SUCCEEDED(hr) && size.cx > 0 && size.cy > 0)
+	{
 		BITMAPINFOHEADER BMIH;
 		memset(&BMIH, 0x0, sizeof(BITMAPINFOHEADER));
 		void* pvBits = NULL;
 		BMIH.biSize = sizeof(BMIH);
-		BMIH.biWidth = rc.right - rc.left;
-		BMIH.biHeight = rc.bottom - rc.top;
+		BMIH.biWidth = size.cx;
+		BMIH.biHeight = size.cy;
 		BMIH.biPlanes = 1;
 		BMIH.biBitCount = 32;
 		BMIH.biCompression = BI_RGB;
 		MyBMP = CreateDIBSection(hTextDC, (LPBITMAPINFO)&BMIH, 0, (LPVOID*)&pvBits, NULL, 0);
-		HBITMAP hOldBMP;
-		if(MyBMP)
-			hOldBMP = (HBITMAP)SelectObject(hTextDC, MyBMP);
-		COLORREF inColor = dc.GetTextColor();
-		BYTE alpha = (inColor >> 24) & 255 ;
+		HBITMAP hOldBMP = MyBMP ? (HBITMAP)SelectObject(hTextDC, MyBMP) : NULL;
 		if (hOldBMP != NULL)
 		{
 			SetTextColor(hTextDC, 0x00FFFFFF);
 			SetBkColor(hTextDC, 0x00000000);
 			SetBkMode(hTextDC, OPAQUE);
 			// draw text to buffer
-			hr = ScriptStringOut(ssa, 0, 0, 0, rc, 0, 0, FALSE);
-			BYTE* DataPtr = (BYTE*)pvBits;
-			BYTE FillR = GetRValue(inColor);
-			BYTE FillG = GetGValue(inColor);
-			BYTE FillB = GetBValue(inColor);
-			BYTE ThisA;
-			for (int LoopY = 0; LoopY < BMIH.biHeight; LoopY++)
-			{
-				for (int LoopX = 0; LoopX < BMIH.biWidth; LoopX++)
-				{
-					ThisA = *DataPtr; // move alpha and premutiply with rgb
-					*DataPtr++ = (FillB * ThisA) >> 8;
-					*DataPtr++ = (FillG * ThisA) >> 8;
-					*DataPtr++ = (FillR * ThisA) >> 8;
-					*DataPtr++ = ThisA;
-				}
-			}
+			hr = ScriptStringOut(ssa, 0, 0, 0, NULL, 0, 0, FALSE);
+			GdiFlush();
+			// move coverage to alpha and premultiply with the text color
+			PremultiplyCoverage((uint32_t*)pvBits, BMIH.biWidth * BMIH.biHeight, GetRValue(color), GetGValue(color), GetBValue(color));
 			SelectObject(hTextDC, hOldBMP);
 		}
-		SelectObject(hTextDC, hOldFont);
-		DeleteDC(hTextDC);
-		DeleteObject(font);
-		if (MyBMP)
-		{
-			// temporary dc select bmp into it
-			HDC hTempDC = CreateCompatibleDC(dc);
-			HBITMAP hOldBMP = (HBITMAP)SelectObject(hTempDC, MyBMP);
-			if (hOldBMP)
-			{
-				BITMAP BMInf;
-				GetObject(MyBMP, sizeof(BITMAP), &BMInf);
-				// fill blend function and blend new text to window
-				BLENDFUNCTION bf;
-				bf.BlendOp = AC_SRC_OVER;
-				bf.BlendFlags = 0;
-				bf.SourceConstantAlpha = alpha;
-				bf.AlphaFormat = AC_SRC_ALPHA;
-				AlphaBlend(dc, x, y, BMInf.bmWidth, BMInf.bmHeight, hTempDC, 0, 0, BMInf.bmWidth, BMInf.bmHeight, bf);
-				// clean up
-				SelectObject(hTempDC, hOldBMP);
-				DeleteObject(MyBMP);
-				DeleteDC(hTempDC);
-			}
-		}
-    }
-
-	hr = ScriptStringFree(&ssa);
-	return hr;
-}
-
-#if 0
-// utf16* to unicode and return length of utf16
-inline static size_t Utf16ToUnicode(const wchar_t* src, ULONG& des)
-{
-	if (!src || (*src) == 0) return 0;
-
-	wchar_t w1 = src[0];
-	if (w1 >= 0xD800 && w1 <= 0xDFFF)
-	{
-		if (w1 < 0xDC00)
+		if (FAILED(hr) && MyBMP)
 		{
-			wchar_t w2 = src[1];
-			if (w2 >= 0xDC00 && w2 <= 0xDFFF)
-			{
-				des = (w2 & 0x03FF) + (((w1 & 0x03FF) + 0x40) << 10);
-				return 2;
-			}
+			DeleteObject(MyBMP);
+			MyBMP = NULL;
 		}
-		return 0; // the src is invalid  
-	}
-	else
-	{
-		des = w1;
-		return 1;
 	}
+	if (ssa)
+		ScriptStringFree(&ssa);
+	SelectObject(hTextDC, hOldFont);
+	DeleteDC(hTextDC);
+	return MyBMP;
 }
 
-// wstring中查找所有emoji字符的range
-static std::vector<DWRITE_TEXT_RANGE> CheckEmojiRange(std::wstring str)
-{
-	std::vector<DWRITE_TEXT_RANGE> rng;
-	size_t i = 0;
-	wchar_t* utf16 = &str[0];
-	ULONG unicode = 0;
-	UINT32 sc = 0, ec = 0;
-	size_t sz = 0;
-	BOOL isEmjtmp = FALSE;
-	BOOL isEmoji = FALSE;
-	while (i < str.size())
-	{
-		sz = Utf16ToUnicode(utf16, unicode);
-		if ( (unicode >= 0x2000 && unicode <= 0x27bf) || (unicode >= 0x1f000 && unicode <= 0x1fbff) )
-			isEmjtmp = TRUE;    /* 当前字符是emoji 字符长度为sz */
-		else
-			isEmjtmp = FALSE;
-		if (isEmoji == TRUE && (*utf16 == 0x200d)) /* 如果前面的字符是Emoji 后面链接符号也认为是Emoji的一部分 */
-		{
-			isEmjtmp = TRUE;
-			sz = 1;
-		}
-		if (isEmoji == FALSE && isEmjtmp == TRUE)    /* 如果前面不是emoji而当前文字为emoji 则这是emoji字符串的开始 */
-		{
-			sc = i;
-		}
-		if (isEmoji == TRUE && isEmjtmp == FALSE)    /* 如果前面是emoji 而当前文字不是emoji，则这是emoji字符串的结尾 */
-		{
-			ec = i;
-			rng.push_back(DWRITE_TEXT_RANGE{ sc, ec - sc });
-		}
-		isEmoji = isEmjtmp;
-		if ((i == str.size() - sz) && isEmjtmp == TRUE)  /* 最后一个字符，刚好为emoji， 这是emoji字符串结尾*/
-		{
-			ec = i + sz;
-			rng.push_back(DWRITE_TEXT_RANGE{ sc, ec - sc });
-		}
-		if (i < str.size())
-		{
-			i += sz;
-			utf16 += sz;
-		}
-	}
-	return rng;
-}
-// wstring中查找所有非emoji字符的range
-static std::vector<DWRITE_TEXT_RANGE> CheckNotEmojiRange(std::wstring str)
-{
-	std::vector<DWRITE_TEXT_RANGE> rng;
-	size_t i = 0;
-	wchar_t* utf16 = &str[0];
-	ULONG unicode = 0;
-	UINT32 sc = 0, ec = 0;
-	size_t sz = 0;
-	BOOL isEmjtmp = FALSE;
-	BOOL isEmoji = TRUE;
-	while (i < str.size())
-	{
-		sz = Utf16ToUnicode(utf16, unicode);
-		if ( (unicode >= 0x2000 && unicode <= 0x27bf) || (unicode >= 0x1f000 && unicode <= 0x1fbff) )
-			isEmjtmp = TRUE;    /* 当前字符是emoji 字符长度为sz */
-		else
-			isEmjtmp = FALSE;
-		if (isEmoji == TRUE && (*utf16 == 0x200d)) /* 如果前面的字符是Emoji 后面链接符号也认为是Emoji的一部分 */
-		{
-			isEmjtmp = TRUE;
-			sz = 1;
-		}
-		if (isEmoji == TRUE && isEmjtmp == FALSE)    /* 如果前面不是emoji而当前文字不是emoji 则这是非emoji字符串的开始 */
-		{
-			sc = i;
-		}
-		if (isEmoji == FALSE && isEmjtmp == TRUE)    /* 如果前面是非emoji 而当前文字是emoji，则这是非emoji字符串的结尾 */
-		{
-			ec = i;
-			rng.push_back(DWRITE_TEXT_RANGE{ sc, ec - sc });
-		}
-		isEmoji = isEmjtmp;
-		if ((i == str.size() - sz) && isEmjtmp == FALSE)  /* 最后一个字符，刚好不是emoji， 这是非emoji字符串结尾*/
-		{
-			ec = i + sz;
-			rng.push_back(DWRITE_TEXT_RANGE{ sc, ec - sc });
-		}
-		if (i < str.size())
-		{
-			i += sz;
-			utf16 += sz;
-		}
-	}
-	return rng;
-}
+#if 0
 static inline int CalcFontOffsetDW(IDWriteTextFormat* pTextFormat)
 {
 	// offset calc start
@@ -1246,31 +1054,27 @@ static inline int CalcFontHeightDW(IDWriteTextFormat* pTextFormat)
 
 HRESULT WeaselPanel::_TextOutWithFallback_D2D (CDCHandle dc, CRect const rc, wstring psz, int cch, COLORREF gdiColor, IDWriteTextFormat* pTextFormat)
 {
-	float r = (float)(GetRValue(gdiColor))/255.0f;
-	float g = (float)(GetGValue(gdiColor))/255.0f;
-	float b = (float)(GetBValue(gdiColor))/255.0f;
-
-	// alpha 
-	float alpha = (float)((gdiColor >> 24) & 255) / 255.0f;
-	ID2D1SolidColorBrush* pBrush = NULL;
-	pDWR->pRenderTarget->CreateSolidColorBrush(D2D1::ColorF(r, g, b, alpha), &pBrush);
-	if (NULL != pBrush && NULL != pDWR->pTextFormat)
-	{
-		IDWriteTextLayout* pTextLayout = NULL;
-		if (pTextFormat == NULL)
-			pTextFormat = pDWR->pTextFormat;
-		pDWR->pDWFactory->CreateTextLayout( ((wstring)psz).c_str(), ((wstring)psz).size(), pTextFormat, 0, 0, &pTextLayout);
-		CSize sz;
-		m_layout->GetTextSizeDW(psz.c_str(), psz.length(), pTextFormat, pDWR->pDWFactory, &sz);
-		float offsetx = (rc.Width() - sz.cx) / 2.0f;
-		pDWR->pRenderTarget->BindDC(dc, &rc);
-		pDWR->pRenderTarget->BeginDraw();
-		if (pTextLayout != NULL)
-			pDWR->pRenderTarget->DrawTextLayout({ offsetx, (float)(rc.Height() / 2) }, pTextLayout, pBrush, D2D1_DRAW_TEXT_OPTIONS_ENABLE_COLOR_FONT);
-		pDWR->pRenderTarget->EndDraw();
-	}
-	pBrush->Release();
-	return S_OK;
+	if (pTextFormat == NULL)
+		pTextFormat = pDWR->pTextFormat;
+	ID2D1SolidColorBrush* pBrush = pDWR->GetBrush(gdiColor);
+	// the layout pass measured the same text, so this is a cache hit
+	IDWriteTextLayout* pTextLayout = pDWR->GetTextLayout(psz, pTextFormat);
+	if (pBrush == NULL || pTextLayout == NULL)
+		return E_FAIL;
+	DWRITE_TEXT_METRICS metrics;
+	HRESULT hr = pTextLayout->GetMetrics(&metrics);
+	if (FAILED(hr))
+		return hr;
+	float offsetx = (rc.Width() - ceil(metrics.width)) / 2.0f;
+	hr = pDWR->BindDC(dc, rc);
+	if (FAILED(hr))
+		return hr;
+	pDWR->pRenderTarget->BeginDraw();
+	pDWR->pRenderTarget->DrawTextLayout({ offsetx, (float)(rc.Height() / 2) }, pTextLayout, pBrush, D2D1_DRAW_TEXT_OPTIONS_ENABLE_COLOR_FONT);
+	hr = pDWR->pRenderTarget->EndDraw();
+	if (hr == D2DERR_RECREATE_TARGET)
+		pDWR->RecreateRenderTarget();
+	return hr;
 }
 static std::vector<std::wstring> ws_split(const std::wstring& in, const std::wstring& delim) 
 {
@@ -1288,91 +1092,68 @@ void WeaselPanel::_TextOut(CDCHandle dc, int x, int y, CRect const& rc, LPCWSTR
 	}
 	else
 	{ 
-		long height = -MulDiv(font_point, dc.GetDeviceCaps(LOGPIXELSY), 72);
+		int dpi = dc.GetDeviceCaps(LOGPIXELSY);
+		long height = -MulDiv(font_point, dpi, 72);
+		COLORREF color = dc.GetTextColor();
+		BYTE alpha = (BYTE)((color >> 24) & 255);
 		std::vector<std::wstring> lines;
 		lines = ws_split(psz, L"\r");
 		int offset = 0;
 		for (wstring line : lines)
 		{
-			CSize size;
+			GlyphRunKey key = { line, font_face, height, dpi, color & 0x00FFFFFF, CSize(rc.Width(), rc.Height()) };
+			const GlyphRun* run = m_glyphRuns.Find(key);
+			Profiler::Count(run != NULL ? PROFILE_GLYPH_RUN_HITS : PROFILE_GLYPH_RUN_MISSES);
+			if (run != NULL)
+			{
+				_BlendGlyphRun(dc, x, y + offset, run->bitmap, alpha);
+				offset += run->line_height;
+				continue;
+			}
+
 			CFont font;
 			font.CreateFontW(height, 0, 0, 0, 0, 0, 0, 0, DEFAULT_CHARSET, 0, 0, 0, 0, font_face.c_str());
-			dc.SelectFont(font);
-			dc.GetTextExtent(line.c_str(), line.length(), &size);
-			if (FAILED(_TextOutWithFallback_ULW(dc, x, y+offset, rc, line.c_str(), line.length(), height, font_face ))) 
+			GlyphRun created = { NULL, 0 };
+			created.bitmap = _CreateGlyphRunBitmap(key.size, line.c_str(), line.length(), font, color, &created.line_height);
+			if (created.bitmap)
 			{
-				//CFont font;
-				//font.CreateFontW(height, 0, 0, 0, 0, 0, 0, 0, DEFAULT_CHARSET, 0, 0, 0, 0, m_style.font_face.c_str());
-
-				HBITMAP MyBMP = _CreateAlphaTextBitmap(psz, font, dc.GetTextColor(), cch);
-				DeleteObject(font);
+				_BlendGlyphRun(dc, x, y + offset, created.bitmap, alpha);
+				const unsigned long evictions = m_glyphRuns.GetStats().evictions;
+				if (!m_glyphRuns.Insert(key, created, key.size.cx * key.size.cy * 4))
+					DeleteObject(created.bitmap);
+				Profiler::Count(PROFILE_GLYPH_RUN_EVICTIONS, m_glyphRuns.GetStats().evictions - evictions);
+			}
+			else
+			{
+				HBITMAP MyBMP = _CreateAlphaTextBitmap(psz, font, color, cch);
 				if (MyBMP)
 				{
-					BYTE alpha = (BYTE)((dc.GetTextColor() >> 24) & 255) ;
-					// temporary dc select bmp into it
-					HDC hTempDC = CreateCompatibleDC(dc);
-					HBITMAP hOldBMP = (HBITMAP)SelectObject(hTempDC, MyBMP);
-					if (hOldBMP)
-					{
-						BITMAP BMInf;
-						GetObject(MyBMP, sizeof(BITMAP), &BMInf);
-						// fill blend function and blend new text to window
-						BLENDFUNCTION bf;
-						bf.BlendOp = AC_SRC_OVER;
-						bf.BlendFlags = 0;
-						bf.SourceConstantAlpha = alpha;
-						bf.AlphaFormat = AC_SRC_ALPHA;
-						AlphaBlend(dc, x, y, BMInf.bmWidth, BMInf.bmHeight, hTempDC, 0, 0, BMInf.bmWidth, BMInf.bmHeight, bf);
-						// clean up
-						SelectObject(hTempDC, hOldBMP);
-						DeleteObject(MyBMP);
-						DeleteDC(hTempDC);
-					}
+					_BlendGlyphRun(dc, x, y, MyBMP, alpha);
+					DeleteObject(MyBMP);
 				}
 			}
-			offset += size.cy;
+			offset += created.line_height;
 		}
 	}
 }
 
-GraphicsRoundRectPath::GraphicsRoundRectPath(void) : Gdiplus::GraphicsPath()
-{
-
-}
-GraphicsRoundRectPath::GraphicsRoundRectPath(int left, int top, int width, int height, int cornerx, int cornery) 
-	: Gdiplus::GraphicsPath()
-{
-	AddRoundRect(left, top, width, height, cornerx, cornery);
-}
-GraphicsRoundRectPath::GraphicsRoundRectPath(const CRect rc, int corner)
-{
-	AddRoundRect(rc.left, rc.top, rc.Width(), rc.Height(), corner, corner);
-}
-void GraphicsRoundRectPath::AddRoundRect(int left, int top, int width, int height, int cornerx, int cornery)
+void WeaselPanel::_BlendGlyphRun(CDCHandle dc, int x, int y, HBITMAP bitmap, BYTE alpha)
 {
-	if(cornery > 0 && cornerx >0)
-	{
-		int cnx = ((cornerx*2 <= width) ? cornerx : (width/2));
-		int cny = ((cornery*2 <= height) ? cornery : (height/2));
-		int elWid = 2 * cnx;
-		int elHei = 2 * cny;
-
-		AddArc(left, top, elWid, elHei, 180, 90);
-		AddLine(left + cnx , top, left + width - cnx , top);
-
-		AddArc(left + width - elWid, top, elWid, elHei, 270, 90);
-		AddLine(left + width, top + cny, left + width, top + height - cny);
-
-		AddArc(left + width - elWid, top + height - elHei, elWid, elHei, 0, 90);
-		AddLine(left + width - cnx, top + height, left + cnx, top + height);
-
-		AddArc(left, top + height - elHei, elWid, elHei, 90, 90);
-		AddLine(left, top + cny, left, top + height - cny);
-	}
-	else
+	if (!m_glyphDC)
+		m_glyphDC.CreateCompatibleDC(dc);
+	HBITMAP hOldBMP = m_glyphDC.SelectBitmap(bitmap);
+	if (hOldBMP)
 	{
-		Gdiplus::Rect& rc = Rect(left, top, width, height);
-		AddRectangle(rc);
+		BITMAP BMInf;
+		GetObject(bitmap, sizeof(BITMAP), &BMInf);
+		// fill blend function and blend new text to window
+		BLENDFUNCTION bf;
+		bf.BlendOp = AC_SRC_OVER;
+		bf.BlendFlags = 0;
+		bf.SourceConstantAlpha = alpha;
+		bf.AlphaFormat = AC_SRC_ALPHA;
+		AlphaBlend(dc, x, y, BMInf.bmWidth, BMInf.bmHeight, m_glyphDC, 0, 0, BMInf.bmWidth, BMInf.bmHeight, bf);
+		m_glyphDC.SelectBitmap(hOldBMP);
 	}
 }
 
@@ -2,14 +2,78 @@
 #include <WeaselCommon.h>
 #include <WeaselUI.h>
 #include "Layout.h"
+#include "LayoutDiff.h"
+#include "ByteBudgetCache.h"
+#include "Rasterizer.h"
+#include "StatusIconAtlas.h"
+#include "MonitorCache.h"
 #include <Usp10.h>
 
-#include <gdiplus.h>
-#pragma comment(lib, "gdiplus.lib")
-#pragma comment(lib, "d2d1.lib")
-#pragma comment(lib, "dwrite.lib")
+#ifndef WM_DPICHANGED
+#define WM_DPICHANGED 0x02E0
+#endif
+
 typedef CWinTraits<WS_POPUP|WS_CLIPSIBLINGS|WS_DISABLED, WS_EX_TOOLWINDOW|WS_EX_TOPMOST> CWeaselPanelTraits;
 
+// 32bpp top-down DIB selected into a memory DC, kept across paints
+class RetainedSurface
+{
+public:
+	RetainedSurface() : m_old(NULL), m_bits(NULL), m_size(0, 0) {}
+	~RetainedSurface() { Release(); }
+
+	// returns true if the surface was recreated and has lost its content
+	bool Ensure(CSize size);
+	void Release();
+	// makes the pixels in rc fully transparent
+	void Clear(CRect const& rc);
+	void CopyFrom(RetainedSurface const& src, CRect const& rc);
+
+	HDC GetDC() const { return m_dc; }
+	CSize GetSize() const { return m_size; }
+	// the bits for drawing straight into, clipped to rc; GdiFlush first
+	weasel::PixelTarget GetTarget(CRect const& rc) const
+	{
+		CRect clip;
+		clip.IntersectRect(rc, CRect(CPoint(0, 0), m_size));
+		return weasel::MakePixelTarget((uint32_t*)m_bits, m_size.cx, clip.left, clip.top, clip.right, clip.bottom);
+	}
+
+private:
+	CDC m_dc;
+	CBitmap m_bitmap;
+	HBITMAP m_old;
+	BYTE* m_bits;
+	CSize m_size;
+};
+
+// a line of GDI fallback text, identified by everything that affects its pixels
+struct GlyphRunKey
+{
+	std::wstring text;
+	std::wstring font_face;
+	int font_height;
+	int dpi;
+	COLORREF color;		// without alpha, which is applied when blending
+	CSize size;
+
+	bool operator<(GlyphRunKey const& other) const;
+};
+
+// the line colorized and premultiplied, ready for AlphaBlend
+struct GlyphRun
+{
+	HBITMAP bitmap;
+	int line_height;
+};
+
+struct GlyphRunRelease
+{
+	void operator()(GlyphRun const& run) const { ::DeleteObject(run.bitmap); }
+};
+
+typedef weasel::ByteBudgetCache<GlyphRunKey, GlyphRun, GlyphRunRelease> GlyphRunCache;
+
 class WeaselPanel : 
 	public CWindowImpl<WeaselPanel, CWindow, CWeaselPanelTraits>,
 	CDoubleBufferImpl<WeaselPanel>
@@ -18,11 +82,16 @@ public:
 	BEGIN_MSG_MAP(WeaselPanel)
 		MESSAGE_HANDLER(WM_CREATE, OnCreate)
 		MESSAGE_HANDLER(WM_DESTROY, OnDestroy)
+		MESSAGE_HANDLER(WM_DPICHANGED, OnDpiChanged)
+		MESSAGE_HANDLER(WM_DISPLAYCHANGE, OnDisplayChange)
+		MESSAGE_HANDLER(WM_SETTINGCHANGE, OnDisplayChange)
 		CHAIN_MSG_MAP(CDoubleBufferImpl<WeaselPanel>)
 	END_MSG_MAP()
 
 	LRESULT OnCreate(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL& bHandled);
 	LRESULT OnDestroy(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL& bHandled);
+	LRESULT OnDpiChanged(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL& bHandled);
+	LRESULT OnDisplayChange(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL& bHandled);
 	LRESULT OnPaint(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL& bHandled);
 	void CloseDialog(int nVal);
 
@@ -31,45 +100,90 @@ public:
 
 	void MoveTo(RECT const& rc);
 	void Refresh();
+	// lays out a page the next Refresh may show, so that showing it takes a paint only
+	void Prepare(weasel::Context const& ctx);
 
 	void DoPaint(CDCHandle dc);
 
 private:
-	void _CreateLayout();
+	// a page laid out by Prepare, and the state it was laid out from, which its layout refers to
+	struct PreparedPage
+	{
+		PreparedPage() : layout(NULL), type(weasel::UIStyle::LAYOUT_TYPE_LAST), dpi(0) {}
+		weasel::Context ctx;
+		weasel::Status status;
+		weasel::UIStyle style;
+		weasel::Layout *layout;
+		weasel::UIStyle::LayoutType type;
+		int dpi;
+	};
+	enum { PREPARED_PAGES = 2 };
+
+	weasel::UIStyle::LayoutType _GetLayoutType() const;
+	void _ResetLayout();
+	void _InitDirectWrite();
+	const PreparedPage* _FindPreparedPage(weasel::Context const& ctx) const;
 	void _ResizeWindow();
 	void _RepositionWindow();
+	const weasel::MonitorEntry* _GetMonitor();
+	int _GetDpi();
+	void _RasterizeStatusIcons(int dpi);
+	void _Invalidate(CRect const& rc);
+	CRect _GetHighlightDirtyRect(CRect const& highlight) const;
+	CRect _GetCandidateExtent(int id) const;
+	bool _NeedsPaint(CRect const& rc) const;
+	bool _ShouldHideCandidates() const;
+	void _DrawBackground(weasel::PixelTarget const& target, CRect const& rc);
+	void _UpdateLayeredWindow(POINT const& ptDst, SIZE const& sz, HDC memDC, POINT const& ptSrc, BLENDFUNCTION const& bf, const RECT* dirty);
 	bool _DrawPreedit(weasel::Text const& text, CDCHandle dc, CRect const& rc);
 	bool _DrawCandidates(CDCHandle dc);
-	void _HighlightTextEx(CDCHandle dc, CRect rc, COLORREF color, COLORREF shadowColor, int blurOffsetX, int blurOffsetY, int radius );
+	void _HighlightTextEx(weasel::PixelTarget const& target, CRect rc, COLORREF color, COLORREF shadowColor, int blurOffsetX, int blurOffsetY, int radius);
 	void _TextOut(CDCHandle dc, int x, int y, CRect const& rc, LPCWSTR psz, int cch, IDWriteTextFormat* pTextFormat, int font_point, std::wstring font_face);
 	HBITMAP _CreateAlphaTextBitmap(LPCWSTR inText, HFONT inFont, COLORREF inColor, int cch);
+	void _BlendGlyphRun(CDCHandle dc, int x, int y, HBITMAP bitmap, BYTE alpha);
 	HRESULT _TextOutWithFallback_D2D(CDCHandle dc, CRect const rc, std::wstring psz, int cch, COLORREF gdiColor, IDWriteTextFormat* pTextFormat);
 
+	// the layout of the current style, one of m_layouts
 	weasel::Layout *m_layout;
+	weasel::Layout *m_layouts[weasel::UIStyle::LAYOUT_TYPE_LAST];
 	weasel::Context &m_ctx;
 	weasel::Status &m_status;
 	weasel::UIStyle &m_style;
 
+	// state m_layout was built from
+	weasel::Context m_layoutCtx;
+	weasel::Status m_layoutStatus;
+	weasel::UIStyle m_layoutStyle;
+	// the pages before and after the one shown, replaced in turn
+	PreparedPage m_prepared[PREPARED_PAGES];
+	int m_nextPrepared;
+
+	// background and border, redrawn on full refreshes only
+	RetainedSurface m_backgroundLayer;
+	// what UpdateLayeredWindow presents; partial paints start from the background layer
+	RetainedSurface m_backBuffer;
+	// area waiting for the next paint, and the one being painted
+	CRect m_dirtyRect;
+	CRect m_paintRect;
+	// m_backBuffer bits clipped to m_paintRect, where backgrounds and highlights are rasterized
+	weasel::PixelTarget m_paintTarget;
+	// colorized GDI text lines, blended again as long as they stay cached
+	GlyphRunCache m_glyphRuns;
+	CDC m_glyphDC;
+
 	CRect m_inputPos;
-	CIcon m_iconDisabled;
-	CIcon m_iconEnabled;
-	CIcon m_iconAlpha;
+	// where _RepositionWindow last put the window, and the size _ResizeWindow wants for it
+	CRect m_windowRect;
+	// work area and dpi of each monitor, until the display settings change
+	weasel::MonitorCache m_monitors;
+	// dpi the layout and the status icons are at
+	int m_dpi;
+	// IDI_ZH, IDI_EN and IDI_RELOAD, premultiplied at each dpi the panel has been shown at
+	weasel::StatusIconAtlas m_statusIcons;
 
-	Gdiplus::GdiplusStartupInput _m_gdiplusStartupInput;
-	ULONG_PTR _m_gdiplusToken;
 	bool _isVistaSp2OrGrater;
 	
+	// its factories and text formats are made by the first layout with color_font
 	DirectWriteResources* pDWR = NULL;
 	GDIFonts* pFonts = NULL;
 };
-
-class GraphicsRoundRectPath : public Gdiplus::GraphicsPath
-{
-public:
-	GraphicsRoundRectPath();
-	GraphicsRoundRectPath(int left, int top, int width, int height, int cornerx, int cornery);
-	GraphicsRoundRectPath(const CRect rc, int corner);
-
-public:
-	void AddRoundRect(int left, int top, int width, int height, int cornerx, int cornery);
-};
@@ -112,6 +112,14 @@ void UI::Update(const Context &ctx, const Status &status)
 	Refresh();
 }
 
+void UI::Prepare(const Context &ctx)
+{
+	if (pimpl_ && pimpl_->panel.IsWindow())
+	{
+		pimpl_->panel.Prepare(ctx);
+	}
+}
+
 UINT_PTR UIImpl::timer = 0;
 
 void UIImpl::Show()
@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+# Generates EmojiTable.h from the Unicode emoji-data.txt.
+#
+#   python gen_emoji_table.py emoji-data.txt > EmojiTable.h
+#
+# emoji-data.txt: https://www.unicode.org/Public/UCD/latest/ucd/emoji/emoji-data.txt
+
+import re
+import sys
+
+PICTOGRAPHIC = 1
+ZWJ = 2
+VARIATION_SELECTOR = 4
+MODIFIER = 8
+REGIONAL_INDICATOR = 16
+TAG = 32
+KEYCAP = 64
+
+BLOCK_SHIFT = 6
+BLOCK_SIZE = 1 << BLOCK_SHIFT
+MAX_CODEPOINT = 0x110000
+# planes 2 and up hold no emoji, only the tag characters which are tested inline
+TABLE_LIMIT = 0x20000
+
+
+def parse(path):
+    props = bytearray(MAX_CODEPOINT)
+    version = ''
+    for line in open(path, encoding='utf-8'):
+        m = re.match(r'#\s*Version:\s*(\S+)', line)
+        if m:
+            version = m.group(1)
+        line = line.split('#', 1)[0].strip()
+        if not line:
+            continue
+        cps, prop = [x.strip() for x in line.split(';')]
+        if prop == 'Extended_Pictographic':
+            flag = PICTOGRAPHIC
+        elif prop == 'Emoji_Modifier':
+            flag = MODIFIER
+        else:
+            continue
+        first, _, last = cps.partition('..')
+        for cp in range(int(first, 16), int(last or first, 16) + 1):
+            props[cp] |= flag
+    # fixed by the emoji sequence grammar (UTS #51), not listed as properties
+    props[0x200D] |= ZWJ
+    props[0x20E3] |= KEYCAP
+    for cp in range(0xFE00, 0xFE10):
+        props[cp] |= VARIATION_SELECTOR
+    for cp in range(0x1F1E6, 0x1F200):
+        props[cp] |= REGIONAL_INDICATOR
+    for cp in range(0xE0020, 0xE0080):
+        props[cp] |= TAG
+    return props, version
+
+
+def build(props):
+    blocks = {}
+    stage1 = []
+    stage2 = []
+    for cp in range(TABLE_LIMIT, MAX_CODEPOINT):
+        assert props[cp] in (0, TAG)
+    for start in range(0, TABLE_LIMIT, BLOCK_SIZE):
+        block = bytes(props[start:start + BLOCK_SIZE])
+        if block not in blocks:
+            blocks[block] = len(blocks)
+            stage2.extend(block)
+        stage1.append(blocks[block])
+    assert len(blocks) < 256
+    return stage1, stage2
+
+
+def emit(name, data, out):
+    out.write('\tstatic const unsigned char %s[%d] = {\n' % (name, len(data)))
+    for i in range(0, len(data), 32):
+        out.write('\t\t' + ','.join(str(x) for x in data[i:i + 32]) + ',\n')
+    out.write('\t};\n')
+
+
+def main():
+    props, version = parse(sys.argv[1])
+    stage1, stage2 = build(props)
+    out = sys.stdout
+    out.write('#pragma once\n\n')
+    out.write('// Generated by gen_emoji_table.py from emoji-data.txt %s. Do not edit.\n' % version)
+    out.write('// %d + %d bytes, %d code points per block\n\n' % (len(stage1), len(stage2), BLOCK_SIZE))
+    out.write('namespace weasel\n{\n')
+    out.write('\tconst int EMOJI_TABLE_BLOCK_SHIFT = %d;\n' % BLOCK_SHIFT)
+    out.write('\tconst unsigned int EMOJI_TABLE_LIMIT = 0x%X;\n\n' % TABLE_LIMIT)
+    emit('kEmojiStage1', stage1, out)
+    out.write('\n')
+    emit('kEmojiStage2', stage2, out)
+    out.write('};\n')
+
+
+if __name__ == '__main__':
+    main()
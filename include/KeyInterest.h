@@ -0,0 +1,155 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+
+namespace weasel
+{
+	/*
+	 * Which keys the server's schema may eat, published with the style, so
+	 * that the text service can answer the others without asking: the
+	 * keysyms of the Latin-1 and function key pages its key_binder and
+	 * switcher bind, one bit each, and whether its processors include one
+	 * that watches modifiers or key releases. Together with whether the
+	 * last key left a composition, that rules out releases, unbound
+	 * function keys and modifier chords while not composing; any other key
+	 * goes to the server. Until a schema publishes it, every key does.
+	 */
+	class KeyInterest
+	{
+	public:
+		enum Flags
+		{
+			ASCII_COMPOSER = 1,	// toggles ascii_mode on modifier taps, and must see what interrupts them
+			CHORD_COMPOSER = 2,	// commits chords on key releases
+		};
+		enum { PAGE_BITS = 256, KEY_BITS = 2 * PAGE_BITS, WORDS = KEY_BITS / 32, HEX_DIGITS = KEY_BITS / 4 };
+
+		KeyInterest() { Clear(); }
+
+		bool IsValid() const { return _valid; }
+		/* Every key goes to the server until the next Publish */
+		void Clear()
+		{
+			_valid = false;
+			_flags = 0;
+			for (int i = 0; i < WORDS; ++i)
+				_bound[i] = 0;
+		}
+		void Publish(int flags)
+		{
+			_flags = flags;
+			_valid = true;
+		}
+		int GetFlags() const { return _flags; }
+
+		/* A keysym outside the two pages has no bit; such keys always go to the server */
+		void Bind(int keycode)
+		{
+			int bit = _Bit(keycode);
+			if (bit >= 0)
+				_bound[bit / 32] |= 1u << (bit % 32);
+		}
+		bool IsBound(int keycode) const
+		{
+			int bit = _Bit(keycode);
+			return bit >= 0 && (_bound[bit / 32] >> (bit % 32) & 1) != 0;
+		}
+
+		/* "flags,keys", the bound keys as HEX_DIGITS hex digits, the lowest bits first; empty until published */
+		template<typename _TyChar>
+		std::basic_string<_TyChar> Format() const
+		{
+			static const char digits[] = "0123456789abcdef";
+			if (!_valid)
+				return std::basic_string<_TyChar>();
+			std::basic_string<_TyChar> text(1, _TyChar(digits[_flags & 0xf]));
+			text += _TyChar(',');
+			for (int i = 0; i < HEX_DIGITS; ++i)
+				text += _TyChar(digits[_bound[i / 8] >> (i % 8 * 4) & 0xf]);
+			return text;
+		}
+		/* Publishes what Format wrote; anything else clears */
+		template<typename _TyChar>
+		bool Parse(std::basic_string<_TyChar> const& text)
+		{
+			Clear();
+			if (text.size() != 2 + HEX_DIGITS || text[1] != _TyChar(','))
+				return false;
+			int flags = _Digit(text[0]);
+			if (flags < 0)
+				return false;
+			for (int i = 0; i < HEX_DIGITS; ++i)
+			{
+				int d = _Digit(text[2 + i]);
+				if (d < 0)
+				{
+					Clear();
+					return false;
+				}
+				_bound[i / 8] |= uint32_t(d) << (i % 8 * 4);
+			}
+			Publish(flags);
+			return true;
+		}
+
+		/*
+		 * Whether the server may eat the key; mask in the 16 bits of
+		 * weasel::KeyEvent, composing as left by the key before.
+		 */
+		bool MayEat(int keycode, int mask, bool composing) const
+		{
+			if (!_valid || IsBound(keycode) || _Bit(keycode) < 0)
+				return true;
+			const bool asciiComposer = (_flags & ASCII_COMPOSER) != 0;
+			if (_IsModifier(keycode))
+				return asciiComposer || composing;
+			if (mask & RELEASE)
+			{
+				if (_flags & CHORD_COMPOSER)
+					return true;
+				// a key released while shift or control is held spoils their tap
+				return asciiComposer && (mask & (SHIFT | CONTROL)) != 0;
+			}
+			if (composing)
+				return true;
+			if (asciiComposer && (mask & (SHIFT | CONTROL)))
+				return true;
+			if (mask & (CONTROL | ALT | SUPER))
+				return false;
+			// speller, punctuator and recognizer take the printable keys and the keypad
+			return (keycode >= 0x20 && keycode <= 0x7e) || (keycode >= 0xff80 && keycode <= 0xffbd);
+		}
+
+	private:
+		// as ibus::Modifier in KeyEvent.h
+		enum { SHIFT = 1 << 0, CONTROL = 1 << 2, ALT = 1 << 3, SUPER = 1 << 10, RELEASE = 1 << 14 };
+
+		static int _Bit(int keycode)
+		{
+			if (keycode >= 0 && keycode < PAGE_BITS)
+				return keycode;
+			if (keycode >= 0xff00 && keycode <= 0xffff)
+				return keycode - 0xff00 + PAGE_BITS;
+			return -1;
+		}
+
+		static int _Digit(int c)
+		{
+			if (c >= '0' && c <= '9')
+				return c - '0';
+			if (c >= 'a' && c <= 'f')
+				return c - 'a' + 10;
+			return -1;
+		}
+
+		// Shift_L to Hyper_R, the locks among them, and Eisu_toggle, which ascii_composer takes as Caps_Lock
+		static bool _IsModifier(int keycode)
+		{
+			return (keycode >= 0xffe1 && keycode <= 0xffee) || keycode == 0xff30;
+		}
+
+		bool _valid;
+		int _flags;
+		uint32_t _bound[WORDS];
+	};
+};
@@ -0,0 +1,224 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <istream>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <WeaselProfiler.h>
+
+namespace weasel
+{
+	// one pipe message as the server handled it
+	struct JournalEntry
+	{
+		int64_t timestamp_ns;	// Profiler::Now at dispatch
+		uint32_t msg;			// WEASEL_IPC_COMMAND
+		uint32_t wparam;
+		uint32_t lparam;
+		uint32_t session;		// lparam, or the session a WEASEL_IPC_START_SESSION started
+		uint32_t result;		// the reply
+		uint32_t response_size;	// bytes of body written with the reply
+		uint32_t handler_ns;
+		uint32_t reserved;
+	};
+
+	/*
+	 * The last CAPACITY pipe messages of the server, for replaying what a
+	 * user ran into. Off until enabled; then any pipe thread records into
+	 * a ring allocated once, claiming its slot with one atomic increment
+	 * and no lock. Each slot carries the sequence number it was written
+	 * for, so that a reader copying the ring skips slots being rewritten.
+	 * Key events are in the clear: the ring stays in memory until dumped.
+	 */
+	class KeyJournal
+	{
+	public:
+		enum { CAPACITY = 16384 };
+
+		constexpr KeyJournal() : _slots(nullptr), _next(0), _enabled(false) {}
+		~KeyJournal() { delete[] _slots.load(std::memory_order_relaxed); }
+
+		/* The journal WeaselServer records its pipe messages into */
+		static KeyJournal& Server()
+		{
+			// constant initialized, so safe without thread safe statics
+			static KeyJournal journal;
+			return journal;
+		}
+
+		bool IsEnabled() const { return _enabled.load(std::memory_order_relaxed); }
+		/* Called by one thread at a time, the tray menu's */
+		void SetEnabled(bool enabled)
+		{
+			if (enabled && !_slots.load(std::memory_order_relaxed))
+				_slots.store(new Slot[CAPACITY], std::memory_order_release);
+			_enabled.store(enabled, std::memory_order_relaxed);
+		}
+
+		void Record(JournalEntry const& entry)
+		{
+			if (!IsEnabled())
+				return;
+			Slot* slots = _slots.load(std::memory_order_acquire);
+			if (!slots)
+				return;
+			const uint64_t n = _next.fetch_add(1, std::memory_order_relaxed);
+			Slot& slot = slots[n % CAPACITY];
+			slot.sequence.store(0, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			slot.entry = entry;
+			slot.sequence.store(n + 1, std::memory_order_release);
+		}
+
+		/* The entries still in the ring, oldest first */
+		std::vector<JournalEntry> Snapshot() const
+		{
+			std::vector<JournalEntry> entries;
+			const Slot* slots = _slots.load(std::memory_order_acquire);
+			if (!slots)
+				return entries;
+			const uint64_t next = _next.load(std::memory_order_relaxed);
+			entries.reserve(next < CAPACITY ? (size_t)next : (size_t)CAPACITY);
+			for (uint64_t n = next > CAPACITY ? next - CAPACITY : 0; n < next; ++n)
+			{
+				const Slot& slot = slots[n % CAPACITY];
+				if (slot.sequence.load(std::memory_order_acquire) != n + 1)
+					continue;
+				JournalEntry entry = slot.entry;
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (slot.sequence.load(std::memory_order_relaxed) == n + 1)
+					entries.push_back(entry);
+			}
+			return entries;
+		}
+
+		/* A header, then the entries as they are in memory */
+		static bool Save(std::ostream& out, std::vector<JournalEntry> const& entries)
+		{
+			FileHeader header = { { 'W', 'K', 'J', '1' }, (uint32_t)sizeof(JournalEntry), (uint32_t)entries.size(), 0 };
+			out.write((const char*)&header, sizeof(header));
+			if (!entries.empty())
+				out.write((const char*)&entries[0], entries.size() * sizeof(JournalEntry));
+			return out.good();
+		}
+
+		/* What Save wrote; fails on another format or a short file */
+		static bool Load(std::istream& in, std::vector<JournalEntry>* entries)
+		{
+			entries->clear();
+			FileHeader header;
+			if (!in.read((char*)&header, sizeof(header)) || memcmp(header.magic, "WKJ1", 4) != 0 ||
+				header.entry_size != sizeof(JournalEntry))
+				return false;
+			entries->resize(header.count);
+			if (header.count && !in.read((char*)&(*entries)[0], (std::streamsize)header.count * sizeof(JournalEntry)))
+			{
+				entries->clear();
+				return false;
+			}
+			return true;
+		}
+
+	private:
+		struct Slot
+		{
+			std::atomic<uint64_t> sequence;	// n + 1 once entry n is written whole
+			JournalEntry entry;
+			Slot() : sequence(0) {}
+		};
+		struct FileHeader
+		{
+			char magic[4];
+			uint32_t entry_size;
+			uint32_t count;
+			uint32_t reserved;
+		};
+
+		std::atomic<Slot*> _slots;
+		std::atomic<uint64_t> _next;
+		std::atomic<bool> _enabled;
+	};
+
+	/* Latencies of one command, as recorded and as replayed */
+	struct JournalReplayStats
+	{
+		ProfileSummary recorded;
+		ProfileSummary replayed;
+		uint64_t response_bytes;
+		uint64_t mismatches;	// replies or bodies other than recorded
+	};
+
+	inline void _AddJournalSample(ProfileSummary& summary, uint64_t ns)
+	{
+		++summary.count;
+		summary.total_ns += ns;
+		summary.max_ns = (std::max)(summary.max_ns, ns);
+		++summary.buckets[GetProfileBucket(ns)];
+	}
+
+	/*
+	 * Feeds the entries, in order and without pauses, to dispatch(entry,
+	 * &response_size), which handles the message as the server would and
+	 * returns its reply, in the terms of the recording: a new session is
+	 * for dispatch to map to the one recorded. after(entry) does untimed
+	 * what the server does once the reply is sent. Statistics by command.
+	 */
+	template<typename _TyDispatch, typename _TyAfter>
+	std::map<uint32_t, JournalReplayStats> ReplayJournal(std::vector<JournalEntry> const& entries, _TyDispatch dispatch, _TyAfter after)
+	{
+		std::map<uint32_t, JournalReplayStats> stats;
+		for (JournalEntry const& entry : entries)
+		{
+			uint32_t response_size = 0;
+			const int64_t start = Profiler::Now();
+			const uint32_t result = dispatch(entry, &response_size);
+			const int64_t end = Profiler::Now();
+			auto it = stats.find(entry.msg);
+			if (it == stats.end())
+			{
+				JournalReplayStats empty = { { 0, 0, 0, { 0 } }, { 0, 0, 0, { 0 } }, 0, 0 };
+				it = stats.insert(std::make_pair(entry.msg, empty)).first;
+			}
+			JournalReplayStats& s = it->second;
+			_AddJournalSample(s.recorded, entry.handler_ns);
+			_AddJournalSample(s.replayed, end > start ? (uint64_t)(end - start) : 0);
+			s.response_bytes += response_size;
+			if (result != entry.result || response_size != entry.response_size)
+				++s.mismatches;
+			after(entry);
+		}
+		return stats;
+	}
+
+	/* A table like Profiler::Report's, a recorded and a replayed row per command named by name(msg) */
+	template<typename _TyName>
+	std::string FormatJournalReplay(std::map<uint32_t, JournalReplayStats> const& stats, _TyName name)
+	{
+		std::string report;
+		char line[192], mismatches[24];
+		snprintf(line, sizeof(line), "%-22s %-8s %10s %12s %10s %10s %10s %10s %10s\n",
+			"command", "", "count", "total ms", "mean us", "p50 us", "p99 us", "max us", "mismatch");
+		report += line;
+		for (auto const& it : stats)
+		{
+			const ProfileSummary* rows[] = { &it.second.recorded, &it.second.replayed };
+			for (int i = 0; i < 2; ++i)
+			{
+				const ProfileSummary& s = *rows[i];
+				mismatches[0] = '\0';
+				if (i)
+					snprintf(mismatches, sizeof(mismatches), "%llu", (unsigned long long)it.second.mismatches);
+				snprintf(line, sizeof(line), "%-22s %-8s %10llu %12.3f %10.1f %10.1f %10.1f %10.1f %10s\n",
+					i ? "" : name(it.first), i ? "replayed" : "recorded", (unsigned long long)s.count, s.total_ns / 1e6,
+					s.count ? s.total_ns / 1e3 / s.count : 0.0, s.Percentile(0.5) / 1e3, s.Percentile(0.99) / 1e3, s.max_ns / 1e3,
+					mismatches);
+				report += line;
+			}
+		}
+		return report;
+	}
+};
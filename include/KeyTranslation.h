@@ -0,0 +1,95 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+namespace weasel
+{
+	/*
+	 * What ToUnicodeEx made of the keys of a keyboard layout, by virtual key
+	 * and the part of the key state the translation reads. The text service
+	 * and the IME keep one per instance, each used by the thread its input
+	 * context belongs to; a different layout starts it over. Dead keys are
+	 * never remembered, and neither is the key after one, whose translation
+	 * depends on what the system held back.
+	 */
+	class KeyTranslationCache
+	{
+	public:
+		enum State
+		{
+			SHIFT = 1 << 0,
+			CAPS_LOCK = 1 << 1,	// toggled
+			LCONTROL = 1 << 2,
+			RCONTROL = 1 << 3,
+			LMENU = 1 << 4,
+			RMENU = 1 << 5,		// AltGr, for which some layouts also set LCONTROL
+			KANA = 1 << 6,		// toggled
+			KEY_UP = 1 << 7,
+		};
+		enum { SLOTS = 512 };
+
+		KeyTranslationCache() : _layout(0), _deadKey(false), _hits(0), _misses(0) { Clear(); }
+
+		void Clear()
+		{
+			for (size_t i = 0; i < SLOTS; ++i)
+				_slots[i].key = 0;
+			_deadKey = false;
+		}
+
+		/*
+		 * The translation of vkey with the state bits of State; translate(&ch)
+		 * asks the system when the cache does not know, and returns what
+		 * ToUnicodeEx does: 1 for a character, 0 for none, -1 for a dead key.
+		 */
+		template<typename _TyTranslate>
+		int Translate(uintptr_t layout, unsigned vkey, unsigned state, _TyTranslate translate, wchar_t* ch)
+		{
+			if (layout != _layout)
+			{
+				Clear();
+				_layout = layout;
+			}
+			const uint16_t key = uint16_t((vkey & 0xff) << 8 | (state & 0xff));
+			Slot& slot = _slots[_Hash(key)];
+			if (!_deadKey && slot.key == key + 1u)
+			{
+				++_hits;
+				*ch = slot.ch;
+				return slot.result;
+			}
+			++_misses;
+			const bool combining = _deadKey;
+			int result = translate(ch);
+			_deadKey = result < 0;
+			if (!combining && (result == 0 || result == 1))
+			{
+				slot.key = key + 1u;
+				slot.ch = result ? *ch : 0;
+				slot.result = (int8_t)result;
+			}
+			return result;
+		}
+
+		unsigned long long Hits() const { return _hits; }
+		unsigned long long Misses() const { return _misses; }
+
+	private:
+		struct Slot
+		{
+			uint32_t key;	// 0 when empty
+			wchar_t ch;
+			int8_t result;
+		};
+
+		static size_t _Hash(uint16_t key)
+		{
+			return (key * 0x9e37u >> 7) % SLOTS;
+		}
+
+		Slot _slots[SLOTS];
+		uintptr_t _layout;
+		bool _deadKey;
+		unsigned long long _hits, _misses;
+	};
+};
@@ -0,0 +1,47 @@
+#pragma once
+#include <stddef.h>
+#include <vector>
+
+namespace weasel
+{
+	/*
+	 * Messages for the host collected while one key is handled and handed
+	 * over together, so that the IME grows the input context's message
+	 * buffer and calls ImmGenerateMessage once per key rather than once per
+	 * message. The counters tell how many messages each hand-over carried.
+	 */
+	template<typename _TyMsg>
+	class MessageBatch
+	{
+	public:
+		MessageBatch() : _flushes(0), _flushed(0) {}
+
+		void Add(_TyMsg const& msg) { _pending.push_back(msg); }
+		size_t Size() const { return _pending.size(); }
+
+		/*
+		 * flush(msgs, count) hands over what was added since the last
+		 * Flush, and is not called when nothing was; the messages are
+		 * dropped whether it succeeds or not.
+		 */
+		template<typename _TyFlush>
+		bool Flush(_TyFlush flush)
+		{
+			if (_pending.empty())
+				return true;
+			bool ok = flush(&_pending[0], _pending.size());
+			++_flushes;
+			_flushed += _pending.size();
+			_pending.clear();
+			return ok;
+		}
+
+		unsigned long long Flushes() const { return _flushes; }
+		unsigned long long Flushed() const { return _flushed; }
+		double MessagesPerFlush() const { return _flushes ? double(_flushed) / _flushes : 0.0; }
+
+	private:
+		std::vector<_TyMsg> _pending;	// keeps its capacity across keys
+		unsigned long long _flushes, _flushed;
+	};
+};
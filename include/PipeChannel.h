@@ -4,6 +4,7 @@
 #include <windows.h>
 #include <boost/interprocess/streams/bufferstream.hpp>
 #include <boost/thread.hpp>
+#include <PipeFrame.h>
 
 namespace weasel {
 
@@ -27,7 +28,6 @@ namespace weasel {
 		HANDLE _TryConnect();
 		size_t _WritePipe(HANDLE p, size_t s, char *b);
 		void _FinalizePipe(HANDLE &p);
-		void _Receive(HANDLE pipe, LPVOID msg, size_t rec_len);
 		/* Try to get a connection from client */
 		HANDLE _ConnectServerPipe(std::wstring &pn);
 		inline bool _Invalid(HANDLE p) const { return p == INVALID_HANDLE_VALUE; }
@@ -37,6 +37,8 @@ namespace weasel {
 		HANDLE hpipe;
 
 		bool has_body;
+		// bytes of body in the frame received last, at ReceiveBuffer()
+		size_t body_size;
 		const size_t buff_size;
 		std::unique_ptr<char[]> buffer;
 		std::unique_ptr<Stream> write_stream;
@@ -47,12 +49,12 @@ namespace weasel {
 	};
 
 
-	/* Pipe based IPC channel */
+	/* Pipe based IPC channel, each message a PipeFrameHeader and its body */
 	template<
 		typename _TyMsg,
 		typename _TyRes = DWORD,
-		size_t _MsgSize = sizeof(_TyMsg),
-		size_t _ResSize = sizeof(_TyRes)>
+		size_t _MsgSize = sizeof(PipeFrameHeader<_TyMsg>),
+		size_t _ResSize = sizeof(PipeFrameHeader<_TyRes>)>
 	class PipeChannel : public PipeChannelBase
 	{
 	public:
@@ -126,8 +128,8 @@ namespace weasel {
 				return false;
 			}
 
-			// Use whole buffer to receive data in client
-			return handler((LPWSTR)buffer.get(), (UINT)(buff_size * sizeof(char) / sizeof(wchar_t)));
+			// the body of the reply, as long as the server wrote it
+			return handler((LPWSTR)ReceiveBuffer(), (UINT)(body_size / sizeof(wchar_t)));
 		}
 
 
@@ -135,11 +137,11 @@ namespace weasel {
 
 		void _Send(HANDLE pipe, Msg &msg)
 		{
+			// the message and the length of the body, then only as much body as was written
 			char *pbuff = buffer.get();
-			DWORD lwritten = 0;
-
-			*reinterpret_cast<Msg *>(pbuff) = msg;
-			size_t data_sz = has_body ? buff_size : _MsgSize;
+			PipeFrameHeader<Msg> header = { msg, has_body ? (uint32_t)_WrittenSize() : 0 };
+			memcpy(pbuff, &header, sizeof(header));
+			size_t data_sz = _MsgSize + header.length;
 
 			try {
 				_WritePipe(pipe, data_sz, pbuff);
@@ -153,21 +155,49 @@ namespace weasel {
 
 		_TyRes _ReceiveResponse()
 		{
-			_TyRes result;
-			_Receive(hpipe, &result, sizeof(result));
-			return result;
+			return _ReceiveFrame(hpipe);
+		}
+
+		/* Reads a frame in one go, leaving its body at ReceiveBuffer() */
+		_TyRes _ReceiveFrame(HANDLE pipe)
+		{
+			DWORD error = 0;
+			auto read = [pipe, &error](char *dst, size_t size, size_t *got) -> PipeReadResult {
+				DWORD lread = 0;
+				BOOL success = ::ReadFile(pipe, dst, (DWORD)size, &lread, NULL);
+				*got = lread;
+				if (success)
+					return PIPE_READ_DONE;
+				error = ::GetLastError();
+				return error == ERROR_MORE_DATA ? PIPE_READ_MORE : PIPE_READ_FAILED;
+			};
+			PipeFrameHeader<_TyRes> header;
+			if (!ReadPipeFrame(read, buffer.get(), buff_size, &header))
+				throw (error && error != ERROR_MORE_DATA) ? error : (DWORD)ERROR_INVALID_DATA;
+			body_size = header.length;
+			has_body = false;
+			return header.msg;
 		}
 
 		Stream& _BufferWriteStream()
 		{
+			// the frame tells how much of the body is in use, so it is not cleared first
 			if (write_stream == nullptr) {
 				char *pbuff = (char *)buffer.get() + _MsgSize;
-				memset(pbuff, 0, buff_size - _MsgSize);
 				write_stream = std::make_unique<Stream>((wchar_t *)pbuff, _SendBufferSizeW());
 			}
 			return *write_stream;
 		}
 
+		/* Bytes written to the body, all of its room if it overflowed */
+		size_t _WrittenSize() const
+		{
+			std::streamoff written = write_stream ? (std::streamoff)write_stream->tellp() : 0;
+			if (written < 0 || (size_t)written > _SendBufferSizeW())
+				written = _SendBufferSizeW();
+			return (size_t)written * sizeof(wchar_t);
+		}
+
 	private:
 
 		inline size_t _SendBufferSizeW() const
@@ -0,0 +1,51 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace weasel {
+
+	/* Starts every message on the pipe; length bytes of body follow it */
+	template<typename _TyMsg>
+	struct PipeFrameHeader
+	{
+		_TyMsg msg;
+		uint32_t length;
+	};
+
+	/* How a read from the transport ended */
+	enum PipeReadResult
+	{
+		PIPE_READ_DONE,		// the message ended
+		PIPE_READ_MORE,		// cut short at the size asked for, ERROR_MORE_DATA
+		PIPE_READ_FAILED
+	};
+
+	/*
+	 * Reads a frame, its header and body, into buffer. A message pipe hands
+	 * over the whole frame in one read; a transport that delivers it in
+	 * pieces is read on where the last piece ended. read(dst, size, &got)
+	 * stores up to size bytes at dst. Fails on a read error, a frame larger
+	 * than capacity or one whose length disagrees with what arrived.
+	 */
+	template<typename _TyHeader, typename _TyRead>
+	bool ReadPipeFrame(_TyRead read, char *buffer, size_t capacity, _TyHeader *header)
+	{
+		size_t received = 0;
+		for (;;) {
+			if (received == capacity)
+				return false;
+			size_t got = 0;
+			PipeReadResult result = read(buffer + received, capacity - received, &got);
+			if (result == PIPE_READ_FAILED)
+				return false;
+			received += got;
+			if (result == PIPE_READ_DONE)
+				break;
+		}
+		if (received < sizeof(_TyHeader))
+			return false;
+		memcpy(header, buffer, sizeof(_TyHeader));
+		return header->length == received - sizeof(_TyHeader);
+	}
+};
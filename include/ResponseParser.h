@@ -9,6 +9,7 @@
 namespace weasel
 {
 	class Deserializer;
+	class KeyInterest;
 
 	// 解析server回應文本
 	struct ResponseParser
@@ -20,8 +21,9 @@ namespace weasel
 		Status* p_status;
 		Config* p_config;
 		UIStyle* p_style;
+		KeyInterest* p_interest;
 
-		ResponseParser(std::wstring* commit, Context* context = 0, Status* status = 0, Config* config = 0, UIStyle* style = 0);
+		ResponseParser(std::wstring* commit, Context* context = 0, Status* status = 0, Config* config = 0, UIStyle* style = 0, KeyInterest* interest = 0);
 
 		// 重載函數調用運算符, 以扮做ResponseHandler
 		bool operator() (LPWSTR buffer, UINT length);
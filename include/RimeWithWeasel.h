@@ -1,6 +1,7 @@
 #pragma once
 #include <WeaselIPC.h>
 #include <WeaselUI.h>
+#include <KeyInterest.h>
 #include <map>
 #include <string>
 
@@ -29,6 +30,7 @@ public:
 	virtual void StartMaintenance();
 	virtual void EndMaintenance();
 	virtual void SetOption(UINT session_id, const std::string &opt, bool val);
+	virtual void Idle();
 
 	void OnUpdateUI(std::function<void()> const &cb);
 
@@ -41,18 +43,26 @@ private:
 	bool _Respond(UINT session_id, EatLine eat);
 	void _ReadClientInfo(UINT session_id, LPWSTR buffer);
 	void _GetCandidateInfo(weasel::CandidateInfo &cinfo, RimeContext &ctx);
+	bool _GetCandidatePage(weasel::CandidateInfo &cinfo, RimeContext &ctx, UINT session_id, int index);
 	void _GetStatus(weasel::Status &stat, UINT session_id);
 	void _GetContext(weasel::Context &ctx, UINT session_id);
 
 	bool _IsSessionTSF(UINT session_id);
+	bool _IsSessionClientDrawn(UINT session_id);
 
 	AppOptionsByAppName m_app_options;
 	weasel::UI* m_ui;  // reference
 	UINT m_active_session;
+	// whose pages next to the one shown Idle lays out, after a key
+	UINT m_prepare_session;
 	bool m_disabled;
 	bool m_vista_greater;
+	// style/server_ui: the panel here draws the candidates of TSF clients as well
+	bool m_server_ui;
 	std::string m_last_schema_id;
 	weasel::UIStyle m_base_style;
+	// of m_last_schema_id, published with its style
+	weasel::KeyInterest m_key_interest;
 
 	std::function<void()> _UpdateUICallback;
 
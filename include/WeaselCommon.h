@@ -122,12 +122,14 @@ namespace weasel
 	// 用於向前端告知設置信息
 	struct Config
 	{
-		Config() : inline_preedit(false) {}
+		Config() : inline_preedit(false), server_ui(false) {}
 		void reset()
 		{
 			inline_preedit = false;
+			server_ui = false;
 		}
 		bool inline_preedit;
+		bool server_ui;
 	};
 
 	struct UIStyle
@@ -166,6 +168,8 @@ namespace weasel
 		bool hide_candidates_when_single;
 		bool color_font;
 		bool display_tray_icon;
+		// the server lays out the pages next to the one shown after each key
+		bool prefetch_pages;
 		std::wstring label_text_format;
 		// layout
 		int min_width;
@@ -182,6 +186,8 @@ namespace weasel
 		int shadow_radius;
 		int shadow_offset_x;
 		int shadow_offset_y;
+		// vertical layouts put longer pages in columns of this many candidates; 0 for one column
+		int grid_rows;
 		// color scheme
 		int text_color;
 		int candidate_text_color;
@@ -203,7 +209,10 @@ namespace weasel
 		// per client
 		int client_caps;
 
-		UIStyle() : font_face(),
+		UIStyle() : align_type(ALIGN_BOTTOM),
+			preedit_type(COMPOSITION),
+			layout_type(LAYOUT_VERTICAL),
+			font_face(),
 			label_font_face(),
 			comment_font_face(),
 			font_point(0),
@@ -211,12 +220,10 @@ namespace weasel
 			comment_font_point(0),
 			inline_preedit(false),
 			hide_candidates_when_single(false),
-			align_type(ALIGN_BOTTOM),
-			preedit_type(COMPOSITION),
 			color_font(0),
 			display_tray_icon(false),
+			prefetch_pages(false),
 			label_text_format(L"%s."),
-			layout_type(LAYOUT_VERTICAL),
 			min_width(0),
 			min_height(0),
 			border(0),
@@ -231,6 +238,7 @@ namespace weasel
 			shadow_radius(0),
 			shadow_offset_x(0),
 			shadow_offset_y(0),
+			grid_rows(0),
 			text_color(0),
 			candidate_text_color(0),
 			candidate_back_color(0),
@@ -268,6 +276,7 @@ namespace boost {
 			ar & s.color_font;
 			ar & s.preedit_type;
 			ar & s.display_tray_icon;
+			ar & s.prefetch_pages;
 			ar & s.label_text_format;
 			// layout
 			ar & s.layout_type;
@@ -285,6 +294,7 @@ namespace boost {
 			ar & s.shadow_radius;
 			ar & s.shadow_offset_x;
 			ar & s.shadow_offset_y;
+			ar & s.grid_rows;
 			// color scheme
 			ar & s.text_color;
 			ar & s.candidate_text_color;
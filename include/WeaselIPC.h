@@ -9,10 +9,18 @@
 #define WEASEL_IPC_PIPE_NAME L"WeaselNamedPipe"
 
 #define WEASEL_IPC_METADATA_SIZE 1024
-#define WEASEL_IPC_BUFFER_SIZE (4 * 1024)
+// 管道兩端之緩衝區：一頁幾十個帶註釋的候選，連同首次回應所附樣式，亦容得下
+#define WEASEL_IPC_BUFFER_SIZE (64 * 1024)
 #define WEASEL_IPC_BUFFER_LENGTH (WEASEL_IPC_BUFFER_SIZE / sizeof(WCHAR))
 #define WEASEL_IPC_SHARED_MEMORY_SIZE (sizeof(PipeMessage) + WEASEL_IPC_BUFFER_SIZE)
 
+// WEASEL_IPC_PROCESS_KEY_EVENT 之回應：服務端無此會話（如服務重啓後），須重新發起會話
+#define WEASEL_IPC_UNKNOWN_SESSION 0xFFFFFFFF
+// 否則爲以下各位：按鍵是否被處理，處理後是否在輸入中，方案之按鍵興趣（KeyInterest）是否待下次回應送達
+#define WEASEL_KEY_EATEN 0x1
+#define WEASEL_KEY_COMPOSING 0x2
+#define WEASEL_KEY_RESYNC 0x4
+
 enum WEASEL_IPC_COMMAND
 {	
 	WEASEL_IPC_ECHO = (WM_APP + 1),
@@ -73,6 +81,7 @@ namespace weasel
 		virtual UINT FindSession(UINT session_id) { return 0; }
 		virtual UINT AddSession(LPWSTR buffer, EatLine eat = 0) { return 0; }
 		virtual UINT RemoveSession(UINT session_id) { return 0; }
+		// 返回 WEASEL_KEY_* 各位
 		virtual BOOL ProcessKeyEvent(KeyEvent keyEvent, UINT session_id, EatLine eat) { return FALSE; }
 		virtual void CommitComposition(UINT session_id) {}
 		virtual void ClearComposition(UINT session_id) {}
@@ -82,6 +91,8 @@ namespace weasel
 		virtual void StartMaintenance() {}
 		virtual void EndMaintenance() {}
 		virtual void SetOption(UINT session_id, const std::string &opt, bool val) {}
+		// 按鍵之回應送出後調用，做客戶端不必等候之事
+		virtual void Idle() {}
 	};
 	
 	// 處理server端回應之物件
@@ -124,16 +135,16 @@ namespace weasel
 		void EndMaintenance();
 		// 测试连接
 		bool Echo();
-		// 请求服务处理按键消息
-		bool ProcessKeyEvent(KeyEvent const& keyEvent);
+		// 请求服务处理按键消息，会话失效时重新发起会话；state 收到 WEASEL_KEY_* 各位
+		bool ProcessKeyEvent(KeyEvent const& keyEvent, UINT* state = 0);
 		// 上屏正在編輯的文字
 		bool CommitComposition();
 		// 清除正在編輯的文字
 		bool ClearComposition();
 		// 更新输入位置
 		void UpdateInputPosition(RECT const& rc);
-		// 输入窗口获得焦点
-		void FocusIn();
+		// 输入窗口获得焦点；client_caps 爲 ClientCapabilities
+		void FocusIn(DWORD client_caps = 0);
 		// 输入窗口失去焦点
 		void FocusOut();
 		// 托盤菜單
@@ -0,0 +1,371 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+
+namespace weasel
+{
+	// phases of the key -> response -> layout -> paint pipeline of WeaselServer
+	enum ProfilePhase
+	{
+		PROFILE_IPC_MESSAGE,			// a pipe message, from dispatch to reply
+		PROFILE_PROCESS_KEY,			// RimeProcessKey
+		PROFILE_RESPOND,				// RimeWithWeaselHandler::_Respond
+		PROFILE_UPDATE_UI,				// RimeWithWeaselHandler::_UpdateUI
+		PROFILE_LAYOUT,					// Layout::DoLayout
+		PROFILE_MEASURE_TEXT,			// text extents taken by the layouts
+		PROFILE_PAINT,					// WeaselPanel::DoPaint
+		PROFILE_BLUR,					// drop shadow blur
+		PROFILE_UPDATE_LAYERED_WINDOW,	// presenting the back buffer
+		PROFILE_PREPARE_PAGE,			// WeaselPanel::Prepare, laying out an adjacent page after the reply
+		PROFILE_PAGE_TURN_PREPARED,		// WeaselPanel::Refresh to another page laid out ahead
+		PROFILE_PAGE_TURN_COLD,			// WeaselPanel::Refresh to another page laid out on the spot
+		PROFILE_IDLE,					// RequestHandler::Idle after a key's reply, laying out the adjacent pages
+		PROFILE_KEY_BEHIND_IDLE,		// an Idle during which the client's next key arrived, the longest it waited
+		PROFILE_PHASE_COUNT
+	};
+
+	enum ProfileCounter
+	{
+		PROFILE_KEYS_EATEN,
+		PROFILE_KEYS_PASSED,
+		PROFILE_FULL_PAINTS,
+		PROFILE_PARTIAL_PAINTS,
+		PROFILE_PAGE_TURN_HITS,
+		PROFILE_PAGE_TURN_MISSES,
+		PROFILE_IDLE_DEFERRED,			// Idle skipped, as the client's next key was waiting
+		PROFILE_GLYPH_RUN_HITS,			// GDI text lines found in the panel's cache
+		PROFILE_GLYPH_RUN_MISSES,
+		PROFILE_GLYPH_RUN_EVICTIONS,
+		PROFILE_COUNTER_COUNT
+	};
+
+	inline const char* GetProfilePhaseName(ProfilePhase phase)
+	{
+		static const char* names[PROFILE_PHASE_COUNT] = {
+			"ipc message", "process key", "respond", "update ui", "layout",
+			"measure text", "paint", "blur", "update layered window",
+			"prepare page", "page turn prepared", "page turn cold",
+			"idle", "key behind idle",
+		};
+		return names[phase];
+	}
+
+	inline const char* GetProfileCounterName(ProfileCounter counter)
+	{
+		static const char* names[PROFILE_COUNTER_COUNT] = {
+			"keys eaten", "keys passed", "full paints", "partial paints",
+			"page turn hits", "page turn misses", "idle deferred",
+			"glyph run hits", "glyph run misses", "glyph run evictions",
+		};
+		return names[counter];
+	}
+
+	// durations in log2 buckets: the first is under 512 ns, bucket i then
+	// holds [2^(i+8), 2^(i+9)) ns and the last everything from about 2 s
+	enum { PROFILE_BUCKETS = 24 };
+
+	inline int GetProfileBucket(uint64_t ns)
+	{
+		int bucket = 0;
+		for (ns >>= 9; ns && bucket < PROFILE_BUCKETS - 1; ns >>= 1)
+			++bucket;
+		return bucket;
+	}
+
+	// one timed occurrence of a phase, for the chrome trace
+	struct ProfileEvent
+	{
+		int64_t start_ns;
+		uint32_t duration_ns;
+		uint32_t phase;
+	};
+
+	/*
+	 * Statistics of one thread. Only the owning thread writes, with plain
+	 * relaxed loads and stores, so recording takes no lock and no locked
+	 * instruction; readers on other threads see each value whole, if not
+	 * all values of the same instant.
+	 */
+	struct ThreadProfile
+	{
+		enum { TRACE_CAPACITY = 16384 };
+
+		struct Histogram
+		{
+			std::atomic<uint64_t> count;
+			std::atomic<uint64_t> total_ns;
+			std::atomic<uint64_t> max_ns;
+			std::atomic<uint64_t> buckets[PROFILE_BUCKETS];
+		};
+
+		ThreadProfile(uint32_t id) : thread_id(id), next(NULL), trace(NULL), trace_count(0), in_use(true)
+		{
+			for (int i = 0; i < PROFILE_PHASE_COUNT; ++i)
+			{
+				histograms[i].count.store(0, std::memory_order_relaxed);
+				histograms[i].total_ns.store(0, std::memory_order_relaxed);
+				histograms[i].max_ns.store(0, std::memory_order_relaxed);
+				for (int j = 0; j < PROFILE_BUCKETS; ++j)
+					histograms[i].buckets[j].store(0, std::memory_order_relaxed);
+			}
+			for (int i = 0; i < PROFILE_COUNTER_COUNT; ++i)
+				counters[i].store(0, std::memory_order_relaxed);
+		}
+
+		static void Add(std::atomic<uint64_t>& value, uint64_t n)
+		{
+			value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+		}
+
+		void Record(ProfilePhase phase, int64_t start_ns, uint64_t ns, bool tracing)
+		{
+			Histogram& h = histograms[phase];
+			Add(h.count, 1);
+			Add(h.total_ns, ns);
+			if (ns > h.max_ns.load(std::memory_order_relaxed))
+				h.max_ns.store(ns, std::memory_order_relaxed);
+			Add(h.buckets[GetProfileBucket(ns)], 1);
+			if (!tracing)
+				return;
+			ProfileEvent* events = trace.load(std::memory_order_relaxed);
+			if (!events)
+			{
+				// allocated once by this thread, on the first event traced
+				events = new ProfileEvent[TRACE_CAPACITY];
+				trace.store(events, std::memory_order_release);
+			}
+			uint64_t n = trace_count.load(std::memory_order_relaxed);
+			ProfileEvent& e = events[n % TRACE_CAPACITY];
+			e.start_ns = start_ns;
+			e.duration_ns = (uint32_t)(ns < 0xFFFFFFFFu ? ns : 0xFFFFFFFFu);
+			e.phase = phase;
+			trace_count.store(n + 1, std::memory_order_release);
+		}
+
+		const uint32_t thread_id;
+		ThreadProfile* next;
+		Histogram histograms[PROFILE_PHASE_COUNT];
+		std::atomic<uint64_t> counters[PROFILE_COUNTER_COUNT];
+		// ring of the latest TRACE_CAPACITY events
+		std::atomic<ProfileEvent*> trace;
+		std::atomic<uint64_t> trace_count;
+		// cleared when the thread is done, so that a new thread takes over the statistics
+		std::atomic<bool> in_use;
+	};
+
+	/* Totals of a phase over all threads */
+	struct ProfileSummary
+	{
+		uint64_t count;
+		uint64_t total_ns;
+		uint64_t max_ns;
+		uint64_t buckets[PROFILE_BUCKETS];
+
+		/* Upper bound of the bucket holding the given fraction of the samples */
+		uint64_t Percentile(double fraction) const
+		{
+			uint64_t rank = (uint64_t)(count * fraction + 0.5), seen = 0;
+			for (int i = 0; i < PROFILE_BUCKETS - 1; ++i)
+			{
+				seen += buckets[i];
+				if (seen >= rank && seen)
+					return (std::min)((uint64_t)512 << i, max_ns);
+			}
+			return max_ns;
+		}
+	};
+
+	/*
+	 * Always compiled instrumentation of WeaselServer: ProfileScope times a
+	 * phase, Count bumps a counter, both into statistics of the calling
+	 * thread, registered on its first use in a lock free list. Report and
+	 * TraceJson read the statistics of every thread, for the tray menu.
+	 */
+	class Profiler
+	{
+	public:
+		static int64_t Now()
+		{
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+
+		static void Record(ProfilePhase phase, int64_t start_ns, int64_t end_ns)
+		{
+			Current()->Record(phase, start_ns, end_ns > start_ns ? (uint64_t)(end_ns - start_ns) : 0, IsTracing());
+		}
+
+		static void Count(ProfileCounter counter, uint64_t n = 1)
+		{
+			ThreadProfile::Add(Current()->counters[counter], n);
+		}
+
+		/* Whether timed phases are also kept as trace events */
+		static bool IsTracing() { return _Tracing().load(std::memory_order_relaxed); }
+		static void SetTracing(bool tracing) { _Tracing().store(tracing, std::memory_order_relaxed); }
+
+		/* Hands the statistics of the calling thread over to the next thread to start */
+		static void ReleaseThread()
+		{
+			ThreadProfile*& current = _Current();
+			if (current)
+				current->in_use.store(false, std::memory_order_release);
+			current = NULL;
+		}
+
+		static ProfileSummary Summarize(ProfilePhase phase)
+		{
+			ProfileSummary summary = { 0, 0, 0, { 0 } };
+			for (ThreadProfile* p = _Head().load(std::memory_order_acquire); p; p = p->next)
+			{
+				const ThreadProfile::Histogram& h = p->histograms[phase];
+				summary.count += h.count.load(std::memory_order_relaxed);
+				summary.total_ns += h.total_ns.load(std::memory_order_relaxed);
+				summary.max_ns = (std::max)(summary.max_ns, h.max_ns.load(std::memory_order_relaxed));
+				for (int i = 0; i < PROFILE_BUCKETS; ++i)
+					summary.buckets[i] += h.buckets[i].load(std::memory_order_relaxed);
+			}
+			return summary;
+		}
+
+		static uint64_t GetCounter(ProfileCounter counter)
+		{
+			uint64_t total = 0;
+			for (ThreadProfile* p = _Head().load(std::memory_order_acquire); p; p = p->next)
+				total += p->counters[counter].load(std::memory_order_relaxed);
+			return total;
+		}
+
+		/* A table of every phase and counter, in milliseconds and microseconds */
+		static std::string Report()
+		{
+			std::string report;
+			char line[160];
+			snprintf(line, sizeof(line), "%-22s %10s %12s %10s %10s %10s %10s\n",
+				"phase", "count", "total ms", "mean us", "p50 us", "p99 us", "max us");
+			report += line;
+			for (int i = 0; i < PROFILE_PHASE_COUNT; ++i)
+			{
+				ProfileSummary s = Summarize((ProfilePhase)i);
+				snprintf(line, sizeof(line), "%-22s %10llu %12.3f %10.1f %10.1f %10.1f %10.1f\n",
+					GetProfilePhaseName((ProfilePhase)i), (unsigned long long)s.count, s.total_ns / 1e6,
+					s.count ? s.total_ns / 1e3 / s.count : 0.0, s.Percentile(0.5) / 1e3, s.Percentile(0.99) / 1e3, s.max_ns / 1e3);
+				report += line;
+			}
+			report += "\n";
+			for (int i = 0; i < PROFILE_COUNTER_COUNT; ++i)
+			{
+				snprintf(line, sizeof(line), "%-22s %10llu\n", GetProfileCounterName((ProfileCounter)i),
+					(unsigned long long)GetCounter((ProfileCounter)i));
+				report += line;
+			}
+			const uint64_t hits = GetCounter(PROFILE_PAGE_TURN_HITS), turns = hits + GetCounter(PROFILE_PAGE_TURN_MISSES);
+			if (turns)
+			{
+				snprintf(line, sizeof(line), "%-22s %9.1f%%\n", "page turn hit rate", 100.0 * hits / turns);
+				report += line;
+			}
+			const uint64_t runHits = GetCounter(PROFILE_GLYPH_RUN_HITS), runs = runHits + GetCounter(PROFILE_GLYPH_RUN_MISSES);
+			if (runs)
+			{
+				snprintf(line, sizeof(line), "%-22s %9.1f%%\n", "glyph run hit rate", 100.0 * runHits / runs);
+				report += line;
+			}
+			return report;
+		}
+
+		/*
+		 * The traced events as chrome://tracing JSON, complete events in
+		 * microseconds. Events overwritten while this runs may come out
+		 * mixed; turn tracing off first for an exact dump.
+		 */
+		static std::string TraceJson(uint32_t pid = 0)
+		{
+			std::string json = "{\"traceEvents\":[";
+			bool first = true;
+			char event[192];
+			for (ThreadProfile* p = _Head().load(std::memory_order_acquire); p; p = p->next)
+			{
+				const ProfileEvent* events = p->trace.load(std::memory_order_acquire);
+				if (!events)
+					continue;
+				const uint64_t count = p->trace_count.load(std::memory_order_acquire);
+				for (uint64_t n = count > ThreadProfile::TRACE_CAPACITY ? count - ThreadProfile::TRACE_CAPACITY : 0; n < count; ++n)
+				{
+					const ProfileEvent& e = events[n % ThreadProfile::TRACE_CAPACITY];
+					snprintf(event, sizeof(event), "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%u,\"tid\":%u}",
+						first ? "" : ",", GetProfilePhaseName((ProfilePhase)e.phase), e.start_ns / 1e3, e.duration_ns / 1e3, pid, p->thread_id);
+					json += event;
+					first = false;
+				}
+			}
+			json += "\n],\"displayTimeUnit\":\"ms\"}\n";
+			return json;
+		}
+
+	private:
+		static ThreadProfile* Current()
+		{
+			ThreadProfile*& current = _Current();
+			if (!current)
+				current = _Acquire();
+			return current;
+		}
+
+		static ThreadProfile* _Acquire()
+		{
+			std::atomic<ThreadProfile*>& head = _Head();
+			for (ThreadProfile* p = head.load(std::memory_order_acquire); p; p = p->next)
+			{
+				bool released = false;
+				if (p->in_use.compare_exchange_strong(released, true, std::memory_order_acquire))
+					return p;
+			}
+			static std::atomic<uint32_t> ids(0);
+			ThreadProfile* profile = new ThreadProfile(ids.fetch_add(1) + 1);
+			ThreadProfile* next = head.load(std::memory_order_relaxed);
+			do
+				profile->next = next;
+			while (!head.compare_exchange_weak(next, profile, std::memory_order_release, std::memory_order_relaxed));
+			return profile;
+		}
+
+		// constant initialized, so safe without thread safe statics
+		static ThreadProfile*& _Current()
+		{
+			static thread_local ThreadProfile* current = NULL;
+			return current;
+		}
+
+		static std::atomic<ThreadProfile*>& _Head()
+		{
+			static std::atomic<ThreadProfile*> head(NULL);
+			return head;
+		}
+
+		static std::atomic<bool>& _Tracing()
+		{
+			static std::atomic<bool> tracing(false);
+			return tracing;
+		}
+	};
+
+	/* Times a phase from construction to destruction */
+	class ProfileScope
+	{
+	public:
+		explicit ProfileScope(ProfilePhase phase) : _phase(phase), _start(Profiler::Now()) {}
+		~ProfileScope() { Profiler::Record(_phase, _start, Profiler::Now()); }
+
+	private:
+		ProfileScope(const ProfileScope&);
+		ProfileScope& operator=(const ProfileScope&);
+
+		ProfilePhase _phase;
+		int64_t _start;
+	};
+};
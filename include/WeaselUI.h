@@ -8,6 +8,7 @@ namespace weasel
 	enum ClientCapabilities
 	{
 		INLINE_PREEDIT_CAPABLE = 1,
+		CLIENT_DRAWS_CANDIDATES = 2,	// the text service or its host draws them, not the server's panel
 	};
 
 	class UIImpl;
@@ -50,6 +51,9 @@ namespace weasel
 		// 更新界面显示内容
 		void Update(Context const& ctx, Status const& status);
 
+		// 预先排版下次更新可能显示的候选页，翻到该页时只需重绘
+		void Prepare(Context const& ctx);
+
 		Context& ctx() { return ctx_; } 
 		Status& status() { return status_; } 
 		UIStyle& style() { return style_; }
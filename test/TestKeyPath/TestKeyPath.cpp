@@ -0,0 +1,375 @@
+﻿// TestKeyPath.cpp : tests of the key path that build without Windows headers.
+//
+
+#include <boost/detail/lightweight_test.hpp>
+#include <KeyInterest.h>
+#include <KeyTranslation.h>
+#include <MessageBatch.h>
+#include <KeyJournal.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct KeyReplay
+{
+	int keys;
+	int answered_locally;
+	int eaten_locally;  // should be none
+};
+
+// a schema like luna_pinyin: the model server eats letters, and while composing
+// space, digits, punctuation, BackSpace, Return and Escape
+static bool model_eats(int keycode, int mask, bool* composing, int* preedit)
+{
+	if (mask & (1 << 14))
+		return false;
+	if (keycode >= 'a' && keycode <= 'z' && !(mask & (1 << 2)))
+	{
+		++*preedit;
+		*composing = true;
+		return true;
+	}
+	if (!*composing)
+		return false;
+	if (keycode == 0xff08)
+		*composing = --*preedit > 0;
+	else if (keycode == 0x20 || keycode == 0xff0d || keycode == 0xff1b || (keycode >= 0x21 && keycode <= 0x7e))
+		*composing = false, *preedit = 0;
+	else
+		return false;
+	return true;
+}
+
+// pinyin with corrections, and between sentences a line break, a caret move and a save
+static KeyReplay replay_typing(weasel::KeyInterest const& interest, int rounds)
+{
+	enum { CONTROL = 1 << 2, RELEASE = 1 << 14 };
+	static const char* const words[] = { "nihao", "shijie", "women", "zai", "xie", "daima", "jintian", "tianqi", "henhao" };
+	std::vector<std::pair<int, int> > keys;
+	auto tap = [&keys](int keycode, int mask) {
+		keys.push_back(std::make_pair(keycode, mask));
+		keys.push_back(std::make_pair(keycode, mask | RELEASE));
+	};
+	for (int r = 0; r < rounds; ++r)
+	{
+		for (size_t w = 0; w < sizeof(words) / sizeof(words[0]); ++w)
+		{
+			for (const char* c = words[w]; *c; ++c)
+				tap(*c, 0);
+			if ((r + w) % 4 == 0)
+			{
+				tap(0xff08, 0);
+				tap(words[w][strlen(words[w]) - 1], 0);
+			}
+			tap(w % 3 == 2 ? '2' : ' ', 0);
+		}
+		tap('.', 0);
+		tap(0xff0d, 0);
+		tap(0xff52, 0);
+		tap(0xff57, 0);
+		keys.push_back(std::make_pair(0xffe3, 0));
+		tap('s', CONTROL);
+		keys.push_back(std::make_pair(0xffe3, CONTROL | RELEASE));
+	}
+
+	KeyReplay replay = { 0, 0, 0 };
+	bool composing = false, server_composing = false;
+	int preedit = 0;
+	for (size_t i = 0; i < keys.size(); ++i)
+	{
+		++replay.keys;
+		bool ask = interest.MayEat(keys[i].first, keys[i].second, composing);
+		bool eaten = model_eats(keys[i].first, keys[i].second, &server_composing, &preedit);
+		if (ask)
+			composing = server_composing;
+		else
+		{
+			++replay.answered_locally;
+			if (eaten)
+				++replay.eaten_locally;
+		}
+	}
+	return replay;
+}
+
+void test_key_interest_replay()
+{
+	weasel::KeyInterest interest;
+	interest.Bind(0x60);
+	interest.Bind(0xffc1);
+	interest.Publish(weasel::KeyInterest::ASCII_COMPOSER);
+	KeyReplay replay = replay_typing(interest, 3);
+	BOOST_TEST_EQ(0, replay.eaten_locally);
+	BOOST_TEST(replay.answered_locally > 0);
+	BOOST_TEST_EQ(0, replay_typing(weasel::KeyInterest(), 1).answered_locally);
+}
+
+void bench_key_interest()
+{
+	weasel::KeyInterest interest;
+	interest.Bind(0x60);
+	interest.Bind(0xffc1);
+	printf("typing replay, keys answered without the server\n");
+	for (int flags = 0; flags < 2; ++flags)
+	{
+		interest.Publish(flags ? weasel::KeyInterest::ASCII_COMPOSER : 0);
+		KeyReplay replay = replay_typing(interest, 100);
+		printf("  %s %d of %d (%.1f%%)\n", flags ? "ascii_composer   " : "no ascii_composer",
+			replay.answered_locally, replay.keys, 100.0 * replay.answered_locally / replay.keys);
+	}
+}
+
+// stands in for ToUnicodeEx: letters, shifted with SHIFT, and VK_OEM_7 a dead key
+struct StubTranslate
+{
+	unsigned vkey, state;
+	int* calls;
+	int operator()(wchar_t* ch) const
+	{
+		++*calls;
+		if (vkey == 0xde)
+		{
+			*ch = L'\'';
+			return -1;
+		}
+		if (vkey < 'A' || vkey > 'Z')
+			return 0;
+		*ch = wchar_t(state & weasel::KeyTranslationCache::SHIFT ? vkey : vkey - 'A' + 'a');
+		return 1;
+	}
+};
+
+static int translate_key(weasel::KeyTranslationCache& cache, uintptr_t layout, unsigned vkey, unsigned state, int* calls, wchar_t* ch)
+{
+	StubTranslate stub = { vkey, state, calls };
+	return cache.Translate(layout, vkey, state, stub, ch);
+}
+
+void test_key_translation_cache()
+{
+	const unsigned SHIFT = weasel::KeyTranslationCache::SHIFT;
+	weasel::KeyTranslationCache cache;
+	int calls = 0;
+	wchar_t ch = 0;
+	BOOST_TEST_EQ(1, translate_key(cache, 0x0409, 'A', 0, &calls, &ch));
+	BOOST_TEST_EQ(L'a', ch);
+	BOOST_TEST_EQ(1, translate_key(cache, 0x0409, 'A', 0, &calls, &ch));
+	BOOST_TEST_EQ(L'a', ch);
+	BOOST_TEST_EQ(1, calls);
+	BOOST_TEST_EQ(1, translate_key(cache, 0x0409, 'A', SHIFT, &calls, &ch));
+	BOOST_TEST_EQ(L'A', ch);
+	BOOST_TEST_EQ(2, calls);
+	// no character is remembered as well
+	BOOST_TEST_EQ(0, translate_key(cache, 0x0409, '1', 0, &calls, &ch));
+	BOOST_TEST_EQ(0, translate_key(cache, 0x0409, '1', 0, &calls, &ch));
+	BOOST_TEST_EQ(3, calls);
+
+	// another layout starts over
+	BOOST_TEST_EQ(1, translate_key(cache, 0x0407, 'A', 0, &calls, &ch));
+	BOOST_TEST_EQ(4, calls);
+
+	// dead keys, and the key after one, always ask the system
+	BOOST_TEST_EQ(-1, translate_key(cache, 0x0407, 0xde, 0, &calls, &ch));
+	BOOST_TEST_EQ(-1, translate_key(cache, 0x0407, 0xde, 0, &calls, &ch));
+	BOOST_TEST_EQ(1, translate_key(cache, 0x0407, 'A', 0, &calls, &ch));
+	BOOST_TEST_EQ(7, calls);
+	BOOST_TEST_EQ(1, translate_key(cache, 0x0407, 'A', 0, &calls, &ch));
+	BOOST_TEST_EQ(7, calls);
+	BOOST_TEST_EQ(3u, cache.Hits());
+	BOOST_TEST_EQ(7u, cache.Misses());
+}
+
+void bench_key_translation()
+{
+	// a recorded stream: each letter of the text pressed and released, capitals with shift
+	const char text[] = "Ni hao shi jie The quick brown fox jumps over the lazy dog women zai xie daima";
+	std::vector<std::pair<unsigned, unsigned> > stream;
+	for (const char* c = text; *c; ++c)
+	{
+		unsigned vkey = *c == ' ' ? 0x20 : unsigned(toupper(*c));
+		unsigned state = isupper(*c) ? weasel::KeyTranslationCache::SHIFT : 0;
+		stream.push_back(std::make_pair(vkey, state));
+		stream.push_back(std::make_pair(vkey, state | weasel::KeyTranslationCache::KEY_UP));
+	}
+	// the stub copies the key state as ConvertKeyEvent does for ToUnicodeEx, which costs far more
+	enum { VK_CONTROL = 0x11, VK_MENU = 0x12 };
+	unsigned char keyState[256] = { 0 };
+	auto stub = [&keyState](unsigned vkey, unsigned, wchar_t* ch) -> int {
+		unsigned char table[256];
+		memcpy(table, keyState, sizeof(table));
+		table[VK_CONTROL] = table[VK_MENU] = 0;
+		*ch = wchar_t(vkey | table[vkey & 0xff]);
+		return vkey >= 'A' && vkey <= 'Z' ? 1 : 0;
+	};
+	const int rounds = 2000;
+	typedef std::chrono::duration<double, std::nano> ns;
+	printf("key translation, recorded stream of %d keys, ns per key\n", (int)stream.size());
+	for (int cached = 0; cached < 2; ++cached)
+	{
+		weasel::KeyTranslationCache cache;
+		unsigned sum = 0;
+		auto t = std::chrono::high_resolution_clock::now();
+		for (int r = 0; r < rounds; ++r)
+		{
+			for (size_t i = 0; i < stream.size(); ++i)
+			{
+				const unsigned vkey = stream[i].first, state = stream[i].second;
+				wchar_t ch = 0;
+				if (cached)
+					cache.Translate(0x0409, vkey, state, [&](wchar_t* c) { return stub(vkey, state, c); }, &ch);
+				else
+					stub(vkey, state, &ch);
+				sum += ch;
+			}
+		}
+		double per_key = ns(std::chrono::high_resolution_clock::now() - t).count() / (rounds * stream.size());
+		if (cached)
+			printf("  cached   %.1f, %.2f%% of keys ask the system (%u)\n", per_key,
+				100.0 * cache.Misses() / (cache.Hits() + cache.Misses()), sum & 1);
+		else
+			printf("  uncached %.1f (%u)\n", per_key, sum & 1);
+	}
+}
+
+struct StubMessage
+{
+	unsigned message;
+	int param;
+};
+
+void test_message_batch()
+{
+	weasel::MessageBatch<StubMessage> batch;
+	std::vector<StubMessage> generated;
+	int calls = 0;
+	auto generate = [&](const StubMessage* messages, size_t count) -> bool {
+		++calls;
+		generated.insert(generated.end(), messages, messages + count);
+		return true;
+	};
+	// a key with nothing to say generates nothing
+	BOOST_TEST(batch.Flush(generate));
+	BOOST_TEST_EQ(0, calls);
+
+	// ending one composition and starting the next, as a commit with a new preedit does
+	const StubMessage transition[] = { { 1, 0 }, { 2, 0 }, { 3, 0 }, { 4, 0 }, { 5, 1 }, { 6, 2 } };
+	for (int i = 0; i < 6; ++i)
+		batch.Add(transition[i]);
+	BOOST_TEST_EQ(6u, batch.Size());
+	BOOST_TEST(batch.Flush(generate));
+	BOOST_TEST_EQ(1, calls);
+	BOOST_TEST_EQ(0u, batch.Size());
+	BOOST_TEST_EQ(6u, generated.size());
+	for (int i = 0; i < 6; ++i)
+		BOOST_TEST(generated[i].message == transition[i].message && generated[i].param == transition[i].param);
+
+	// a failed hand-over drops the messages rather than repeating them with the next key
+	batch.Add(transition[0]);
+	BOOST_TEST(!batch.Flush([](const StubMessage*, size_t) { return false; }));
+	BOOST_TEST_EQ(0u, batch.Size());
+	BOOST_TEST_EQ(2u, batch.Flushes());
+	BOOST_TEST_EQ(7u, batch.Flushed());
+	BOOST_TEST_EQ(3.5, batch.MessagesPerFlush());
+}
+
+void test_key_journal()
+{
+	static weasel::KeyJournal journal;
+	weasel::JournalEntry entry = { 0, 1, 0, 0, 0, 0, 0, 0, 0 };
+	// off until enabled
+	journal.Record(entry);
+	BOOST_TEST(journal.Snapshot().empty());
+
+	journal.SetEnabled(true);
+	const uint32_t total = weasel::KeyJournal::CAPACITY + 5;
+	for (uint32_t i = 0; i < total; ++i)
+	{
+		entry.timestamp_ns = i;
+		entry.msg = 1 + i % 2;
+		entry.lparam = entry.session = 7;
+		entry.result = i % 3 == 0;
+		entry.response_size = i % 2 ? 0 : 64;
+		entry.handler_ns = 1000 + i % 2 * 100000;
+		journal.Record(entry);
+	}
+	// the oldest five are overwritten, the rest come out in order
+	std::vector<weasel::JournalEntry> entries = journal.Snapshot();
+	BOOST_TEST_EQ((size_t)weasel::KeyJournal::CAPACITY, entries.size());
+	BOOST_TEST_EQ(5, entries.front().timestamp_ns);
+	BOOST_TEST_EQ((int64_t)total - 1, entries.back().timestamp_ns);
+
+	journal.SetEnabled(false);
+	journal.Record(entry);
+	BOOST_TEST_EQ((size_t)weasel::KeyJournal::CAPACITY, journal.Snapshot().size());
+
+	std::stringstream file;
+	BOOST_TEST(weasel::KeyJournal::Save(file, entries));
+	std::vector<weasel::JournalEntry> loaded;
+	BOOST_TEST(weasel::KeyJournal::Load(file, &loaded));
+	BOOST_TEST_EQ(entries.size(), loaded.size());
+	BOOST_TEST(!memcmp(&entries[0], &loaded[0], entries.size() * sizeof(weasel::JournalEntry)));
+	// cut short, or not a journal at all
+	std::string saved = file.str();
+	std::stringstream truncated(saved.substr(0, saved.size() - 1));
+	BOOST_TEST(!weasel::KeyJournal::Load(truncated, &loaded));
+	BOOST_TEST(loaded.empty());
+	std::stringstream other("not a journal, but long enough for a header");
+	BOOST_TEST(!weasel::KeyJournal::Load(other, &loaded));
+
+	// a handler that answers every key of command 2 with a body it did not have before
+	auto dispatch = [](const weasel::JournalEntry& e, uint32_t* response_size) -> uint32_t {
+		*response_size = e.msg == 2 ? 16 : e.response_size;
+		return e.result;
+	};
+	size_t idle = 0;
+	std::map<uint32_t, weasel::JournalReplayStats> stats = weasel::ReplayJournal(entries, dispatch,
+		[&idle](const weasel::JournalEntry&) { ++idle; });
+	BOOST_TEST_EQ(2u, stats.size());
+	BOOST_TEST_EQ(entries.size(), idle);
+	BOOST_TEST_EQ(entries.size() / 2, stats[1].replayed.count);
+	BOOST_TEST_EQ(0u, stats[1].mismatches);
+	BOOST_TEST_EQ(stats[2].recorded.count, stats[2].mismatches);
+	BOOST_TEST_EQ(101000u, stats[2].recorded.max_ns);
+	BOOST_TEST_EQ(16u * stats[2].replayed.count, stats[2].response_bytes);
+	std::string report = weasel::FormatJournalReplay(stats, [](uint32_t msg) { return msg == 1 ? "one" : "two"; });
+	BOOST_TEST(report.find("one") != std::string::npos && report.find("replayed") != std::string::npos);
+}
+
+void bench_key_journal()
+{
+	static weasel::KeyJournal journal;
+	journal.SetEnabled(true);
+	weasel::JournalEntry entry = { 0, 1, 0x61, 7, 7, 1, 64, 1000, 0 };
+	const int rounds = 1000000;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < rounds; ++i)
+	{
+		entry.timestamp_ns = i;
+		journal.Record(entry);
+	}
+	auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	printf("journal record: %.1f ns\n", (double)elapsed / rounds);
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc > 1 && !strcmp(argv[1], "/bench"))
+	{
+		bench_key_interest();
+		bench_key_translation();
+		bench_key_journal();
+		return 0;
+	}
+
+	test_key_interest_replay();
+	test_key_translation_cache();
+	test_message_batch();
+	test_key_journal();
+
+	return boost::report_errors();
+}
@@ -3,8 +3,16 @@
 
 #include "stdafx.h"
 #include <boost/detail/lightweight_test.hpp>
+#include <boost/archive/text_woarchive.hpp>
+#include <boost/interprocess/streams/bufferstream.hpp>
+#include <WeaselIPC.h>
 #include <ResponseParser.h>
+#include <PipeFrame.h>
+#include <KeyInterest.h>
+#include <algorithm>
+#include <sstream>
 #include <string>
+#include <vector>
 
 void test_1()
 {
@@ -94,12 +102,194 @@ void test_4()
 	BOOST_TEST_EQ(1, c.totalPages);
 }
 
+// a reply frame as the server sends it: the eaten flag, the length, then the body
+static std::vector<char> make_frame(const wchar_t* body, uint32_t extra_length = 0)
+{
+	weasel::PipeFrameHeader<DWORD> header = { 1, (uint32_t)(wcslen(body) * sizeof(wchar_t)) + extra_length };
+	std::vector<char> frame((const char*)&header, (const char*)&header + sizeof(header));
+	frame.insert(frame.end(), (const char*)body, (const char*)(body + wcslen(body)));
+	return frame;
+}
+
+// hands over at most chunk bytes a read, PIPE_READ_MORE until the frame is through, as ReadFile on a message pipe
+static bool read_frame(std::vector<char> const& frame, size_t chunk, char* buffer, size_t capacity,
+	weasel::PipeFrameHeader<DWORD>* header, int* reads)
+{
+	size_t offset = 0;
+	*reads = 0;
+	auto read = [&](char* dst, size_t size, size_t* got) -> weasel::PipeReadResult {
+		++*reads;
+		size_t n = (std::min)((std::min)(size, chunk), frame.size() - offset);
+		memcpy(dst, &frame[offset], n);
+		offset += n;
+		*got = n;
+		return offset == frame.size() ? weasel::PIPE_READ_DONE : weasel::PIPE_READ_MORE;
+	};
+	return weasel::ReadPipeFrame(read, buffer, capacity, header);
+}
+
+void test_pipe_frame()
+{
+	const wchar_t body[] = L"action=status\nstatus.ascii_mode=1\nstatus.composing=0\nstatus.disabled=0\n.\n";
+	std::vector<char> frame = make_frame(body);
+	char buffer[WEASEL_IPC_BUFFER_SIZE];
+	weasel::PipeFrameHeader<DWORD> header;
+	int reads = 0;
+
+	BOOST_TEST(read_frame(frame, sizeof(buffer), buffer, sizeof(buffer), &header, &reads));
+	BOOST_TEST_EQ(1, reads);
+	BOOST_TEST_EQ(1u, header.msg);
+	BOOST_TEST_EQ(wcslen(body) * sizeof(wchar_t), header.length);
+
+	// partial reads end up with the same frame
+	memset(buffer, 0, sizeof(buffer));
+	BOOST_TEST(read_frame(frame, 7, buffer, sizeof(buffer), &header, &reads));
+	BOOST_TEST_EQ((int)((frame.size() + 6) / 7), reads);
+	BOOST_TEST_EQ(wcslen(body) * sizeof(wchar_t), header.length);
+	weasel::Status status;
+	weasel::ResponseParser parser(NULL, NULL, &status);
+	BOOST_TEST(parser((LPWSTR)(buffer + sizeof(header)), header.length / sizeof(wchar_t)));
+	BOOST_TEST(status.ascii_mode);
+
+	// a length other than what arrived, and a frame larger than the buffer
+	BOOST_TEST(!read_frame(make_frame(body, 2), 7, buffer, sizeof(buffer), &header, &reads));
+	BOOST_TEST(!read_frame(frame, 7, buffer, frame.size() - 1, &header, &reads));
+	BOOST_TEST(!read_frame(std::vector<char>(3), 7, buffer, sizeof(buffer), &header, &reads));
+}
+
+// the first reply to a key on a 50 candidate page, commented, as RimeWithWeaselHandler::_Respond writes it
+static std::wstring large_page_reply(weasel::CandidateInfo const& cinfo, weasel::UIStyle const& style)
+{
+	std::wstringstream cand, styles;
+	{
+		boost::archive::text_woarchive oa(cand);
+		oa << cinfo;
+	}
+	{
+		boost::archive::text_woarchive oa(styles);
+		oa << style;
+	}
+	weasel::KeyInterest interest;
+	interest.Publish(weasel::KeyInterest::ASCII_COMPOSER);
+	return L"action=commit,config,ctx,interest,status,style\n"
+		L"commit=上屏的字\n"
+		L"status.ascii_mode=0\n"
+		L"status.composing=1\n"
+		L"status.disabled=0\n"
+		L"ctx.preedit=hou xuan\n"
+		L"ctx.preedit.cursor=0,8\n"
+		L"ctx.cand=" + cand.str() + L"\n"
+		L"config.inline_preedit=0\n"
+		L"config.server_ui=0\n"
+		L"style=" + styles.str() + L"\n"
+		L"interest=" + interest.Format<wchar_t>() + L"\n"
+		L".\n";
+}
+
+void test_large_page_reply()
+{
+	weasel::CandidateInfo cinfo;
+	for (int i = 0; i < 50; ++i)
+	{
+		cinfo.candies.push_back(weasel::Text(L"候選" + std::to_wstring(i)));
+		cinfo.comments.push_back(weasel::Text(L"hòu xuǎn " + std::to_wstring(i)));
+		cinfo.labels.push_back(weasel::Text(std::to_wstring(i % 10)));
+	}
+	cinfo.totalPages = 3;
+	weasel::UIStyle style;
+	style.font_face = style.label_font_face = style.comment_font_face = L"Segoe UI Emoji, Microsoft YaHei UI, Noto Sans CJK SC";
+	const std::wstring body = large_page_reply(cinfo, style);
+
+	// written into the channel's send buffer, after the frame header, as the server does
+	std::vector<char> buffer(WEASEL_IPC_BUFFER_SIZE);
+	const size_t room = (buffer.size() - sizeof(weasel::PipeFrameHeader<weasel::PipeMessage>)) / sizeof(wchar_t);
+	boost::interprocess::wbufferstream stream((wchar_t*)&buffer[sizeof(weasel::PipeFrameHeader<weasel::PipeMessage>)], room);
+	stream << body;
+	BOOST_TEST(stream.good());
+	BOOST_TEST((size_t)stream.tellp() == body.size());
+
+	weasel::PipeFrameHeader<DWORD> header;
+	int reads = 0;
+	BOOST_TEST(read_frame(make_frame(body.c_str()), 4096, &buffer[0], buffer.size(), &header, &reads));
+	std::wstring commit;
+	weasel::Context ctx;
+	weasel::Status status;
+	weasel::ResponseParser parser(&commit, &ctx, &status);
+	BOOST_TEST(parser((LPWSTR)(&buffer[0] + sizeof(header)), header.length / sizeof(wchar_t)));
+	BOOST_TEST(commit == L"上屏的字");
+	BOOST_TEST_EQ(50u, ctx.cinfo.candies.size());
+	BOOST_TEST(ctx.cinfo.comments[49].str == L"hòu xuǎn 49");
+}
+
+static std::wstring interest_reply(std::wstring const& interest)
+{
+	return L"action=interest\ninterest=" + interest + L"\n.\n";
+}
+
+void test_key_interest()
+{
+	enum { SHIFT = 1 << 0, CONTROL = 1 << 2, ALT = 1 << 3, RELEASE = 1 << 14 };
+	weasel::KeyInterest interest;
+	// every key goes to the server until the schema's interest arrives
+	BOOST_TEST(interest.MayEat(0xff51, 0, false));
+	BOOST_TEST(interest.MayEat(0x61, RELEASE, false));
+
+	weasel::KeyInterest published;
+	published.Bind(0xffc1);  // F4
+	published.Bind(0x60);  // grave
+	published.Publish(weasel::KeyInterest::ASCII_COMPOSER);
+	std::wstring reply = interest_reply(published.Format<wchar_t>());
+	weasel::ResponseParser parser(NULL, NULL, NULL, NULL, NULL, &interest);
+	BOOST_TEST(parser(&reply[0], (UINT)reply.size()));
+	BOOST_TEST(interest.IsValid());
+	BOOST_TEST_EQ((int)weasel::KeyInterest::ASCII_COMPOSER, interest.GetFlags());
+	BOOST_TEST(interest.IsBound(0xffc1));
+	BOOST_TEST(interest.IsBound(0x60));
+	BOOST_TEST(!interest.IsBound(0xff51));
+
+	// not composing
+	BOOST_TEST(interest.MayEat(0x61, 0, false));
+	BOOST_TEST(interest.MayEat(0xffc1, 0, false));
+	BOOST_TEST(interest.MayEat(0xffe1, 0, false));
+	BOOST_TEST(interest.MayEat(0xffe1, SHIFT | RELEASE, false));
+	BOOST_TEST(interest.MayEat(0x63, CONTROL, false));
+	BOOST_TEST(interest.MayEat(0x61, SHIFT | RELEASE, false));
+	BOOST_TEST(interest.MayEat(0x1000e9, 0, false));
+	BOOST_TEST(!interest.MayEat(0xff51, 0, false));
+	BOOST_TEST(!interest.MayEat(0xff0d, 0, false));
+	BOOST_TEST(!interest.MayEat(0x61, RELEASE, false));
+	BOOST_TEST(!interest.MayEat(0xff09, ALT, false));
+	// composing
+	BOOST_TEST(interest.MayEat(0xff08, 0, true));
+	BOOST_TEST(interest.MayEat(0xff51, 0, true));
+	BOOST_TEST(!interest.MayEat(0x61, RELEASE, true));
+
+	// without ascii_composer modifiers only matter while composing; chord_composer wants releases
+	BOOST_TEST(interest.Parse(std::wstring(L"0,") + published.Format<wchar_t>().substr(2)));
+	BOOST_TEST(!interest.MayEat(0xffe1, 0, false));
+	BOOST_TEST(!interest.MayEat(0x63, CONTROL, false));
+	BOOST_TEST(interest.MayEat(0xffe1, 0, true));
+	BOOST_TEST(interest.Parse(std::wstring(L"2,") + published.Format<wchar_t>().substr(2)));
+	BOOST_TEST(interest.MayEat(0x61, RELEASE, false));
+
+	// an empty or malformed interest leaves every key to the server
+	reply = interest_reply(L"");
+	BOOST_TEST(parser(&reply[0], (UINT)reply.size()));
+	BOOST_TEST(!interest.IsValid());
+	BOOST_TEST(!interest.Parse(std::wstring(L"1,") + std::wstring(weasel::KeyInterest::HEX_DIGITS - 1, L'0') + L"g"));
+	BOOST_TEST(!interest.IsValid());
+	BOOST_TEST(weasel::KeyInterest().Format<char>().empty());
+}
+
 int _tmain(int argc, _TCHAR* argv[])
 {
 	test_1();
 	test_2();
 	test_3();
 	test_4();
+	test_pipe_frame();
+	test_large_page_reply();
+	test_key_interest();
 
 	system("pause");
 	return boost::report_errors();
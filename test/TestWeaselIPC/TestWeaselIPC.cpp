@@ -4,11 +4,14 @@
 #include "stdafx.h"
 #include <WeaselIPC.h>
 #include <RimeWithWeasel.h>
+#include <KeyJournal.h>
 
 #include <boost/interprocess/streams/bufferstream.hpp>
 using namespace boost::interprocess;
 
+#include <fstream>
 #include <iostream>
+#include <map>
 #include <memory>
 
 CAppModule _Module;
@@ -16,8 +19,9 @@ CAppModule _Module;
 int console_main();
 int client_main();
 int server_main();
+int replay_main(const wchar_t* path, bool rime);
 
-// usage: TestWeaselIPC.exe [/start | /stop | /console]
+// usage: TestWeaselIPC.exe [/start | /stop | /console | /replay weasel_journal.bin [/rime]]
 
 int _tmain(int argc, _TCHAR* argv[])
 {
@@ -45,6 +49,10 @@ int _tmain(int argc, _TCHAR* argv[])
 		return console_main();
 		return 0;
 	}
+	else if (argc > 2 && !wcscmp(L"/replay", argv[1]))
+	{
+		return replay_main(argv[2], argc > 3 && !wcscmp(L"/rime", argv[3]));
+	}
 
 	return -1;
 }
@@ -198,3 +206,145 @@ int server_main()
 	std::cerr << "server quitting." << std::endl;
 	return ret;
 }
+
+// answers like TestRequestHandler, without the logging, so that the replay times the dispatch alone
+class ReplayRequestHandler : public weasel::RequestHandler
+{
+public:
+	ReplayRequestHandler() : m_counter(0) {}
+	virtual UINT FindSession(UINT session_id)
+	{
+		return (session_id <= m_counter ? session_id : 0);
+	}
+	virtual UINT AddSession(LPWSTR buffer, EatLine eat)
+	{
+		return ++m_counter;
+	}
+	virtual BOOL ProcessKeyEvent(weasel::KeyEvent keyEvent, UINT session_id, EatLine eat)
+	{
+		std::wstring greeting(L"Greeting=Hello, 小狼毫.\n");
+		eat(greeting);
+		return TRUE;
+	}
+private:
+	unsigned int m_counter;
+};
+
+const char* command_name(uint32_t msg)
+{
+	static const char* names[] = {
+		"echo", "start_session", "end_session", "process_key_event", "shutdown_server",
+		"focus_in", "focus_out", "update_input_pos", "start_maintenance", "end_maintenance",
+		"commit_composition", "clear_composition", "tray_command",
+	};
+	return msg >= WEASEL_IPC_ECHO && msg < WEASEL_IPC_LAST_COMMAND ? names[msg - WEASEL_IPC_ECHO] : "unknown";
+}
+
+// replays a journal dumped from the tray, as fast as it goes, through the mock handler or with /rime the server's
+int replay_main(const wchar_t* path, bool rime)
+{
+	std::ifstream file(path, std::ios::binary);
+	std::vector<weasel::JournalEntry> entries;
+	if (!weasel::KeyJournal::Load(file, &entries))
+	{
+		std::cerr << "failed to read journal." << std::endl;
+		return -5;
+	}
+
+	HRESULT hRes = _Module.Init(NULL, GetModuleHandle(NULL));
+	ATLASSERT(SUCCEEDED(hRes));
+
+	weasel::UI ui;
+	std::unique_ptr<weasel::RequestHandler> handler;
+	if (rime)
+	{
+		ui.Create(NULL);
+		handler.reset(new RimeWithWeaselHandler(&ui));
+	}
+	else
+	{
+		handler.reset(new ReplayRequestHandler);
+	}
+	handler->Initialize();
+
+	// the messages go straight to the handler, as ServerImpl hands them over; the reply body is only counted
+	std::map<UINT, UINT> sessions;  // recorded, replayed
+	std::wstring body;
+	auto eat = [&body](std::wstring &line) -> bool {
+		body += line;
+		return true;
+	};
+	auto dispatch = [&](const weasel::JournalEntry& e, uint32_t* response_size) -> uint32_t {
+		body.clear();
+		auto it = sessions.find(e.session);
+		const UINT session = it != sessions.end() ? it->second : 0;
+		uint32_t result = 0;
+		switch (e.msg)
+		{
+		case WEASEL_IPC_ECHO:
+			result = handler->FindSession(session) ? e.session : 0;
+			break;
+		case WEASEL_IPC_START_SESSION:
+		{
+			// the client's description of itself is not journaled; an empty one reads as an IMM client
+			std::vector<WCHAR> info(WEASEL_IPC_BUFFER_LENGTH);
+			UINT started = handler->AddSession(&info[0], eat);
+			if (started)
+				sessions[e.session] = started;
+			result = started ? e.session : 0;
+			break;
+		}
+		case WEASEL_IPC_END_SESSION:
+			result = handler->RemoveSession(session);
+			sessions.erase(e.session);
+			break;
+		case WEASEL_IPC_PROCESS_KEY_EVENT:
+			result = handler->FindSession(session) ? handler->ProcessKeyEvent(weasel::KeyEvent(e.wparam), session, eat)
+				: WEASEL_IPC_UNKNOWN_SESSION;
+			break;
+		case WEASEL_IPC_FOCUS_IN:
+			handler->FocusIn(e.wparam, session);
+			break;
+		case WEASEL_IPC_FOCUS_OUT:
+			handler->FocusOut(e.wparam, session);
+			break;
+		case WEASEL_IPC_UPDATE_INPUT_POS:
+		{
+			// as ServerImpl::OnUpdateInputPosition decodes it, in physical pixels
+			const UINT w = e.wparam;
+			const int hi_res = (w >> 31) & 0x01;
+			RECT rc;
+			rc.left = ((w & 0x7ff) - (w & 0x800)) << hi_res;
+			rc.top = (((w >> 12) & 0x7ff) - ((w >> 12) & 0x800)) << hi_res;
+			rc.right = rc.left + 6;
+			rc.bottom = rc.top + (((w >> 24) & 0x7f) << hi_res);
+			handler->UpdateInputPosition(rc, session);
+			break;
+		}
+		case WEASEL_IPC_COMMIT_COMPOSITION:
+			handler->CommitComposition(session);
+			break;
+		case WEASEL_IPC_CLEAR_COMPOSITION:
+			handler->ClearComposition(session);
+			break;
+		default:
+			// maintenance, shutdown and tray commands are not replayed
+			result = e.result;
+			break;
+		}
+		*response_size = (uint32_t)(body.size() * sizeof(wchar_t));
+		return result;
+	};
+	auto after = [&](const weasel::JournalEntry& e) {
+		if (e.msg == WEASEL_IPC_PROCESS_KEY_EVENT)
+			handler->Idle();
+	};
+	auto stats = weasel::ReplayJournal(entries, dispatch, after);
+
+	handler->Finalize();
+	if (rime)
+		ui.Destroy();
+	std::cout << entries.size() << " messages from " << wcstomb(path) << std::endl
+		<< weasel::FormatJournalReplay(stats, command_name);
+	return 0;
+}
@@ -0,0 +1,1427 @@
+﻿// TestWeaselUI.cpp : Defines the entry point for the console application.
+//
+
+#include <boost/detail/lightweight_test.hpp>
+#include <FontFit.h>
+#include <LayoutDiff.h>
+#include <EmojiSegment.h>
+#include <Premultiply.h>
+#include <ByteBudgetCache.h>
+#include <HeadlessPanel.h>
+#include <PngCodec.h>
+#include <Rasterizer.h>
+#include <StatusIconAtlas.h>
+#include <MonitorCache.h>
+#include <CandidateGrid.h>
+#include <WeaselProfiler.h>
+#include <chrono>
+#include <cstdlib>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#include <gdiplus.h>
+#include <d2d1.h>
+#include <dwrite.h>
+#include <psapi.h>
+#pragma comment(lib, "gdiplus.lib")
+#pragma comment(lib, "d2d1.lib")
+#pragma comment(lib, "dwrite.lib")
+#pragma comment(lib, "psapi.lib")
+#endif
+
+// stands in for a full layout pass: fixed padding plus text that scales with the font point
+struct FakeLayout
+{
+	int columns;	// widest row, in em
+	int rows;
+	int padding;
+	int calls;
+
+	weasel::FitExtent Measure(int point)
+	{
+		++calls;
+		// glyph advances are hinted to whole pixels, line height is 4/3 em
+		weasel::FitExtent sz = { padding + columns * ((point * 15 + 8) / 16), padding + rows * (point * 4 / 3) };
+		return sz;
+	}
+};
+
+static weasel::FontFitKey MakeKey(int width, int height, int candidates, size_t length)
+{
+	weasel::FontFitKey key = { width, height, candidates, weasel::FontFitKey::Bucket(length) };
+	return key;
+}
+
+static bool Fits(FakeLayout layout, int point, int width, int height)
+{
+	weasel::FitExtent sz = layout.Measure(point);
+	return sz.cx <= width && sz.cy <= height;
+}
+
+void test_fit_largest()
+{
+	const int areas[][2] = { { 1920, 1040 }, { 1366, 728 }, { 3840, 2100 }, { 800, 560 } };
+	for (auto& area : areas)
+	{
+		for (int columns = 4; columns < 80; columns += 7)
+		{
+			weasel::FontFitter fitter;
+			FakeLayout layout = { columns, 11, 24, 0 };
+			int point = fitter.Fit(MakeKey(area[0], area[1], 10, columns), 12, [&](int p) { return layout.Measure(p); });
+			BOOST_TEST(Fits(layout, point, area[0], area[1]));
+			BOOST_TEST(point == 2048 || !Fits(layout, point + 1, area[0], area[1]));
+			// one reference measurement, two predictions and a rounding correction at most
+			BOOST_TEST(layout.calls <= 4);
+		}
+	}
+}
+
+void test_fit_memoized()
+{
+	weasel::FontFitter fitter;
+	FakeLayout layout = { 20, 11, 24, 0 };
+	weasel::FontFitKey key = MakeKey(1920, 1040, 10, 20);
+	int point = fitter.Fit(key, 12, [&](int p) { return layout.Measure(p); });
+
+	// typing within the same shape lays out once at the remembered point
+	layout.calls = 0;
+	layout.columns = 21;
+	key.text_bucket = weasel::FontFitKey::Bucket(21);
+	BOOST_TEST_EQ(fitter.Fit(key, 12, [&](int p) { return layout.Measure(p); }), point);
+	BOOST_TEST_EQ(layout.calls, 1);
+	BOOST_TEST_EQ(fitter.HitCount(), 1u);
+
+	// overflowing the remembered point triggers a re-fit
+	layout.calls = 0;
+	layout.columns = 60;
+	int smaller = fitter.Fit(key, 12, [&](int p) { return layout.Measure(p); });
+	BOOST_TEST(smaller < point);
+	BOOST_TEST(Fits(layout, smaller, 1920, 1040));
+	BOOST_TEST(layout.calls > 1);
+	BOOST_TEST_EQ(fitter.HitCount(), 1u);
+}
+
+void test_fit_clamped()
+{
+	weasel::FontFitter fitter(4, 2048);
+	FakeLayout layout = { 400, 40, 24, 0 };
+	BOOST_TEST_EQ(fitter.Fit(MakeKey(320, 200, 10, 400), 12, [&](int p) { return layout.Measure(p); }), 4);
+	FakeLayout tiny = { 1, 1, 0, 0 };
+	BOOST_TEST_EQ(fitter.Fit(MakeKey(1920, 1040, 1, 1), 12, [&](int p) { return tiny.Measure(p); }), 780);
+}
+
+void test_layout_diff()
+{
+	weasel::Context ctx;
+	ctx.preedit.str = L"zhong";
+	ctx.cinfo.candies.push_back(weasel::Text(L"中"));
+	ctx.cinfo.candies.push_back(weasel::Text(L"種"));
+	ctx.cinfo.comments.resize(2);
+	ctx.cinfo.labels.resize(2);
+	weasel::Status status;
+	status.composing = true;
+	weasel::UIStyle style;
+
+	weasel::Context next(ctx);
+	BOOST_TEST_EQ(weasel::DiffLayout(ctx, status, style, next, status, style), weasel::LAYOUT_UNCHANGED);
+	next.cinfo.highlighted = 1;
+	BOOST_TEST_EQ(weasel::DiffLayout(ctx, status, style, next, status, style), weasel::LAYOUT_HIGHLIGHT_CHANGED);
+
+	weasel::UIStyle recolored(style);
+	recolored.hilited_candidate_back_color = 0xff0000ff;
+	BOOST_TEST_EQ(weasel::DiffLayout(ctx, status, style, next, status, recolored), weasel::LAYOUT_REPAINT);
+	weasel::Status disabled(status);
+	disabled.disabled = true;
+	BOOST_TEST_EQ(weasel::DiffLayout(ctx, status, style, ctx, disabled, style), weasel::LAYOUT_REPAINT);
+
+	next.cinfo.candies[1].str = L"重";
+	BOOST_TEST_EQ(weasel::DiffLayout(ctx, status, style, next, status, style), weasel::LAYOUT_CHANGED);
+	weasel::Status ascii(status);
+	ascii.ascii_mode = true;
+	BOOST_TEST_EQ(weasel::DiffLayout(ctx, status, style, ctx, ascii, style), weasel::LAYOUT_CHANGED);
+	weasel::UIStyle bigger(style);
+	bigger.font_point += 2;
+	BOOST_TEST_EQ(weasel::DiffLayout(ctx, status, style, ctx, status, bigger), weasel::LAYOUT_CHANGED);
+}
+
+void test_page_turn()
+{
+	weasel::Context shown;
+	shown.preedit.str = L"zhong";
+	shown.cinfo.candies.push_back(weasel::Text(L"中"));
+	shown.cinfo.candies.push_back(weasel::Text(L"種"));
+	shown.cinfo.comments.resize(2);
+	shown.cinfo.labels.resize(2);
+	weasel::Status status;
+	status.composing = true;
+	weasel::UIStyle style;
+
+	// the next page as the server prepares it, and as paging down then shows it
+	weasel::Context prepared(shown);
+	prepared.cinfo.candies[0].str = L"重";
+	prepared.cinfo.candies[1].str = L"眾";
+	prepared.cinfo.currentPage = 1;
+	weasel::Context next(prepared);
+	next.cinfo.highlighted = 1;
+	BOOST_TEST(weasel::IsPageTurn(shown, next));
+	BOOST_TEST_EQ(weasel::DiffLayout(prepared, status, style, next, status, style), weasel::LAYOUT_HIGHLIGHT_CHANGED);
+
+	BOOST_TEST(!weasel::IsPageTurn(shown, shown));
+	weasel::Context typed(next);
+	typed.preedit.str = L"zhongg";
+	BOOST_TEST(!weasel::IsPageTurn(shown, typed));
+	// the same page turn on other candidates than prepared misses
+	next.cinfo.candies[1].str = L"衆";
+	BOOST_TEST_EQ(weasel::DiffLayout(prepared, status, style, next, status, style), weasel::LAYOUT_CHANGED);
+}
+
+// builds UTF-16 from code points, the same on 16 and 32 bit wchar_t
+static std::wstring Utf16(std::vector<unsigned int> cps)
+{
+	std::wstring s;
+	for (auto cp : cps)
+	{
+		if (cp >= 0x10000)
+		{
+			s.push_back((wchar_t)(0xD800 + ((cp - 0x10000) >> 10)));
+			s.push_back((wchar_t)(0xDC00 + ((cp - 0x10000) & 0x3FF)));
+		}
+		else
+			s.push_back((wchar_t)cp);
+	}
+	return s;
+}
+
+static std::wstring DescribeRuns(const std::wstring& text)
+{
+	std::vector<weasel::EmojiRun> runs;
+	weasel::SegmentEmoji(text, &runs);
+	std::wstring s;
+	for (auto& run : runs)
+	{
+		s += run.emoji ? L"E" : L"T";
+		s += std::to_wstring(run.length);
+	}
+	return s;
+}
+
+void test_emoji_property()
+{
+	BOOST_TEST(weasel::GetEmojiProperty(0x1F600) & weasel::EMOJI_PICTOGRAPHIC);
+	BOOST_TEST(weasel::GetEmojiProperty(0x2764) & weasel::EMOJI_PICTOGRAPHIC);
+	BOOST_TEST(weasel::GetEmojiProperty(0x00A9) & weasel::EMOJI_PICTOGRAPHIC);
+	BOOST_TEST_EQ(weasel::GetEmojiProperty(0x200D), (unsigned int)weasel::EMOJI_ZWJ);
+	BOOST_TEST_EQ(weasel::GetEmojiProperty(0xFE0F), (unsigned int)weasel::EMOJI_VARIATION_SELECTOR);
+	BOOST_TEST(weasel::GetEmojiProperty(0x1F3FD) & weasel::EMOJI_MODIFIER);
+	BOOST_TEST_EQ(weasel::GetEmojiProperty(0x1F1E8), (unsigned int)weasel::EMOJI_REGIONAL_INDICATOR);
+	BOOST_TEST_EQ(weasel::GetEmojiProperty(0xE0067), (unsigned int)weasel::EMOJI_TAG);
+	// the old hard-coded 0x2000-0x27bf range took punctuation for emoji
+	BOOST_TEST_EQ(weasel::GetEmojiProperty(0x201C), 0u);
+	BOOST_TEST_EQ(weasel::GetEmojiProperty(0x4E2D), 0u);
+	BOOST_TEST_EQ(weasel::GetEmojiProperty('a'), 0u);
+	BOOST_TEST_EQ(weasel::GetEmojiProperty(0x10FFFF), 0u);
+}
+
+void test_emoji_segment()
+{
+	BOOST_TEST(DescribeRuns(L"") == L"");
+	BOOST_TEST(DescribeRuns(L"zhong") == L"T5");
+	BOOST_TEST(DescribeRuns(Utf16({ 0x1F600 })) == L"E2");
+	BOOST_TEST(DescribeRuns(Utf16({ 0x4E2D, 0x1F600, 0x6587 })) == L"T1E2T1");
+	// family: man ZWJ woman ZWJ girl
+	BOOST_TEST(DescribeRuns(Utf16({ 'a', 0x1F468, 0x200D, 0x1F469, 0x200D, 0x1F467, 'b' })) == L"T1E8T1");
+	// thumbs up with a skin tone, heart with VS16
+	BOOST_TEST(DescribeRuns(Utf16({ 0x1F44D, 0x1F3FD, 0x2764, 0xFE0F })) == L"E6");
+	// flags: regional indicator pair, and England as a tag sequence
+	BOOST_TEST(DescribeRuns(Utf16({ 0x1F1E8, 0x1F1F3, ' ', 0x1F3F4, 0xE0067, 0xE0062, 0xE0065, 0xE006E, 0xE0067, 0xE007F })) == L"E4T1E14");
+	// keycap sequences are emoji, plain digits are not
+	BOOST_TEST(DescribeRuns(Utf16({ '1', 0xFE0F, 0x20E3, '2', '#', 0x20E3 })) == L"E3T1E2");
+	// joiners and selectors outside an emoji are text
+	BOOST_TEST(DescribeRuns(Utf16({ 0x200D, 'x', 0xFE0F })) == L"T3");
+	// punctuation in the old range stays text
+	BOOST_TEST(DescribeRuns(Utf16({ 0x201C, 'x', 0x201D })) == L"T3");
+	// a lone surrogate is one unit of text
+	BOOST_TEST(DescribeRuns(Utf16({ 0xD83D, 'x' })) == L"T2");
+
+	// runs alternate and cover the string
+	std::wstring text = Utf16({ 'a', 0x1F600, 0x1F601, 'b', 0x2764, 0xFE0F });
+	std::vector<weasel::EmojiRun> runs;
+	weasel::SegmentEmoji(text, &runs);
+	unsigned int next = 0;
+	for (size_t i = 0; i < runs.size(); ++i)
+	{
+		BOOST_TEST_EQ(runs[i].start, next);
+		if (i > 0)
+			BOOST_TEST(runs[i].emoji != runs[i - 1].emoji);
+		next += runs[i].length;
+	}
+	BOOST_TEST_EQ(next, (unsigned int)text.length());
+}
+
+void test_div255()
+{
+	for (unsigned int x = 0; x <= 255 * 255; ++x)
+		BOOST_TEST_EQ(weasel::Div255(x), (2 * x + 255) / 510);
+}
+
+static std::vector<uint32_t> RandomCoverage(size_t count)
+{
+	std::vector<uint32_t> pixels(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		// gray coverage as GDI leaves it, with garbage in the alpha byte
+		unsigned int a = rand() & 0xFF;
+		pixels[i] = ((rand() & 0xFF) << 24) | (a << 16) | (a << 8) | a;
+	}
+	return pixels;
+}
+
+void test_premultiply()
+{
+	srand(7);
+	std::vector<uint32_t> pixels(256);
+	for (unsigned int a = 0; a < 256; ++a)
+		pixels[a] = a * 0x010101;
+	weasel::PremultiplyCoverageScalar(&pixels[0], pixels.size(), 0x12, 0xfe, 0xff);
+	for (unsigned int a = 0; a < 256; ++a)
+	{
+		BOOST_TEST_EQ(pixels[a] >> 24, a);
+		BOOST_TEST_EQ((pixels[a] >> 16) & 0xFF, (2 * 0x12 * a + 255) / 510);
+		BOOST_TEST_EQ((pixels[a] >> 8) & 0xFF, (2 * 0xfe * a + 255) / 510);
+		BOOST_TEST_EQ(pixels[a] & 0xFF, a);
+	}
+
+#ifdef WEASEL_PREMULTIPLY_X86
+	const bool avx2 = (weasel::DetectCpuFeatures() & weasel::CPU_AVX2) != 0;
+	// every length covers a different mix of vector body and scalar tail
+	for (size_t count = 0; count < 40; ++count)
+	{
+		unsigned char r = rand() & 0xFF, g = rand() & 0xFF, b = rand() & 0xFF;
+		std::vector<uint32_t> src = RandomCoverage(count + 1);
+		std::vector<uint32_t> scalar(src), sse2(src), avx(src);
+		weasel::PremultiplyCoverageScalar(&scalar[0], count, r, g, b);
+		weasel::PremultiplyCoverageSSE2(&sse2[0], count, r, g, b);
+		BOOST_TEST(sse2 == scalar);
+		if (avx2)
+		{
+			weasel::PremultiplyCoverageAVX2(&avx[0], count, r, g, b);
+			BOOST_TEST(avx == scalar);
+		}
+		// the pixel past the end is untouched
+		BOOST_TEST_EQ(scalar[count], src[count]);
+	}
+#endif
+}
+
+struct CountRelease
+{
+	std::vector<int>* released;
+	void operator()(int value) const { released->push_back(value); }
+};
+
+void test_byte_budget_cache()
+{
+	std::vector<int> released;
+	CountRelease release = { &released };
+	weasel::ByteBudgetCache<std::wstring, int, CountRelease> cache(100, release);
+
+	BOOST_TEST(cache.Find(L"1.") == NULL);
+	BOOST_TEST(cache.Insert(L"1.", 1, 40));
+	BOOST_TEST(cache.Insert(L"2.", 2, 40));
+	BOOST_TEST(cache.Find(L"1.") != NULL && *cache.Find(L"1.") == 1);
+	BOOST_TEST_EQ(cache.GetStats().bytes, 80u);
+
+	// "2." is the least recently used and goes first
+	BOOST_TEST(cache.Insert(L"3.", 3, 40));
+	BOOST_TEST(cache.Find(L"2.") == NULL);
+	BOOST_TEST_EQ(released.size(), 1u);
+	BOOST_TEST_EQ(released[0], 2);
+	BOOST_TEST_EQ(cache.GetStats().evictions, 1u);
+	BOOST_TEST_EQ(cache.GetStats().entries, 2u);
+
+	// replacing a key releases the old value
+	BOOST_TEST(cache.Insert(L"3.", 30, 20));
+	BOOST_TEST_EQ(released.back(), 3);
+	BOOST_TEST_EQ(cache.GetStats().bytes, 60u);
+
+	// a value over the whole budget stays with the caller
+	BOOST_TEST(!cache.Insert(L"huge", 4, 101));
+	BOOST_TEST_EQ(cache.GetStats().entries, 2u);
+
+	const weasel::CacheStats& stats = cache.GetStats();
+	BOOST_TEST_EQ(stats.hits, 2u);
+	BOOST_TEST_EQ(stats.misses, 2u);
+
+	cache.Clear();
+	BOOST_TEST_EQ(released.size(), 4u);
+	BOOST_TEST_EQ(cache.GetStats().bytes, 0u);
+}
+
+// premultiplied pixels, including transparent and opaque ones
+static std::vector<uint32_t> RandomPremultiplied(size_t count)
+{
+	std::vector<uint32_t> pixels(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		unsigned int a = i % 5 == 0 ? 0 : i % 5 == 1 ? 255 : rand() & 0xFF;
+		pixels[i] = (a << 24) | ((rand() % (a + 1)) << 16) | ((rand() % (a + 1)) << 8) | (rand() % (a + 1));
+	}
+	return pixels;
+}
+
+// every pixel from the signed distance, without the spans
+static void ReferenceRoundRect(weasel::PixelTarget const& target, int left, int top, int right, int bottom, int radius, int pen, uint32_t color)
+{
+	int r = (std::max)((std::min)(radius, (std::min)((right - left) / 2, (bottom - top) / 2)), 0);
+	weasel::RoundRectDistance distance((float)left, (float)top, (float)right, (float)bottom, (float)r);
+	for (int y = target.top; y < target.bottom; ++y)
+		for (int x = target.left; x < target.right; ++x)
+		{
+			float d = distance(x + 0.5f, y + 0.5f);
+			float coverage = pen ? pen / 2.0f + 0.5f - fabsf(d) : 0.5f - d;
+			if (weasel::CoverageByte(coverage))
+				weasel::BlendPixel(target.Row(y) + x, color, weasel::CoverageByte(coverage));
+		}
+}
+
+// area coverage from 16x16 samples per pixel
+static unsigned int SupersampledCoverage(int left, int top, int right, int bottom, int r, int x, int y)
+{
+	int inside = 0;
+	for (int sy = 0; sy < 16; ++sy)
+		for (int sx = 0; sx < 16; ++sx)
+		{
+			float px = x + (sx + 0.5f) / 16, py = y + (sy + 0.5f) / 16;
+			if (px < left || px >= right || py < top || py >= bottom)
+				continue;
+			float dx = (std::max)((std::max)(left + r - px, px - (right - r)), 0.0f);
+			float dy = (std::max)((std::max)(top + r - py, py - (bottom - r)), 0.0f);
+			inside += dx * dx + dy * dy <= (float)r * r;
+		}
+	return (inside * 255 + 128) / 256;
+}
+
+void test_round_rect()
+{
+	const uint32_t colors[] = { 0xFF112233, 0x80402010, 0x10080402 };
+	const int shapes[][5] = { { 3, 4, 60, 30, 6 }, { 0, 0, 64, 40, 0 }, { 10, 10, 17, 50, 20 }, { -5, 2, 70, 41, 3 } };
+	for (int c = 0; c < 3; ++c)
+		for (int s = 0; s < 4; ++s)
+			for (int pen = 0; pen < 4; ++pen)
+			{
+				const int* rc = shapes[s];
+				weasel::Framebuffer expected(64, 40), actual(64, 40);
+				expected.Clear(0x80204060);
+				actual.Clear(0x80204060);
+				ReferenceRoundRect(expected.Target(), rc[0], rc[1], rc[2], rc[3], rc[4], pen, colors[c]);
+				if (pen)
+					weasel::StrokeRoundRect(actual.Target(), rc[0], rc[1], rc[2], rc[3], rc[4], pen, colors[c]);
+				else
+					weasel::FillRoundRect(actual.Target(), rc[0], rc[1], rc[2], rc[3], rc[4], colors[c]);
+				BOOST_TEST(std::equal(actual.Pixels(), actual.Pixels() + 64 * 40, expected.Pixels()));
+			}
+
+	// the distance estimate stays close to the covered area
+	weasel::Framebuffer fb(40, 40);
+	weasel::FillRoundRect(fb.Target(), 2, 3, 38, 35, 12, 0xFF000000);
+	unsigned int worst = 0;
+	for (int y = 0; y < 40; ++y)
+		for (int x = 0; x < 40; ++x)
+		{
+			int diff = (int)(fb.GetPixel(x, y) >> 24) - (int)SupersampledCoverage(2, 3, 38, 35, 12, x, y);
+			worst = (std::max)(worst, (unsigned int)abs(diff));
+		}
+	BOOST_TEST(worst <= 24);
+
+	// clipped to the target rect
+	weasel::Framebuffer clipped(20, 20);
+	weasel::FillRoundRect(weasel::MakePixelTarget(clipped.Pixels(), 20, 5, 5, 10, 10), 0, 0, 20, 20, 0, 0xFFFFFFFF);
+	BOOST_TEST_EQ(clipped.GetPixel(4, 5), 0u);
+	BOOST_TEST_EQ(clipped.GetPixel(5, 5), 0xFFFFFFFFu);
+	BOOST_TEST_EQ(clipped.GetPixel(10, 9), 0u);
+}
+
+void test_blend_span()
+{
+	srand(4);
+	std::vector<uint32_t> dst = RandomPremultiplied(67), src = RandomPremultiplied(67);
+	for (size_t i = 0; i < 8; ++i)
+	{
+		uint32_t color = src[i];
+		std::vector<uint32_t> expected = dst, actual = dst;
+		weasel::BlendSpanScalar(&expected[0], expected.size(), color);
+		weasel::BlendSpan(&actual[0], actual.size(), color);
+		BOOST_TEST(actual == expected);
+	}
+	std::vector<uint32_t> expected = dst, actual = dst;
+	weasel::BlendRowScalar(&expected[0], &src[0], src.size());
+	weasel::BlendRow(&actual[0], &src[0], src.size());
+	BOOST_TEST(actual == expected);
+#ifdef WEASEL_PREMULTIPLY_X86
+	actual = dst;
+	weasel::BlendSpanSSE2(&actual[0], actual.size(), src[0]);
+	expected = dst;
+	weasel::BlendSpanScalar(&expected[0], expected.size(), src[0]);
+	BOOST_TEST(actual == expected);
+	actual = dst;
+	weasel::BlendRowSSE2(&actual[0], &src[0], src.size());
+	expected = dst;
+	weasel::BlendRowScalar(&expected[0], &src[0], src.size());
+	BOOST_TEST(actual == expected);
+#endif
+}
+
+void test_png_roundtrip()
+{
+	srand(3);
+	std::vector<uint32_t> pixels = RandomPremultiplied(37 * 11);
+	std::vector<unsigned char> png;
+	BOOST_TEST(weasel::EncodePng(&pixels[0], 37, 11, &png));
+	std::vector<uint32_t> decoded;
+	int width = 0, height = 0;
+	BOOST_TEST(weasel::DecodePng(&png[0], png.size(), &decoded, &width, &height));
+	BOOST_TEST_EQ(width, 37);
+	BOOST_TEST_EQ(height, 11);
+	BOOST_TEST(decoded == pixels);
+
+	// flat fills compress to a fraction of their size
+	std::vector<uint32_t> flat(200 * 100, 0xFF336699);
+	BOOST_TEST(weasel::EncodePng(&flat[0], 200, 100, &png));
+	BOOST_TEST(png.size() < flat.size() * 4 / 50);
+	BOOST_TEST(weasel::DecodePng(&png[0], png.size(), &decoded, &width, &height));
+	BOOST_TEST(decoded == flat);
+
+	// a corrupt chunk is rejected
+	png[40] ^= 1;
+	BOOST_TEST(!weasel::DecodePng(&png[0], png.size(), &decoded, &width, &height));
+}
+
+void test_framebuffer()
+{
+	weasel::Framebuffer fb(20, 20);
+	fb.FillRoundRect(weasel::MakeFbRect(2, 2, 18, 18), 6, 0xFF000000);
+	BOOST_TEST_EQ(fb.GetPixel(10, 10), 0xFF000000u);
+	BOOST_TEST_EQ(fb.GetPixel(10, 2), 0xFF000000u);		// straight edge
+	BOOST_TEST_EQ(fb.GetPixel(2, 2), 0u);				// cut off by the corner
+	BOOST_TEST_EQ(fb.GetPixel(1, 10), 0u);
+	unsigned int corner = fb.GetPixel(3, 4) >> 24;		// on the arc
+	BOOST_TEST(corner > 0 && corner < 255);
+
+	// half transparent white over opaque black
+	fb.Blend(10, 10, weasel::PremultiplyStyleColor(0x80FFFFFF), 255);
+	BOOST_TEST_EQ(fb.GetPixel(10, 10), 0xFF808080u);
+
+	// a one pixel pen straddles the edge, half on either side
+	weasel::Framebuffer border(10, 10);
+	border.StrokeRoundRect(weasel::MakeFbRect(2, 2, 8, 8), 0, 1, 0xFFFFFFFF);
+	BOOST_TEST_EQ(border.GetPixel(1, 5) >> 24, 128u);
+	BOOST_TEST_EQ(border.GetPixel(2, 5) >> 24, 128u);
+	BOOST_TEST_EQ(border.GetPixel(5, 5), 0u);
+
+	// style colors are 0xAABBGGRR
+	BOOST_TEST_EQ(weasel::PremultiplyStyleColor(0xFF0000FF), 0xFFFF0000u);
+	BOOST_TEST_EQ(weasel::PremultiplyStyleColor(0x00FFFFFF), 0u);
+}
+
+static weasel::UIStyle HeadlessStyle(weasel::UIStyle::LayoutType layout_type)
+{
+	weasel::UIStyle style;
+	style.layout_type = layout_type;
+	style.font_point = 12;
+	style.label_font_point = 10;
+	style.comment_font_point = 10;
+	style.margin_x = 8;
+	style.margin_y = 6;
+	style.spacing = 6;
+	style.candidate_spacing = 4;
+	style.hilite_spacing = 4;
+	style.hilite_padding = 2;
+	style.round_corner = 4;
+	style.round_corner_ex = 6;
+	style.border = 1;
+	style.text_color = 0xFF404040;
+	style.candidate_text_color = 0xFF202020;
+	style.label_text_color = 0xFF808080;
+	style.comment_text_color = 0xFF7F7F7F;
+	style.back_color = 0xFFF5F5F5;
+	style.border_color = 0xFFC0C0C0;
+	style.hilited_text_color = 0xFF000000;
+	style.hilited_back_color = 0xFFE0E0E0;
+	style.hilited_candidate_text_color = 0xFFFFFFFF;
+	style.hilited_candidate_back_color = 0xFFD77800;
+	style.hilited_label_text_color = 0xFFF0F0F0;
+	style.hilited_comment_text_color = 0xFFE0E0E0;
+	return style;
+}
+
+static weasel::Context HeadlessContext(const wchar_t* preedit, const wchar_t** candidates, int count, int highlighted)
+{
+	weasel::Context ctx;
+	ctx.preedit.str = preedit;
+	if (!ctx.preedit.str.empty())
+		ctx.preedit.attributes.push_back(weasel::TextAttribute(0, (int)ctx.preedit.str.length(), weasel::HIGHLIGHTED));
+	for (int i = 0; i < count; ++i)
+	{
+		ctx.cinfo.candies.push_back(weasel::Text(candidates[i]));
+		ctx.cinfo.comments.push_back(weasel::Text(i % 2 ? L"~ni" : L""));
+		ctx.cinfo.labels.push_back(weasel::Text(std::wstring(1, L'1' + i)));
+	}
+	ctx.cinfo.highlighted = highlighted;
+	return ctx;
+}
+
+static const wchar_t* kHeadlessCandidates[] = { L"\x4F60", L"\x4F60\x597D", L"\x5C3C", L"\x62DF", L"\x6CE5", L"\x817B", L"\x9006", L"\x5B9E\x5728", L"\x5E74", L"\x5462" };
+
+void test_headless_layout()
+{
+	weasel::UIStyle style = HeadlessStyle(weasel::UIStyle::LAYOUT_VERTICAL);
+	weasel::HeadlessFonts fonts(style);
+	BOOST_TEST_EQ(fonts.text.Em(), 16);
+	BOOST_TEST_EQ(fonts.label.Em(), 13);
+
+	weasel::Context ctx = HeadlessContext(L"ni", kHeadlessCandidates, 2, 1);
+	weasel::Status status;
+	status.composing = true;
+	weasel::LayoutRects layout;
+	weasel::HeadlessLayOut(style, ctx, status, fonts, &layout);
+
+	// "ni" plus hilite_padding on both sides of the highlighted range
+	BOOST_TEST_EQ(layout.preedit.Width(), 2 * 8 + 2 * 2);
+	BOOST_TEST_EQ(layout.preedit.top, style.margin_y);
+	// the label "1." is two half width glyphs of the label font
+	BOOST_TEST_EQ(layout.labels[0].Width(), 12);
+	BOOST_TEST_EQ(layout.texts[0].left, style.margin_x + 12 + style.hilite_spacing);
+	BOOST_TEST_EQ(layout.texts[1].top, layout.texts[0].bottom + style.candidate_spacing);
+	// comments line up to the right of the widest candidate with a comment
+	BOOST_TEST_EQ(layout.comments[1].left, layout.texts[1].right + style.hilite_spacing);
+	BOOST_TEST_EQ(layout.highlight.top, layout.texts[1].top);
+	BOOST_TEST_EQ(layout.highlight.right, layout.width - style.margin_x);
+	BOOST_TEST_EQ(layout.height, layout.texts[1].bottom + style.margin_y);
+	BOOST_TEST(layout.statusIcon.IsEmpty());
+
+	style.layout_type = weasel::UIStyle::LAYOUT_HORIZONTAL;
+	weasel::HeadlessLayOut(style, ctx, status, fonts, &layout);
+	BOOST_TEST_EQ(layout.texts[0].top, layout.texts[1].top);
+	BOOST_TEST_EQ(layout.highlight.left, layout.labels[1].left);
+
+	// moving the highlight without laying out again puts it where a fresh layout does
+	for (int type = 0; type < 2; ++type)
+	{
+		style.layout_type = type ? weasel::UIStyle::LAYOUT_HORIZONTAL : weasel::UIStyle::LAYOUT_VERTICAL;
+		ctx.cinfo.highlighted = 1;
+		weasel::LayoutEngine engine(style, ctx, status);
+		weasel::LayoutRects moved;
+		engine.DoLayout(fonts, weasel::StatusIconSize(fonts.dpi), &moved);
+		ctx.cinfo.highlighted = 0;
+		engine.UpdateHighlight(&moved);
+		weasel::HeadlessLayOut(style, ctx, status, fonts, &layout);
+		BOOST_TEST(!memcmp(&moved.highlight, &layout.highlight, sizeof(layout.highlight)));
+		BOOST_TEST(!memcmp(&moved.texts[0], &layout.texts[0], sizeof(layout.texts[0])));
+	}
+
+	// pages longer than ten candidates are laid out in full, and a shorter one after them leaves no rects behind
+	const wchar_t* page[12];
+	for (int i = 0; i < 12; ++i)
+		page[i] = kHeadlessCandidates[i % 10];
+	style.layout_type = weasel::UIStyle::LAYOUT_VERTICAL;
+	ctx = HeadlessContext(L"", page, 12, 11);
+	weasel::HeadlessLayOut(style, ctx, status, fonts, &layout);
+	BOOST_TEST_EQ(layout.texts.size(), 12u);
+	BOOST_TEST_EQ(layout.texts[11].top, layout.texts[10].bottom + style.candidate_spacing);
+	BOOST_TEST_EQ(layout.highlight.top, layout.texts[11].top);
+	ctx = HeadlessContext(L"", page, 3, 0);
+	weasel::HeadlessLayOut(style, ctx, status, fonts, &layout);
+	BOOST_TEST_EQ(layout.texts.size(), 3u);
+	BOOST_TEST_EQ(layout.height, layout.texts[2].bottom + style.margin_y);
+}
+
+void test_monitor_cache()
+{
+	using weasel::MakeScreenRect;
+	weasel::MonitorCache cache;
+	BOOST_TEST(!cache.IsValid());
+	cache.Assign(std::vector<weasel::MonitorEntry>());
+	BOOST_TEST(cache.IsValid());
+	BOOST_TEST(cache.Find(0, 0) == NULL);
+
+	// a 1920x1080 primary with the taskbar at the bottom, and a 2560x1440 one to its right
+	weasel::MonitorEntry primary = { MakeScreenRect(0, 0, 1920, 1080), MakeScreenRect(0, 0, 1920, 1040), 96 };
+	weasel::MonitorEntry secondary = { MakeScreenRect(1920, -360, 4480, 1080), MakeScreenRect(1920, -360, 4480, 1080), 144 };
+	std::vector<weasel::MonitorEntry> monitors;
+	monitors.push_back(primary);
+	monitors.push_back(secondary);
+	cache.Assign(monitors);
+	BOOST_TEST_EQ(cache.Size(), 2u);
+	BOOST_TEST_EQ(cache.Find(100, 100)->dpi, 96);
+	BOOST_TEST_EQ(cache.Find(1920, 0)->dpi, 144);
+	BOOST_TEST_EQ(cache.Find(1919, 1079)->dpi, 96);
+	// off every monitor, the nearest one
+	BOOST_TEST_EQ(cache.Find(-50, 500)->dpi, 96);
+	BOOST_TEST_EQ(cache.Find(3000, -400)->dpi, 144);
+	BOOST_TEST_EQ(cache.Find(1910, -100)->dpi, 144);
+	cache.Invalidate();
+	BOOST_TEST(!cache.IsValid());
+
+	const weasel::ScreenRect work = primary.work;
+	int x = 0, y = 0;
+	// below the input
+	weasel::PlacePanel(MakeScreenRect(100, 200, 102, 220), 300, 100, work, &x, &y);
+	BOOST_TEST_EQ(x, 100);
+	BOOST_TEST_EQ(y, 220);
+	// pushed back from the right edge
+	weasel::PlacePanel(MakeScreenRect(1800, 200, 1802, 220), 300, 100, work, &x, &y);
+	BOOST_TEST_EQ(x, 1620);
+	// above the input near the taskbar
+	weasel::PlacePanel(MakeScreenRect(100, 980, 102, 1000), 300, 100, work, &x, &y);
+	BOOST_TEST_EQ(y, 880);
+	// taller than the room above and below: as low as fits
+	weasel::PlacePanel(MakeScreenRect(100, 50, 102, 1000), 300, 1000, work, &x, &y);
+	BOOST_TEST_EQ(y, 0);
+	weasel::PlacePanel(MakeScreenRect(-40, 500, -38, 520), 300, 100, work, &x, &y);
+	BOOST_TEST_EQ(x, 0);
+}
+
+void test_candidate_grid()
+{
+	// candidates of labels 10 wide, texts 20 + 10 * i wide and 16 high, a 30 x 12 comment on odd ones
+	weasel::CandidateGrid grid;
+	grid.Reset(7);
+	for (size_t i = 0; i < 7; ++i)
+	{
+		grid.SetSize(i, weasel::CandidateGrid::LABEL, 10, 12);
+		grid.SetSize(i, weasel::CandidateGrid::TEXT, 20 + 10 * (int)i, 16);
+		if (i % 2)
+			grid.SetSize(i, weasel::CandidateGrid::COMMENT, 30, 12);
+	}
+	int width = 0, height = 0;
+	grid.Arrange(8, 100, 0, 4, 2, 8, weasel::UIStyle::ALIGN_BOTTOM, &width, &height);
+	BOOST_TEST_EQ(grid.Columns(), 1u);
+	BOOST_TEST_EQ(height, 7 * 16 + 6 * 2);
+	// comments start right of the widest candidate with one (#5: 10 + 4 + 70 + 4)
+	BOOST_TEST_EQ(grid.Rect(1, weasel::CandidateGrid::COMMENT).left, 8 + 88);
+	BOOST_TEST_EQ(width, 88 + 30);
+	BOOST_TEST_EQ(grid.Rect(3, weasel::CandidateGrid::TEXT).left, 8 + 14);
+	BOOST_TEST_EQ(grid.Rect(3, weasel::CandidateGrid::TEXT).top, 100 + 3 * 18);
+	// bottom aligned within the row
+	BOOST_TEST_EQ(grid.Rect(3, weasel::CandidateGrid::LABEL).top, 100 + 3 * 18 + 4);
+	BOOST_TEST_EQ(grid.HighlightRect(3, 200).left, 8);
+	BOOST_TEST_EQ(grid.HighlightRect(3, 200).right, 200);
+
+	// three rows per column: 0-2, 3-5 and 6, rows shared across columns
+	grid.Reset(7);
+	for (size_t i = 0; i < 7; ++i)
+	{
+		grid.SetSize(i, weasel::CandidateGrid::LABEL, 10, 12);
+		grid.SetSize(i, weasel::CandidateGrid::TEXT, 20 + 10 * (int)i, i == 4 ? 24 : 16);
+		if (i % 2)
+			grid.SetSize(i, weasel::CandidateGrid::COMMENT, 30, 12);
+	}
+	grid.Arrange(8, 100, 3, 4, 2, 8, weasel::UIStyle::ALIGN_TOP, &width, &height);
+	BOOST_TEST_EQ(grid.Columns(), 3u);
+	BOOST_TEST_EQ(height, 16 + 24 + 16 + 2 * 2);
+	BOOST_TEST_EQ(grid.Rect(3, weasel::CandidateGrid::LABEL).top, 100);
+	BOOST_TEST_EQ(grid.Rect(2, weasel::CandidateGrid::LABEL).top, 100 + 16 + 2 + 24 + 2);
+	BOOST_TEST_EQ(grid.Rect(6, weasel::CandidateGrid::LABEL).top, 100);
+	// column 0: candidates up to 10 + 4 + 40, comment of #1 at 10 + 4 + 30 + 4
+	const int column0 = (std::max)(54, 48 + 30);
+	BOOST_TEST_EQ(grid.Rect(3, weasel::CandidateGrid::LABEL).left, 8 + column0 + 8);
+	BOOST_TEST_EQ(grid.Rect(1, weasel::CandidateGrid::COMMENT).left, 8 + 48);
+	// column 1 aligns its comments on its own: #5 is 10 + 4 + 70 + 4
+	BOOST_TEST_EQ(grid.Rect(5, weasel::CandidateGrid::COMMENT).left, 8 + column0 + 8 + 88);
+	const int column1 = 88 + 30;
+	BOOST_TEST_EQ(grid.Rect(6, weasel::CandidateGrid::LABEL).left, 8 + column0 + 8 + column1 + 8);
+	BOOST_TEST_EQ(width, column0 + 8 + column1 + 8 + 10 + 4 + 80);
+	// highlights span their column; the last one reaches the content edge
+	BOOST_TEST_EQ(grid.HighlightRect(4, 500).left, 8 + column0 + 8);
+	BOOST_TEST_EQ(grid.HighlightRect(4, 500).right, 8 + column0 + 8 + column1);
+	BOOST_TEST_EQ(grid.HighlightRect(4, 500).Height(), 24);
+	BOOST_TEST_EQ(grid.HighlightRect(6, 500).right, 500);
+
+	grid.Reset(0);
+	grid.Arrange(8, 100, 3, 4, 2, 8, weasel::UIStyle::ALIGN_TOP, &width, &height);
+	BOOST_TEST_EQ(width, 0);
+	BOOST_TEST_EQ(height, 0);
+}
+
+void test_status_icon_atlas()
+{
+	// SM_CXICON at 100%, 125%, 150% and 200% scaling
+	BOOST_TEST_EQ(weasel::StatusIconSize(96), 32);
+	BOOST_TEST_EQ(weasel::StatusIconSize(120), 40);
+	BOOST_TEST_EQ(weasel::StatusIconSize(144), 48);
+	BOOST_TEST_EQ(weasel::StatusIconSize(192), 64);
+
+	weasel::Status status;
+	BOOST_TEST_EQ(weasel::GetStatusIconKind(status), weasel::STATUS_ICON_ENABLED);
+	status.ascii_mode = true;
+	BOOST_TEST_EQ(weasel::GetStatusIconKind(status), weasel::STATUS_ICON_ALPHA);
+	status.disabled = true;
+	BOOST_TEST_EQ(weasel::GetStatusIconKind(status), weasel::STATUS_ICON_DISABLED);
+
+	weasel::StatusIconAtlas atlas;
+	weasel::Framebuffer target(100, 60);
+	BOOST_TEST(!atlas.Draw(target.Target(), 0, 0, 96, weasel::STATUS_ICON_ALPHA));
+	weasel::Framebuffer* strip = atlas.Add(120);
+	BOOST_TEST_EQ(strip->Width(), 40 * weasel::STATUS_ICON_COUNT);
+	BOOST_TEST_EQ(strip->Height(), 40);
+	// one opaque and one half transparent pixel in the second cell
+	strip->FillRect(weasel::MakeFbRect(40, 0, 41, 1), 0xFF102030);
+	strip->FillRect(weasel::MakeFbRect(79, 39, 80, 40), 0x80400000);
+	target.FillRect(weasel::MakeFbRect(0, 0, 100, 60), 0xFF000080);
+	BOOST_TEST(atlas.Draw(target.Target(), 10, 5, 120, weasel::STATUS_ICON_ALPHA));
+	BOOST_TEST_EQ(target.GetPixel(10, 5), 0xFF102030u);
+	BOOST_TEST_EQ(target.GetPixel(49, 44), 0xFF400040u);
+	BOOST_TEST_EQ(target.GetPixel(11, 5), 0xFF000080u);
+	// clipped to the target
+	BOOST_TEST(atlas.Draw(target.Target(), 90, 50, 120, weasel::STATUS_ICON_ALPHA));
+	BOOST_TEST_EQ(target.GetPixel(90, 50), 0xFF102030u);
+
+	// a strip per dpi, the oldest replaced past MAX_DPIS
+	atlas.Add(96);
+	atlas.Add(144);
+	atlas.Add(192);
+	BOOST_TEST_EQ(atlas.Size(), 4u);
+	BOOST_TEST(atlas.Find(120) != NULL);
+	atlas.Add(168);
+	BOOST_TEST_EQ(atlas.Size(), 4u);
+	BOOST_TEST(atlas.Find(120) == NULL);
+	BOOST_TEST_EQ(atlas.Find(168)->Height(), weasel::StatusIconSize(168));
+	atlas.Clear();
+	BOOST_TEST(atlas.Find(96) == NULL);
+
+	// the layout sizes the icon for the dpi of the fonts
+	weasel::UIStyle style = HeadlessStyle(weasel::UIStyle::LAYOUT_VERTICAL);
+	weasel::Context ctx;
+	ctx.aux.str = L"ni";
+	weasel::Status composing;
+	composing.composing = true;
+	weasel::HeadlessFonts fonts(style, 144);
+	weasel::LayoutRects layout;
+	weasel::HeadlessLayOut(style, ctx, composing, fonts, &layout);
+	BOOST_TEST_EQ(layout.statusIcon.Width(), 48);
+	BOOST_TEST_EQ(layout.statusIcon.Height(), 48);
+}
+
+void test_profiler()
+{
+	BOOST_TEST_EQ(weasel::GetProfileBucket(0), 0);
+	BOOST_TEST_EQ(weasel::GetProfileBucket(511), 0);
+	BOOST_TEST_EQ(weasel::GetProfileBucket(512), 1);
+	BOOST_TEST_EQ(weasel::GetProfileBucket(1500), 2);
+	BOOST_TEST_EQ(weasel::GetProfileBucket(~0ull), weasel::PROFILE_BUCKETS - 1);
+
+	// statistics are global, compare against where they stood
+	const weasel::ProfileSummary before = weasel::Profiler::Summarize(weasel::PROFILE_BLUR);
+	const uint64_t eaten = weasel::Profiler::GetCounter(weasel::PROFILE_KEYS_EATEN);
+	weasel::Profiler::Record(weasel::PROFILE_BLUR, 1000, 1000 + 700);
+	weasel::Profiler::Record(weasel::PROFILE_BLUR, 1000, 1000 + 3000000);
+	weasel::Profiler::Count(weasel::PROFILE_KEYS_EATEN, 2);
+	// recorded on another thread, which hands its statistics over when done
+	std::thread([] {
+		weasel::Profiler::Record(weasel::PROFILE_BLUR, 0, 900);
+		weasel::Profiler::Count(weasel::PROFILE_KEYS_EATEN);
+		weasel::Profiler::ReleaseThread();
+	}).join();
+	weasel::ProfileSummary after = weasel::Profiler::Summarize(weasel::PROFILE_BLUR);
+	BOOST_TEST_EQ(after.count - before.count, 3u);
+	BOOST_TEST_EQ(after.total_ns - before.total_ns, 700u + 3000000u + 900u);
+	BOOST_TEST_EQ(after.buckets[1] - before.buckets[1], 2u);
+	BOOST_TEST(after.max_ns >= 3000000u);
+	BOOST_TEST_EQ(weasel::Profiler::GetCounter(weasel::PROFILE_KEYS_EATEN) - eaten, 3u);
+	weasel::ProfileSummary three = { 3, 3000, 1100, { 0 } };
+	three.buckets[0] = 1;
+	three.buckets[2] = 2;
+	BOOST_TEST_EQ(three.Percentile(0.3), 512u);
+	BOOST_TEST_EQ(three.Percentile(0.99), 1100u);
+
+	std::string report = weasel::Profiler::Report();
+	BOOST_TEST(report.find("update layered window") != std::string::npos);
+	BOOST_TEST(report.find("keys eaten") != std::string::npos);
+
+	// only phases timed while tracing become trace events
+	weasel::Profiler::SetTracing(true);
+	{
+		weasel::ProfileScope profile(weasel::PROFILE_MEASURE_TEXT);
+	}
+	weasel::Profiler::SetTracing(false);
+	weasel::Profiler::Record(weasel::PROFILE_UPDATE_UI, 0, 10);
+	std::string trace = weasel::Profiler::TraceJson(42);
+	BOOST_TEST_EQ(trace.find("{\"traceEvents\":["), 0u);
+	BOOST_TEST(trace.find("{\"name\":\"measure text\",\"ph\":\"X\"") != std::string::npos);
+	BOOST_TEST(trace.find("\"pid\":42") != std::string::npos);
+	BOOST_TEST(trace.find("update ui") == std::string::npos);
+}
+
+struct GoldenScene
+{
+	const char* name;
+	weasel::UIStyle style;
+	weasel::Context ctx;
+	weasel::Status status;
+};
+
+static std::vector<GoldenScene> GoldenScenes()
+{
+	std::vector<GoldenScene> scenes;
+	GoldenScene vertical = { "vertical", HeadlessStyle(weasel::UIStyle::LAYOUT_VERTICAL),
+		HeadlessContext(L"nihao", kHeadlessCandidates, 5, 1), weasel::Status() };
+	vertical.status.composing = true;
+	vertical.style.shadow_radius = 2;
+	vertical.style.shadow_color = 0x40000000;
+	scenes.push_back(vertical);
+
+	GoldenScene horizontal = { "horizontal", HeadlessStyle(weasel::UIStyle::LAYOUT_HORIZONTAL),
+		HeadlessContext(L"ni", kHeadlessCandidates, 4, 0), weasel::Status() };
+	horizontal.status.composing = true;
+	horizontal.style.border = 2;
+	horizontal.style.hilited_candidate_shadow_color = 0x60000000;
+	horizontal.style.shadow_radius = 1;
+	horizontal.style.shadow_offset_x = 1;
+	horizontal.style.shadow_offset_y = 1;
+	scenes.push_back(horizontal);
+
+	// a long page in columns of five
+	const wchar_t* page[12];
+	for (int i = 0; i < 12; ++i)
+		page[i] = kHeadlessCandidates[i % 10];
+	GoldenScene grid = { "grid", HeadlessStyle(weasel::UIStyle::LAYOUT_VERTICAL), HeadlessContext(L"ni", page, 12, 7), weasel::Status() };
+	grid.status.composing = true;
+	grid.style.grid_rows = 5;
+	grid.style.candidate_back_color = 0xFFEBEBEB;
+	scenes.push_back(grid);
+
+	// switching to ascii mode shows the status icon with the tip
+	GoldenScene ascii = { "ascii", HeadlessStyle(weasel::UIStyle::LAYOUT_VERTICAL), weasel::Context(), weasel::Status() };
+	ascii.ctx.aux.str = L"ABC";
+	ascii.status.ascii_mode = true;
+	scenes.push_back(ascii);
+	return scenes;
+}
+
+/* Renders the scenes and compares them with golden/<name>.png; writes golden/<name>.actual.png on mismatch */
+void test_headless_golden(bool update)
+{
+	std::vector<GoldenScene> scenes = GoldenScenes();
+	for (size_t i = 0; i < scenes.size(); ++i)
+	{
+		weasel::HeadlessPanel panel(scenes[i].style);
+		BOOST_TEST(panel.Render(scenes[i].ctx, scenes[i].status));
+		const weasel::Framebuffer& actual = panel.GetFramebuffer();
+		std::string path = std::string("golden/") + scenes[i].name;
+		if (update)
+		{
+			BOOST_TEST(weasel::WritePngFile((path + ".png").c_str(), actual));
+			continue;
+		}
+		weasel::Framebuffer expected;
+		bool same = weasel::ReadPngFile((path + ".png").c_str(), &expected) &&
+			expected.Width() == actual.Width() && expected.Height() == actual.Height() &&
+			std::equal(actual.Pixels(), actual.Pixels() + actual.Width() * actual.Height(), expected.Pixels());
+		if (!same)
+		{
+			printf("golden mismatch: %s.png, see %s.actual.png\n", path.c_str(), path.c_str());
+			weasel::WritePngFile((path + ".actual.png").c_str(), actual);
+		}
+		BOOST_TEST(same);
+	}
+
+	// nothing to show hides the panel
+	weasel::UIStyle style = HeadlessStyle(weasel::UIStyle::LAYOUT_VERTICAL);
+	weasel::Status composing;
+	composing.composing = true;
+	weasel::HeadlessPanel panel(style);
+	BOOST_TEST(!panel.Render(weasel::Context(), composing));
+}
+
+// the step-halving search this replaces, kept for comparison
+static int LegacyFit(FakeLayout& layout, int point, int width, int height)
+{
+	int step = 32;
+	for (;;)
+	{
+		weasel::FitExtent sz = layout.Measure(point);
+		if (step == 0)
+			return point;
+		if (sz.cx > width || sz.cy > height)
+		{
+			if (step > 0)
+				step = -(step >> 1);
+		}
+		else if (sz.cx <= width * 31 / 32 && sz.cy <= height * 31 / 32)
+		{
+			if (step < 0)
+				step = -step >> 1;
+		}
+		else
+			return point;
+		point += step;
+	}
+}
+
+void bench_font_fit()
+{
+	const int rounds = 100000;
+	srand(1);
+	std::vector<FakeLayout> corpus;
+	for (int i = 0; i < rounds; ++i)
+	{
+		FakeLayout layout = { 2 + rand() % 120, 1 + rand() % 11, 24, 0 };
+		corpus.push_back(layout);
+	}
+
+	unsigned long legacyCalls = 0, fitCalls = 0;
+	auto t0 = std::chrono::high_resolution_clock::now();
+	int point = 12;
+	for (auto layout : corpus)
+	{
+		point = LegacyFit(layout, point, 1920, 1040);
+		legacyCalls += layout.calls;
+	}
+	auto t1 = std::chrono::high_resolution_clock::now();
+	for (auto layout : corpus)
+	{
+		weasel::FontFitter fitter;
+		fitter.Fit(MakeKey(1920, 1040, layout.rows, layout.columns), 12, [&](int p) { return layout.Measure(p); });
+		fitCalls += layout.calls;
+	}
+	auto t2 = std::chrono::high_resolution_clock::now();
+
+	typedef std::chrono::duration<double, std::micro> us;
+	printf("font fit, %d random layouts into 1920x1040\n", rounds);
+	printf("  step halving: %.2f passes/fit, %.3f us/fit\n", (double)legacyCalls / rounds, us(t1 - t0).count() / rounds);
+	printf("  analytic:     %.2f passes/fit, %.3f us/fit\n", (double)fitCalls / rounds, us(t2 - t1).count() / rounds);
+
+	// typing: every key lays its page out again, with one more letter of preedit and
+	// new candidates of about the same length, so the shape of the page rarely changes
+	std::vector<std::pair<weasel::FontFitKey, FakeLayout> > typing;
+	while ((int)typing.size() < rounds)
+	{
+		const int candidates = 5 + rand() % 6;
+		const int letters = 2 + rand() % 10;
+		for (int k = 1; k <= letters; ++k)
+		{
+			int length = k, widest = 0;
+			for (int c = 0; c < candidates; ++c)
+			{
+				int chars = 1 + rand() % 4;
+				length += chars;
+				widest = (std::max)(widest, chars);
+			}
+			// the label and its spacing before the widest candidate, or the half width preedit
+			FakeLayout layout = { (std::max)(3 + widest, (k + 1) / 2), candidates + 1, 24, 0 };
+			typing.push_back(std::make_pair(MakeKey(1920, 1040, candidates, length), layout));
+		}
+	}
+	unsigned long typedCalls = 0;
+	fitCalls = 0;
+	auto t3 = std::chrono::high_resolution_clock::now();
+	for (auto& page : typing)
+	{
+		weasel::FontFitter fitter;
+		FakeLayout layout = page.second;
+		fitter.Fit(page.first, 12, [&](int p) { return layout.Measure(p); });
+		fitCalls += layout.calls;
+	}
+	auto t4 = std::chrono::high_resolution_clock::now();
+	// as FullScreenLayout keeps its fitter across refreshes
+	weasel::FontFitter shared;
+	for (auto& page : typing)
+	{
+		FakeLayout layout = page.second;
+		shared.Fit(page.first, 12, [&](int p) { return layout.Measure(p); });
+		typedCalls += layout.calls;
+	}
+	auto t5 = std::chrono::high_resolution_clock::now();
+
+	const int keys = (int)typing.size();
+	printf("font fit, typing replay of %d keys into 1920x1040\n", keys);
+	printf("  analytic:     %.2f passes/fit, %.3f us/fit\n", (double)fitCalls / keys, us(t4 - t3).count() / keys);
+	printf("  memoized:     %.2f passes/fit, %.3f us/fit, %.1f%% memo hits\n", (double)typedCalls / keys,
+		us(t5 - t4).count() / keys, 100.0 * shared.HitCount() / keys);
+}
+
+// the two by-value passes with hard-coded ranges this replaces, kept for comparison
+struct LegacyRange { unsigned int start, length; };
+
+static size_t LegacyUtf16ToUnicode(const wchar_t* src, unsigned long& des)
+{
+	if (!src || (*src) == 0) return 0;
+	wchar_t w1 = src[0];
+	if (w1 >= 0xD800 && w1 <= 0xDFFF)
+	{
+		if (w1 < 0xDC00)
+		{
+			wchar_t w2 = src[1];
+			if (w2 >= 0xDC00 && w2 <= 0xDFFF)
+			{
+				des = (w2 & 0x03FF) + (((w1 & 0x03FF) + 0x40) << 10);
+				return 2;
+			}
+		}
+		return 0;
+	}
+	des = w1;
+	return 1;
+}
+
+static std::vector<LegacyRange> LegacyCheckRange(std::wstring str, bool wantEmoji)
+{
+	std::vector<LegacyRange> rng;
+	size_t i = 0, sz = 0;
+	wchar_t* utf16 = &str[0];
+	unsigned long unicode = 0;
+	unsigned int sc = 0, ec = 0;
+	bool isEmjtmp = false, isEmoji = !wantEmoji;
+	while (i < str.size())
+	{
+		sz = LegacyUtf16ToUnicode(utf16, unicode);
+		if (sz == 0)
+			break;
+		isEmjtmp = (unicode >= 0x2000 && unicode <= 0x27bf) || (unicode >= 0x1f000 && unicode <= 0x1fbff);
+		if (isEmoji && *utf16 == 0x200d)
+		{
+			isEmjtmp = true;
+			sz = 1;
+		}
+		if (isEmoji != wantEmoji && isEmjtmp == wantEmoji)
+			sc = (unsigned int)i;
+		if (isEmoji == wantEmoji && isEmjtmp != wantEmoji)
+		{
+			ec = (unsigned int)i;
+			rng.push_back(LegacyRange{ sc, ec - sc });
+		}
+		isEmoji = isEmjtmp;
+		if (i == str.size() - sz && isEmjtmp == wantEmoji)
+		{
+			ec = (unsigned int)(i + sz);
+			rng.push_back(LegacyRange{ sc, ec - sc });
+		}
+		i += sz;
+		utf16 += sz;
+	}
+	return rng;
+}
+
+void bench_emoji_segment()
+{
+	const int rounds = 200000;
+	const unsigned int pool[] = { 'a', 'z', '1', 0x4E2D, 0x6587, 0x5B57, 0x3001, 0x1F600, 0x1F44D, 0x1F3FD, 0x2764, 0xFE0F, 0x200D, 0x1F468 };
+	srand(1);
+	std::vector<std::wstring> corpus;
+	for (int i = 0; i < 1000; ++i)
+	{
+		std::vector<unsigned int> cps;
+		for (int n = 1 + rand() % 12; n > 0; --n)
+			cps.push_back(pool[rand() % (sizeof(pool) / sizeof(pool[0]))]);
+		corpus.push_back(Utf16(cps));
+	}
+
+	size_t legacyRuns = 0, runs = 0;
+	auto t0 = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < rounds; ++i)
+	{
+		const std::wstring& text = corpus[i % corpus.size()];
+		legacyRuns += LegacyCheckRange(text, true).size() + LegacyCheckRange(text, false).size();
+	}
+	auto t1 = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < rounds; ++i)
+	{
+		const std::wstring& text = corpus[i % corpus.size()];
+		weasel::SegmentEmoji(text.c_str(), text.length(), [&runs](const weasel::EmojiRun&) { ++runs; });
+	}
+	auto t2 = std::chrono::high_resolution_clock::now();
+
+	typedef std::chrono::duration<double, std::nano> ns;
+	printf("emoji segmentation, %d strings of up to 12 characters\n", rounds);
+	printf("  two passes: %.1f ns/string, %.2f runs/string\n", ns(t1 - t0).count() / rounds, (double)legacyRuns / rounds);
+	printf("  one pass:   %.1f ns/string, %.2f runs/string\n", ns(t2 - t1).count() / rounds, (double)runs / rounds);
+}
+
+void bench_premultiply()
+{
+	const size_t megapixel = 1024 * 1024;
+	const int rounds = 50;
+	srand(1);
+	std::vector<uint32_t> src = RandomCoverage(megapixel), pixels;
+
+	typedef std::chrono::duration<double, std::milli> ms;
+	printf("premultiply, ms per megapixel\n");
+	pixels = src;
+	auto t0 = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < rounds; ++i)
+	{
+		// the byte loop with >> 8 this replaces
+		unsigned char* p = (unsigned char*)&pixels[0];
+		for (size_t n = 0; n < megapixel; ++n, p += 4)
+		{
+			unsigned char a = p[0];
+			p[0] = (0x34 * a) >> 8;
+			p[1] = (0x56 * a) >> 8;
+			p[2] = (0x78 * a) >> 8;
+			p[3] = a;
+		}
+	}
+	printf("  byte loop: %.3f\n", ms(std::chrono::high_resolution_clock::now() - t0).count() / rounds);
+
+	auto run = [&](const char* name, void (*kernel)(uint32_t*, size_t, unsigned char, unsigned char, unsigned char)) {
+		pixels = src;
+		auto t = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < rounds; ++i)
+			kernel(&pixels[0], megapixel, 0x78, 0x56, 0x34);
+		printf("  %s %.3f\n", name, ms(std::chrono::high_resolution_clock::now() - t).count() / rounds);
+	};
+	run("scalar:   ", weasel::PremultiplyCoverageScalar);
+#ifdef WEASEL_PREMULTIPLY_X86
+	run("sse2:     ", weasel::PremultiplyCoverageSSE2);
+	if (weasel::DetectCpuFeatures() & weasel::CPU_AVX2)
+		run("avx2:     ", weasel::PremultiplyCoverageAVX2);
+#endif
+}
+
+#ifdef _WIN32
+static double WorkingSetKB()
+{
+	PROCESS_MEMORY_COUNTERS counters = { sizeof(counters) };
+	GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+	return counters.WorkingSetSize / 1024.0;
+}
+#endif
+
+void bench_panel_startup()
+{
+	// what WeaselPanel::OnCreate did in every process that made a panel, before anything is drawn;
+	// run first, as the cost is loading each stack into the process
+	printf("panel startup, ms and working set KB added\n");
+#ifdef _WIN32
+	typedef std::chrono::duration<double, std::milli> ms;
+	double ws = WorkingSetKB();
+	auto t = std::chrono::high_resolution_clock::now();
+	ULONG_PTR token;
+	Gdiplus::GdiplusStartupInput input;
+	Gdiplus::GdiplusStartup(&token, &input, NULL);
+	printf("  GDI+ startup, now never:                  %8.3f %8.0f\n", ms(std::chrono::high_resolution_clock::now() - t).count(), WorkingSetKB() - ws);
+
+	ws = WorkingSetKB();
+	t = std::chrono::high_resolution_clock::now();
+	ID2D1Factory* d2d = NULL;
+	IDWriteFactory* dwrite = NULL;
+	ID2D1DCRenderTarget* target = NULL;
+	IDWriteTextFormat* formats[3] = { NULL, NULL, NULL };
+	D2D1CreateFactory(D2D1_FACTORY_TYPE_MULTI_THREADED, &d2d);
+	DWriteCreateFactory(DWRITE_FACTORY_TYPE_SHARED, __uuidof(IDWriteFactory), reinterpret_cast<IUnknown**>(&dwrite));
+	const D2D1_RENDER_TARGET_PROPERTIES properties = D2D1::RenderTargetProperties(D2D1_RENDER_TARGET_TYPE_DEFAULT,
+		D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED));
+	if (d2d)
+		d2d->CreateDCRenderTarget(&properties, &target);
+	for (int i = 0; dwrite && i < 3; ++i)
+		dwrite->CreateTextFormat(L"Microsoft YaHei", NULL, DWRITE_FONT_WEIGHT_NORMAL, DWRITE_FONT_STYLE_NORMAL,
+			DWRITE_FONT_STRETCH_NORMAL, 14 * 96 / 72.0f, L"", &formats[i]);
+	printf("  Direct2D and DirectWrite, now color_font: %8.3f %8.0f\n", ms(std::chrono::high_resolution_clock::now() - t).count(), WorkingSetKB() - ws);
+
+	for (int i = 0; i < 3; ++i)
+		if (formats[i])
+			formats[i]->Release();
+	if (target)
+		target->Release();
+	if (dwrite)
+		dwrite->Release();
+	if (d2d)
+		d2d->Release();
+	Gdiplus::GdiplusShutdown(token);
+#else
+	printf("  Windows only\n");
+#endif
+}
+
+void bench_round_rect()
+{
+	// a vertical panel background with its border, a highlighted candidate, a horizontal panel
+	struct Shape { const char* name; int width, height, radius; };
+	const Shape shapes[] = { { "panel 320x420", 320, 420, 6 }, { "highlight 300x32", 300, 32, 4 }, { "panel 640x72", 640, 72, 8 } };
+	const int rounds = 200;
+	typedef std::chrono::duration<double, std::milli> ms;
+	printf("round rect fill + 1px border, ms per shape\n");
+#ifdef _WIN32
+	ULONG_PTR token;
+	Gdiplus::GdiplusStartupInput input;
+	Gdiplus::GdiplusStartup(&token, &input, NULL);
+#endif
+	for (int s = 0; s < 3; ++s)
+	{
+		const Shape& shape = shapes[s];
+		weasel::Framebuffer fb(shape.width + 4, shape.height + 4);
+		weasel::PixelTarget target = fb.Target();
+		auto t = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < rounds; ++i)
+		{
+			weasel::FillRoundRect(target, 2, 2, shape.width + 2, shape.height + 2, shape.radius, 0xF0F5F5F5);
+			weasel::StrokeRoundRect(target, 2, 2, shape.width + 2, shape.height + 2, shape.radius, 1, 0xFFC0C0C0);
+		}
+		double spans = ms(std::chrono::high_resolution_clock::now() - t).count() / rounds;
+		t = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < rounds; ++i)
+		{
+			ReferenceRoundRect(target, 2, 2, shape.width + 2, shape.height + 2, shape.radius, 0, 0xF0F5F5F5);
+			ReferenceRoundRect(target, 2, 2, shape.width + 2, shape.height + 2, shape.radius, 1, 0xFFC0C0C0);
+		}
+		double perPixel = ms(std::chrono::high_resolution_clock::now() - t).count() / rounds;
+		printf("  %-17s rasterizer %.4f, per pixel distance %.4f", shape.name, spans, perPixel);
+#ifdef _WIN32
+		// what the panel did before: GraphicsRoundRectPath filled and drawn at SmoothingModeHighQuality
+		Gdiplus::Bitmap bitmap(fb.Width(), fb.Height(), fb.Width() * 4, PixelFormat32bppPARGB, (BYTE*)fb.Pixels());
+		Gdiplus::Graphics g(&bitmap);
+		g.SetSmoothingMode(Gdiplus::SmoothingModeHighQuality);
+		Gdiplus::SolidBrush brush(Gdiplus::Color(0xF0, 0xF5, 0xF5, 0xF5));
+		Gdiplus::Pen pen(Gdiplus::Color(0xFF, 0xC0, 0xC0, 0xC0), 1.0f);
+		t = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < rounds; ++i)
+		{
+			Gdiplus::GraphicsPath path;
+			int d = shape.radius * 2;
+			path.AddArc(2, 2, d, d, 180, 90);
+			path.AddArc(2 + shape.width - d, 2, d, d, 270, 90);
+			path.AddArc(2 + shape.width - d, 2 + shape.height - d, d, d, 0, 90);
+			path.AddArc(2, 2 + shape.height - d, d, d, 90, 90);
+			path.CloseFigure();
+			g.FillPath(&brush, &path);
+			g.DrawPath(&pen, &path);
+		}
+		g.Flush(Gdiplus::FlushIntentionSync);
+		printf(", GDI+ %.4f", ms(std::chrono::high_resolution_clock::now() - t).count() / rounds);
+#endif
+		printf("\n");
+	}
+#ifdef _WIN32
+	Gdiplus::GdiplusShutdown(token);
+#endif
+}
+
+void bench_paint()
+{
+	// a typing session: preedit growing with the page of candidates, and paging through
+	std::vector<weasel::Context> corpus;
+	const wchar_t* preedits[] = { L"n", L"ni", L"nih", L"niha", L"nihao", L"nihaoa", L"nihaoas", L"nihaoasd" };
+	for (int i = 0; i < 8; ++i)
+		for (int highlighted = 0; highlighted < 10; highlighted += 3)
+			corpus.push_back(HeadlessContext(preedits[i], kHeadlessCandidates, 10 - i, highlighted % (10 - i)));
+	weasel::Status status;
+	status.composing = true;
+
+	typedef std::chrono::duration<double, std::milli> ms;
+	printf("headless paint, ms per frame over %d contexts\n", (int)corpus.size());
+	const weasel::UIStyle::LayoutType layouts[] = { weasel::UIStyle::LAYOUT_VERTICAL, weasel::UIStyle::LAYOUT_HORIZONTAL };
+	for (int shadow = 0; shadow < 2; ++shadow)
+		for (int l = 0; l < 2; ++l)
+		{
+			weasel::UIStyle style = HeadlessStyle(layouts[l]);
+			if (shadow)
+			{
+				style.shadow_radius = 4;
+				style.shadow_color = 0x40000000;
+				style.hilited_candidate_shadow_color = 0x40000000;
+			}
+			weasel::HeadlessPanel panel(style);
+			const int rounds = 20;
+			auto t = std::chrono::high_resolution_clock::now();
+			for (int r = 0; r < rounds; ++r)
+				for (size_t i = 0; i < corpus.size(); ++i)
+					panel.Render(corpus[i], status);
+			double frame = ms(std::chrono::high_resolution_clock::now() - t).count() / (rounds * corpus.size());
+			printf("  %s, %s: %.3f (last frame %dx%d)\n", l ? "horizontal" : "vertical  ", shadow ? "shadow   " : "no shadow",
+				frame, panel.GetFramebuffer().Width(), panel.GetFramebuffer().Height());
+		}
+}
+
+void bench_candidate_layout()
+{
+	const wchar_t* page[50];
+	for (int i = 0; i < 50; ++i)
+		page[i] = kHeadlessCandidates[i % 10];
+	weasel::Status status;
+	status.composing = true;
+
+	typedef std::chrono::duration<double, std::micro> us;
+	printf("headless candidate layout, us per page\n");
+	const int counts[] = { 10, 20, 50 };
+	for (int c = 0; c < 3; ++c)
+	{
+		weasel::Context ctx = HeadlessContext(L"ni", page, counts[c], 0);
+		for (int grid = 0; grid < 2; ++grid)
+		{
+			weasel::UIStyle style = HeadlessStyle(weasel::UIStyle::LAYOUT_VERTICAL);
+			style.grid_rows = grid ? 10 : 0;
+			weasel::HeadlessFonts fonts(style);
+			weasel::LayoutRects layout;
+			weasel::LayoutEngine engine(style, ctx, status);
+			const int rounds = 2000;
+			auto t = std::chrono::high_resolution_clock::now();
+			for (int r = 0; r < rounds; ++r)
+				engine.DoLayout(fonts, weasel::StatusIconSize(fonts.dpi), &layout);
+			printf("  %2d candidates, %s: %.2f (%dx%d)\n", counts[c], grid ? "grid of 10 rows" : "one column     ",
+				us(std::chrono::high_resolution_clock::now() - t).count() / rounds, layout.width, layout.height);
+		}
+	}
+}
+
+void bench_profile_scope()
+{
+	const int rounds = 1000000;
+	typedef std::chrono::duration<double, std::nano> ns;
+	printf("profile scope, ns per scope\n");
+	for (int tracing = 0; tracing < 2; ++tracing)
+	{
+		weasel::Profiler::SetTracing(tracing != 0);
+		auto t = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < rounds; ++i)
+			weasel::ProfileScope profile(weasel::PROFILE_MEASURE_TEXT);
+		printf("  %s %.1f\n", tracing ? "tracing    " : "not tracing", ns(std::chrono::high_resolution_clock::now() - t).count() / rounds);
+	}
+	weasel::Profiler::SetTracing(false);
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc > 1 && !strcmp(argv[1], "/bench"))
+	{
+		bench_panel_startup();
+		bench_font_fit();
+		bench_emoji_segment();
+		bench_premultiply();
+		bench_round_rect();
+		bench_paint();
+		bench_candidate_layout();
+		bench_profile_scope();
+		return 0;
+	}
+	if (argc > 1 && !strcmp(argv[1], "/golden-update"))
+	{
+		test_headless_golden(true);
+		return boost::report_errors();
+	}
+
+	test_fit_largest();
+	test_fit_memoized();
+	test_fit_clamped();
+	test_layout_diff();
+	test_page_turn();
+	test_emoji_property();
+	test_emoji_segment();
+	test_div255();
+	test_premultiply();
+	test_byte_budget_cache();
+	test_round_rect();
+	test_blend_span();
+	test_png_roundtrip();
+	test_framebuffer();
+	test_headless_layout();
+	test_candidate_grid();
+	test_status_icon_atlas();
+	test_monitor_cache();
+	test_profiler();
+	test_headless_golden(false);
+
+	return boost::report_errors();
+}